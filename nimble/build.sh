@@ -34,14 +34,19 @@ cp Makefile "${ATBM_DIR}/"
 echo "Copying OS layer files to ${ATBM_DIR}/os/..."
 mkdir -p "${ATBM_DIR}/os"
 cp -r os/* "${ATBM_DIR}/os/"
+mkdir -p "${ATBM_DIR}/tools"
+cp -r tools/* "${ATBM_DIR}/tools/"
 
 # Build libnimble inside the source directory
 echo "Building libnimble..."
 cd "${ATBM_DIR}"
 make clean
 make
+make eventq-stress npl-timing
 make install-staging DESTDIR=../out
 
 echo "NimBLE library built and installed successfully"
 echo "Library: $(pwd)/../out/lib/libnimble.so"
 echo "Headers: $(pwd)/../out/include/"
+echo "Event queue stress test: $(pwd)/eventq-stress"
+echo "Timed-wait check: $(pwd)/npl-timing"
@@ -18,10 +18,19 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include "nimble/nimble_npl.h"
-#include "os/os_mempool.h"
+#include "os_npl_internal.h"
 
 /* Forward declaration to fix musl build error */
 void ble_npl_eventq_main(void);
@@ -29,131 +38,496 @@ void ble_npl_eventq_main(void);
 #ifndef INT32_MAX
 #define INT32_MAX              (2147483647)
 #endif
-#define BLE_EVT_Q_COUNT  8
 
+/*
+ * Event queue pool sizing. Queues are carved out of malloc'd slabs of
+ * BLE_EVT_Q_SLAB_COUNT entries; BLE_EVT_Q_PREALLOC queues are reserved on
+ * first use and the pool grows on demand up to BLE_EVT_Q_MAX (0 = no cap).
+ * The NPL_EVENTQ_PREALLOC / NPL_EVENTQ_MAX environment variables, or
+ * ble_npl_eventq_pool_configure() before the first queue is created,
+ * override the build-time values.
+ */
+#ifndef BLE_EVT_Q_SLAB_COUNT
+#define BLE_EVT_Q_SLAB_COUNT  8
+#endif
+#ifndef BLE_EVT_Q_PREALLOC
+#define BLE_EVT_Q_PREALLOC    BLE_EVT_Q_SLAB_COUNT
+#endif
+#ifndef BLE_EVT_Q_MAX
+#define BLE_EVT_Q_MAX         64
+#endif
+
+/* ev_queued states */
+#define EV_IDLE         0
+#define EV_QUEUED       1
 
+/* How long ble_npl_eventq_remove waits for an unlinked event before it warns */
+#ifndef NPL_EVENTQ_REMOVE_TIMEOUT_MS
+#define NPL_EVENTQ_REMOVE_TIMEOUT_MS 100
+#endif
+
+/*
+ * Intrusive multi-producer/single-consumer queue (D. Vyukov). Producers
+ * only exchange `head` and link the previous node, the single consumer
+ * owns `tail`. The STAILQ link inside ble_npl_event is reused as the
+ * next pointer, so queueing never allocates.
+ *
+ * The consumer sleeps on `futex_seq` only when the queue is empty;
+ * producers bump the sequence after linking and issue a FUTEX_WAKE only
+ * if a consumer is actually parked.
+ *
+ * `pop_lock` is held by the consumer around each pop and by
+ * ble_npl_eventq_remove, which unlinks the event from the middle of the
+ * queue. Producers never take it, so puts stay lock-free; the remove path
+ * is rare (callout stop, connection teardown).
+ */
 struct ble_eventq_s {
     uint8_t              b_init;
-	pthread_mutex_t 	 m_mutex;
-	pthread_mutexattr_t  m_mutex_attr;
-	pthread_cond_t		 m_condv;
+    struct ble_npl_event *head;
+    struct ble_npl_event *tail;
+    struct ble_npl_event stub;
+    uint32_t             futex_seq;
+    uint32_t             waiters;
+    pthread_mutex_t      pop_lock;
+    struct ble_eventq_s  *free_next;
+};
 
-    STAILQ_HEAD(ble_queue_list, ble_npl_event) mq_head;
+#define wqueue_t struct ble_eventq_s
+
+struct ble_eventq_slab {
+    struct ble_eventq_slab *next;
+    wqueue_t               queues[BLE_EVT_Q_SLAB_COUNT];
 };
 
-static bool b_pool_init = 0;
-struct os_mempool ble_eventq_pool;
-static os_membuf_t ble_eventq_pool_buf[
-    OS_MEMPOOL_SIZE(BLE_EVT_Q_COUNT, sizeof (struct ble_eventq_s))
-];
+/*
+ * Queue creation is rare (stack init, per-connection setup), so a plain
+ * mutex around the free list is sufficient here
+ */
+static struct {
+    pthread_mutex_t        lock;
+    pthread_once_t         once;
+    struct ble_eventq_slab *slabs;
+    wqueue_t               *free_list;
+    uint32_t               prealloc;
+    uint32_t               limit;
+    uint32_t               capacity;
+    uint32_t               in_use;
+    uint32_t               high_water;
+    uint32_t               slab_count;
+    uint32_t               failures;
+} ble_eventq_pool = {
+    .lock     = PTHREAD_MUTEX_INITIALIZER,
+    .once     = PTHREAD_ONCE_INIT,
+    .prealloc = BLE_EVT_Q_PREALLOC,
+    .limit    = BLE_EVT_Q_MAX,
+};
 
-#define wqueue_t struct ble_eventq_s
+#define EV_NEXT(ev) STAILQ_NEXT(ev, next)
 
-struct ble_eventq_s  m_queue[BLE_EVT_Q_COUNT];
 
+static void mpscq_init(wqueue_t *q)
+{
+    EV_NEXT(&q->stub) = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
 
-int mqueue_init(struct ble_eventq_s *mq)
+static void mpscq_push(wqueue_t *q, struct ble_npl_event *ev)
 {
+    struct ble_npl_event *prev;
 
-    STAILQ_INIT(&mq->mq_head);
+    __atomic_store_n(&EV_NEXT(ev), NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&q->head, ev, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&EV_NEXT(prev), ev, __ATOMIC_RELEASE);
+}
 
-    return (0);
+/*
+ * Returns NULL when the queue is empty or a producer is between its
+ * exchange and link steps; that producer wakes the consumer afterwards.
+ */
+static struct ble_npl_event *mpscq_pop(wqueue_t *q)
+{
+    struct ble_npl_event *tail = q->tail;
+    struct ble_npl_event *next = __atomic_load_n(&EV_NEXT(tail), __ATOMIC_ACQUIRE);
+
+    if (tail == &q->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&EV_NEXT(next), __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    mpscq_push(q, &q->stub);
+
+    next = __atomic_load_n(&EV_NEXT(tail), __ATOMIC_ACQUIRE);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+static bool mpscq_is_empty(wqueue_t *q)
+{
+    return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == &q->stub &&
+           __atomic_load_n(&EV_NEXT(&q->stub), __ATOMIC_ACQUIRE) == NULL;
 }
 
-struct ble_npl_event *mqueue_get(struct ble_eventq_s *mq)
+/* Only 32-bit architectures added after time64 lack the legacy call */
+#ifdef SYS_futex
+#define NPL_SYS_FUTEX SYS_futex
+#else
+#define NPL_SYS_FUTEX SYS_futex_time64
+#endif
+
+/*
+ * FUTEX_WAIT with a relative timeout (NULL = forever)
+ *
+ * 32-bit targets with a 64-bit time_t (musl >= 1.2) pass their timespec
+ * to futex_time64, which kernels before 5.1 (the T31 runs 3.10) reject
+ * with ENOSYS. Those fall back, once and for good, to the legacy call
+ * with a 32-bit timespec.
+ *
+ * Returns 0 when woken, or -1 with errno EAGAIN (the value had already
+ * changed), EINTR, ETIMEDOUT, or another error if futexes are unusable.
+ */
+long npl_futex_wait(uint32_t *uaddr, uint32_t val, const struct timespec *rel)
 {
-    struct ble_npl_event *mp;
-    os_sr_t sr;
+#if defined(SYS_futex_time64) && defined(SYS_futex)
+    static int time64_missing;
+
+    if (sizeof(time_t) > sizeof(long)) {
+        struct {
+            long tv_sec;
+            long tv_nsec;
+        } rel32;
+
+        if (!__atomic_load_n(&time64_missing, __ATOMIC_RELAXED)) {
+            long ret = syscall(SYS_futex_time64, uaddr, FUTEX_WAIT_PRIVATE, val, rel, NULL, 0);
+            if (ret == 0 || errno != ENOSYS) {
+                return ret;
+            }
+            __atomic_store_n(&time64_missing, 1, __ATOMIC_RELAXED);
+        }
 
-    OS_ENTER_CRITICAL(sr);
-    mp = STAILQ_FIRST(&mq->mq_head);
-    if (mp) {
-        STAILQ_REMOVE_HEAD(&mq->mq_head, next);
+        if (rel) {
+            rel32.tv_sec = rel->tv_sec > LONG_MAX ? LONG_MAX : (long)rel->tv_sec;
+            rel32.tv_nsec = rel->tv_nsec;
+        }
+        return syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, rel ? &rel32 : NULL, NULL, 0);
     }
-    OS_EXIT_CRITICAL(sr);
+#endif
+    return syscall(NPL_SYS_FUTEX, uaddr, FUTEX_WAIT_PRIVATE, val, rel, NULL, 0);
+}
 
-    return (mp);
+void npl_futex_wake(uint32_t *uaddr)
+{
+    syscall(NPL_SYS_FUTEX, uaddr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
 }
 
-int mqueue_put(struct ble_eventq_s *mq, struct ble_npl_event *evq)
+
+void wqueue_init(wqueue_t * q)
 {
-    os_sr_t sr;
+    pthread_mutexattr_t attr;
+
+    q->b_init = 1;
+    q->futex_seq = 0;
+    q->waiters = 0;
+    mpscq_init(q);
+
+    /* The consumer may be a SCHED_FIFO task, the remover a lower one */
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&q->pop_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void wqueue_deinit(wqueue_t * q) {
+    if (q->b_init) {
+        q->b_init = 0;
+        pthread_mutex_destroy(&q->pop_lock);
+    }
+}
 
-    OS_ENTER_CRITICAL(sr);
-    STAILQ_INSERT_TAIL(&mq->mq_head, evq, next);
-    OS_EXIT_CRITICAL(sr);
+/*
+ * Wake a consumer parked in wqueue_get, if any
+ */
+static void wqueue_wake(wqueue_t * q) {
+    __atomic_add_fetch(&q->futex_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->waiters, __ATOMIC_SEQ_CST)) {
+        npl_futex_wake(&q->futex_seq);
+    }
+}
 
-    return (0);
+void wqueue_put(wqueue_t * q,struct ble_npl_event * ev) {
+    mpscq_push(q, ev);
+    wqueue_wake(q);
 }
 
-struct ble_npl_event *mqueue_pick(struct ble_eventq_s *mq)
+/*
+ * Absolute CLOCK_MONOTONIC deadline that lies tmo ticks in the future
+ */
+void npl_deadline(struct timespec *ts, ble_npl_time_t tmo)
 {
-	struct ble_npl_event *mp;
-    os_sr_t sr;
+    uint32_t ms = ble_npl_time_ticks_to_ms32(tmo);
+
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec  += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
 
-    OS_ENTER_CRITICAL(sr);
-    mp = STAILQ_FIRST(&mq->mq_head);
-    OS_EXIT_CRITICAL(sr);
+/*
+ * Time left until deadline, false once it has passed
+ */
+bool npl_remaining(const struct timespec *deadline, struct timespec *rel)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rel->tv_sec  = deadline->tv_sec - now.tv_sec;
+    rel->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (rel->tv_nsec < 0) {
+        rel->tv_sec--;
+        rel->tv_nsec += 1000000000L;
+    }
 
-    return (mp);
+    return rel->tv_sec >= 0 && (rel->tv_sec > 0 || rel->tv_nsec > 0);
 }
 
-void mqueue_del_unlock(struct ble_eventq_s *mq,struct ble_npl_event *mp)
+/*
+ * Pop the next event (consumer only)
+ */
+static struct ble_npl_event *wqueue_take(wqueue_t *q)
 {
-   // os_sr_t sr;
+    struct ble_npl_event *ev;
 
-   // OS_ENTER_CRITICAL(sr);
-	STAILQ_REMOVE(&mq->mq_head, mp, ble_npl_event, next);
-   // OS_EXIT_CRITICAL(sr);
+    pthread_mutex_lock(&q->pop_lock);
+    ev = mpscq_pop(q);
+    if (ev) {
+        __atomic_store_n(&ev->ev_queued, EV_IDLE, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&q->pop_lock);
 
+    return ev;
 }
 
+/*
+ * Block until a producer finishes a put on q, or for at most 1 ms
+ *
+ * Used by the remove path to wait out a producer that is between its
+ * exchange and link steps, without spinning against it: it may be a
+ * lower-priority task that needs the CPU to get there.
+ */
+static void wqueue_wait_producer(wqueue_t *q, uint32_t seq)
+{
+    static const struct timespec rel = { 0, 1000000L };
 
+    __atomic_add_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+    npl_futex_wait(&q->futex_seq, seq, &rel);
+    __atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+}
 
-void wqueue_init(wqueue_t * q)
+/*
+ * Unlink ev from q. Called with pop_lock held, so only producers run
+ * concurrently, and they only touch `head` and the next pointer of the
+ * node they replaced there.
+ *
+ * Returns false if ev is not (yet) reachable from the consumer side.
+ */
+static bool wqueue_unlink(wqueue_t *q, struct ble_npl_event *ev)
 {
-	q->b_init = 1;
-    pthread_mutexattr_init(&q->m_mutex_attr);
-    pthread_mutexattr_settype(&q->m_mutex_attr, PTHREAD_MUTEX_RECURSIVE);
-    pthread_mutex_init(&q->m_mutex, &q->m_mutex_attr);
-    pthread_cond_init(&q->m_condv, NULL);
-	mqueue_init(q);
+    struct ble_npl_event *prev = NULL;
+    struct ble_npl_event *node = q->tail;
+    struct ble_npl_event *next;
+
+    while (node != ev) {
+        if (node == NULL) {
+            return false;
+        }
+        prev = node;
+        node = __atomic_load_n(&EV_NEXT(node), __ATOMIC_ACQUIRE);
+    }
+
+    next = __atomic_load_n(&EV_NEXT(ev), __ATOMIC_ACQUIRE);
+    if (next == NULL) {
+        /* ev is the newest node: hand `head` back to its predecessor (or
+         * the stub when ev is the only node). A producer that already
+         * exchanged head is about to link after ev; wait for it and
+         * splice its node in instead. */
+        struct ble_npl_event *expected = ev;
+        struct ble_npl_event *replacement = prev ? prev : &q->stub;
+
+        __atomic_store_n(&EV_NEXT(replacement), NULL, __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&q->head, &expected, replacement, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            if (!prev) {
+                q->tail = &q->stub;
+            }
+            return true;
+        }
+
+        for (;;) {
+            uint32_t seq = __atomic_load_n(&q->futex_seq, __ATOMIC_SEQ_CST);
+            next = __atomic_load_n(&EV_NEXT(ev), __ATOMIC_ACQUIRE);
+            if (next) {
+                break;
+            }
+            wqueue_wait_producer(q, seq);
+        }
+    }
+
+    if (prev) {
+        __atomic_store_n(&EV_NEXT(prev), next, __ATOMIC_RELEASE);
+    } else {
+        q->tail = next;
+    }
+    return true;
 }
 
-void wqueue_deinit(wqueue_t * q) {
-	if(q->b_init){
-		q->b_init = 0;
-	    pthread_mutex_destroy(&q->m_mutex);
-	    pthread_cond_destroy(&q->m_condv);
-	}
+/*
+ * Take ev off q, waiting out a concurrent put of the same event
+ *
+ * Returns only once ev is off every queue, so the caller may free or
+ * re-initialise it. An event that is still not linked after
+ * NPL_EVENTQ_REMOVE_TIMEOUT_MS was most likely put on another queue: that
+ * is reported once, and the wait goes on until its consumer pops it.
+ */
+static void wqueue_remove(wqueue_t *q, struct ble_npl_event *ev)
+{
+    struct timespec deadline;
+    struct timespec rel;
+    bool reported = false;
+
+    npl_deadline(&deadline, ble_npl_time_ms_to_ticks32(NPL_EVENTQ_REMOVE_TIMEOUT_MS));
+
+    pthread_mutex_lock(&q->pop_lock);
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&q->futex_seq, __ATOMIC_SEQ_CST);
+
+        /* Popped by a consumer (or never queued): nothing to do */
+        if (__atomic_load_n(&ev->ev_queued, __ATOMIC_ACQUIRE) != EV_QUEUED) {
+            break;
+        }
+
+        if (wqueue_unlink(q, ev)) {
+            __atomic_store_n(&EV_NEXT(ev), NULL, __ATOMIC_RELAXED);
+            __atomic_store_n(&ev->ev_queued, EV_IDLE, __ATOMIC_RELEASE);
+            break;
+        }
+
+        /* Marked queued but not linked yet: a put is in progress */
+        if (!reported && !npl_remaining(&deadline, &rel)) {
+            printf("<error>ble_npl_eventq_remove: event %p is not on queue %p, "
+                   "waiting for it to be run\n", (void *)ev, (void *)q);
+            reported = true;
+        }
+
+        /* Let q's consumer run meanwhile; the walk starts over anyway */
+        pthread_mutex_unlock(&q->pop_lock);
+        wqueue_wait_producer(q, seq);
+        pthread_mutex_lock(&q->pop_lock);
+    }
+    pthread_mutex_unlock(&q->pop_lock);
 }
 
-void wqueue_put(wqueue_t * q,struct ble_npl_event * ev) {
-    pthread_mutex_lock(&q->m_mutex);
-    mqueue_put(q,ev);
-    pthread_cond_signal(&q->m_condv);
-    pthread_mutex_unlock(&q->m_mutex);
+/*
+ * Handed to a stopping task instead of blocking. It is never queued, and
+ * its callback is the task's stop point, reached with no NPL locks held.
+ */
+static void npl_stop_event_cb(struct ble_npl_event *ev)
+{
+    (void)ev;
+    pthread_exit(NULL);
 }
 
-struct ble_npl_event * wqueue_get(wqueue_t * q,uint32_t tmo) {
-    pthread_mutex_lock(&q->m_mutex);
-    if (tmo) {
-        while ((mqueue_pick(q)) == NULL) {
-            pthread_cond_wait(&q->m_condv, &q->m_mutex);
-        }
+static struct ble_npl_event npl_stop_event = {
+    .ev_cb = npl_stop_event_cb,
+};
+
+/*
+ * Wait for an event: tmo == 0 polls, BLE_NPL_TIME_FOREVER blocks until an
+ * event is queued, anything else waits at most tmo ticks and returns NULL
+ * on timeout. Must only be called by the queue's single consumer task.
+ *
+ * NPL tasks that have been asked to stop (ble_npl_task_remove) get
+ * npl_stop_event instead of blocking, whatever the timeout: running it
+ * ends the task, so even a forever wait never returns NULL.
+ */
+struct ble_npl_event * wqueue_get(wqueue_t * q,ble_npl_time_t tmo) {
+    struct ble_npl_event *item;
+    struct timespec deadline;
+    struct timespec rel;
+    uint32_t seq;
+
+    item = wqueue_take(q);
+    if (item || tmo == 0) {
+        return item;
     }
 
-    struct ble_npl_event * item = mqueue_get(q);
+    if (tmo != BLE_NPL_TIME_FOREVER) {
+        npl_deadline(&deadline, tmo);
+    }
 
+    for (;;) {
+        seq = __atomic_load_n(&q->futex_seq, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
 
-    pthread_mutex_unlock(&q->m_mutex);
-    return item;
-}
+        /* Re-check after announcing ourselves: a producer that linked its
+         * event before seeing waiters != 0 is caught here */
+        item = wqueue_take(q);
+        if (item) {
+            __atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+            return item;
+        }
+
+        if (tmo != BLE_NPL_TIME_FOREVER && !npl_remaining(&deadline, &rel)) {
+            __atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+            return NULL;
+        }
 
-void wqueue_remove(wqueue_t * q,struct ble_npl_event * ev) {
-    pthread_mutex_lock(&q->m_mutex);
-	mqueue_del_unlock(q,ev);
-    pthread_mutex_unlock(&q->m_mutex);
+        if (!npl_task_park(&q->futex_seq)) {
+            __atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+            return &npl_stop_event;
+        }
+
+        if (npl_futex_wait(&q->futex_seq, seq, (tmo == BLE_NPL_TIME_FOREVER) ? NULL : &rel) < 0) {
+            switch (errno) {
+            case EAGAIN:    /* A producer got in first */
+            case EINTR:
+            case ETIMEDOUT: /* The deadline check above ends the wait */
+                break;
+            default:
+                /* Futexes unusable: poll rather than spin, the consumer
+                 * may be a SCHED_FIFO task starving everyone else */
+                usleep(1000);
+                break;
+            }
+        }
+
+        npl_task_unpark();
+        __atomic_sub_fetch(&q->waiters, 1, __ATOMIC_SEQ_CST);
+
+        item = wqueue_take(q);
+        if (item) {
+            return item;
+        }
+    }
 }
 
 
@@ -170,20 +544,108 @@ ble_npl_eventq_dflt_get(void)
 #endif //CONFIG_BLE_ADV_CFG
 
 
-void
-ble_npl_eventq_init(struct ble_npl_eventq *evq)
+/*
+ * Add one slab to the pool. Called with the pool lock held.
+ */
+static int eventq_pool_grow(void)
+{
+    struct ble_eventq_slab *slab;
+    uint32_t add = BLE_EVT_Q_SLAB_COUNT;
+
+    if (ble_eventq_pool.limit) {
+        if (ble_eventq_pool.capacity >= ble_eventq_pool.limit) {
+            return -1;
+        }
+        if (add > ble_eventq_pool.limit - ble_eventq_pool.capacity) {
+            add = ble_eventq_pool.limit - ble_eventq_pool.capacity;
+        }
+    }
+
+    slab = calloc(1, sizeof(*slab));
+    if (!slab) {
+        return -1;
+    }
+
+    slab->next = ble_eventq_pool.slabs;
+    ble_eventq_pool.slabs = slab;
+    ble_eventq_pool.slab_count++;
+
+    for (uint32_t i = 0; i < add; i++) {
+        slab->queues[i].free_next = ble_eventq_pool.free_list;
+        ble_eventq_pool.free_list = &slab->queues[i];
+    }
+    ble_eventq_pool.capacity += add;
+
+    return 0;
+}
+
+static wqueue_t *eventq_pool_get(void)
 {
-    if (b_pool_init==0) {
-        b_pool_init = 1;
-        ble_npl_eventq_main();
+    wqueue_t *q;
+
+    pthread_once(&ble_eventq_pool.once, ble_npl_eventq_main);
+
+    pthread_mutex_lock(&ble_eventq_pool.lock);
+    if (!ble_eventq_pool.free_list && eventq_pool_grow() < 0) {
+        ble_eventq_pool.failures++;
+        pthread_mutex_unlock(&ble_eventq_pool.lock);
+        return NULL;
+    }
+
+    q = ble_eventq_pool.free_list;
+    ble_eventq_pool.free_list = q->free_next;
+    q->free_next = NULL;
+
+    ble_eventq_pool.in_use++;
+    if (ble_eventq_pool.in_use > ble_eventq_pool.high_water) {
+        ble_eventq_pool.high_water = ble_eventq_pool.in_use;
     }
+    pthread_mutex_unlock(&ble_eventq_pool.lock);
+
+    return q;
+}
+
+static void eventq_pool_put(wqueue_t *q)
+{
+    pthread_mutex_lock(&ble_eventq_pool.lock);
+    q->free_next = ble_eventq_pool.free_list;
+    ble_eventq_pool.free_list = q;
+    ble_eventq_pool.in_use--;
+    pthread_mutex_unlock(&ble_eventq_pool.lock);
+}
+
+void
+ble_npl_eventq_pool_configure(uint32_t prealloc, uint32_t limit)
+{
+    pthread_mutex_lock(&ble_eventq_pool.lock);
+    ble_eventq_pool.prealloc = prealloc;
+    ble_eventq_pool.limit = limit;
+    pthread_mutex_unlock(&ble_eventq_pool.lock);
+}
+
+void
+ble_npl_eventq_pool_get_stats(struct ble_npl_eventq_pool_stats *stats)
+{
+    pthread_mutex_lock(&ble_eventq_pool.lock);
+    stats->in_use = ble_eventq_pool.in_use;
+    stats->high_water = ble_eventq_pool.high_water;
+    stats->capacity = ble_eventq_pool.capacity;
+    stats->limit = ble_eventq_pool.limit;
+    stats->slabs = ble_eventq_pool.slab_count;
+    stats->failures = ble_eventq_pool.failures;
+    pthread_mutex_unlock(&ble_eventq_pool.lock);
+}
 
-    evq->q = os_memblock_get(&ble_eventq_pool);
+void
+ble_npl_eventq_init(struct ble_npl_eventq *evq)
+{
+    evq->q = eventq_pool_get();
 	if(evq->q){
 		wqueue_init((wqueue_t *)evq->q);
 	}
 	else {
-		printf("<error>ble_npl_eventq_init fail\n");
+		printf("<error>ble_npl_eventq_init fail: queue pool exhausted (limit %u)\n",
+		       ble_eventq_pool.limit);
 	}
 }
 void
@@ -191,7 +653,8 @@ ble_npl_eventq_release(struct ble_npl_eventq* evq)
 {
 	if(evq->q){
 		wqueue_deinit((wqueue_t *)evq->q);
-    	os_memblock_put(&ble_eventq_pool, evq->q);
+		eventq_pool_put((wqueue_t *)evq->q);
+		evq->q = NULL;
 	}
 	else {
 		printf("<error>ble_npl_eventq_release fail\n");
@@ -201,13 +664,7 @@ ble_npl_eventq_release(struct ble_npl_eventq* evq)
 bool
 ble_npl_eventq_is_empty(struct ble_npl_eventq *evq)
 {
-    wqueue_t* q = (wqueue_t*)(evq->q);
-
-    if (mqueue_pick((wqueue_t *)q)) {
-        return 1;
-    } else {
-        return 0;
-    }
+    return mpscq_is_empty((wqueue_t *)(evq->q));
 }
 
 int
@@ -220,28 +677,23 @@ void
 ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev)
 {
     wqueue_t *q = (wqueue_t *)(evq->q);
+    uint8_t state = EV_IDLE;
 
-    if (ev->ev_queued) {
+    /* Already queued: nothing to do, as with the STAILQ version */
+    if (!__atomic_compare_exchange_n(&ev->ev_queued, &state, EV_QUEUED, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
         return;
     }
 
-    ev->ev_queued = 1;
     wqueue_put(q,ev);
 }
 
 struct ble_npl_event *ble_npl_eventq_get(struct ble_npl_eventq *evq,
                                          ble_npl_time_t tmo)
 {
-    struct ble_npl_event *ev;
     wqueue_t *q = (wqueue_t *)(evq->q);
 
-    ev = wqueue_get(q,tmo);
-
-    if (ev) {
-        ev->ev_queued = 0;
-    }
-
-    return ev;
+    return wqueue_get(q,tmo);
 }
 
 void
@@ -273,7 +725,7 @@ ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn,
 bool
 ble_npl_event_is_queued(struct ble_npl_event *ev)
 {
-    return ev->ev_queued;
+    return __atomic_load_n(&ev->ev_queued, __ATOMIC_ACQUIRE) == EV_QUEUED;
 }
 
 void *
@@ -299,22 +751,44 @@ ble_npl_event_run(struct ble_npl_event *ev)
 void
 ble_npl_eventq_remove(struct ble_npl_eventq *evq, struct ble_npl_event *ev)
 {
-    wqueue_t *q = (wqueue_t *)(evq->q);
-
-    if (!ev->ev_queued) {
+    /* Unlinked on return, so the event may be freed or re-initialised */
+    if (!ble_npl_event_is_queued(ev)) {
         return;
     }
 
-    ev->ev_queued = 0;
-    wqueue_remove(q,ev);
+    wqueue_remove((wqueue_t *)(evq->q), ev);
 }
 
 void ble_npl_eventq_main(void)
 {
-    printf("ble_npl_eventq_main\n");
-    /* Create memory pool of OS events */
-    os_mempool_init(&ble_eventq_pool, BLE_EVT_Q_COUNT,
-                         sizeof (struct ble_eventq_s), ble_eventq_pool_buf,
-                         "ble_evq_pool");
+    const char *env;
+    uint32_t prealloc;
+
+    pthread_mutex_lock(&ble_eventq_pool.lock);
+
+    env = getenv("NPL_EVENTQ_PREALLOC");
+    if (env) {
+        ble_eventq_pool.prealloc = (uint32_t)strtoul(env, NULL, 0);
+    }
+    env = getenv("NPL_EVENTQ_MAX");
+    if (env) {
+        ble_eventq_pool.limit = (uint32_t)strtoul(env, NULL, 0);
+    }
+
+    prealloc = ble_eventq_pool.prealloc;
+    if (ble_eventq_pool.limit && prealloc > ble_eventq_pool.limit) {
+        prealloc = ble_eventq_pool.limit;
+    }
+
+    /* Reserve the preallocated queues up front */
+    while (ble_eventq_pool.capacity < prealloc) {
+        if (eventq_pool_grow() < 0) {
+            break;
+        }
+    }
+
+    printf("ble_npl_eventq_main: %u queue(s) preallocated, limit %u\n",
+           ble_eventq_pool.capacity, ble_eventq_pool.limit);
 
+    pthread_mutex_unlock(&ble_eventq_pool.lock);
 }
@@ -27,6 +27,22 @@ void ble_npl_sem_free(struct ble_npl_sem *sem);
 void ble_npl_eventq_release(struct ble_npl_eventq *evq);
 struct ble_npl_eventq *nimble_port_get_dflt_eventq(void);
 
+/* Event queue pool (growable, see os_eventq.c) */
+struct ble_npl_eventq_pool_stats {
+    uint32_t in_use;      /* Queues currently handed out */
+    uint32_t high_water;  /* Maximum in_use seen since start */
+    uint32_t capacity;    /* Queues allocated across all slabs */
+    uint32_t limit;       /* Configured cap, 0 = unlimited */
+    uint32_t slabs;       /* Number of slabs allocated */
+    uint32_t failures;    /* ble_npl_eventq_init calls refused by the cap */
+};
+
+void ble_npl_eventq_pool_configure(uint32_t prealloc, uint32_t limit);
+void ble_npl_eventq_pool_get_stats(struct ble_npl_eventq_pool_stats *stats);
+
+/* Task extensions */
+bool ble_npl_task_stop_requested(void);
+
 /* CLI/Application callbacks (stubs for Improv WiFi mode) */
 void ble_startup_indication(const void *data);
 void cli_set_event(const char *cmd_line, int len);
@@ -0,0 +1,50 @@
+/*
+ * OS NPL internals - shared between the task, event queue and semaphore layers
+ *
+ * Not part of the NPL API; only the files in this directory include it.
+ */
+
+#ifndef _OS_NPL_INTERNAL_H_
+#define _OS_NPL_INTERNAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "nimble/nimble_npl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Futex and deadline helpers (os_eventq.c)
+ */
+
+/* FUTEX_WAIT on uaddr while it holds val, rel = NULL waits forever */
+long npl_futex_wait(uint32_t *uaddr, uint32_t val, const struct timespec *rel);
+
+/* Wake every thread waiting on uaddr */
+void npl_futex_wake(uint32_t *uaddr);
+
+/* Absolute CLOCK_MONOTONIC deadline tmo ticks from now */
+void npl_deadline(struct timespec *ts, ble_npl_time_t tmo);
+
+/* Time left until deadline, false once it has passed */
+bool npl_remaining(const struct timespec *deadline, struct timespec *rel);
+
+/*
+ * Called by a blocking NPL call (event queue get, semaphore pend) right
+ * before the calling task sleeps on the futex word seq. Records seq so
+ * that ble_npl_task_remove() can bump and wake it, and returns false if a
+ * stop has already been requested (the caller must not block).
+ */
+bool npl_task_park(uint32_t *seq);
+
+/* Called once the task is running again */
+void npl_task_unpark(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _OS_NPL_INTERNAL_H_ */
@@ -0,0 +1,189 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "os/os.h"
+#include "nimble/nimble_npl.h"
+#include "os_npl_internal.h"
+
+/*
+ * Futex-based counting semaphore. It replaces the sem_t version so that a
+ * task blocked in ble_npl_sem_pend can be woken by ble_npl_task_remove
+ * like one blocked on its event queue, instead of being cancelled.
+ *
+ * struct ble_npl_sem comes from the upstream headers and cannot change,
+ * so the state lives in the storage of its sem_t. Releasers bump `seq`
+ * after adding a token and issue a FUTEX_WAKE only if someone waits.
+ */
+struct npl_sem {
+    uint32_t tokens;
+    uint32_t seq;
+    uint32_t waiters;
+};
+
+_Static_assert(sizeof(struct npl_sem) <= sizeof(sem_t), "npl_sem must fit in sem_t");
+
+#define NPL_SEM(sem) ((struct npl_sem *)(void *)&(sem)->lock)
+
+static bool
+npl_sem_take(struct npl_sem *s)
+{
+    uint32_t tokens = __atomic_load_n(&s->tokens, __ATOMIC_ACQUIRE);
+
+    while (tokens) {
+        if (__atomic_compare_exchange_n(&s->tokens, &tokens, tokens - 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+ble_npl_error_t
+ble_npl_sem_init(struct ble_npl_sem *sem, uint16_t tokens)
+{
+    struct npl_sem *s;
+
+    if (!sem) {
+        return BLE_NPL_INVALID_PARAM;
+    }
+
+    s = NPL_SEM(sem);
+    s->tokens = tokens;
+    s->seq = 0;
+    s->waiters = 0;
+    sem->vaild = 1;
+
+    return BLE_NPL_OK;
+}
+
+void
+ble_npl_sem_free(struct ble_npl_sem *sem)
+{
+    if (sem) {
+        sem->vaild = 0;
+    }
+}
+
+/*
+ * Take a token: timeout == 0 polls, BLE_NPL_TIME_FOREVER blocks until one
+ * is released, anything else waits at most timeout ticks.
+ *
+ * An NPL task that has been asked to stop does not block: a timed pend
+ * returns BLE_NPL_TIMEOUT, a forever pend ends the task right here, where
+ * pthread_cancel would have ended it in sem_wait.
+ */
+ble_npl_error_t
+ble_npl_sem_pend(struct ble_npl_sem *sem, ble_npl_time_t timeout)
+{
+    struct npl_sem *s;
+    struct timespec deadline;
+    struct timespec rel;
+    uint32_t seq;
+
+    if (!sem) {
+        return BLE_NPL_INVALID_PARAM;
+    }
+
+    s = NPL_SEM(sem);
+    if (npl_sem_take(s)) {
+        return BLE_NPL_OK;
+    }
+    if (timeout == 0) {
+        return BLE_NPL_TIMEOUT;
+    }
+
+    if (timeout != BLE_NPL_TIME_FOREVER) {
+        npl_deadline(&deadline, timeout);
+    }
+
+    for (;;) {
+        seq = __atomic_load_n(&s->seq, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+
+        /* Re-check after announcing ourselves: a release that added its
+         * token before seeing waiters != 0 is caught here */
+        if (npl_sem_take(s)) {
+            __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+            return BLE_NPL_OK;
+        }
+
+        if (timeout != BLE_NPL_TIME_FOREVER && !npl_remaining(&deadline, &rel)) {
+            __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+            return BLE_NPL_TIMEOUT;
+        }
+
+        if (!npl_task_park(&s->seq)) {
+            __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+            if (timeout == BLE_NPL_TIME_FOREVER) {
+                pthread_exit(NULL);
+            }
+            return BLE_NPL_TIMEOUT;
+        }
+
+        if (npl_futex_wait(&s->seq, seq, (timeout == BLE_NPL_TIME_FOREVER) ? NULL : &rel) < 0) {
+            switch (errno) {
+            case EAGAIN:    /* A release got in first */
+            case EINTR:
+            case ETIMEDOUT: /* The deadline check above ends the wait */
+                break;
+            default:
+                /* Futexes unusable: poll rather than spin */
+                usleep(1000);
+                break;
+            }
+        }
+
+        npl_task_unpark();
+        __atomic_sub_fetch(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+ble_npl_error_t
+ble_npl_sem_release(struct ble_npl_sem *sem)
+{
+    struct npl_sem *s;
+
+    if (!sem) {
+        return BLE_NPL_INVALID_PARAM;
+    }
+
+    s = NPL_SEM(sem);
+    __atomic_add_fetch(&s->tokens, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST)) {
+        npl_futex_wake(&s->seq);
+    }
+
+    return BLE_NPL_OK;
+}
+
+uint16_t
+ble_npl_sem_get_count(struct ble_npl_sem *sem)
+{
+    uint32_t tokens = __atomic_load_n(&NPL_SEM(sem)->tokens, __ATOMIC_RELAXED);
+
+    return tokens > UINT16_MAX ? UINT16_MAX : (uint16_t)tokens;
+}
@@ -17,12 +17,164 @@
  * under the License.
  */
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <pthread.h>
 #include <sched.h>
 
 #include "os/os.h"
 #include "nimble/nimble_npl.h"
+#include "os_npl_internal.h"
+
+/*
+ * Real-time scheduling for NPL tasks. NPL priorities follow the NimBLE
+ * convention (0 = most urgent, 255 = least) and are spread linearly over
+ * SCHED_FIFO priorities [1, NPL_TASK_RT_PRIO_MAX]; the ceiling is kept low
+ * so BLE never outranks kernel and watchdog threads. Tasks at
+ * NPL_TASK_PRIO_NORMAL, or any task when the process lacks CAP_SYS_NICE,
+ * run under SCHED_OTHER. NPL_TASK_SCHED=fifo|rr|other overrides the policy.
+ */
+#ifndef NPL_TASK_SCHED_POLICY
+#define NPL_TASK_SCHED_POLICY    SCHED_FIFO
+#endif
+#ifndef NPL_TASK_RT_PRIO_MAX
+#define NPL_TASK_RT_PRIO_MAX     20
+#endif
+#define NPL_TASK_PRIO_NORMAL     255
+
+/* How long ble_npl_task_remove waits for a task to reach its stop point */
+#ifndef NPL_TASK_STOP_TIMEOUT_MS
+#define NPL_TASK_STOP_TIMEOUT_MS 2000
+#endif
+
+/*
+ * Per-task control block. struct ble_npl_task comes from the upstream
+ * headers and cannot grow, so the stop token lives here, keyed by task.
+ */
+struct npl_task_ctl {
+    struct npl_task_ctl  *next;
+    struct ble_npl_task  *task;
+    ble_npl_task_func_t  func;
+    void                 *arg;
+    uint32_t             stop;        /* Stop token, set by ble_npl_task_remove */
+    uint32_t             *parked_seq; /* Futex word the task is blocked on, if any */
+    bool                 exited;      /* Protected by task_lock */
+};
+
+static pthread_mutex_t task_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t task_exit_cond;
+static pthread_once_t task_once = PTHREAD_ONCE_INIT;
+static struct npl_task_ctl *task_list;
+static int task_sched_policy = NPL_TASK_SCHED_POLICY;
+static __thread struct npl_task_ctl *current_task;
+
+static void npl_task_setup(void)
+{
+    pthread_condattr_t attr;
+    const char *env = getenv("NPL_TASK_SCHED");
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&task_exit_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (env) {
+        if (strcasecmp(env, "fifo") == 0) {
+            task_sched_policy = SCHED_FIFO;
+        } else if (strcasecmp(env, "rr") == 0) {
+            task_sched_policy = SCHED_RR;
+        } else if (strcasecmp(env, "other") == 0) {
+            task_sched_policy = SCHED_OTHER;
+        } else {
+            printf("<warn>NPL_TASK_SCHED '%s' unknown, valid values are fifo, rr and other\n", env);
+        }
+    }
+}
+
+static struct npl_task_ctl *npl_task_find(struct ble_npl_task *t)
+{
+    struct npl_task_ctl *ctl;
+
+    for (ctl = task_list; ctl != NULL; ctl = ctl->next) {
+        if (ctl->task == t) {
+            return ctl;
+        }
+    }
+
+    return NULL;
+}
+
+static void npl_task_unlink(struct npl_task_ctl *ctl)
+{
+    struct npl_task_ctl **pp;
+
+    for (pp = &task_list; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == ctl) {
+            *pp = ctl->next;
+            return;
+        }
+    }
+}
+
+static void npl_task_exited(void *arg)
+{
+    struct npl_task_ctl *ctl = arg;
+
+    pthread_mutex_lock(&task_lock);
+    ctl->exited = true;
+    pthread_cond_broadcast(&task_exit_cond);
+    pthread_mutex_unlock(&task_lock);
+}
+
+static void *npl_task_trampoline(void *arg)
+{
+    struct npl_task_ctl *ctl = arg;
+    void *ret;
+
+    current_task = ctl;
+
+    pthread_cleanup_push(npl_task_exited, ctl);
+    ret = ctl->func(ctl->arg);
+    pthread_cleanup_pop(1);
+
+    return ret;
+}
+
+bool
+npl_task_park(uint32_t *seq)
+{
+    struct npl_task_ctl *ctl = current_task;
+
+    if (!ctl) {
+        return true;
+    }
+
+    __atomic_store_n(&ctl->parked_seq, seq, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ctl->stop, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&ctl->parked_seq, NULL, __ATOMIC_SEQ_CST);
+        return false;
+    }
+
+    return true;
+}
+
+void
+npl_task_unpark(void)
+{
+    if (current_task) {
+        __atomic_store_n(&current_task->parked_seq, NULL, __ATOMIC_SEQ_CST);
+    }
+}
+
+bool
+ble_npl_task_stop_requested(void)
+{
+    return current_task && __atomic_load_n(&current_task->stop, __ATOMIC_SEQ_CST);
+}
 
 void *
 ble_npl_get_current_task_id(void)
@@ -43,20 +195,46 @@ ble_npl_task_yield(void)
     sched_yield();
 }
 
+/*
+ * Map the ATBM driver thread classes onto NPL priorities: the HCI
+ * bottom half must preempt everything else on single-core SoCs.
+ */
+static uint8_t
+atbm_prio_to_npl(int prio)
+{
+    switch (prio) {
+#if ATBM_SDIO_BUS && (!ATBM_TXRX_IN_ONE_THREAD)
+    case RX_BH_TASK_PRIO:
+        return 0;
+    case TX_BH_TASK_PRIO:
+        return 16;
+#else
+    case BH_TASK_PRIO:
+        return 0;
+#endif
+    case BLE_TASK_PRIO:
+        return 32;
+    case BLE_AT_PRIO:
+    case ELOOP_TASK_PRIO:
+        return 128;
+    default:
+        return NPL_TASK_PRIO_NORMAL;
+    }
+}
+
 pAtbm_thread_t
 atbm_createThread(atbm_int32(*task)(atbm_void* p_arg), atbm_void* p_arg, int prio)
 {
-    struct ble_npl_task* s_task = malloc(sizeof(struct ble_npl_task));
+    struct ble_npl_task* s_task = calloc(1, sizeof(struct ble_npl_task));
     int err;
 
-    if (BLE_AT_PRIO == prio)
-        prio = 9;
-    else
-        prio = 1;
+    if (!s_task) {
+        return NULL;
+    }
 
-    err = ble_npl_task_init(s_task, "s_task[0]",
+    err = ble_npl_task_init(s_task, "atbm",
                             (ble_npl_task_func_t)(void*)task,  /* Cast to correct type */
-                            p_arg, 1, 0, NULL, 0);
+                            p_arg, atbm_prio_to_npl(prio), 0, NULL, 0);
 
     if (err) {
         free(s_task);
@@ -77,8 +255,17 @@ atbm_stopThread(pAtbm_thread_t thread_id)
 int
 atbm_ThreadStopEvent(pAtbm_thread_t thread_id)
 {
-    (void)thread_id;
-    return 0;
+    struct npl_task_ctl *ctl;
+    int stop = 0;
+
+    pthread_mutex_lock(&task_lock);
+    ctl = npl_task_find(thread_id);
+    if (ctl) {
+        stop = (int)__atomic_load_n(&ctl->stop, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&task_lock);
+
+    return stop;
 }
 
 int
@@ -100,6 +287,8 @@ ble_npl_task_init(struct ble_npl_task *t, const char *name, ble_npl_task_func_t
                   void *arg, uint8_t prio, ble_npl_time_t sanity_itvl,
                   ble_npl_stack_t *stack_bottom, uint16_t stack_size)
 {
+    struct npl_task_ctl *ctl;
+    bool realtime;
     int err;
 
     if ((t == NULL) || (func == NULL)) {
@@ -107,28 +296,124 @@ ble_npl_task_init(struct ble_npl_task *t, const char *name, ble_npl_task_func_t
     }
 
     /* Unused parameters */
-    (void)name;
-    (void)prio;
     (void)sanity_itvl;
     (void)stack_bottom;
     (void)stack_size;
 
-    err = pthread_create(&t->handle, NULL, func, arg);
+    pthread_once(&task_once, npl_task_setup);
+
+    ctl = calloc(1, sizeof(*ctl));
+    if (!ctl) {
+        return -1;
+    }
+    ctl->task = t;
+    ctl->func = func;
+    ctl->arg = arg;
+
+    t->name = name;
+
+    pthread_mutex_lock(&task_lock);
+    ctl->next = task_list;
+    task_list = ctl;
+    pthread_mutex_unlock(&task_lock);
+
+    realtime = (prio != NPL_TASK_PRIO_NORMAL && task_sched_policy != SCHED_OTHER);
 
-    return err ? -1 : 0;
+    pthread_attr_init(&t->attr);
+    if (realtime) {
+        memset(&t->param, 0, sizeof(t->param));
+        t->param.sched_priority = NPL_TASK_RT_PRIO_MAX -
+                                  (prio * (NPL_TASK_RT_PRIO_MAX - 1)) / 254;
+        pthread_attr_setinheritsched(&t->attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&t->attr, task_sched_policy);
+        pthread_attr_setschedparam(&t->attr, &t->param);
+    }
+
+    err = pthread_create(&t->handle, &t->attr, npl_task_trampoline, ctl);
+    if (err == EPERM && realtime) {
+        /* No CAP_SYS_NICE / RLIMIT_RTPRIO: fall back to normal scheduling */
+        printf("<warn>no permission for real-time priority, task %s runs SCHED_OTHER\n",
+               name ? name : "?");
+        pthread_attr_destroy(&t->attr);
+        pthread_attr_init(&t->attr);
+        err = pthread_create(&t->handle, &t->attr, npl_task_trampoline, ctl);
+    }
+
+    if (err) {
+        pthread_mutex_lock(&task_lock);
+        npl_task_unlink(ctl);
+        pthread_mutex_unlock(&task_lock);
+        pthread_attr_destroy(&t->attr);
+        free(ctl);
+        return -1;
+    }
+
+    return 0;
 }
 
+/*
+ * Stop a task cooperatively: raise its stop token, wake the event queue or
+ * semaphore it is blocked on, and wait for it to leave at its stop point
+ * (the stop event of its queue, or a forever semaphore pend).
+ * pthread_cancel is only used as a last resort for a task that never
+ * blocks in NPL again.
+ */
 int
 ble_npl_task_remove(struct ble_npl_task *t)
 {
+    struct npl_task_ctl *ctl;
+    uint32_t *seq;
+    struct timespec deadline;
     void *ret;
+    int err = 0;
 
     if (!t) {
         return -1;
     }
 
-    pthread_cancel(t->handle);
+    pthread_mutex_lock(&task_lock);
+    ctl = npl_task_find(t);
+    pthread_mutex_unlock(&task_lock);
+
+    if (!ctl || pthread_equal(t->handle, pthread_self())) {
+        return -1;
+    }
+
+    __atomic_store_n(&ctl->stop, 1, __ATOMIC_SEQ_CST);
+    seq = __atomic_load_n(&ctl->parked_seq, __ATOMIC_SEQ_CST);
+    if (seq) {
+        /* Everyone blocked on that word re-checks; only this task stops */
+        __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+        npl_futex_wake(seq);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec  += NPL_TASK_STOP_TIMEOUT_MS / 1000;
+    deadline.tv_nsec += (long)(NPL_TASK_STOP_TIMEOUT_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&task_lock);
+    while (!ctl->exited && err != ETIMEDOUT) {
+        err = pthread_cond_timedwait(&task_exit_cond, &task_lock, &deadline);
+    }
+    pthread_mutex_unlock(&task_lock);
+
+    if (!ctl->exited) {
+        printf("<warn>task %s ignored stop request for %d ms, cancelling\n",
+               t->name ? t->name : "?", NPL_TASK_STOP_TIMEOUT_MS);
+        pthread_cancel(t->handle);
+    }
+
     pthread_join(t->handle, &ret);
+    pthread_attr_destroy(&t->attr);
+
+    pthread_mutex_lock(&task_lock);
+    npl_task_unlink(ctl);
+    pthread_mutex_unlock(&task_lock);
+    free(ctl);
 
     return 0;
 }
@@ -0,0 +1,342 @@
+/**
+ * @file eventq_stress.c
+ * @brief Multi-producer stress test for the lock-free NPL event queue
+ *
+ * Producer threads put, remove, re-initialise and move their events
+ * between two queues while a consumer thread drains each queue, and the
+ * tool checks the guarantees callers of os_eventq.c rely on:
+ *
+ *  - an event runs at most once per put, and only on the queue it was
+ *    last put on;
+ *  - after ble_npl_eventq_remove() returns the event is off the queue, so
+ *    it may be re-initialised (memset) or put on another queue at once;
+ *  - no event is lost: every put that is not removed runs.
+ *
+ * A corrupted queue shows up as lost events or as a stall: a fence event
+ * that never runs.
+ * Run it on the target with the consumers at SCHED_FIFO (-f) as well,
+ * which is how the NimBLE host task runs.
+ *
+ * Usage: eventq-stress [-p producers] [-e events] [-d seconds] [-f]
+ * Exit status is 0 when no check failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "nimble/nimble_npl.h"
+#include "os/os_npl_extensions.h"
+
+#define STRESS_QUEUES        2
+#define STRESS_MAX_PRODUCERS 64
+#define STRESS_MAX_EVENTS    256
+#define STRESS_FENCE_MS      2000   /* A fence not run by then means a broken queue */
+
+/* One producer-owned event */
+typedef struct {
+    struct ble_npl_event ev;
+    int queue;                      /* Queue it was last put on */
+    int prev_queue;                 /* Queue it was moved from this cycle, or -1 */
+    uint32_t runs;                  /* Callback invocations, written by consumers */
+} stress_event_t;
+
+typedef struct {
+    int id;
+    int events;
+    stress_event_t ev[STRESS_MAX_EVENTS];
+    struct ble_npl_event fence[STRESS_QUEUES];
+    sem_t fence_done;
+    uint64_t puts;
+    uint64_t removes;
+    uint64_t moves;
+    uint64_t cycles;
+    uint32_t seed;
+} stress_producer_t;
+
+static struct ble_npl_eventq queues[STRESS_QUEUES];
+static stress_producer_t producers[STRESS_MAX_PRODUCERS];
+static volatile int stop;
+static uint32_t failures;
+static __thread int consumer_queue = -1;
+
+#define FAIL(...) do {                                  \
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED); \
+        fprintf(stderr, "FAIL: " __VA_ARGS__);          \
+    } while (0)
+
+static uint32_t next_random(uint32_t *state) {
+    /* xorshift32 */
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void event_cb(struct ble_npl_event *ev) {
+    stress_event_t *se = ble_npl_event_get_arg(ev);
+    int queue = __atomic_load_n(&se->queue, __ATOMIC_ACQUIRE);
+
+    /* The consumer of the queue it was moved from may have popped it just
+     * before the remove, and is allowed to finish running it */
+    if (queue != consumer_queue &&
+        __atomic_load_n(&se->prev_queue, __ATOMIC_ACQUIRE) != consumer_queue) {
+        FAIL("event %p ran on queue %d, last put on queue %d\n",
+             (void *)se, consumer_queue, queue);
+    }
+    __atomic_add_fetch(&se->runs, 1, __ATOMIC_RELEASE);
+}
+
+static void fence_cb(struct ble_npl_event *ev) {
+    stress_producer_t *p = ble_npl_event_get_arg(ev);
+    sem_post(&p->fence_done);
+}
+
+/*
+ * Wait until queue q's consumer is past everything put so far
+ *
+ * Single consumer, FIFO: once the fence has run, an event the consumer
+ * had already popped when it was removed has run as well. Fences after
+ * a queue is corrupted never arrive.
+ */
+static bool fence(stress_producer_t *p, int q) {
+    struct timespec deadline;
+
+    ble_npl_eventq_put(&queues[q], &p->fence[q]);
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += STRESS_FENCE_MS / 1000;
+    while (sem_timedwait(&p->fence_done, &deadline) < 0) {
+        if (errno != EINTR) {
+            FAIL("producer %d: queue %d stalled\n", p->id, q);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void *producer_thread(void *arg) {
+    stress_producer_t *p = arg;
+    uint32_t expected[STRESS_MAX_EVENTS];
+    uint32_t slack[STRESS_MAX_EVENTS];
+    bool removed[STRESS_MAX_EVENTS];
+
+    for (int i = 0; i < p->events; i++) {
+        p->ev[i].queue = i % STRESS_QUEUES;
+        p->ev[i].prev_queue = -1;
+        ble_npl_event_init(&p->ev[i].ev, event_cb, &p->ev[i]);
+    }
+    for (int q = 0; q < STRESS_QUEUES; q++) {
+        ble_npl_event_init(&p->fence[q], fence_cb, p);
+    }
+
+    while (!stop) {
+        /* Put everything, some of it twice: the second put is a no-op
+         * unless the consumer popped the event in between */
+        for (int i = 0; i < p->events; i++) {
+            stress_event_t *se = &p->ev[i];
+
+            expected[i] = __atomic_load_n(&se->runs, __ATOMIC_ACQUIRE) + 1;
+            slack[i] = 0;
+            removed[i] = false;
+            ble_npl_eventq_put(&queues[se->queue], &se->ev);
+            if ((next_random(&p->seed) & 7) == 0) {
+                ble_npl_eventq_put(&queues[se->queue], &se->ev);
+                slack[i] = 1;
+            }
+            p->puts++;
+        }
+
+        /* Remove a random half, racing the consumers */
+        for (int i = 0; i < p->events; i++) {
+            stress_event_t *se = &p->ev[i];
+            uint32_t r = next_random(&p->seed);
+
+            if (r & 1) {
+                continue;
+            }
+
+            ble_npl_eventq_remove(&queues[se->queue], &se->ev);
+            if (ble_npl_event_is_queued(&se->ev)) {
+                FAIL("producer %d: event %d still queued after remove\n", p->id, i);
+            }
+            removed[i] = true;
+            p->removes++;
+
+            /* The event is ours again: wipe it at once, and sometimes
+             * move it. A popped copy may still be about to run, hence
+             * the slack. */
+            if (r & 2) {
+                if (r & 4) {
+                    __atomic_store_n(&se->prev_queue, se->queue, __ATOMIC_RELEASE);
+                    __atomic_store_n(&se->queue, (se->queue + 1) % STRESS_QUEUES,
+                                     __ATOMIC_RELEASE);
+                    p->moves++;
+                }
+                expected[i] = __atomic_load_n(&se->runs, __ATOMIC_ACQUIRE) + 1;
+                slack[i] = 1;
+                removed[i] = false;
+                ble_npl_event_init(&se->ev, event_cb, se);
+                ble_npl_eventq_put(&queues[se->queue], &se->ev);
+            }
+        }
+
+        for (int q = 0; q < STRESS_QUEUES; q++) {
+            if (!fence(p, q)) {
+                return NULL;
+            }
+        }
+
+        for (int i = 0; i < p->events; i++) {
+            uint32_t runs = __atomic_load_n(&p->ev[i].runs, __ATOMIC_ACQUIRE);
+
+            if (runs > expected[i] + slack[i]) {
+                FAIL("producer %d: event %d ran %u time(s) more than put\n",
+                     p->id, i, runs - expected[i] - slack[i]);
+            } else if (runs < expected[i] && !removed[i]) {
+                FAIL("producer %d: event %d was lost\n", p->id, i);
+            }
+            __atomic_store_n(&p->ev[i].prev_queue, -1, __ATOMIC_RELAXED);
+        }
+        p->cycles++;
+    }
+
+    /* Leave nothing behind on the queues */
+    for (int i = 0; i < p->events; i++) {
+        ble_npl_eventq_remove(&queues[p->ev[i].queue], &p->ev[i].ev);
+    }
+    for (int q = 0; q < STRESS_QUEUES; q++) {
+        fence(p, q);
+    }
+    return NULL;
+}
+
+static void *consumer_thread(void *arg) {
+    consumer_queue = (int)(intptr_t)arg;
+
+    while (!stop) {
+        struct ble_npl_event *ev = ble_npl_eventq_get(&queues[consumer_queue],
+                                                      ble_npl_time_ms_to_ticks32(100));
+        if (ev) {
+            ble_npl_event_run(ev);
+        }
+    }
+
+    /* Drain the producers' final fences */
+    for (;;) {
+        struct ble_npl_event *ev = ble_npl_eventq_get(&queues[consumer_queue],
+                                                      ble_npl_time_ms_to_ticks32(500));
+        if (!ev) {
+            break;
+        }
+        ble_npl_event_run(ev);
+    }
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-p producers] [-e events] [-d seconds] [-f]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int nproducers = 4;
+    int nevents = 32;
+    int duration = 10;
+    bool fifo = false;
+    pthread_t consumers[STRESS_QUEUES];
+    pthread_t threads[STRESS_MAX_PRODUCERS];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:e:d:fh")) != -1) {
+        switch (opt) {
+        case 'p':
+            nproducers = atoi(optarg);
+            break;
+        case 'e':
+            nevents = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'f':
+            fifo = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (nproducers < 1 || nproducers > STRESS_MAX_PRODUCERS ||
+        nevents < 1 || nevents > STRESS_MAX_EVENTS || duration < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    for (int q = 0; q < STRESS_QUEUES; q++) {
+        ble_npl_eventq_init(&queues[q]);
+        if (!queues[q].q) {
+            fprintf(stderr, "Failed to create event queue\n");
+            return 1;
+        }
+    }
+
+    for (int q = 0; q < STRESS_QUEUES; q++) {
+        pthread_attr_t attr;
+        struct sched_param param = { .sched_priority = 10 };
+
+        pthread_attr_init(&attr);
+        if (fifo) {
+            pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+            pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+            pthread_attr_setschedparam(&attr, &param);
+        }
+        int err = pthread_create(&consumers[q], &attr, consumer_thread, (void *)(intptr_t)q);
+        pthread_attr_destroy(&attr);
+        if (err) {
+            fprintf(stderr, "Failed to start consumer: %s\n", strerror(err));
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < nproducers; i++) {
+        producers[i].id = i;
+        producers[i].events = nevents;
+        producers[i].seed = 2463534242u + (uint32_t)i * 7919u;
+        sem_init(&producers[i].fence_done, 0, 0);
+        pthread_create(&threads[i], NULL, producer_thread, &producers[i]);
+    }
+
+    printf("%d producer(s) x %d event(s), %d queue(s)%s, %d s\n", nproducers, nevents,
+           STRESS_QUEUES, fifo ? " (SCHED_FIFO consumers)" : "", duration);
+    sleep((unsigned)duration);
+    stop = 1;
+
+    uint64_t puts = 0, removes = 0, moves = 0, cycles = 0;
+    for (int i = 0; i < nproducers; i++) {
+        pthread_join(threads[i], NULL);
+        puts += producers[i].puts;
+        removes += producers[i].removes;
+        moves += producers[i].moves;
+        cycles += producers[i].cycles;
+    }
+    for (int q = 0; q < STRESS_QUEUES; q++) {
+        pthread_join(consumers[q], NULL);
+        if (!ble_npl_eventq_is_empty(&queues[q])) {
+            FAIL("queue %d not empty at exit\n", q);
+        }
+        ble_npl_eventq_release(&queues[q]);
+    }
+
+    printf("%llu cycles, %llu puts, %llu removes, %llu moves: %u failure(s)\n",
+           (unsigned long long)cycles, (unsigned long long)puts,
+           (unsigned long long)removes, (unsigned long long)moves, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+/**
+ * @file npl_timing.c
+ * @brief Timed-wait accuracy check for the NPL event queue and callouts
+ *
+ * Measures how far the actual wakeup lands from the requested one for:
+ *
+ *  - ble_npl_eventq_get() on an empty queue with a timeout: it must not
+ *    return before the timeout has passed;
+ *  - callouts: the event must not run before its ticks have passed, as
+ *    seen by the thread running the queue.
+ *
+ * Both fail when a wakeup is early or later than the allowed latency, and
+ * print min/avg/max latency per timeout. Run it on the target with -f as
+ * well: the NimBLE host task runs at SCHED_FIFO.
+ *
+ * Usage: npl-timing [-n rounds] [-l max-late-ms] [-f]
+ * Exit status is 0 when no check failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "nimble/nimble_npl.h"
+#include "os/os_npl_extensions.h"
+
+#define TIMING_FENCE_MS      2000   /* A callout not run by then is lost */
+
+/* Timeouts measured, in ms */
+static const uint32_t timeouts_ms[] = { 1, 2, 5, 10, 20, 50, 100 };
+#define TIMING_TIMEOUTS (sizeof(timeouts_ms) / sizeof(timeouts_ms[0]))
+
+typedef struct {
+    int64_t min_us;
+    int64_t max_us;
+    int64_t sum_us;
+    uint32_t samples;
+} timing_stats_t;
+
+static struct ble_npl_eventq timer_queue;
+static struct ble_npl_callout callout;
+static sem_t callout_done;
+static int64_t callout_ran_ns;
+static volatile int stop;
+static uint32_t failures;
+
+#define FAIL(...) do {                                  \
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED); \
+        fprintf(stderr, "FAIL: " __VA_ARGS__);          \
+    } while (0)
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void stats_add(timing_stats_t *st, int64_t late_us) {
+    if (st->samples == 0 || late_us < st->min_us) {
+        st->min_us = late_us;
+    }
+    if (st->samples == 0 || late_us > st->max_us) {
+        st->max_us = late_us;
+    }
+    st->sum_us += late_us;
+    st->samples++;
+}
+
+static void stats_print(const char *what, uint32_t tmo_ms, const timing_stats_t *st) {
+    printf("%-12s %4u ms: late min %6lld us, avg %6lld us, max %6lld us (%u samples)\n",
+           what, tmo_ms, (long long)st->min_us,
+           (long long)(st->samples ? st->sum_us / st->samples : 0),
+           (long long)st->max_us, st->samples);
+}
+
+/*
+ * Check one wakeup
+ *
+ * early_slack_us covers the tick rounding of the API being measured; any
+ * other early wakeup and any latency above max_late_us is a failure.
+ */
+static void check_wakeup(const char *what, uint32_t tmo_ms, int64_t elapsed_ns,
+                         int64_t early_slack_us, int64_t max_late_us,
+                         timing_stats_t *st) {
+    int64_t late_us = elapsed_ns / 1000 - (int64_t)tmo_ms * 1000;
+
+    stats_add(st, late_us);
+    if (late_us < -early_slack_us) {
+        FAIL("%s %u ms: woke %lld us early\n", what, tmo_ms, (long long)-late_us);
+    } else if (late_us > max_late_us) {
+        FAIL("%s %u ms: woke %lld us late\n", what, tmo_ms, (long long)late_us);
+    }
+}
+
+static void measure_eventq_get(int rounds, int64_t max_late_us) {
+    struct ble_npl_eventq q;
+
+    ble_npl_eventq_init(&q);
+    if (!q.q) {
+        FAIL("failed to create event queue\n");
+        return;
+    }
+
+    for (size_t t = 0; t < TIMING_TIMEOUTS; t++) {
+        timing_stats_t st = { 0 };
+
+        for (int r = 0; r < rounds; r++) {
+            int64_t start = now_ns();
+            struct ble_npl_event *ev = ble_npl_eventq_get(&q,
+                                                          ble_npl_time_ms_to_ticks32(timeouts_ms[t]));
+            int64_t elapsed = now_ns() - start;
+
+            if (ev) {
+                FAIL("eventq_get returned an event from an empty queue\n");
+                continue;
+            }
+            /* The timeout is relative to the call, never rounded down */
+            check_wakeup("eventq_get", timeouts_ms[t], elapsed, 0, max_late_us, &st);
+        }
+        stats_print("eventq_get", timeouts_ms[t], &st);
+    }
+
+    ble_npl_eventq_release(&q);
+}
+
+static void callout_cb(struct ble_npl_event *ev) {
+    (void)ev;
+    __atomic_store_n(&callout_ran_ns, now_ns(), __ATOMIC_RELEASE);
+    sem_post(&callout_done);
+}
+
+static void *timer_thread(void *arg) {
+    (void)arg;
+
+    while (!stop) {
+        struct ble_npl_event *ev = ble_npl_eventq_get(&timer_queue,
+                                                      ble_npl_time_ms_to_ticks32(100));
+        if (ev) {
+            ble_npl_event_run(ev);
+        }
+    }
+    return NULL;
+}
+
+static void measure_callout(int rounds, int64_t max_late_us) {
+    /* A reset lands anywhere within the current tick */
+    int64_t tick_us = (int64_t)ble_npl_time_ticks_to_ms32(1) * 1000;
+
+    for (size_t t = 0; t < TIMING_TIMEOUTS; t++) {
+        timing_stats_t st = { 0 };
+
+        for (int r = 0; r < rounds; r++) {
+            struct timespec deadline;
+            int64_t start = now_ns();
+
+            ble_npl_callout_reset(&callout, ble_npl_time_ms_to_ticks32(timeouts_ms[t]));
+
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += TIMING_FENCE_MS / 1000;
+            while (sem_timedwait(&callout_done, &deadline) < 0) {
+                if (errno != EINTR) {
+                    FAIL("callout %u ms: never ran\n", timeouts_ms[t]);
+                    return;
+                }
+            }
+
+            int64_t elapsed = __atomic_load_n(&callout_ran_ns, __ATOMIC_ACQUIRE) - start;
+            check_wakeup("callout", timeouts_ms[t], elapsed, tick_us, max_late_us, &st);
+        }
+        stats_print("callout", timeouts_ms[t], &st);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n rounds] [-l max-late-ms] [-f]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int rounds = 50;
+    int max_late_ms = 20;
+    bool fifo = false;
+    pthread_t timer;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:fh")) != -1) {
+        switch (opt) {
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        case 'l':
+            max_late_ms = atoi(optarg);
+            break;
+        case 'f':
+            fifo = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (rounds < 1 || max_late_ms < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (fifo) {
+        struct sched_param param = { .sched_priority = 10 };
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err) {
+            fprintf(stderr, "Failed to set SCHED_FIFO: %s\n", strerror(err));
+            return 1;
+        }
+    }
+
+    printf("%d round(s) per timeout, max latency %d ms%s\n", rounds, max_late_ms,
+           fifo ? " (SCHED_FIFO)" : "");
+
+    measure_eventq_get(rounds, (int64_t)max_late_ms * 1000);
+
+    /* The timer thread inherits the policy of this one */
+    ble_npl_eventq_init(&timer_queue);
+    if (!timer_queue.q) {
+        fprintf(stderr, "Failed to create event queue\n");
+        return 1;
+    }
+    sem_init(&callout_done, 0, 0);
+    ble_npl_callout_init(&callout, &timer_queue, callout_cb, NULL);
+    int err = pthread_create(&timer, NULL, timer_thread, NULL);
+    if (err) {
+        fprintf(stderr, "Failed to start timer thread: %s\n", strerror(err));
+        return 1;
+    }
+
+    measure_callout(rounds, (int64_t)max_late_ms * 1000);
+
+    stop = 1;
+    pthread_join(timer, NULL);
+    ble_npl_callout_stop(&callout);
+    ble_npl_callout_free(&callout);
+    ble_npl_eventq_release(&timer_queue);
+
+    printf("%u failure(s)\n", failures);
+    return failures ? 1 : 0;
+}
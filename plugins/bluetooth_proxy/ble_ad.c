@@ -0,0 +1,278 @@
+/**
+ * @file ble_ad.c
+ * @brief Single-pass AD structure scanner
+ */
+
+#include "ble_ad.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define BLE_AD_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BLE_AD_NEON 1
+#endif
+
+/* Hash lane seeds */
+#define HASH_SEED0 0x9E3779B1u
+#define HASH_SEED1 0x85EBCA77u
+#define HASH_SEED2 0xC2B2AE3Du
+#define HASH_SEED3 0x27D4EB2Fu
+
+/* -----------------------------------------------------------------
+ * Length chain
+ * ----------------------------------------------------------------- */
+
+/**
+ * Walk the AD structures, collecting their types for classification
+ *
+ * @param types Receives the type of each field, zero-padded to 16 bytes
+ */
+static void ad_walk(const uint8_t *data, size_t len, ble_ad_index_t *index, uint8_t types[16]) {
+    size_t pos = 0;
+    int count = 0;
+
+    memset(types, 0, 16);
+
+    while (pos < len && count < BLE_AD_MAX_FIELDS) {
+        uint8_t field_len = data[pos];
+        if (field_len == 0) {
+            /* Padding, or the end of the advertisement before the scan response */
+            pos++;
+            continue;
+        }
+        if (pos + 1 + field_len > len) {
+            break;
+        }
+
+        index->fields[count].type = data[pos + 1];
+        index->fields[count].len = (uint8_t)(field_len - 1);
+        index->fields[count].offset = (uint8_t)(pos + 2);
+        types[count] = data[pos + 1];
+        count++;
+        pos += 1 + (size_t)field_len;
+    }
+
+    index->count = (uint8_t)count;
+}
+
+/* -----------------------------------------------------------------
+ * Hash
+ *
+ * Four 32-bit lanes, each mixing every fourth word of 16-byte blocks
+ * (the tail is zero-padded) with shift/add/xor steps that exist on
+ * every SIMD unit, folded with the murmur3 finalizer.
+ * ----------------------------------------------------------------- */
+
+static uint32_t hash_finish(const uint32_t lanes[4], size_t len) {
+    uint32_t h = (uint32_t)len;
+
+    for (int i = 0; i < 4; i++) {
+        h ^= lanes[i];
+        h = (h << 13) | (h >> 19);
+        h = h * 5 + 0xE6546B64u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t hash_scalar(const uint8_t *data, size_t len) {
+    uint32_t lanes[4] = { HASH_SEED0, HASH_SEED1, HASH_SEED2, HASH_SEED3 };
+    uint8_t tail[16];
+
+    for (size_t pos = 0; pos < len; pos += 16) {
+        const uint8_t *p = data + pos;
+        if (len - pos < 16) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, len - pos);
+            p = tail;
+        }
+
+        for (int i = 0; i < 4; i++) {
+            uint32_t w = (uint32_t)p[4 * i] | ((uint32_t)p[4 * i + 1] << 8) |
+                         ((uint32_t)p[4 * i + 2] << 16) | ((uint32_t)p[4 * i + 3] << 24);
+            uint32_t s = lanes[i] ^ w;
+            s += s << 10;
+            s ^= s >> 6;
+            lanes[i] = s;
+        }
+    }
+
+    return hash_finish(lanes, len);
+}
+
+/* -----------------------------------------------------------------
+ * Classification
+ * ----------------------------------------------------------------- */
+
+static void classify_scalar(const uint8_t types[16], ble_ad_index_t *index) {
+    index->service_uuids = 0;
+    index->service_data = 0;
+    index->manufacturer = 0;
+    index->names = 0;
+
+    for (int i = 0; i < index->count; i++) {
+        uint16_t bit = (uint16_t)(1U << i);
+        switch (types[i]) {
+        case BLE_AD_UUID16_INCOMPLETE:
+        case BLE_AD_UUID16_COMPLETE:
+        case BLE_AD_UUID32_INCOMPLETE:
+        case BLE_AD_UUID32_COMPLETE:
+        case BLE_AD_UUID128_INCOMPLETE:
+        case BLE_AD_UUID128_COMPLETE:
+            index->service_uuids |= bit;
+            break;
+        case BLE_AD_SERVICE_DATA_16:
+        case BLE_AD_SERVICE_DATA_32:
+        case BLE_AD_SERVICE_DATA_128:
+            index->service_data |= bit;
+            break;
+        case BLE_AD_MANUFACTURER:
+            index->manufacturer |= bit;
+            break;
+        case BLE_AD_NAME_SHORT:
+        case BLE_AD_NAME_COMPLETE:
+            index->names |= bit;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void ble_ad_scan_scalar(const uint8_t *data, size_t len, ble_ad_index_t *index) {
+    uint8_t types[16];
+
+    ad_walk(data, len, index, types);
+    classify_scalar(types, index);
+    index->hash = hash_scalar(data, len);
+}
+
+#if defined(BLE_AD_SSE2)
+
+static uint32_t hash_simd(const uint8_t *data, size_t len) {
+    __m128i s = _mm_set_epi32((int)HASH_SEED3, (int)HASH_SEED2, (int)HASH_SEED1, (int)HASH_SEED0);
+    uint8_t tail[16];
+    uint32_t lanes[4];
+
+    for (size_t pos = 0; pos < len; pos += 16) {
+        __m128i w;
+        if (len - pos >= 16) {
+            w = _mm_loadu_si128((const __m128i *)(data + pos));
+        } else {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, data + pos, len - pos);
+            w = _mm_loadu_si128((const __m128i *)tail);
+        }
+
+        s = _mm_xor_si128(s, w);
+        s = _mm_add_epi32(s, _mm_slli_epi32(s, 10));
+        s = _mm_xor_si128(s, _mm_srli_epi32(s, 6));
+    }
+
+    _mm_storeu_si128((__m128i *)lanes, s);
+    return hash_finish(lanes, len);
+}
+
+/* Bitmask of the bytes of v in [lo, lo + span) */
+static int range_mask(__m128i v, uint8_t lo, uint8_t span) {
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8((char)lo));
+    __m128i in = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8((char)(span - 1))), d);
+    return _mm_movemask_epi8(in);
+}
+
+static int eq_mask(__m128i v, uint8_t value) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)value)));
+}
+
+static void classify_simd(const uint8_t types[16], ble_ad_index_t *index) {
+    __m128i v = _mm_loadu_si128((const __m128i *)types);
+    int valid = (int)((1U << index->count) - 1);
+
+    index->service_uuids = (uint16_t)(range_mask(v, BLE_AD_UUID16_INCOMPLETE, 6) & valid);
+    index->service_data = (uint16_t)((eq_mask(v, BLE_AD_SERVICE_DATA_16) |
+                                      range_mask(v, BLE_AD_SERVICE_DATA_32, 2)) & valid);
+    index->manufacturer = (uint16_t)(eq_mask(v, BLE_AD_MANUFACTURER) & valid);
+    index->names = (uint16_t)(range_mask(v, BLE_AD_NAME_SHORT, 2) & valid);
+}
+
+#elif defined(BLE_AD_NEON)
+
+static uint32_t hash_simd(const uint8_t *data, size_t len) {
+    static const uint32_t seeds[4] = { HASH_SEED0, HASH_SEED1, HASH_SEED2, HASH_SEED3 };
+    uint32x4_t s = vld1q_u32(seeds);
+    uint8_t tail[16];
+    uint32_t lanes[4];
+
+    for (size_t pos = 0; pos < len; pos += 16) {
+        uint32x4_t w;
+        if (len - pos >= 16) {
+            w = vreinterpretq_u32_u8(vld1q_u8(data + pos));
+        } else {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, data + pos, len - pos);
+            w = vreinterpretq_u32_u8(vld1q_u8(tail));
+        }
+
+        s = veorq_u32(s, w);
+        s = vaddq_u32(s, vshlq_n_u32(s, 10));
+        s = veorq_u32(s, vshrq_n_u32(s, 6));
+    }
+
+    vst1q_u32(lanes, s);
+    return hash_finish(lanes, len);
+}
+
+/* Collapse a byte compare result to one bit per byte */
+static int movemask(uint8x16_t in) {
+    static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+                                         1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t bits = vandq_u8(in, vld1q_u8(weights));
+
+    /* Pairwise adds leave the low half sum in lane 0, the high half sum in lane 1 */
+    uint8x8_t sum = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+    sum = vpadd_u8(sum, sum);
+    sum = vpadd_u8(sum, sum);
+    return vget_lane_u8(sum, 0) | (vget_lane_u8(sum, 1) << 8);
+}
+
+/* Bitmask of the bytes of v in [lo, lo + span) */
+static int range_mask(uint8x16_t v, uint8_t lo, uint8_t span) {
+    uint8x16_t d = vsubq_u8(v, vdupq_n_u8(lo));
+    return movemask(vcltq_u8(d, vdupq_n_u8(span)));
+}
+
+static int eq_mask(uint8x16_t v, uint8_t value) {
+    return movemask(vceqq_u8(v, vdupq_n_u8(value)));
+}
+
+static void classify_simd(const uint8_t types[16], ble_ad_index_t *index) {
+    uint8x16_t v = vld1q_u8(types);
+    int valid = (int)((1U << index->count) - 1);
+
+    index->service_uuids = (uint16_t)(range_mask(v, BLE_AD_UUID16_INCOMPLETE, 6) & valid);
+    index->service_data = (uint16_t)((eq_mask(v, BLE_AD_SERVICE_DATA_16) |
+                                      range_mask(v, BLE_AD_SERVICE_DATA_32, 2)) & valid);
+    index->manufacturer = (uint16_t)(eq_mask(v, BLE_AD_MANUFACTURER) & valid);
+    index->names = (uint16_t)(range_mask(v, BLE_AD_NAME_SHORT, 2) & valid);
+}
+
+#endif
+
+void ble_ad_scan(const uint8_t *data, size_t len, ble_ad_index_t *index) {
+#if defined(BLE_AD_SSE2) || defined(BLE_AD_NEON)
+    uint8_t types[16];
+
+    ad_walk(data, len, index, types);
+    classify_simd(types, index);
+    index->hash = hash_simd(data, len);
+#else
+    ble_ad_scan_scalar(data, len, index);
+#endif
+}
@@ -0,0 +1,105 @@
+/**
+ * @file ble_ad.h
+ * @brief Single-pass AD structure scanner
+ *
+ * Indexes the length-type-value AD structures of an advertisement once,
+ * so filters and decoders look fields up instead of re-walking the data.
+ * The same pass classifies the fields (service UUIDs, service data,
+ * manufacturer data, local name) and computes a payload hash for change
+ * detection.
+ *
+ * The length chain is inherently serial and walked with scalar loads;
+ * field classification and the hash use SSE2 on x86-64 and NEON on
+ * ARM, with a portable scalar implementation elsewhere (MIPS).
+ * Both produce identical results.
+ */
+
+#ifndef BLE_AD_H
+#define BLE_AD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* AD types (Bluetooth Assigned Numbers, section 2.3) */
+#define BLE_AD_FLAGS              0x01
+#define BLE_AD_UUID16_INCOMPLETE  0x02
+#define BLE_AD_UUID16_COMPLETE    0x03
+#define BLE_AD_UUID32_INCOMPLETE  0x04
+#define BLE_AD_UUID32_COMPLETE    0x05
+#define BLE_AD_UUID128_INCOMPLETE 0x06
+#define BLE_AD_UUID128_COMPLETE   0x07
+#define BLE_AD_NAME_SHORT         0x08
+#define BLE_AD_NAME_COMPLETE      0x09
+#define BLE_AD_SERVICE_DATA_16    0x16
+#define BLE_AD_SERVICE_DATA_32    0x20
+#define BLE_AD_SERVICE_DATA_128   0x21
+#define BLE_AD_MANUFACTURER       0xFF
+
+/* AD structures indexed per advertisement (advertisement + scan response) */
+#define BLE_AD_MAX_FIELDS 16
+
+/**
+ * One AD structure
+ */
+typedef struct {
+    uint8_t type;
+    uint8_t len;                /* Payload length, without the type byte */
+    uint8_t offset;             /* Payload offset in the advertisement data */
+} ble_ad_field_t;
+
+/**
+ * Index of an advertisement
+ *
+ * The class masks have bit i set if fields[i] is of that class.
+ */
+typedef struct {
+    ble_ad_field_t fields[BLE_AD_MAX_FIELDS];
+    uint8_t count;
+    uint16_t service_uuids;     /* 16/32/128-bit service UUID lists */
+    uint16_t service_data;      /* 16/32/128-bit service data */
+    uint16_t manufacturer;      /* Manufacturer specific data */
+    uint16_t names;             /* Shortened or complete local name */
+    uint32_t hash;              /* Payload hash, for change detection */
+} ble_ad_index_t;
+
+/**
+ * Index an advertisement
+ *
+ * Parsing stops at the first malformed structure or after
+ * BLE_AD_MAX_FIELDS fields; the hash always covers all of data.
+ *
+ * @param data Advertisement data (AD structures)
+ * @param len Length of data (at most 255)
+ * @param index Receives the fields, class masks and hash
+ */
+void ble_ad_scan(const uint8_t *data, size_t len, ble_ad_index_t *index);
+
+/**
+ * Scalar reference of ble_ad_scan()
+ *
+ * Same results without SIMD; used on targets without SSE2/NEON and to
+ * check and benchmark the vector paths.
+ */
+void ble_ad_scan_scalar(const uint8_t *data, size_t len, ble_ad_index_t *index);
+
+/**
+ * Get the payload of a field
+ *
+ * @param data Advertisement data the index was built from
+ * @param field Field of the index
+ * @return Pointer to the payload (after the type byte)
+ */
+static inline const uint8_t *ble_ad_field_data(const uint8_t *data, const ble_ad_field_t *field) {
+    return data + field->offset;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_AD_H */
@@ -0,0 +1,189 @@
+/**
+ * @file ble_aggregator.c
+ * @brief Merges advertisement streams of several receivers
+ */
+
+#include "ble_aggregator.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Advertisements emitted per lock hold when expiring */
+#define AGGREGATOR_EMIT_CHUNK 16
+
+/**
+ * Advertisement held for its deduplication window
+ */
+typedef struct {
+    bool valid;
+    uint8_t best_receiver;         /* Receiver that reported the best RSSI */
+    uint16_t receivers;            /* Receivers that heard it (bit per receiver) */
+    uint64_t first_seen_ms;
+    ble_advertisement_t advert;    /* rssi is the best RSSI so far */
+} agg_entry_t;
+
+typedef struct {
+    uint64_t received;             /* Advertisements from this receiver */
+    uint64_t duplicates;           /* Of which already heard by another receiver */
+    uint64_t best;                 /* Emitted advertisements this receiver heard best */
+} receiver_stats_t;
+
+struct ble_aggregator {
+    pthread_mutex_t mutex;
+    agg_entry_t entries[BLE_AGGREGATOR_MAX_ENTRIES];
+    receiver_stats_t stats[BLE_AGGREGATOR_MAX_RECEIVERS];
+    uint64_t emitted;
+    uint64_t evicted;
+    ble_aggregator_emit_fn emit;
+    void *user_data;
+};
+
+static uint64_t get_timestamp_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool same_advertisement(const ble_advertisement_t *a, const ble_advertisement_t *b) {
+    return a->data_hash == b->data_hash && a->data_len == b->data_len &&
+           memcmp(a->address, b->address, BLE_MAC_LEN) == 0;
+}
+
+/**
+ * Take an entry out of the table for emission
+ *
+ * Caller holds the mutex.
+ */
+static void take_entry(ble_aggregator_t *agg, agg_entry_t *entry, ble_advertisement_t *out) {
+    *out = entry->advert;
+    agg->stats[entry->best_receiver].best++;
+    agg->emitted++;
+    entry->valid = false;
+}
+
+ble_aggregator_t *ble_aggregator_create(ble_aggregator_emit_fn emit, void *user_data) {
+    ble_aggregator_t *agg = calloc(1, sizeof(*agg));
+    if (!agg) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&agg->mutex, NULL);
+    agg->emit = emit;
+    agg->user_data = user_data;
+    return agg;
+}
+
+void ble_aggregator_add(ble_aggregator_t *agg, int receiver, const ble_advertisement_t *advert,
+                        uint32_t window_ms) {
+    uint64_t now = get_timestamp_ms();
+    agg_entry_t *free_slot = NULL;
+    agg_entry_t *oldest = NULL;
+    ble_advertisement_t evicted;
+    bool have_evicted = false;
+
+    if (receiver < 0 || receiver >= BLE_AGGREGATOR_MAX_RECEIVERS) {
+        return;
+    }
+
+    pthread_mutex_lock(&agg->mutex);
+
+    agg->stats[receiver].received++;
+
+    for (int i = 0; i < BLE_AGGREGATOR_MAX_ENTRIES; i++) {
+        agg_entry_t *entry = &agg->entries[i];
+
+        if (!entry->valid) {
+            if (!free_slot) {
+                free_slot = entry;
+            }
+            continue;
+        }
+
+        if (now - entry->first_seen_ms < window_ms && same_advertisement(&entry->advert, advert)) {
+            /* Heard again: keep one copy with the best RSSI */
+            agg->stats[receiver].duplicates++;
+            entry->receivers |= (uint16_t)(1U << receiver);
+            if (advert->rssi > entry->advert.rssi) {
+                entry->advert.rssi = advert->rssi;
+                entry->best_receiver = (uint8_t)receiver;
+            }
+            pthread_mutex_unlock(&agg->mutex);
+            return;
+        }
+
+        if (!oldest || entry->first_seen_ms < oldest->first_seen_ms) {
+            oldest = entry;
+        }
+    }
+
+    if (!free_slot) {
+        /* Table full: emit the oldest early to make room */
+        take_entry(agg, oldest, &evicted);
+        have_evicted = true;
+        agg->evicted++;
+        free_slot = oldest;
+    }
+
+    free_slot->valid = true;
+    free_slot->best_receiver = (uint8_t)receiver;
+    free_slot->receivers = (uint16_t)(1U << receiver);
+    free_slot->first_seen_ms = now;
+    free_slot->advert = *advert;
+
+    pthread_mutex_unlock(&agg->mutex);
+
+    if (have_evicted) {
+        agg->emit(&evicted, agg->user_data);
+    }
+}
+
+void ble_aggregator_expire(ble_aggregator_t *agg, uint32_t window_ms) {
+    ble_advertisement_t due[AGGREGATOR_EMIT_CHUNK];
+    int count;
+
+    do {
+        uint64_t now = get_timestamp_ms();
+        count = 0;
+
+        pthread_mutex_lock(&agg->mutex);
+        for (int i = 0; i < BLE_AGGREGATOR_MAX_ENTRIES && count < AGGREGATOR_EMIT_CHUNK; i++) {
+            agg_entry_t *entry = &agg->entries[i];
+            if (entry->valid && now - entry->first_seen_ms >= window_ms) {
+                take_entry(agg, entry, &due[count++]);
+            }
+        }
+        pthread_mutex_unlock(&agg->mutex);
+
+        for (int i = 0; i < count; i++) {
+            agg->emit(&due[i], agg->user_data);
+        }
+    } while (count == AGGREGATOR_EMIT_CHUNK);
+}
+
+void ble_aggregator_dump(ble_aggregator_t *agg, FILE *out) {
+    pthread_mutex_lock(&agg->mutex);
+
+    fprintf(out, "aggregator.emitted %llu\n", (unsigned long long)agg->emitted);
+    fprintf(out, "aggregator.evicted %llu\n", (unsigned long long)agg->evicted);
+    for (int i = 0; i < BLE_AGGREGATOR_MAX_RECEIVERS; i++) {
+        const receiver_stats_t *stats = &agg->stats[i];
+        if (stats->received == 0) {
+            continue;
+        }
+        fprintf(out, "aggregator.receiver.%d received=%llu duplicates=%llu best=%llu\n", i,
+                (unsigned long long)stats->received, (unsigned long long)stats->duplicates,
+                (unsigned long long)stats->best);
+    }
+
+    pthread_mutex_unlock(&agg->mutex);
+}
+
+void ble_aggregator_free(ble_aggregator_t *agg) {
+    if (!agg) {
+        return;
+    }
+
+    pthread_mutex_destroy(&agg->mutex);
+    free(agg);
+}
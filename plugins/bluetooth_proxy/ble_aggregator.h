@@ -0,0 +1,88 @@
+/**
+ * @file ble_aggregator.h
+ * @brief Merges advertisement streams of several receivers
+ *
+ * Receivers are the local radio and the upstream proxies. The same
+ * advertisement heard by several receivers within a window is forwarded
+ * once, keyed by (MAC, payload hash), carrying the best RSSI any receiver
+ * reported for it. An advertisement is held until its window ends, then
+ * emitted.
+ */
+
+#ifndef BLE_AGGREGATOR_H
+#define BLE_AGGREGATOR_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "ble_scanner.h"
+#include "ble_upstream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Advertisements held at once; when full the oldest is emitted early */
+#define BLE_AGGREGATOR_MAX_ENTRIES 256
+
+/* Receiver 0 is the local radio, 1.. the upstreams */
+#define BLE_AGGREGATOR_MAX_RECEIVERS (1 + BLE_UPSTREAM_MAX)
+
+/**
+ * Callback for merged advertisements
+ *
+ * @param advert Advertisement with the best RSSI of all receivers
+ * @param user_data User-provided context
+ */
+typedef void (*ble_aggregator_emit_fn)(const ble_advertisement_t *advert, void *user_data);
+
+/* Aggregator (opaque) */
+typedef struct ble_aggregator ble_aggregator_t;
+
+/**
+ * Create an aggregator
+ *
+ * @param emit Callback for merged advertisements (called without internal locks held)
+ * @param user_data Passed to emit
+ * @return Aggregator, or NULL on allocation failure
+ */
+ble_aggregator_t *ble_aggregator_create(ble_aggregator_emit_fn emit, void *user_data);
+
+/**
+ * Add an advertisement heard by a receiver
+ *
+ * @param agg Aggregator
+ * @param receiver Receiver index (< BLE_AGGREGATOR_MAX_RECEIVERS)
+ * @param advert Advertisement (data_hash must be set)
+ * @param window_ms Deduplication window
+ */
+void ble_aggregator_add(ble_aggregator_t *agg, int receiver, const ble_advertisement_t *advert,
+                        uint32_t window_ms);
+
+/**
+ * Emit advertisements whose window has ended
+ *
+ * @param agg Aggregator
+ * @param window_ms Deduplication window
+ */
+void ble_aggregator_expire(ble_aggregator_t *agg, uint32_t window_ms);
+
+/**
+ * Write per-receiver counters as metric lines
+ *
+ * @param agg Aggregator
+ * @param out Stream
+ */
+void ble_aggregator_dump(ble_aggregator_t *agg, FILE *out);
+
+/**
+ * Free the aggregator (held advertisements are dropped)
+ *
+ * @param agg Aggregator (NULL is ignored)
+ */
+void ble_aggregator_free(ble_aggregator_t *agg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_AGGREGATOR_H */
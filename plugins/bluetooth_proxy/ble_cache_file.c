@@ -0,0 +1,180 @@
+/**
+ * @file ble_cache_file.c
+ * @brief Memory-mapped snapshot of the BLE device cache
+ */
+
+#include "ble_cache_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOG_PREFIX "[ble-cache] "
+
+#define CACHE_FILE_MAGIC   0x434C4245u  /* "EBLC" */
+#define CACHE_FILE_VERSION 1
+#define CACHE_FILE_SLOTS   2
+
+/**
+ * Slot header, followed by BLE_SCANNER_MAX_DEVICES records
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t sequence;             /* Incremented per snapshot, newest slot wins */
+    uint32_t count;
+    uint64_t saved_ms;             /* CLOCK_REALTIME at snapshot time */
+    uint32_t crc;                  /* CRC-32 of the header (crc = 0) and the records */
+    uint32_t reserved;
+} cache_slot_header_t;
+
+typedef struct {
+    cache_slot_header_t header;
+    ble_cache_record_t records[BLE_SCANNER_MAX_DEVICES];
+} cache_slot_t;
+
+struct ble_cache_file {
+    int fd;
+    cache_slot_t *slots;           /* CACHE_FILE_SLOTS slots, mapped */
+    uint32_t sequence;             /* Sequence of the newest valid slot */
+    int newest;                    /* Index of the newest valid slot, -1 if none */
+};
+
+static uint64_t realtime_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t slot_crc(const cache_slot_t *slot) {
+    cache_slot_header_t header = slot->header;
+    uint32_t count = header.count <= BLE_SCANNER_MAX_DEVICES ? header.count : 0;
+
+    header.crc = 0;
+    uint32_t crc = crc32_update(0, (const uint8_t *)&header, sizeof(header));
+    return crc32_update(crc, (const uint8_t *)slot->records, count * sizeof(ble_cache_record_t));
+}
+
+static bool slot_valid(const cache_slot_t *slot) {
+    return slot->header.magic == CACHE_FILE_MAGIC &&
+           slot->header.version == CACHE_FILE_VERSION &&
+           slot->header.record_size == sizeof(ble_cache_record_t) &&
+           slot->header.count <= BLE_SCANNER_MAX_DEVICES &&
+           slot->header.crc == slot_crc(slot);
+}
+
+ble_cache_file_t *ble_cache_file_open(const char *path) {
+    size_t size = CACHE_FILE_SLOTS * sizeof(cache_slot_t);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, LOG_PREFIX "Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    /* Size the file; a file of another layout is simply overwritten */
+    struct stat st;
+    if (fstat(fd, &st) < 0 || ((size_t)st.st_size != size && ftruncate(fd, (off_t)size) < 0)) {
+        fprintf(stderr, LOG_PREFIX "Cannot size %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, LOG_PREFIX "Cannot map %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    ble_cache_file_t *file = calloc(1, sizeof(*file));
+    if (!file) {
+        munmap(map, size);
+        close(fd);
+        return NULL;
+    }
+
+    file->fd = fd;
+    file->slots = (cache_slot_t *)map;
+    file->newest = -1;
+
+    for (int i = 0; i < CACHE_FILE_SLOTS; i++) {
+        if (slot_valid(&file->slots[i]) &&
+            (file->newest < 0 || (int32_t)(file->slots[i].header.sequence - file->sequence) > 0)) {
+            file->newest = i;
+            file->sequence = file->slots[i].header.sequence;
+        }
+    }
+
+    return file;
+}
+
+int ble_cache_file_load(ble_cache_file_t *file, ble_cache_record_t *records,
+                        uint64_t *saved_ago_ms) {
+    if (!file || file->newest < 0) {
+        return -1;
+    }
+
+    const cache_slot_t *slot = &file->slots[file->newest];
+    uint64_t now = realtime_ms();
+
+    memcpy(records, slot->records, slot->header.count * sizeof(ble_cache_record_t));
+    *saved_ago_ms = now > slot->header.saved_ms ? now - slot->header.saved_ms : 0;
+    return (int)slot->header.count;
+}
+
+int ble_cache_file_save(ble_cache_file_t *file, const ble_cache_record_t *records, int count) {
+    if (!file || count < 0 || count > BLE_SCANNER_MAX_DEVICES) {
+        return -1;
+    }
+
+    /* Overwrite the other slot: the newest stays valid until this one is */
+    int target = file->newest < 0 ? 0 : (file->newest + 1) % CACHE_FILE_SLOTS;
+    cache_slot_t *slot = &file->slots[target];
+
+    slot->header.magic = 0;  /* Invalid while being written */
+    memcpy(slot->records, records, (size_t)count * sizeof(ble_cache_record_t));
+
+    slot->header.version = CACHE_FILE_VERSION;
+    slot->header.record_size = sizeof(ble_cache_record_t);
+    slot->header.sequence = file->sequence + 1;
+    slot->header.count = (uint32_t)count;
+    slot->header.saved_ms = realtime_ms();
+    slot->header.reserved = 0;
+    slot->header.magic = CACHE_FILE_MAGIC;
+    slot->header.crc = slot_crc(slot);
+
+    /* The page cache outlives the process; this only hurries it to disk */
+    msync(file->slots, CACHE_FILE_SLOTS * sizeof(cache_slot_t), MS_ASYNC);
+
+    file->newest = target;
+    file->sequence = slot->header.sequence;
+    return 0;
+}
+
+void ble_cache_file_close(ble_cache_file_t *file) {
+    if (!file) {
+        return;
+    }
+
+    munmap(file->slots, CACHE_FILE_SLOTS * sizeof(cache_slot_t));
+    close(file->fd);
+    free(file);
+}
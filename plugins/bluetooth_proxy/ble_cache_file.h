@@ -0,0 +1,80 @@
+/**
+ * @file ble_cache_file.h
+ * @brief Memory-mapped snapshot of the BLE device cache
+ *
+ * Lets a restarted or upgraded service report the devices it knew
+ * before without waiting for them to be heard again. The file holds two
+ * fixed-size slots written alternately, each with a sequence number and a
+ * CRC-32; loading picks the newest slot whose checksum matches, so a
+ * crash in the middle of a snapshot leaves the previous one usable.
+ */
+
+#ifndef BLE_CACHE_FILE_H
+#define BLE_CACHE_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ble_scanner.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Device record of a snapshot
+ */
+typedef struct {
+    uint8_t address[BLE_MAC_LEN];
+    uint8_t address_type;
+    int8_t rssi;
+    uint8_t data_len;
+    uint8_t reserved[3];
+    uint32_t age_ms;               /* Time since the device was last heard, at snapshot time */
+    uint8_t data[BLE_ADV_DATA_MAX];
+    uint8_t padding[2];
+} ble_cache_record_t;
+
+/* Snapshot file (opaque) */
+typedef struct ble_cache_file ble_cache_file_t;
+
+/**
+ * Open or create a snapshot file and map it
+ *
+ * @param path File path
+ * @return Snapshot file, or NULL if it cannot be created or mapped
+ */
+ble_cache_file_t *ble_cache_file_open(const char *path);
+
+/**
+ * Load the newest valid snapshot
+ *
+ * @param file Snapshot file
+ * @param records Receives up to BLE_SCANNER_MAX_DEVICES records
+ * @param saved_ago_ms Receives the wall-clock time since the snapshot was written
+ * @return Number of records, or -1 if the file holds no valid snapshot
+ */
+int ble_cache_file_load(ble_cache_file_t *file, ble_cache_record_t *records,
+                        uint64_t *saved_ago_ms);
+
+/**
+ * Write a snapshot into the older slot
+ *
+ * @param file Snapshot file
+ * @param records Records
+ * @param count Number of records (<= BLE_SCANNER_MAX_DEVICES)
+ * @return 0 on success, -1 on error
+ */
+int ble_cache_file_save(ble_cache_file_t *file, const ble_cache_record_t *records, int count);
+
+/**
+ * Unmap and close a snapshot file
+ *
+ * @param file Snapshot file (NULL is ignored)
+ */
+void ble_cache_file_close(ble_cache_file_t *file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_CACHE_FILE_H */
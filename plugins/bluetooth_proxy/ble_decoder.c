@@ -0,0 +1,347 @@
+/**
+ * @file ble_decoder.c
+ * @brief Edge decoding of sensor advertisements
+ */
+
+#include "ble_decoder.h"
+#include "ble_ad.h"
+#include "../../src/include/esphome_proto.h"
+#include <string.h>
+
+/**
+ * Format decoder
+ *
+ * @param id UUID or company ID the entry matched
+ * @param p Payload after the 16-bit UUID/company ID
+ * @param len Length of p
+ * @param out Readings are appended here
+ */
+typedef void (*ble_format_decode_fn)(uint16_t id, const uint8_t *p, size_t len,
+                                     ble_decoded_t *out);
+
+/**
+ * Format table entry
+ */
+typedef struct {
+    const char *format;
+    uint8_t ad_type;            /* BLE_AD_SERVICE_DATA_16 or BLE_AD_MANUFACTURER */
+    bool any_id;                /* Match any UUID/company ID (format keyed by name) */
+    uint16_t id;                /* UUID or company ID */
+    uint8_t min_len;            /* Payload length bounds after the ID */
+    uint8_t max_len;
+    const char *local_name;     /* Required local name, or NULL */
+    ble_format_decode_fn decode;
+} ble_format_t;
+
+static const ble_reading_info_t reading_info[BLE_READING_KIND_COUNT] = {
+    [BLE_READING_TEMPERATURE] = { "temperature", "Temperature", "\xC2\xB0" "C", "temperature", 2, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_HUMIDITY]    = { "humidity", "Humidity", "%", "humidity", 1, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_BATTERY]     = { "battery", "Battery", "%", "battery", 0, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_VOLTAGE]     = { "voltage", "Voltage", "V", "voltage", 3, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_PRESSURE]    = { "pressure", "Pressure", "hPa", "pressure", 2, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_ILLUMINANCE] = { "illuminance", "Illuminance", "lx", "illuminance", 2, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_DEW_POINT]   = { "dew_point", "Dew Point", "\xC2\xB0" "C", "temperature", 2, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_MOISTURE]    = { "moisture", "Moisture", "%", "moisture", 1, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_CO2]         = { "co2", "CO2", "ppm", "carbon_dioxide", 0, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_TVOC]        = { "tvoc", "TVOC", "\xC2\xB5g/m\xC2\xB3", "volatile_organic_compounds", 0, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_PM25]        = { "pm25", "PM2.5", "\xC2\xB5g/m\xC2\xB3", "pm25", 0, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_PM10]        = { "pm10", "PM10", "\xC2\xB5g/m\xC2\xB3", "pm10", 0, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_POWER]       = { "power", "Power", "W", "power", 2, SENSOR_STATE_CLASS_MEASUREMENT },
+    [BLE_READING_ENERGY]      = { "energy", "Energy", "kWh", "energy", 3, SENSOR_STATE_CLASS_TOTAL_INCREASING },
+};
+
+/* -----------------------------------------------------------------
+ * Helpers
+ * ----------------------------------------------------------------- */
+
+static uint16_t le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint16_t be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/**
+ * Append a reading, keeping only the first one of each kind
+ */
+static void add_reading(ble_decoded_t *out, ble_reading_kind_t kind, float value) {
+    for (int i = 0; i < out->count; i++) {
+        if (out->readings[i].kind == kind) {
+            return;
+        }
+    }
+    if (out->count < BLE_DECODER_MAX_READINGS) {
+        out->readings[out->count].kind = kind;
+        out->readings[out->count].value = value;
+        out->count++;
+    }
+}
+
+/* -----------------------------------------------------------------
+ * BTHome v2 (https://bthome.io/format/)
+ * ----------------------------------------------------------------- */
+
+#define BTHOME_KIND_NONE (-1)
+
+/**
+ * BTHome object: fixed size, optionally mapped to a reading
+ */
+typedef struct {
+    uint8_t id;
+    uint8_t len;
+    int8_t kind;                /* ble_reading_kind_t, or BTHOME_KIND_NONE to skip */
+    bool is_signed;
+    float factor;
+} bthome_object_t;
+
+static const bthome_object_t bthome_objects[] = {
+    { 0x00, 1, BTHOME_KIND_NONE, false, 1.0f },             /* packet id */
+    { 0x01, 1, BLE_READING_BATTERY, false, 1.0f },
+    { 0x02, 2, BLE_READING_TEMPERATURE, true, 0.01f },
+    { 0x03, 2, BLE_READING_HUMIDITY, false, 0.01f },
+    { 0x04, 3, BLE_READING_PRESSURE, false, 0.01f },
+    { 0x05, 3, BLE_READING_ILLUMINANCE, false, 0.01f },
+    { 0x06, 2, BTHOME_KIND_NONE, false, 0.01f },            /* mass (kg) */
+    { 0x07, 2, BTHOME_KIND_NONE, false, 0.01f },            /* mass (lb) */
+    { 0x08, 2, BLE_READING_DEW_POINT, true, 0.01f },
+    { 0x09, 1, BTHOME_KIND_NONE, false, 1.0f },             /* count */
+    { 0x0A, 3, BLE_READING_ENERGY, false, 0.001f },
+    { 0x0B, 3, BLE_READING_POWER, false, 0.01f },
+    { 0x0C, 2, BLE_READING_VOLTAGE, false, 0.001f },
+    { 0x0D, 2, BLE_READING_PM25, false, 1.0f },
+    { 0x0E, 2, BLE_READING_PM10, false, 1.0f },
+    { 0x12, 2, BLE_READING_CO2, false, 1.0f },
+    { 0x13, 2, BLE_READING_TVOC, false, 1.0f },
+    { 0x14, 2, BLE_READING_MOISTURE, false, 0.01f },
+    { 0x2E, 1, BLE_READING_HUMIDITY, false, 1.0f },
+    { 0x2F, 1, BLE_READING_MOISTURE, false, 1.0f },
+    { 0x3A, 1, BTHOME_KIND_NONE, false, 1.0f },             /* button event */
+    { 0x3C, 2, BTHOME_KIND_NONE, false, 1.0f },             /* dimmer event */
+    { 0x3D, 2, BTHOME_KIND_NONE, false, 1.0f },             /* count */
+    { 0x3E, 4, BTHOME_KIND_NONE, false, 1.0f },             /* count */
+    { 0x3F, 2, BTHOME_KIND_NONE, true, 0.1f },              /* rotation */
+    { 0x40, 2, BTHOME_KIND_NONE, false, 1.0f },             /* distance (mm) */
+    { 0x41, 2, BTHOME_KIND_NONE, false, 0.1f },             /* distance (m) */
+    { 0x42, 3, BTHOME_KIND_NONE, false, 0.001f },           /* duration */
+    { 0x43, 2, BTHOME_KIND_NONE, false, 0.001f },           /* current */
+    { 0x44, 2, BTHOME_KIND_NONE, false, 0.01f },            /* speed */
+    { 0x45, 2, BLE_READING_TEMPERATURE, true, 0.1f },
+    { 0x46, 1, BTHOME_KIND_NONE, false, 0.1f },             /* UV index */
+    { 0x47, 2, BTHOME_KIND_NONE, false, 0.1f },             /* volume (L) */
+    { 0x48, 2, BTHOME_KIND_NONE, false, 1.0f },             /* volume (mL) */
+    { 0x49, 2, BTHOME_KIND_NONE, false, 0.001f },           /* volume flow */
+    { 0x4A, 2, BLE_READING_VOLTAGE, false, 0.1f },
+    { 0x4B, 3, BTHOME_KIND_NONE, false, 0.001f },           /* gas */
+    { 0x4C, 4, BTHOME_KIND_NONE, false, 0.001f },           /* gas */
+    { 0x4D, 4, BLE_READING_ENERGY, false, 0.001f },
+    { 0x4E, 4, BTHOME_KIND_NONE, false, 0.001f },           /* volume */
+    { 0x4F, 4, BTHOME_KIND_NONE, false, 0.001f },           /* water */
+    { 0x50, 4, BTHOME_KIND_NONE, false, 1.0f },             /* timestamp */
+    { 0x51, 2, BTHOME_KIND_NONE, false, 0.001f },           /* acceleration */
+    { 0x52, 2, BTHOME_KIND_NONE, false, 0.001f },           /* gyroscope */
+};
+
+static const bthome_object_t *bthome_lookup(uint8_t id) {
+    /* 0x0F-0x11 and 0x15-0x2D are one-byte binary sensors */
+    static const bthome_object_t binary = { 0, 1, BTHOME_KIND_NONE, false, 1.0f };
+    if ((id >= 0x0F && id <= 0x11) || (id >= 0x15 && id <= 0x2D)) {
+        return &binary;
+    }
+
+    for (size_t i = 0; i < sizeof(bthome_objects) / sizeof(bthome_objects[0]); i++) {
+        if (bthome_objects[i].id == id) {
+            return &bthome_objects[i];
+        }
+    }
+    return NULL;
+}
+
+static void decode_bthome(uint16_t id, const uint8_t *p, size_t len, ble_decoded_t *out) {
+    (void)id;
+
+    /* Device information: bit 0 encryption, bits 5-7 version */
+    uint8_t info = p[0];
+    if ((info & 0x01) || (info >> 5) != 2) {
+        return;
+    }
+
+    size_t pos = 1;
+    while (pos < len) {
+        const bthome_object_t *obj = bthome_lookup(p[pos]);
+
+        /* Unknown object: its size is unknown too, so stop */
+        if (!obj || pos + 1 + obj->len > len) {
+            return;
+        }
+
+        if (obj->kind != BTHOME_KIND_NONE) {
+            uint32_t raw = 0;
+            for (int i = obj->len - 1; i >= 0; i--) {
+                raw = (raw << 8) | p[pos + 1 + i];
+            }
+
+            int64_t value = raw;
+            if (obj->is_signed && (raw & (1U << (obj->len * 8 - 1)))) {
+                value -= (int64_t)1 << (obj->len * 8);
+            }
+            add_reading(out, (ble_reading_kind_t)obj->kind, (float)value * obj->factor);
+        }
+
+        pos += 1 + obj->len;
+    }
+}
+
+/* -----------------------------------------------------------------
+ * ATC1441 / PVVX custom firmware (LYWSD03MMC and friends)
+ * ----------------------------------------------------------------- */
+
+static void decode_atc(uint16_t id, const uint8_t *p, size_t len, ble_decoded_t *out) {
+    (void)id;
+    (void)len;
+
+    /* MAC[6] (big-endian), temp int16 BE 0.1 C, hum %, batt %, batt mV BE, counter */
+    add_reading(out, BLE_READING_TEMPERATURE, (float)(int16_t)be16(p + 6) * 0.1f);
+    add_reading(out, BLE_READING_HUMIDITY, (float)p[8]);
+    add_reading(out, BLE_READING_BATTERY, (float)p[9]);
+    add_reading(out, BLE_READING_VOLTAGE, (float)be16(p + 10) * 0.001f);
+}
+
+static void decode_pvvx(uint16_t id, const uint8_t *p, size_t len, ble_decoded_t *out) {
+    (void)id;
+    (void)len;
+
+    /* MAC[6] (little-endian), temp int16 0.01 C, hum 0.01 %, batt mV, batt %, counter, flags */
+    add_reading(out, BLE_READING_TEMPERATURE, (float)(int16_t)le16(p + 6) * 0.01f);
+    add_reading(out, BLE_READING_HUMIDITY, (float)le16(p + 8) * 0.01f);
+    add_reading(out, BLE_READING_VOLTAGE, (float)le16(p + 10) * 0.001f);
+    add_reading(out, BLE_READING_BATTERY, (float)p[12]);
+}
+
+/* -----------------------------------------------------------------
+ * Govee
+ * ----------------------------------------------------------------- */
+
+static void decode_govee_h5075(uint16_t id, const uint8_t *p, size_t len, ble_decoded_t *out) {
+    (void)id;
+    (void)len;
+
+    /* 00, temperature and humidity packed in 24 bits (BE, bit 23 = negative), battery */
+    uint32_t packed = ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    bool negative = (packed & 0x800000) != 0;
+    packed &= 0x7FFFFF;
+
+    float temperature = (float)(packed / 1000) / 10.0f;
+    add_reading(out, BLE_READING_TEMPERATURE, negative ? -temperature : temperature);
+    add_reading(out, BLE_READING_HUMIDITY, (float)(packed % 1000) / 10.0f);
+    add_reading(out, BLE_READING_BATTERY, (float)p[4]);
+}
+
+static void decode_govee_h5074(uint16_t id, const uint8_t *p, size_t len, ble_decoded_t *out) {
+    (void)id;
+    (void)len;
+
+    /* 00, temp int16 LE 0.01 C, hum uint16 LE 0.01 %, battery */
+    add_reading(out, BLE_READING_TEMPERATURE, (float)(int16_t)le16(p + 1) * 0.01f);
+    add_reading(out, BLE_READING_HUMIDITY, (float)le16(p + 3) * 0.01f);
+    add_reading(out, BLE_READING_BATTERY, (float)p[5]);
+}
+
+/* -----------------------------------------------------------------
+ * Inkbird IBS-TH / IBS-TH2
+ * ----------------------------------------------------------------- */
+
+static void decode_inkbird(uint16_t id, const uint8_t *p, size_t len, ble_decoded_t *out) {
+    (void)len;
+
+    /* The "company ID" is the temperature (int16 LE 0.01 C), then humidity,
+     * probe type, CRC16, battery % */
+    add_reading(out, BLE_READING_TEMPERATURE, (float)(int16_t)id * 0.01f);
+    add_reading(out, BLE_READING_HUMIDITY, (float)le16(p) * 0.01f);
+    add_reading(out, BLE_READING_BATTERY, (float)p[5]);
+}
+
+static void decode_inkbird_tps(uint16_t id, const uint8_t *p, size_t len, ble_decoded_t *out) {
+    (void)len;
+
+    /* As IBS-TH, without a humidity sensor */
+    add_reading(out, BLE_READING_TEMPERATURE, (float)(int16_t)id * 0.01f);
+    add_reading(out, BLE_READING_BATTERY, (float)p[5]);
+}
+
+/* -----------------------------------------------------------------
+ * Format table
+ * ----------------------------------------------------------------- */
+
+static const ble_format_t formats[] = {
+    { "BTHome",  BLE_AD_SERVICE_DATA_16, false, 0xFCD2, 1, 255, NULL, decode_bthome },
+    { "PVVX",    BLE_AD_SERVICE_DATA_16, false, 0x181A, 15, 15, NULL, decode_pvvx },
+    { "ATC",     BLE_AD_SERVICE_DATA_16, false, 0x181A, 13, 13, NULL, decode_atc },
+    { "Govee",   BLE_AD_MANUFACTURER,    false, 0xEC88, 6, 6, NULL, decode_govee_h5075 },
+    { "Govee",   BLE_AD_MANUFACTURER,    false, 0xEC88, 7, 7, NULL, decode_govee_h5074 },
+    { "Inkbird", BLE_AD_MANUFACTURER,    true,  0,      7, 7, "sps", decode_inkbird },
+    { "Inkbird", BLE_AD_MANUFACTURER,    true,  0,      7, 7, "tps", decode_inkbird_tps },
+};
+
+static bool name_matches(const uint8_t *data, const ble_ad_index_t *index, const char *name) {
+    size_t name_len = strlen(name);
+
+    for (int i = 0; i < index->count; i++) {
+        const ble_ad_field_t *field = &index->fields[i];
+        if ((index->names & (1U << i)) && field->len == name_len &&
+            memcmp(ble_ad_field_data(data, field), name, name_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ble_decode_advertisement(const uint8_t *data, size_t len, ble_decoded_t *out) {
+    ble_ad_index_t index;
+    ble_ad_scan(data, len, &index);
+    return ble_decode_indexed(data, &index, out);
+}
+
+bool ble_decode_indexed(const uint8_t *data, const ble_ad_index_t *index, ble_decoded_t *out) {
+    out->format = NULL;
+    out->count = 0;
+
+    /* Every format lives in service or manufacturer data */
+    if ((index->service_data | index->manufacturer) == 0) {
+        return false;
+    }
+
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        const ble_format_t *format = &formats[f];
+
+        for (int i = 0; i < index->count; i++) {
+            const ble_ad_field_t *field = &index->fields[i];
+            if (field->type != format->ad_type || field->len < 2) {
+                continue;
+            }
+
+            const uint8_t *field_data = ble_ad_field_data(data, field);
+            uint16_t id = le16(field_data);
+            size_t payload_len = (size_t)field->len - 2;
+            if ((!format->any_id && id != format->id) ||
+                payload_len < format->min_len || payload_len > format->max_len) {
+                continue;
+            }
+            if (format->local_name && !name_matches(data, index, format->local_name)) {
+                continue;
+            }
+
+            format->decode(id, field_data + 2, payload_len, out);
+            if (out->count > 0) {
+                out->format = format->format;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+const ble_reading_info_t *ble_reading_info(ble_reading_kind_t kind) {
+    return &reading_info[kind];
+}
@@ -0,0 +1,111 @@
+/**
+ * @file ble_decoder.h
+ * @brief Edge decoding of sensor advertisements
+ *
+ * Parses the advertisement formats of common BLE sensors so their
+ * readings can be published as native sensor entities instead of raw
+ * advertisements:
+ * - BTHome v2 (unencrypted), service data 0xFCD2
+ * - ATC1441 and PVVX custom firmware, service data 0x181A
+ * - Govee H5072/H5075 and H5074, manufacturer data 0xEC88
+ * - Inkbird IBS-TH/IBS-TH2 ("sps"/"tps"), manufacturer data
+ *
+ * Formats are matched through a table keyed by AD type and UUID or
+ * company ID; adding a format is one table entry and one decode function.
+ */
+
+#ifndef BLE_DECODER_H
+#define BLE_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "ble_ad.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum readings decoded from one advertisement */
+#define BLE_DECODER_MAX_READINGS 8
+
+/**
+ * Kinds of readings, one sensor entity each
+ */
+typedef enum {
+    BLE_READING_TEMPERATURE = 0,
+    BLE_READING_HUMIDITY,
+    BLE_READING_BATTERY,
+    BLE_READING_VOLTAGE,
+    BLE_READING_PRESSURE,
+    BLE_READING_ILLUMINANCE,
+    BLE_READING_DEW_POINT,
+    BLE_READING_MOISTURE,
+    BLE_READING_CO2,
+    BLE_READING_TVOC,
+    BLE_READING_PM25,
+    BLE_READING_PM10,
+    BLE_READING_POWER,
+    BLE_READING_ENERGY,
+    BLE_READING_KIND_COUNT
+} ble_reading_kind_t;
+
+/**
+ * Entity metadata of a reading kind
+ */
+typedef struct {
+    const char *id;             /* object_id suffix */
+    const char *name;           /* Entity name suffix */
+    const char *unit;           /* Unit of measurement */
+    const char *device_class;   /* Home Assistant device class */
+    int accuracy_decimals;
+    uint32_t state_class;       /* SENSOR_STATE_CLASS_* */
+} ble_reading_info_t;
+
+typedef struct {
+    ble_reading_kind_t kind;
+    float value;
+} ble_reading_t;
+
+/**
+ * Result of decoding one advertisement
+ */
+typedef struct {
+    const char *format;         /* Format name, e.g. "BTHome" (static string) */
+    ble_reading_t readings[BLE_DECODER_MAX_READINGS];
+    int count;
+} ble_decoded_t;
+
+/**
+ * Decode an advertisement
+ *
+ * @param data Advertisement data (AD structures, advertisement + scan response)
+ * @param len Length of data
+ * @param out Receives the format and readings (first reading of each kind)
+ * @return true if a known format produced at least one reading
+ */
+bool ble_decode_advertisement(const uint8_t *data, size_t len, ble_decoded_t *out);
+
+/**
+ * Decode an advertisement already indexed with ble_ad_scan()
+ *
+ * @param data Advertisement data the index was built from
+ * @param index Index of data
+ * @param out Receives the format and readings
+ * @return true if a known format produced at least one reading
+ */
+bool ble_decode_indexed(const uint8_t *data, const ble_ad_index_t *index, ble_decoded_t *out);
+
+/**
+ * Get the entity metadata of a reading kind
+ *
+ * @param kind Reading kind
+ * @return Metadata (static)
+ */
+const ble_reading_info_t *ble_reading_info(ble_reading_kind_t kind);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_DECODER_H */
@@ -0,0 +1,164 @@
+/**
+ * @file ble_feed.h
+ * @brief Shared-memory advertisement feed: layout and client library
+ *
+ * The scanner publishes every advertisement it processes into a ring in
+ * POSIX shared memory, so other daemons on the same host can follow the
+ * radio without opening their own HCI socket. There is one writer and
+ * any number of readers; readers map the ring read-only and never block
+ * the writer.
+ *
+ * Readers blocked in ble_feed_reader_wait() count themselves in the
+ * header's waiters word, and the writer issues a futex wake only while it
+ * is non-zero. Updating it needs write access to the object; a reader
+ * without it polls every BLE_FEED_POLL_MS instead. A reader killed while
+ * waiting leaves the count raised, which only costs the writer wakes.
+ *
+ * Each record carries the sequence number of the advertisement it holds.
+ * The writer zeroes it, fills the record, then stores the new sequence; a
+ * reader accepts a record only if its sequence is the expected one both
+ * before and after reading it. A reader that falls more than a ring
+ * behind skips ahead and counts the advertisements it lost.
+ *
+ * Shared words are 32 bits wide: 64-bit atomics are library calls on
+ * 32-bit MIPS, and libatomic's fallback lock does not work across
+ * processes. Sequences wrap around and skip 0; compare them with
+ * ble_feed_seq_after().
+ *
+ * This header is self-contained so it can be installed for out-of-tree
+ * readers (link with the esphome-ble-feed library).
+ */
+
+#ifndef BLE_FEED_H
+#define BLE_FEED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BLE_FEED_MAGIC        0x464C4245u  /* "EBLF" */
+#define BLE_FEED_VERSION      3
+#define BLE_FEED_DATA_MAX     62           /* Advertisement + scan response */
+#define BLE_FEED_DEFAULT_NAME "/esphome-linux-ble-feed"  /* Suggested name; the feed is opt-in */
+#define BLE_FEED_POLL_MS      10           /* Wait granularity of readers that cannot count as waiters */
+
+/**
+ * Ring header, at offset 0 of the shared memory object
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;          /* sizeof(ble_feed_record_t) */
+    uint32_t slot_count;           /* Power of two */
+    uint32_t writer_pid;
+    uint32_t head;                 /* Sequence of the newest record (0 = none yet) */
+    uint32_t head_futex;           /* Changed on every publish and on close */
+    uint32_t closed;               /* Set when the writer shuts down */
+    uint32_t waiters;              /* Readers sleeping on head_futex; wakes are skipped at 0 */
+    uint8_t reserved[32];
+} ble_feed_header_t;
+
+/**
+ * Advertisement record; record n lives in slot n & (slot_count - 1)
+ */
+typedef struct {
+    uint32_t sequence;             /* 0 while being written */
+    uint32_t data_hash;            /* Payload hash, equal payloads hash equal */
+    uint64_t timestamp_ns;         /* CLOCK_MONOTONIC when processed */
+    uint8_t address[6];            /* MAC address, most significant byte first */
+    uint8_t address_type;          /* 0=public, 1=random */
+    int8_t rssi;                   /* dBm */
+    uint8_t data_len;
+    uint8_t data[BLE_FEED_DATA_MAX];
+    uint8_t reserved[9];
+} ble_feed_record_t;
+
+/**
+ * Sequence that follows a (wraps around, skipping 0)
+ */
+static inline uint32_t ble_feed_seq_next(uint32_t a) {
+    return a + 1 ? a + 1 : 1;
+}
+
+/**
+ * Check whether sequence a is newer than b (wrap-safe)
+ */
+static inline bool ble_feed_seq_after(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+/* Feed reader (opaque) */
+typedef struct ble_feed_reader ble_feed_reader_t;
+
+/**
+ * Map a feed for reading
+ *
+ * Reading starts at the newest record; older records are skipped.
+ *
+ * @param name Shared memory object name (e.g. BLE_FEED_DEFAULT_NAME)
+ * @return Reader, or NULL if the feed does not exist or is incompatible
+ */
+ble_feed_reader_t *ble_feed_reader_open(const char *name);
+
+/**
+ * Copy the next record
+ *
+ * @param reader Reader
+ * @param record Receives the record
+ * @return 1 if a record was read, 0 if none is available, -1 if the
+ *         writer has shut down (reopen the feed)
+ */
+int ble_feed_reader_next(ble_feed_reader_t *reader, ble_feed_record_t *record);
+
+/**
+ * Access the next record in place (zero-copy)
+ *
+ * The record may be overwritten while it is read: use its contents only
+ * once ble_feed_reader_release() confirms it was intact.
+ *
+ * @param reader Reader
+ * @return Record in the shared ring, or NULL if none is available
+ */
+const ble_feed_record_t *ble_feed_reader_peek(ble_feed_reader_t *reader);
+
+/**
+ * Finish with the record returned by ble_feed_reader_peek()
+ *
+ * @param reader Reader
+ * @return true if the record was not overwritten while it was used
+ */
+bool ble_feed_reader_release(ble_feed_reader_t *reader);
+
+/**
+ * Wait for a record to become available
+ *
+ * @param reader Reader
+ * @param timeout_ms Maximum wait (-1 = forever)
+ * @return 1 if a record is available, 0 on timeout, -1 if the writer
+ *         has shut down or exited
+ */
+int ble_feed_reader_wait(ble_feed_reader_t *reader, int timeout_ms);
+
+/**
+ * Get the number of records overwritten before this reader got to them
+ *
+ * @param reader Reader
+ * @return Lost records since the reader was opened
+ */
+uint64_t ble_feed_reader_lost(const ble_feed_reader_t *reader);
+
+/**
+ * Unmap a feed
+ *
+ * @param reader Reader (NULL is ignored)
+ */
+void ble_feed_reader_close(ble_feed_reader_t *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_FEED_H */
@@ -0,0 +1,242 @@
+/**
+ * @file ble_feed_client.c
+ * @brief Shared-memory advertisement feed reader
+ */
+
+#include "ble_feed.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+struct ble_feed_reader {
+    const ble_feed_header_t *header;
+    ble_feed_header_t *header_rw;  /* Writable mapping of the header (waiters only), NULL if none */
+    const ble_feed_record_t *records;
+    size_t map_size;
+    uint32_t mask;
+    uint32_t next;                 /* Sequence of the next record to read */
+    uint64_t lost;
+    const ble_feed_record_t *peeked;
+};
+
+ble_feed_reader_t *ble_feed_reader_open(const char *name) {
+    /* Write access is only used for the waiters word of the header */
+    bool writable = true;
+    int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0 && errno == EACCES) {
+        writable = false;
+        fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ble_feed_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    void *header_rw = MAP_FAILED;
+    if (map != MAP_FAILED && writable) {
+        header_rw = mmap(NULL, sizeof(ble_feed_header_t), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const ble_feed_header_t *header = (const ble_feed_header_t *)map;
+    uint32_t slots = header->slot_count;
+    if (header->magic != BLE_FEED_MAGIC || header->version != BLE_FEED_VERSION ||
+        header->record_size != sizeof(ble_feed_record_t) || slots == 0 ||
+        (slots & (slots - 1)) != 0 ||
+        size < sizeof(ble_feed_header_t) + (size_t)slots * sizeof(ble_feed_record_t)) {
+        if (header_rw != MAP_FAILED) {
+            munmap(header_rw, sizeof(ble_feed_header_t));
+        }
+        munmap(map, size);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    ble_feed_reader_t *reader = calloc(1, sizeof(*reader));
+    if (!reader) {
+        if (header_rw != MAP_FAILED) {
+            munmap(header_rw, sizeof(ble_feed_header_t));
+        }
+        munmap(map, size);
+        return NULL;
+    }
+
+    reader->header = header;
+    if (header_rw != MAP_FAILED) {
+        reader->header_rw = (ble_feed_header_t *)header_rw;
+    }
+    reader->records = (const ble_feed_record_t *)(header + 1);
+    reader->map_size = size;
+    reader->mask = slots - 1;
+    reader->next = ble_feed_seq_next(__atomic_load_n(&header->head, __ATOMIC_ACQUIRE));
+    return reader;
+}
+
+const ble_feed_record_t *ble_feed_reader_peek(ble_feed_reader_t *reader) {
+    uint32_t head = __atomic_load_n(&reader->header->head, __ATOMIC_ACQUIRE);
+
+    if (ble_feed_seq_after(reader->next, head)) {
+        return NULL;
+    }
+
+    /* Fell a ring behind: the older records are gone */
+    if (head - reader->next > reader->mask) {
+        uint32_t oldest = head - reader->mask;
+        reader->lost += oldest - reader->next;
+        reader->next = oldest ? oldest : 1;
+    }
+
+    const ble_feed_record_t *record = &reader->records[reader->next & reader->mask];
+    if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != reader->next) {
+        /* Already overwritten (or being written): retry from the new head */
+        reader->lost++;
+        reader->next = ble_feed_seq_next(reader->next);
+        return NULL;
+    }
+
+    reader->peeked = record;
+    return record;
+}
+
+bool ble_feed_reader_release(ble_feed_reader_t *reader) {
+    const ble_feed_record_t *record = reader->peeked;
+    if (!record) {
+        return false;
+    }
+
+    /* Order the reads of the record before the sequence re-check */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    bool intact = __atomic_load_n(&record->sequence, __ATOMIC_RELAXED) == reader->next;
+
+    if (!intact) {
+        reader->lost++;
+    }
+    reader->next = ble_feed_seq_next(reader->next);
+    reader->peeked = NULL;
+    return intact;
+}
+
+int ble_feed_reader_next(ble_feed_reader_t *reader, ble_feed_record_t *record) {
+    for (;;) {
+        const ble_feed_record_t *slot = ble_feed_reader_peek(reader);
+        if (!slot) {
+            if (!ble_feed_seq_after(reader->next,
+                                    __atomic_load_n(&reader->header->head, __ATOMIC_ACQUIRE))) {
+                continue;  /* Skipped an overwritten record, more are available */
+            }
+            return __atomic_load_n(&reader->header->closed, __ATOMIC_ACQUIRE) ? -1 : 0;
+        }
+
+        memcpy(record, slot, sizeof(*record));
+        if (ble_feed_reader_release(reader)) {
+            return 1;
+        }
+    }
+}
+
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Check for a record, or the end of the feed, before going to sleep
+ *
+ * @return 1 if a record is available, -1 if the writer is gone, 0 otherwise
+ */
+static int reader_ready(const ble_feed_reader_t *reader) {
+    const ble_feed_header_t *header = reader->header;
+
+    if (!ble_feed_seq_after(reader->next, __atomic_load_n(&header->head, __ATOMIC_SEQ_CST))) {
+        return 1;
+    }
+    if (__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE) ||
+        (kill((pid_t)header->writer_pid, 0) < 0 && errno == ESRCH)) {
+        return -1;
+    }
+    return 0;
+}
+
+int ble_feed_reader_wait(ble_feed_reader_t *reader, int timeout_ms) {
+    const ble_feed_header_t *header = reader->header;
+    int64_t deadline = monotonic_ms() + timeout_ms;
+    int ret;
+
+    /* Counted before the checks below: the writer skips the wake at 0 */
+    if (reader->header_rw) {
+        __atomic_add_fetch(&reader->header_rw->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+
+    for (;;) {
+        uint32_t futex = __atomic_load_n(&header->head_futex, __ATOMIC_SEQ_CST);
+
+        ret = reader_ready(reader);
+        if (ret != 0) {
+            break;
+        }
+
+        int64_t sleep_ms = -1;
+        if (timeout_ms >= 0) {
+            sleep_ms = deadline - monotonic_ms();
+            if (sleep_ms <= 0) {
+                break;
+            }
+        }
+        /* Not counted as a waiter: nobody wakes this reader */
+        if (!reader->header_rw && (sleep_ms < 0 || sleep_ms > BLE_FEED_POLL_MS)) {
+            sleep_ms = BLE_FEED_POLL_MS;
+        }
+
+        struct timespec ts;
+        if (sleep_ms >= 0) {
+            ts.tv_sec = (time_t)(sleep_ms / 1000);
+            ts.tv_nsec = (long)(sleep_ms % 1000) * 1000000;
+        }
+
+        /* Sleep until the writer publishes (shared futex: works on the read-only mapping);
+         * wake-ups, EAGAIN and EINTR all lead back to the checks above */
+        syscall(SYS_futex, &header->head_futex, FUTEX_WAIT, futex,
+                sleep_ms < 0 ? NULL : &ts, NULL, 0);
+    }
+
+    if (reader->header_rw) {
+        __atomic_sub_fetch(&reader->header_rw->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+    return ret;
+}
+
+uint64_t ble_feed_reader_lost(const ble_feed_reader_t *reader) {
+    return reader->lost;
+}
+
+void ble_feed_reader_close(ble_feed_reader_t *reader) {
+    if (!reader) {
+        return;
+    }
+
+    if (reader->header_rw) {
+        munmap(reader->header_rw, sizeof(ble_feed_header_t));
+    }
+    munmap((void *)reader->header, reader->map_size);
+    free(reader);
+}
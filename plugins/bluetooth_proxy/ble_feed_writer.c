@@ -0,0 +1,187 @@
+/**
+ * @file ble_feed_writer.c
+ * @brief Shared-memory advertisement feed writer
+ */
+
+#include "ble_feed_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define LOG_PREFIX "[ble-feed] "
+
+/* Largest ring accepted (6 MB of records) */
+#define FEED_MAX_SLOTS 65536
+
+struct ble_feed_writer {
+    char *name;
+    ble_feed_header_t *header;
+    ble_feed_record_t *records;
+    size_t map_size;
+    uint32_t mask;
+    uint32_t head;                 /* Writer-private copy of header->head */
+};
+
+static uint32_t round_up_pow2(uint32_t value) {
+    uint32_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+/**
+ * Check whether an existing object is a feed left behind by a dead writer
+ *
+ * Anything else (a live writer, or an object that is not a feed) is not
+ * ours to remove.
+ */
+static bool feed_is_stale(const char *name) {
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ble_feed_header_t)) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, sizeof(ble_feed_header_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const ble_feed_header_t *header = (const ble_feed_header_t *)map;
+    bool stale = false;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == BLE_FEED_MAGIC) {
+        pid_t pid = (pid_t)header->writer_pid;
+        stale = __atomic_load_n(&header->closed, __ATOMIC_ACQUIRE) ||
+                (kill(pid, 0) < 0 && errno == ESRCH);
+        if (!stale) {
+            fprintf(stderr, LOG_PREFIX "%s is in use by process %d\n", name, (int)pid);
+        }
+    } else {
+        fprintf(stderr, LOG_PREFIX "%s exists and is not an advertisement feed\n", name);
+    }
+
+    munmap(map, sizeof(ble_feed_header_t));
+    return stale;
+}
+
+ble_feed_writer_t *ble_feed_writer_create(const char *name, uint32_t slots) {
+    if (slots < 2) {
+        slots = 2;
+    } else if (slots > FEED_MAX_SLOTS) {
+        slots = FEED_MAX_SLOTS;
+    }
+    slots = round_up_pow2(slots);
+
+    size_t size = sizeof(ble_feed_header_t) + (size_t)slots * sizeof(ble_feed_record_t);
+
+    /* Never take over another instance's feed; only the object of a
+     * crashed writer is replaced */
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == EEXIST && feed_is_stale(name)) {
+        fprintf(stderr, LOG_PREFIX "Replacing %s left behind by a stopped writer\n", name);
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        fprintf(stderr, LOG_PREFIX "Cannot create %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    if (ftruncate(fd, (off_t)size) < 0) {
+        fprintf(stderr, LOG_PREFIX "Cannot size %s: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, LOG_PREFIX "Cannot map %s: %s\n", name, strerror(errno));
+        shm_unlink(name);
+        return NULL;
+    }
+
+    ble_feed_writer_t *writer = calloc(1, sizeof(*writer));
+    if (!writer || !(writer->name = strdup(name))) {
+        free(writer);
+        munmap(map, size);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    writer->header = (ble_feed_header_t *)map;
+    writer->records = (ble_feed_record_t *)(writer->header + 1);
+    writer->map_size = size;
+    writer->mask = slots - 1;
+
+    /* The object is zero-filled; the magic goes in last so readers never see a partial header */
+    writer->header->version = BLE_FEED_VERSION;
+    writer->header->record_size = sizeof(ble_feed_record_t);
+    writer->header->slot_count = slots;
+    writer->header->writer_pid = (uint32_t)getpid();
+    __atomic_store_n(&writer->header->magic, BLE_FEED_MAGIC, __ATOMIC_RELEASE);
+
+    printf(LOG_PREFIX "Publishing advertisements to %s (%u records)\n", name, slots);
+    return writer;
+}
+
+void ble_feed_writer_publish(ble_feed_writer_t *writer, const ble_advertisement_t *advert,
+                             uint64_t timestamp_ns) {
+    uint32_t sequence = writer->head = ble_feed_seq_next(writer->head);
+    ble_feed_record_t *record = &writer->records[sequence & writer->mask];
+
+    /* Invalidate the slot before its contents change (readers re-check the sequence) */
+    __atomic_store_n(&record->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->timestamp_ns = timestamp_ns;
+    record->data_hash = advert->data_hash;
+    memcpy(record->address, advert->address, sizeof(record->address));
+    record->address_type = advert->address_type;
+    record->rssi = advert->rssi;
+    record->data_len = (uint8_t)advert->data_len;
+    memcpy(record->data, advert->data, advert->data_len);
+
+    __atomic_store_n(&record->sequence, sequence, __ATOMIC_RELEASE);
+    __atomic_store_n(&writer->header->head, sequence, __ATOMIC_RELEASE);
+
+    /* Wake readers blocked in ble_feed_reader_wait(), if there are any: a
+     * reader counts itself before its last check of head, so either it sees
+     * this sequence or this load sees it */
+    __atomic_store_n(&writer->header->head_futex, sequence, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&writer->header->waiters, __ATOMIC_SEQ_CST) != 0) {
+        syscall(SYS_futex, &writer->header->head_futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+void ble_feed_writer_close(ble_feed_writer_t *writer) {
+    if (!writer) {
+        return;
+    }
+
+    __atomic_store_n(&writer->header->closed, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&writer->header->head_futex, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &writer->header->head_futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    munmap(writer->header, writer->map_size);
+    shm_unlink(writer->name);
+    free(writer->name);
+    free(writer);
+}
@@ -0,0 +1,58 @@
+/**
+ * @file ble_feed_writer.h
+ * @brief Shared-memory advertisement feed writer (see ble_feed.h)
+ */
+
+#ifndef BLE_FEED_WRITER_H
+#define BLE_FEED_WRITER_H
+
+#include <stdint.h>
+#include "ble_feed.h"
+#include "ble_scanner.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default ring size (rounded up to a power of two) */
+#define BLE_FEED_DEFAULT_SLOTS 1024
+
+/* Feed writer (opaque) */
+typedef struct ble_feed_writer ble_feed_writer_t;
+
+/**
+ * Create the shared memory object and initialize the ring
+ *
+ * An object left behind by a previous writer is replaced; its readers see
+ * it as shut down.
+ *
+ * @param name Shared memory object name (leading '/')
+ * @param slots Ring size in records (rounded up to a power of two)
+ * @return Writer, or NULL on error
+ */
+ble_feed_writer_t *ble_feed_writer_create(const char *name, uint32_t slots);
+
+/**
+ * Publish an advertisement
+ *
+ * Never blocks. Must only be called from one thread at a time.
+ *
+ * @param writer Writer
+ * @param advert Advertisement (data_hash must be set)
+ * @param timestamp_ns CLOCK_MONOTONIC time the advertisement was processed
+ */
+void ble_feed_writer_publish(ble_feed_writer_t *writer, const ble_advertisement_t *advert,
+                             uint64_t timestamp_ns);
+
+/**
+ * Mark the feed shut down, wake readers and remove the object
+ *
+ * @param writer Writer (NULL is ignored)
+ */
+void ble_feed_writer_close(ble_feed_writer_t *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_FEED_WRITER_H */
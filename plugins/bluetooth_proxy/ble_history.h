@@ -0,0 +1,162 @@
+/**
+ * @file ble_history.h
+ * @brief Advertisement history log: layout and query library
+ *
+ * The scanner appends a compact record per device and interval to a ring
+ * in a memory-mapped file of fixed size, so "the device dropped off"
+ * reports can be checked against what was actually heard, and when. The
+ * file survives restarts; records carry wall-clock time.
+ *
+ * Each record links to the previous record of the same device, and a
+ * hash index keyed by MAC address points at each device's newest record.
+ * A query follows one device's chain backwards and never scans the ring.
+ * The scanner thread is the only writer and takes no locks: records and
+ * index entries are invalidated (sequence 0) while they change, and
+ * readers check the sequence before and after reading, as in ble_feed.h.
+ * Sequences are 32 bits wide for the same reason as there (no 64-bit
+ * atomics on 32-bit MIPS); they wrap around and skip 0.
+ *
+ * This header is self-contained so it can be installed for out-of-tree
+ * readers (link with the esphome-ble-history library).
+ */
+
+#ifndef BLE_HISTORY_H
+#define BLE_HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BLE_HISTORY_MAGIC       0x48484245u  /* "EBHH" */
+#define BLE_HISTORY_VERSION     2
+#define BLE_HISTORY_INDEX_SIZE  8192         /* Index entries, power of two */
+#define BLE_HISTORY_INDEX_PROBE 16           /* Entries searched per lookup */
+
+/**
+ * File header, at offset 0; the index and then the records follow
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;          /* sizeof(ble_history_record_t) */
+    uint32_t record_count;         /* Power of two */
+    uint32_t index_size;           /* BLE_HISTORY_INDEX_SIZE */
+    uint32_t head;                 /* Sequence of the newest record (0 = none yet) */
+    uint32_t writer_pid;
+    uint8_t reserved[40];
+} ble_history_header_t;
+
+/**
+ * Index entry of a device
+ */
+typedef struct {
+    uint32_t newest;               /* Sequence of the device's newest record, 0 while changing */
+    uint8_t address[6];
+    uint8_t reserved[2];
+} ble_history_index_entry_t;
+
+/**
+ * Advertisement record; record n lives in slot n & (record_count - 1)
+ */
+typedef struct {
+    uint32_t sequence;             /* 0 while being written */
+    uint32_t previous;             /* Sequence of the device's previous record, 0 = none */
+    uint64_t time_ms;              /* CLOCK_REALTIME */
+    uint32_t data_hash;            /* Payload hash, equal payloads hash equal */
+    uint8_t address[6];            /* MAC address, most significant byte first */
+    uint8_t address_type;          /* 0=public, 1=random */
+    int8_t rssi;                   /* dBm */
+    uint8_t data_len;
+    uint8_t reserved[3];
+} ble_history_record_t;
+
+/**
+ * Device known to the index
+ */
+typedef struct {
+    uint8_t address[6];
+    uint64_t last_ms;              /* Time of its newest record */
+    int8_t rssi;                   /* RSSI of its newest record */
+} ble_history_device_t;
+
+/**
+ * Sequence that follows a (wraps around, skipping 0)
+ */
+static inline uint32_t ble_history_seq_next(uint32_t a) {
+    return a + 1 ? a + 1 : 1;
+}
+
+/**
+ * Check whether sequence a is newer than b (wrap-safe)
+ */
+static inline bool ble_history_seq_after(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+/**
+ * Check whether a record is still in the ring, given the newest sequence
+ */
+static inline bool ble_history_seq_alive(uint32_t sequence, uint32_t head, uint32_t record_count) {
+    return sequence != 0 && head - sequence < record_count;
+}
+
+/**
+ * First index entry to probe for a device (FNV-1a of the address)
+ */
+static inline uint32_t ble_history_index_slot(const uint8_t *address) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 6; i++) {
+        hash = (hash ^ address[i]) * 16777619u;
+    }
+    return hash & (BLE_HISTORY_INDEX_SIZE - 1);
+}
+
+/* History reader (opaque) */
+typedef struct ble_history_reader ble_history_reader_t;
+
+/**
+ * Map a history file for reading
+ *
+ * @param path File path
+ * @return Reader, or NULL if the file does not exist or is incompatible
+ */
+ble_history_reader_t *ble_history_open(const char *path);
+
+/**
+ * Get the records of one device, newest first
+ *
+ * @param reader Reader
+ * @param address MAC address, most significant byte first
+ * @param since_ms Oldest record time to return (CLOCK_REALTIME ms)
+ * @param records Receives the records
+ * @param max Size of records
+ * @return Number of records
+ */
+int ble_history_query(ble_history_reader_t *reader, const uint8_t *address, uint64_t since_ms,
+                      ble_history_record_t *records, int max);
+
+/**
+ * List the devices whose newest record is still in the ring
+ *
+ * @param reader Reader
+ * @param devices Receives the devices, in index order
+ * @param max Size of devices
+ * @return Number of devices
+ */
+int ble_history_devices(ble_history_reader_t *reader, ble_history_device_t *devices, int max);
+
+/**
+ * Unmap a history file
+ *
+ * @param reader Reader (NULL is ignored)
+ */
+void ble_history_close(ble_history_reader_t *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_HISTORY_H */
@@ -0,0 +1,160 @@
+/**
+ * @file ble_history_client.c
+ * @brief Advertisement history log reader
+ */
+
+#include "ble_history.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct ble_history_reader {
+    const ble_history_header_t *header;
+    const ble_history_index_entry_t *index;
+    const ble_history_record_t *records;
+    size_t map_size;
+    uint32_t record_count;
+};
+
+ble_history_reader_t *ble_history_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ble_history_header_t)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const ble_history_header_t *header = (const ble_history_header_t *)map;
+    uint32_t count = header->record_count;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != BLE_HISTORY_MAGIC ||
+        header->version != BLE_HISTORY_VERSION ||
+        header->record_size != sizeof(ble_history_record_t) ||
+        header->index_size != BLE_HISTORY_INDEX_SIZE || count == 0 || (count & (count - 1)) != 0 ||
+        size < sizeof(ble_history_header_t) +
+               BLE_HISTORY_INDEX_SIZE * sizeof(ble_history_index_entry_t) +
+               (size_t)count * sizeof(ble_history_record_t)) {
+        munmap(map, size);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    ble_history_reader_t *reader = calloc(1, sizeof(*reader));
+    if (!reader) {
+        munmap(map, size);
+        return NULL;
+    }
+
+    reader->header = header;
+    reader->index = (const ble_history_index_entry_t *)(header + 1);
+    reader->records = (const ble_history_record_t *)(reader->index + BLE_HISTORY_INDEX_SIZE);
+    reader->map_size = size;
+    reader->record_count = count;
+    return reader;
+}
+
+/**
+ * Copy a record if it still holds the given sequence
+ */
+static bool read_record(const ble_history_reader_t *reader, uint32_t sequence,
+                        ble_history_record_t *record) {
+    uint32_t head = __atomic_load_n(&reader->header->head, __ATOMIC_ACQUIRE);
+    if (!ble_history_seq_alive(sequence, head, reader->record_count)) {
+        return false;
+    }
+
+    const ble_history_record_t *slot = &reader->records[sequence & (reader->record_count - 1)];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != sequence) {
+        return false;
+    }
+    memcpy(record, slot, sizeof(*record));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence;
+}
+
+/**
+ * Read an index entry consistently
+ *
+ * @return Sequence of the entry's newest record, 0 if free or changing
+ */
+static uint32_t read_entry(const ble_history_index_entry_t *entry, uint8_t *address) {
+    uint32_t newest = __atomic_load_n(&entry->newest, __ATOMIC_ACQUIRE);
+    if (newest == 0) {
+        return 0;
+    }
+    memcpy(address, entry->address, 6);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&entry->newest, __ATOMIC_RELAXED) == newest ? newest : 0;
+}
+
+int ble_history_query(ble_history_reader_t *reader, const uint8_t *address, uint64_t since_ms,
+                      ble_history_record_t *records, int max) {
+    uint32_t slot = ble_history_index_slot(address);
+    uint32_t sequence = 0;
+
+    for (int i = 0; i < BLE_HISTORY_INDEX_PROBE && sequence == 0; i++) {
+        uint8_t entry_address[6];
+        uint32_t newest = read_entry(&reader->index[(slot + i) & (BLE_HISTORY_INDEX_SIZE - 1)],
+                                     entry_address);
+        if (newest != 0 && memcmp(entry_address, address, 6) == 0) {
+            sequence = newest;
+        }
+    }
+
+    /* Follow the device's chain until it leaves the time range or the ring */
+    int count = 0;
+    while (count < max && read_record(reader, sequence, &records[count])) {
+        const ble_history_record_t *record = &records[count];
+        if (memcmp(record->address, address, 6) != 0 || record->time_ms < since_ms) {
+            break;
+        }
+        count++;
+        if (!ble_history_seq_after(sequence, record->previous)) {
+            break;
+        }
+        sequence = record->previous;
+    }
+    return count;
+}
+
+int ble_history_devices(ble_history_reader_t *reader, ble_history_device_t *devices, int max) {
+    int count = 0;
+
+    for (uint32_t i = 0; i < BLE_HISTORY_INDEX_SIZE && count < max; i++) {
+        ble_history_device_t *device = &devices[count];
+        ble_history_record_t record;
+
+        uint32_t newest = read_entry(&reader->index[i], device->address);
+        if (!read_record(reader, newest, &record) ||
+            memcmp(record.address, device->address, 6) != 0) {
+            continue;
+        }
+        device->last_ms = record.time_ms;
+        device->rssi = record.rssi;
+        count++;
+    }
+    return count;
+}
+
+void ble_history_close(ble_history_reader_t *reader) {
+    if (!reader) {
+        return;
+    }
+
+    munmap((void *)reader->header, reader->map_size);
+    free(reader);
+}
@@ -0,0 +1,212 @@
+/**
+ * @file ble_history_writer.c
+ * @brief Advertisement history log writer
+ */
+
+#include "ble_history_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOG_PREFIX "[ble-history] "
+
+/* Smallest ring accepted */
+#define HISTORY_MIN_RECORDS 1024
+
+struct ble_history_writer {
+    int fd;
+    ble_history_header_t *header;
+    ble_history_index_entry_t *index;
+    ble_history_record_t *records;
+    size_t map_size;
+    uint32_t record_count;
+    uint32_t head;                 /* Writer-private copy of header->head */
+    uint32_t interval_ms;
+};
+
+static uint64_t realtime_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t round_down_pow2(uint64_t value) {
+    uint32_t result = 1;
+    while ((uint64_t)result * 2 <= value && result < 0x80000000u) {
+        result <<= 1;
+    }
+    return result;
+}
+
+static bool header_matches(const ble_history_header_t *header, uint32_t record_count) {
+    return header->magic == BLE_HISTORY_MAGIC && header->version == BLE_HISTORY_VERSION &&
+           header->record_size == sizeof(ble_history_record_t) &&
+           header->record_count == record_count && header->index_size == BLE_HISTORY_INDEX_SIZE;
+}
+
+ble_history_writer_t *ble_history_writer_open(const char *path, size_t size,
+                                              uint32_t interval_ms) {
+    size_t fixed = sizeof(ble_history_header_t) +
+                   BLE_HISTORY_INDEX_SIZE * sizeof(ble_history_index_entry_t);
+    size_t min_size = fixed + HISTORY_MIN_RECORDS * sizeof(ble_history_record_t);
+    if (size < min_size) {
+        size = min_size;
+    }
+
+    uint32_t record_count = round_down_pow2((size - fixed) / sizeof(ble_history_record_t));
+    size = fixed + (size_t)record_count * sizeof(ble_history_record_t);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        fprintf(stderr, LOG_PREFIX "Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || ((size_t)st.st_size != size && ftruncate(fd, (off_t)size) < 0)) {
+        fprintf(stderr, LOG_PREFIX "Cannot size %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, LOG_PREFIX "Cannot map %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    ble_history_writer_t *writer = calloc(1, sizeof(*writer));
+    if (!writer) {
+        munmap(map, size);
+        close(fd);
+        return NULL;
+    }
+
+    writer->fd = fd;
+    writer->header = (ble_history_header_t *)map;
+    writer->index = (ble_history_index_entry_t *)(writer->header + 1);
+    writer->records = (ble_history_record_t *)(writer->index + BLE_HISTORY_INDEX_SIZE);
+    writer->map_size = size;
+    writer->record_count = record_count;
+    writer->interval_ms = interval_ms;
+
+    if (header_matches(writer->header, record_count)) {
+        writer->head = writer->header->head;
+        printf(LOG_PREFIX "Continuing %s (%u records, sequence %u)\n", path,
+               record_count, writer->head);
+    } else {
+        /* Another layout or size: start an empty log, the magic goes in last */
+        __atomic_store_n(&writer->header->magic, 0, __ATOMIC_RELEASE);
+        memset(map, 0, size);
+        writer->header->version = BLE_HISTORY_VERSION;
+        writer->header->record_size = sizeof(ble_history_record_t);
+        writer->header->record_count = record_count;
+        writer->header->index_size = BLE_HISTORY_INDEX_SIZE;
+        __atomic_store_n(&writer->header->magic, BLE_HISTORY_MAGIC, __ATOMIC_RELEASE);
+        printf(LOG_PREFIX "Logging advertisements to %s (%u records)\n", path, record_count);
+    }
+    writer->header->writer_pid = (uint32_t)getpid();
+
+    return writer;
+}
+
+/**
+ * Check whether a record is still in the ring
+ */
+static bool record_alive(const ble_history_writer_t *writer, uint32_t sequence) {
+    return ble_history_seq_alive(sequence, writer->head, writer->record_count);
+}
+
+/**
+ * Find a device's index entry, or pick one to take over for it
+ *
+ * Takes over, in order of preference, a free entry, one whose records
+ * are all overwritten, or the one with the oldest newest record.
+ *
+ * @param found Set if the entry is the device's own
+ */
+static ble_history_index_entry_t *find_entry(ble_history_writer_t *writer, const uint8_t *address,
+                                             bool *found) {
+    uint32_t slot = ble_history_index_slot(address);
+    ble_history_index_entry_t *victim = NULL;
+
+    for (int i = 0; i < BLE_HISTORY_INDEX_PROBE; i++) {
+        ble_history_index_entry_t *entry = &writer->index[(slot + i) & (BLE_HISTORY_INDEX_SIZE - 1)];
+
+        if (entry->newest != 0 && memcmp(entry->address, address, 6) == 0) {
+            *found = true;
+            return entry;
+        }
+
+        bool alive = record_alive(writer, entry->newest);
+        if (!victim || (!alive && record_alive(writer, victim->newest)) ||
+            (alive && record_alive(writer, victim->newest) && ble_history_seq_after(victim->newest, entry->newest))) {
+            victim = entry;
+        }
+    }
+
+    *found = false;
+    return victim;
+}
+
+void ble_history_writer_append(ble_history_writer_t *writer, const ble_advertisement_t *advert) {
+    uint64_t now_ms = realtime_ms();
+    uint32_t previous = 0;
+    bool found;
+
+    ble_history_index_entry_t *entry = find_entry(writer, advert->address, &found);
+
+    if (found && record_alive(writer, entry->newest)) {
+        const ble_history_record_t *last =
+            &writer->records[entry->newest & (writer->record_count - 1)];
+
+        /* Same payload heard again shortly: the previous record covers it */
+        if (last->data_hash == advert->data_hash && now_ms - last->time_ms < writer->interval_ms) {
+            return;
+        }
+        previous = entry->newest;
+    }
+
+    uint32_t sequence = writer->head = ble_history_seq_next(writer->head);
+    ble_history_record_t *record = &writer->records[sequence & (writer->record_count - 1)];
+
+    /* Invalidate the slot before its contents change (readers re-check the sequence) */
+    __atomic_store_n(&record->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    record->previous = previous;
+    record->time_ms = now_ms;
+    record->data_hash = advert->data_hash;
+    memcpy(record->address, advert->address, sizeof(record->address));
+    record->address_type = advert->address_type;
+    record->rssi = advert->rssi;
+    record->data_len = (uint8_t)advert->data_len;
+
+    __atomic_store_n(&record->sequence, sequence, __ATOMIC_RELEASE);
+
+    /* An entry taken over for this device is invalidated while its address changes */
+    if (!found) {
+        __atomic_store_n(&entry->newest, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(entry->address, advert->address, sizeof(entry->address));
+    }
+    __atomic_store_n(&entry->newest, sequence, __ATOMIC_RELEASE);
+    __atomic_store_n(&writer->header->head, sequence, __ATOMIC_RELEASE);
+}
+
+void ble_history_writer_close(ble_history_writer_t *writer) {
+    if (!writer) {
+        return;
+    }
+
+    munmap(writer->header, writer->map_size);
+    close(writer->fd);
+    free(writer);
+}
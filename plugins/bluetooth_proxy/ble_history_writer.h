@@ -0,0 +1,60 @@
+/**
+ * @file ble_history_writer.h
+ * @brief Advertisement history log writer (see ble_history.h)
+ */
+
+#ifndef BLE_HISTORY_WRITER_H
+#define BLE_HISTORY_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ble_history.h"
+#include "ble_scanner.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Defaults ([bluetooth_proxy] history_size_mb, history_interval_ms) */
+#define BLE_HISTORY_DEFAULT_SIZE_MB     16
+#define BLE_HISTORY_DEFAULT_INTERVAL_MS 1000
+
+/* History writer (opaque) */
+typedef struct ble_history_writer ble_history_writer_t;
+
+/**
+ * Open or create a history file and map it
+ *
+ * A file of the same layout and size is continued; anything else is
+ * overwritten with an empty log.
+ *
+ * @param path File path
+ * @param size File size in bytes (the record ring is rounded down to a power of two)
+ * @param interval_ms Log a device at most this often while its payload is unchanged
+ * @return Writer, or NULL on error
+ */
+ble_history_writer_t *ble_history_writer_open(const char *path, size_t size,
+                                              uint32_t interval_ms);
+
+/**
+ * Log an advertisement
+ *
+ * Never blocks or locks. Must only be called from one thread at a time.
+ *
+ * @param writer Writer
+ * @param advert Advertisement (data_hash must be set)
+ */
+void ble_history_writer_append(ble_history_writer_t *writer, const ble_advertisement_t *advert);
+
+/**
+ * Unmap the history file (the log stays on disk)
+ *
+ * @param writer Writer (NULL is ignored)
+ */
+void ble_history_writer_close(ble_history_writer_t *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_HISTORY_WRITER_H */
@@ -0,0 +1,256 @@
+/**
+ * @file ble_ranging.c
+ * @brief Per-device RSSI filtering and distance estimation
+ */
+
+#include "ble_ranging.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_PREFIX "[ble-ranging] "
+
+/* Estimates are clamped to 1 cm .. 1 km */
+#define RANGING_MIN_DECADES_Q8 (-2 * 256)
+#define RANGING_MAX_DECADES_Q8 (3 * 256 - 1)
+
+/* Attempts at a consistent read before taking the last copy */
+#define RANGING_READ_RETRIES 8
+
+/* 10^(i/16) in Q16, i = 0..16 */
+static const uint32_t pow10_q16[17] = {
+    65536, 75680, 87394, 100921, 116541, 134580, 155410, 179465, 207243,
+    239321, 276363, 319139, 368536, 425579, 491451, 567518, 655360,
+};
+
+/* Centimetres in 10^k metres, k = -2..2 */
+static const uint32_t decade_cm[5] = { 1, 10, 100, 1000, 10000 };
+
+/**
+ * Filter state of one device
+ *
+ * Written by the updating thread only, inside an odd seq (seqlock).
+ */
+typedef struct {
+    uint8_t address[BLE_MAC_LEN];
+    int tx_power;                  /* RSSI at 1 m, dBm */
+    uint32_t seq;                  /* Odd while the fields below change */
+    int32_t rssi_q8;               /* Filter estimate */
+    int32_t variance_q8;           /* Estimate variance, 1/256 dB^2 */
+    uint32_t distance_cm;
+    uint32_t samples;
+    uint64_t last_ms;
+} ranging_device_t;
+
+struct ble_ranging {
+    ranging_device_t devices[BLE_RANGING_MAX_DEVICES];
+    int count;
+    int path_loss_x10;
+    uint32_t timeout_ms;
+};
+
+/**
+ * Parse "AA:BB:CC:DD:EE:FF[@tx_power]"
+ */
+static int parse_device(const char *entry, int default_tx_power, ranging_device_t *device) {
+    unsigned int mac[BLE_MAC_LEN];
+    int consumed = 0;
+
+    while (*entry == ' ' || *entry == '\t') {
+        entry++;
+    }
+    if (sscanf(entry, "%2x:%2x:%2x:%2x:%2x:%2x%n", &mac[0], &mac[1], &mac[2], &mac[3],
+               &mac[4], &mac[5], &consumed) != BLE_MAC_LEN) {
+        return -1;
+    }
+
+    const char *rest = entry + consumed;
+    device->tx_power = default_tx_power;
+    if (*rest == '@') {
+        char *end;
+        long tx_power = strtol(rest + 1, &end, 10);
+        if (end == rest + 1 || tx_power < -127 || tx_power > 20) {
+            return -1;
+        }
+        device->tx_power = (int)tx_power;
+        rest = end;
+    }
+    while (*rest == ' ' || *rest == '\t') {
+        rest++;
+    }
+    if (*rest != '\0') {
+        return -1;
+    }
+
+    for (int i = 0; i < BLE_MAC_LEN; i++) {
+        device->address[i] = (uint8_t)mac[i];
+    }
+    return 0;
+}
+
+ble_ranging_t *ble_ranging_create(const char *devices, int tx_power, int path_loss_x10,
+                                  uint32_t timeout_ms) {
+    if (!devices || path_loss_x10 <= 0) {
+        return NULL;
+    }
+
+    ble_ranging_t *ranging = calloc(1, sizeof(*ranging));
+    if (!ranging) {
+        return NULL;
+    }
+
+    char *copy = strdup(devices);
+    if (!copy) {
+        free(ranging);
+        return NULL;
+    }
+
+    char *saveptr = NULL;
+    for (char *entry = strtok_r(copy, ",", &saveptr); entry;
+         entry = strtok_r(NULL, ",", &saveptr)) {
+        if (ranging->count == BLE_RANGING_MAX_DEVICES) {
+            fprintf(stderr, LOG_PREFIX "More than %d devices, ignoring the rest\n",
+                    BLE_RANGING_MAX_DEVICES);
+            break;
+        }
+
+        if (parse_device(entry, tx_power, &ranging->devices[ranging->count]) < 0) {
+            fprintf(stderr, LOG_PREFIX "Invalid device '%s'\n", entry);
+            continue;
+        }
+        ranging->count++;
+    }
+    free(copy);
+
+    if (ranging->count == 0) {
+        free(ranging);
+        return NULL;
+    }
+
+    ranging->path_loss_x10 = path_loss_x10;
+    ranging->timeout_ms = timeout_ms;
+
+    printf(LOG_PREFIX "Tracking %d device(s), path loss exponent %d.%d\n", ranging->count,
+           path_loss_x10 / 10, path_loss_x10 % 10);
+    return ranging;
+}
+
+/**
+ * Log-distance model in fixed point
+ *
+ * The exponent (tx_power - rssi) / (10 n) is split into whole decades,
+ * taken from a table, and a fraction, interpolated in 16 steps.
+ */
+static uint32_t estimate_distance_cm(int32_t rssi_q8, int tx_power, int path_loss_x10) {
+    int32_t decades_q8 = (tx_power * 256 - rssi_q8) / path_loss_x10;
+
+    if (decades_q8 < RANGING_MIN_DECADES_Q8) {
+        decades_q8 = RANGING_MIN_DECADES_Q8;
+    } else if (decades_q8 > RANGING_MAX_DECADES_Q8) {
+        decades_q8 = RANGING_MAX_DECADES_Q8;
+    }
+
+    uint32_t offset = (uint32_t)(decades_q8 - RANGING_MIN_DECADES_Q8);
+    uint32_t fraction = offset & 0xff;
+    uint32_t step = fraction >> 4;
+    uint32_t scale = pow10_q16[step] +
+                     (((pow10_q16[step + 1] - pow10_q16[step]) * (fraction & 0xf)) >> 4);
+
+    return (uint32_t)(((uint64_t)decade_cm[offset >> 8] * scale + 0x8000) >> 16);
+}
+
+void ble_ranging_update(ble_ranging_t *ranging, const uint8_t *address, int8_t rssi,
+                        uint64_t now_ms) {
+    ranging_device_t *device = NULL;
+    for (int i = 0; i < ranging->count; i++) {
+        if (memcmp(ranging->devices[i].address, address, BLE_MAC_LEN) == 0) {
+            device = &ranging->devices[i];
+            break;
+        }
+    }
+    if (!device) {
+        return;
+    }
+
+    __atomic_store_n(&device->seq, device->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    int32_t measured_q8 = (int32_t)rssi * 256;
+
+    if (device->samples == 0 || now_ms - device->last_ms > ranging->timeout_ms) {
+        /* First advertisement after an absence: start from the measurement */
+        device->rssi_q8 = measured_q8;
+        device->variance_q8 = BLE_RANGING_MEASUREMENT_NOISE;
+        device->samples = 0;
+    } else {
+        /* Predict (constant RSSI plus drift), then correct with gain K = P / (P + R) in Q16 */
+        int32_t variance = device->variance_q8 + BLE_RANGING_PROCESS_NOISE;
+        int32_t gain = (int32_t)(((int64_t)variance << 16) /
+                                 (variance + BLE_RANGING_MEASUREMENT_NOISE));
+        device->rssi_q8 += (int32_t)(((int64_t)gain * (measured_q8 - device->rssi_q8)) >> 16);
+        device->variance_q8 = (int32_t)(((int64_t)(65536 - gain) * variance) >> 16);
+    }
+
+    device->distance_cm = estimate_distance_cm(device->rssi_q8, device->tx_power,
+                                               ranging->path_loss_x10);
+    device->samples++;
+    device->last_ms = now_ms;
+
+    __atomic_store_n(&device->seq, device->seq + 1, __ATOMIC_RELEASE);
+}
+
+int ble_ranging_count(const ble_ranging_t *ranging) {
+    return ranging ? ranging->count : 0;
+}
+
+const uint8_t *ble_ranging_address(const ble_ranging_t *ranging, int index) {
+    return ranging->devices[index].address;
+}
+
+void ble_ranging_read(const ble_ranging_t *ranging, int index, uint64_t now_ms,
+                      ble_ranging_estimate_t *out) {
+    const ranging_device_t *device = &ranging->devices[index];
+
+    memset(out, 0, sizeof(*out));
+    for (int attempt = 0; attempt < RANGING_READ_RETRIES; attempt++) {
+        uint32_t seq = __atomic_load_n(&device->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+
+        out->rssi_q8 = device->rssi_q8;
+        out->distance_cm = device->distance_cm;
+        out->samples = device->samples;
+        out->last_ms = device->last_ms;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&device->seq, __ATOMIC_RELAXED) == seq) {
+            break;
+        }
+    }
+
+    memcpy(out->address, device->address, BLE_MAC_LEN);
+    out->present = out->samples > 0 && now_ms - out->last_ms <= ranging->timeout_ms;
+}
+
+void ble_ranging_dump(ble_ranging_t *ranging, FILE *out) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    for (int i = 0; i < ranging->count; i++) {
+        ble_ranging_estimate_t estimate;
+        ble_ranging_read(ranging, i, now_ms, &estimate);
+
+        fprintf(out, "ranging.%02X:%02X:%02X:%02X:%02X:%02X present=%d samples=%u "
+                "rssi=%.1f distance_m=%.2f\n",
+                estimate.address[0], estimate.address[1], estimate.address[2],
+                estimate.address[3], estimate.address[4], estimate.address[5],
+                estimate.present, estimate.samples, estimate.rssi_q8 / 256.0,
+                estimate.distance_cm / 100.0);
+    }
+}
+
+void ble_ranging_free(ble_ranging_t *ranging) {
+    free(ranging);
+}
@@ -0,0 +1,128 @@
+/**
+ * @file ble_ranging.h
+ * @brief Per-device RSSI filtering and distance estimation
+ *
+ * Selected devices get a 1-D Kalman filter over their RSSI, updated on
+ * every advertisement the scanner processes, and a distance estimate from
+ * the log-distance path loss model:
+ *
+ *   distance = 10 ^ ((tx_power - rssi) / (10 * n))  metres
+ *
+ * where tx_power is the RSSI at 1 m and n the path loss exponent. All of
+ * it is integer arithmetic (RSSI in 1/256 dB, distance in cm), so the
+ * per-advertisement update costs no soft-float calls on FPU-less targets.
+ */
+
+#ifndef BLE_RANGING_H
+#define BLE_RANGING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "ble_scanner.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Devices tracked at once */
+#define BLE_RANGING_MAX_DEVICES 16
+
+/* Defaults ([bluetooth_proxy] ranging_tx_power, ranging_path_loss, ranging_timeout_ms) */
+#define BLE_RANGING_DEFAULT_TX_POWER   -59    /* RSSI at 1 m, dBm */
+#define BLE_RANGING_DEFAULT_PATH_LOSS  25     /* Path loss exponent x10 */
+#define BLE_RANGING_DEFAULT_TIMEOUT_MS 30000  /* Silence after which a device is away */
+
+/* Filter noise variances in 1/256 dB^2 */
+#define BLE_RANGING_PROCESS_NOISE     32      /* 0.125 dB^2 of drift per advertisement */
+#define BLE_RANGING_MEASUREMENT_NOISE 4096    /* 16 dB^2 (4 dB standard deviation) */
+
+/**
+ * Current estimate of a tracked device
+ */
+typedef struct {
+    uint8_t address[BLE_MAC_LEN];
+    bool present;                  /* Heard within the timeout */
+    int32_t rssi_q8;               /* Filtered RSSI in 1/256 dBm */
+    uint32_t distance_cm;          /* Estimated distance in cm */
+    uint32_t samples;              /* Advertisements filtered since the device reappeared */
+    uint64_t last_ms;              /* CLOCK_MONOTONIC time of the last advertisement */
+} ble_ranging_estimate_t;
+
+/* Ranging state (opaque) */
+typedef struct ble_ranging ble_ranging_t;
+
+/**
+ * Create the filter state for a list of devices
+ *
+ * @param devices "AA:BB:CC:DD:EE:FF[@tx_power], ..." (per-device tx_power in dBm)
+ * @param tx_power Default RSSI at 1 m, dBm
+ * @param path_loss_x10 Path loss exponent x10 (20 = free space, 25-40 indoors)
+ * @param timeout_ms A device not heard for this long is away; its filter restarts
+ * @return Ranging state, or NULL if no device could be parsed
+ */
+ble_ranging_t *ble_ranging_create(const char *devices, int tx_power, int path_loss_x10,
+                                  uint32_t timeout_ms);
+
+/**
+ * Feed one advertisement's RSSI
+ *
+ * Returns at once for untracked devices. Never blocks; must only be
+ * called from one thread at a time.
+ *
+ * @param ranging Ranging state
+ * @param address Advertiser MAC
+ * @param rssi RSSI in dBm
+ * @param now_ms CLOCK_MONOTONIC time in milliseconds
+ */
+void ble_ranging_update(ble_ranging_t *ranging, const uint8_t *address, int8_t rssi,
+                        uint64_t now_ms);
+
+/**
+ * Get the number of tracked devices
+ *
+ * @param ranging Ranging state (NULL: none)
+ * @return Device count
+ */
+int ble_ranging_count(const ble_ranging_t *ranging);
+
+/**
+ * Get a tracked device's MAC
+ *
+ * @param ranging Ranging state
+ * @param index Device index (< ble_ranging_count())
+ * @return MAC (BLE_MAC_LEN bytes, valid until ble_ranging_free())
+ */
+const uint8_t *ble_ranging_address(const ble_ranging_t *ranging, int index);
+
+/**
+ * Read a device's estimate (safe concurrently with ble_ranging_update())
+ *
+ * @param ranging Ranging state
+ * @param index Device index (< ble_ranging_count())
+ * @param now_ms CLOCK_MONOTONIC time in milliseconds, for the presence check
+ * @param out Receives the estimate
+ */
+void ble_ranging_read(const ble_ranging_t *ranging, int index, uint64_t now_ms,
+                      ble_ranging_estimate_t *out);
+
+/**
+ * Write per-device estimates as metric lines
+ *
+ * @param ranging Ranging state
+ * @param out Stream
+ */
+void ble_ranging_dump(ble_ranging_t *ranging, FILE *out);
+
+/**
+ * Free the ranging state
+ *
+ * @param ranging Ranging state (NULL is ignored)
+ */
+void ble_ranging_free(ble_ranging_t *ranging);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_RANGING_H */
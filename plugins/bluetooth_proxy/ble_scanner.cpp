@@ -4,6 +4,14 @@
  */
 
 #include "ble_scanner.h"
+#include "ble_ad.h"
+#include "ble_cache_file.h"
+#include "ble_feed_writer.h"
+#include "ble_history_writer.h"
+#include "ble_ranging.h"
+#include "../../src/include/esphome_thread.h"
+#include "../../src/include/esphome_rcu.h"
+#include "../../src/include/esphome_metrics.h"
 #include <blepp/lescan.h>
 #include <blepp/bleclienttransport.h>
 #include <stdio.h>
@@ -18,19 +26,23 @@
 
 /**
  * Cached device state
+ *
+ * Written under cache_mutex, read without it: writers make seq odd while
+ * they change an entry, readers copy it and retry if seq moved.
  */
-#define MAX_CACHED_DEVICES 64
-#define REPORT_INTERVAL_MS 10000      /* Report every 10 seconds */
-#define DEVICE_TIMEOUT_MS  60000      /* Remove devices not seen in 60 seconds */
-
 typedef struct {
+    uint32_t seq;                           /* Seqlock sequence, odd while being written */
     uint8_t address[BLE_MAC_LEN];          /* BLE MAC address */
     uint8_t address_type;                   /* 0=public, 1=random */
     int8_t rssi;                            /* Signal strength */
     uint8_t data[BLE_ADV_DATA_MAX];        /* Advertisement data */
     size_t data_len;
+    ble_ad_index_t ad;                      /* AD structures of data, with payload hash */
     bool valid;
+    bool stale;                             /* Restored from the snapshot, not heard since */
     uint64_t last_seen;                     /* Timestamp of last update */
+    uint64_t received_ns;                   /* Last advertisement taken from libblepp */
+    uint64_t cached_ns;                     /* ... and stored here */
 } cached_device_t;
 
 /**
@@ -40,19 +52,46 @@ struct ble_scanner {
     BLEPP::BLEClientTransport *transport;
     BLEPP::BLEScanner *scanner;
     ble_advert_callback_t callback;
+    ble_report_callback_t report_callback;  /* Around report passes, may be NULL */
     void *user_data;
     bool running;
     pthread_t event_thread;
     pthread_t report_thread;
-    cached_device_t device_cache[MAX_CACHED_DEVICES];
+    cached_device_t device_cache[BLE_SCANNER_MAX_DEVICES];
+    const ble_scanner_params_t *params;     /* RCU-published, see ble_scanner_set_params() */
     pthread_mutex_t cache_mutex;
     bool stop_requested;
+    pthread_t bringup_thread;
+    bool bringup_thread_started;
+    pthread_mutex_t state_mutex;            /* Guards transport_state, start_pending, start/stop */
+    ble_transport_state_t transport_state;
+    bool start_pending;                     /* Start requested before the transport was ready */
+    ble_cache_file_t *cache_file;           /* Snapshot file, NULL without ble_scanner_load_cache() */
+    bool restored_pending;                  /* Restored devices not reported yet */
+    ble_feed_writer_t *feed;                /* Shared-memory feed, written by the event thread */
+    ble_history_writer_t *history;          /* History log, written by the event thread */
+    ble_ranging_t *ranging;                 /* Tracked device filters, updated by the event thread */
+
+    /* Cache access statistics (atomic; 32-bit, as 32-bit MIPS has no 64-bit atomics) */
+    uint32_t cache_locks;                   /* cache_mutex acquisitions */
+    uint32_t cache_lock_contended;          /* ... that had to wait for the other thread */
+    uint32_t sweeps;                        /* Lock-free passes over the cache */
+    uint32_t sweep_retries;                 /* Entries read again, changed during the copy */
 };
 
 /* -----------------------------------------------------------------
  * Utility functions
  * ----------------------------------------------------------------- */
 
+/**
+ * Get current timestamp in nanoseconds
+ */
+static uint64_t get_timestamp_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /**
  * Get current timestamp in milliseconds
  */
@@ -83,24 +122,120 @@ static bool parse_mac_address(const char *str, uint8_t *mac) {
     return true;
 }
 
+/* -----------------------------------------------------------------
+ * Device cache access
+ * ----------------------------------------------------------------- */
+
+/**
+ * Lock the cache for writing, counting contention
+ */
+static void cache_lock(ble_scanner_t *scanner) {
+    if (pthread_mutex_trylock(&scanner->cache_mutex) != 0) {
+        __atomic_fetch_add(&scanner->cache_lock_contended, 1, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&scanner->cache_mutex);
+    }
+    __atomic_fetch_add(&scanner->cache_locks, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Start changing a cache entry (caller holds cache_mutex)
+ */
+static void device_write_begin(cached_device_t *device) {
+    __atomic_store_n(&device->seq, device->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
 /**
- * Find or create cached device entry
+ * Publish the changes to a cache entry
  */
-static cached_device_t *get_or_create_cached_device(ble_scanner_t *scanner, const uint8_t *mac) {
-    pthread_mutex_lock(&scanner->cache_mutex);
+static void device_write_end(cached_device_t *device) {
+    __atomic_store_n(&device->seq, device->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Empty a cache entry, inside a write section
+ */
+static void device_reset(cached_device_t *device) {
+    uint32_t seq = device->seq;
+    memset(device, 0, sizeof(*device));
+    device->seq = seq;
+}
+
+/**
+ * Copy a cache entry without the lock
+ *
+ * @return Number of retries because a writer changed the entry meanwhile
+ */
+static uint32_t device_read(const cached_device_t *device, cached_device_t *copy) {
+    uint32_t retries = 0;
+
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&device->seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1)) {
+            memcpy(copy, device, sizeof(*copy));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&device->seq, __ATOMIC_RELAXED) == seq) {
+                return retries;
+            }
+        }
+        retries++;
+    }
+}
+
+/**
+ * Take a consistent copy of every valid cache entry
+ *
+ * Lock-free, so the event thread never waits for a sweep. Each entry is
+ * consistent on its own; entries may be from slightly different moments.
+ *
+ * @param devices Filled with the copies (BLE_SCANNER_MAX_DEVICES entries)
+ * @return Number of valid entries
+ */
+static int cache_sweep(ble_scanner_t *scanner, cached_device_t *devices) {
+    uint32_t retries = 0;
+    int count = 0;
+
+    for (int i = 0; i < BLE_SCANNER_MAX_DEVICES; i++) {
+        retries += device_read(&scanner->device_cache[i], &devices[count]);
+        if (devices[count].valid) {
+            count++;
+        }
+    }
 
+    __atomic_fetch_add(&scanner->sweeps, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&scanner->sweep_retries, retries, __ATOMIC_RELAXED);
+    return count;
+}
+
+/**
+ * Copy the current parameters (a reload may replace the published block)
+ */
+static ble_scanner_params_t get_params(const ble_scanner_t *scanner) {
+    int rcu = esphome_rcu_read_lock();
+    ble_scanner_params_t params = *esphome_rcu_dereference(scanner->params);
+    esphome_rcu_read_unlock(rcu);
+    return params;
+}
+
+/**
+ * Find or claim the cache entry of a device and start writing it
+ *
+ * Caller holds cache_mutex and ends the write section.
+ */
+static cached_device_t *find_or_claim_device(ble_scanner_t *scanner, const uint8_t *mac) {
     /* Look for existing entry */
-    for (int i = 0; i < MAX_CACHED_DEVICES; i++) {
+    for (int i = 0; i < BLE_SCANNER_MAX_DEVICES; i++) {
         if (scanner->device_cache[i].valid &&
             memcmp(scanner->device_cache[i].address, mac, BLE_MAC_LEN) == 0) {
-            pthread_mutex_unlock(&scanner->cache_mutex);
+            device_write_begin(&scanner->device_cache[i]);
             return &scanner->device_cache[i];
         }
     }
 
-    /* Find empty slot or oldest entry */
+    /* Find empty slot or oldest entry among the configured slots */
+    uint32_t max_devices = get_params(scanner).max_devices;
     cached_device_t *oldest = &scanner->device_cache[0];
-    for (int i = 0; i < MAX_CACHED_DEVICES; i++) {
+    for (uint32_t i = 0; i < max_devices; i++) {
         if (!scanner->device_cache[i].valid) {
             /* Empty slot found */
             oldest = &scanner->device_cache[i];
@@ -112,34 +247,44 @@ static cached_device_t *get_or_create_cached_device(ble_scanner_t *scanner, cons
     }
 
     /* Initialize new entry */
-    memset(oldest, 0, sizeof(cached_device_t));
+    device_write_begin(oldest);
+    device_reset(oldest);
     memcpy(oldest->address, mac, BLE_MAC_LEN);
     oldest->valid = true;
-    oldest->last_seen = get_timestamp_ms();
-
-    pthread_mutex_unlock(&scanner->cache_mutex);
     return oldest;
 }
 
 /**
  * Remove stale devices from cache
+ *
+ * Checks without the lock first: most sweeps find nothing to remove.
  */
-static void cleanup_stale_devices(ble_scanner_t *scanner) {
+static void cleanup_stale_devices(ble_scanner_t *scanner, const cached_device_t *devices,
+                                  int count, uint32_t timeout_ms) {
     uint64_t now = get_timestamp_ms();
-    uint64_t timeout_threshold = now - DEVICE_TIMEOUT_MS;
+    bool any = false;
+
+    for (int i = 0; i < count && !any; i++) {
+        any = now - devices[i].last_seen > timeout_ms;
+    }
+    if (!any) {
+        return;
+    }
 
-    pthread_mutex_lock(&scanner->cache_mutex);
+    cache_lock(scanner);
 
     int removed = 0;
-    for (int i = 0; i < MAX_CACHED_DEVICES; i++) {
+    for (int i = 0; i < BLE_SCANNER_MAX_DEVICES; i++) {
         cached_device_t *device = &scanner->device_cache[i];
 
-        if (device->valid && device->last_seen < timeout_threshold) {
+        if (device->valid && now - device->last_seen > timeout_ms) {
             printf(LOG_PREFIX "Removing stale device: %02X:%02X:%02X:%02X:%02X:%02X (not seen for %llu ms)\n",
                    device->address[0], device->address[1], device->address[2],
                    device->address[3], device->address[4], device->address[5],
                    (unsigned long long)(now - device->last_seen));
-            memset(device, 0, sizeof(cached_device_t));
+            device_write_begin(device);
+            device_reset(device);
+            device_write_end(device);
             removed++;
         }
     }
@@ -155,51 +300,191 @@ static void cleanup_stale_devices(ble_scanner_t *scanner) {
  * Convert libblepp advertisement to our format and merge into cache
  */
 static void process_advertisement(ble_scanner_t *scanner, const BLEPP::AdvertisingResponse &ad) {
+    /* libblepp keeps no receive time: this is when the HCI thread dequeues it */
+    uint64_t received_ns = get_timestamp_ns();
     uint8_t mac[BLE_MAC_LEN];
     if (!parse_mac_address(ad.address.c_str(), mac)) {
         printf(LOG_PREFIX "Failed to parse MAC address: %s\n", ad.address.c_str());
         return;
     }
 
-    cached_device_t *device = get_or_create_cached_device(scanner, mac);
-
-    pthread_mutex_lock(&scanner->cache_mutex);
-
-    // Update RSSI
-    device->rssi = ad.rssi;
-
-    // Determine address type (random if contains local/private, public otherwise)
-    // This is a simplification - libblepp doesn't directly expose address type
-    device->address_type = 0; // Default to public
-
     // Use raw_packet data directly from libblepp - this contains the actual
     // advertisement data bytes as received from the BLE device
-    device->data_len = 0;
+    uint8_t data[BLE_ADV_DATA_MAX];
+    size_t data_len = 0;
 
     for (const auto &packet : ad.raw_packet) {
-        if (device->data_len + packet.size() <= BLE_ADV_DATA_MAX) {
-            memcpy(&device->data[device->data_len], packet.data(), packet.size());
-            device->data_len += packet.size();
+        if (data_len + packet.size() <= BLE_ADV_DATA_MAX) {
+            memcpy(&data[data_len], packet.data(), packet.size());
+            data_len += packet.size();
         } else {
             // Would overflow, copy what we can
-            size_t remaining = BLE_ADV_DATA_MAX - device->data_len;
+            size_t remaining = BLE_ADV_DATA_MAX - data_len;
             if (remaining > 0) {
-                memcpy(&device->data[device->data_len], packet.data(), remaining);
-                device->data_len = BLE_ADV_DATA_MAX;
+                memcpy(&data[data_len], packet.data(), remaining);
+                data_len = BLE_ADV_DATA_MAX;
             }
             break;
         }
     }
 
+    // Index the AD structures once, outside the cache lock
+    ble_ad_index_t index;
+    ble_ad_scan(data, data_len, &index);
+
+    // Every advertisement goes to the local feed and the history, not just the periodic reports
+    if (scanner->feed || scanner->history) {
+        ble_advertisement_t advert;
+        memcpy(advert.address, mac, BLE_MAC_LEN);
+        advert.address_type = 0;
+        advert.rssi = ad.rssi;
+        memcpy(advert.data, data, data_len);
+        advert.data_len = data_len;
+        advert.data_hash = index.hash;
+        advert.stale = false;
+        advert.received_ns = received_ns;
+        advert.cached_ns = 0;
+        if (scanner->feed) {
+            ble_feed_writer_publish(scanner->feed, &advert, received_ns);
+        }
+        if (scanner->history) {
+            ble_history_writer_append(scanner->history, &advert);
+        }
+    }
+
+    // Tracked devices are filtered per advertisement, not per report
+    if (scanner->ranging) {
+        ble_ranging_update(scanner->ranging, mac, ad.rssi, get_timestamp_ms());
+    }
+
+    cache_lock(scanner);
+
+    cached_device_t *device = find_or_claim_device(scanner, mac);
+
+    // Update RSSI
+    device->rssi = ad.rssi;
+
+    // Determine address type (random if contains local/private, public otherwise)
+    // This is a simplification - libblepp doesn't directly expose address type
+    device->address_type = 0; // Default to public
+
+    // Most advertisements repeat the previous payload: only the RSSI changes
+    if (device->data_len != data_len || device->ad.hash != index.hash ||
+        memcmp(device->data, data, data_len) != 0) {
+        memcpy(device->data, data, data_len);
+        device->data_len = data_len;
+        device->ad = index;
+    }
+
     device->last_seen = get_timestamp_ms();
+    device->stale = false;
+    device->received_ns = received_ns;
+    device->cached_ns = get_timestamp_ns();
 
+    device_write_end(device);
     pthread_mutex_unlock(&scanner->cache_mutex);
 }
 
+/* -----------------------------------------------------------------
+ * Cache snapshot
+ * ----------------------------------------------------------------- */
+
+/**
+ * Write the device cache to the snapshot file
+ *
+ * Called from the report thread, or once it has been joined.
+ */
+static void save_snapshot(ble_scanner_t *scanner) {
+    cached_device_t devices[BLE_SCANNER_MAX_DEVICES];
+    ble_cache_record_t records[BLE_SCANNER_MAX_DEVICES];
+
+    if (!scanner->cache_file) {
+        return;
+    }
+
+    int count = cache_sweep(scanner, devices);
+    uint64_t now = get_timestamp_ms();
+
+    for (int i = 0; i < count; i++) {
+        const cached_device_t *device = &devices[i];
+        ble_cache_record_t *record = &records[i];
+        uint64_t age = now - device->last_seen;
+
+        memset(record, 0, sizeof(*record));
+        memcpy(record->address, device->address, BLE_MAC_LEN);
+        record->address_type = device->address_type;
+        record->rssi = device->rssi;
+        record->data_len = (uint8_t)device->data_len;
+        record->age_ms = age > UINT32_MAX ? UINT32_MAX : (uint32_t)age;
+        memcpy(record->data, device->data, device->data_len);
+    }
+
+    ble_cache_file_save(scanner->cache_file, records, count);
+}
+
+/**
+ * Metrics provider for device cache access
+ */
+static void scanner_metrics_dump(FILE *out, void *user_data) {
+    ble_scanner_t *scanner = (ble_scanner_t *)user_data;
+    uint32_t locks = __atomic_load_n(&scanner->cache_locks, __ATOMIC_RELAXED);
+    uint32_t contended = __atomic_load_n(&scanner->cache_lock_contended, __ATOMIC_RELAXED);
+    uint32_t sweeps = __atomic_load_n(&scanner->sweeps, __ATOMIC_RELAXED);
+    uint32_t retries = __atomic_load_n(&scanner->sweep_retries, __ATOMIC_RELAXED);
+
+    fprintf(out, "scanner.cache_locks %u contended=%u\n", locks, contended);
+    fprintf(out, "scanner.sweeps %u retries=%u\n", sweeps, retries);
+}
+
 /* -----------------------------------------------------------------
  * Periodic reporting thread
  * ----------------------------------------------------------------- */
 
+/**
+ * Report cached devices to the callback
+ *
+ * @param devices Copies of the cache entries, from cache_sweep()
+ * @param count Number of entries
+ * @param stale_only Only report devices restored from the snapshot
+ * @return Number of reported devices
+ */
+static int report_devices(ble_scanner_t *scanner, const cached_device_t *devices, int count,
+                          bool stale_only) {
+    int reported = 0;
+
+    for (int i = 0; i < count && scanner->callback; i++) {
+        const cached_device_t *device = &devices[i];
+
+        if (stale_only && !device->stale) {
+            continue;
+        }
+        if (reported == 0 && scanner->report_callback) {
+            scanner->report_callback(true, scanner->user_data);
+        }
+
+        /* Create advertisement from cached state */
+        ble_advertisement_t advert;
+        memcpy(advert.address, device->address, sizeof(advert.address));
+        advert.address_type = device->address_type;
+        advert.rssi = device->rssi;
+        memcpy(advert.data, device->data, device->data_len);
+        advert.data_len = device->data_len;
+        advert.data_hash = device->ad.hash;
+        advert.stale = device->stale;
+        advert.received_ns = device->received_ns;
+        advert.cached_ns = device->cached_ns;
+
+        scanner->callback(&advert, scanner->user_data);
+        reported++;
+    }
+
+    if (reported > 0 && scanner->report_callback) {
+        scanner->report_callback(false, scanner->user_data);
+    }
+
+    return reported;
+}
+
 /**
  * Report thread - periodically reports all cached devices
  */
@@ -211,56 +496,36 @@ static void *report_thread_func(void *arg) {
     /* Use shorter sleep intervals to check stop flag more frequently */
     const int sleep_interval_ms = 100;
     int elapsed_ms = 0;
+    int snapshot_elapsed_ms = 0;
 
     while (!scanner->stop_requested) {
         usleep(sleep_interval_ms * 1000);
         elapsed_ms += sleep_interval_ms;
+        snapshot_elapsed_ms += sleep_interval_ms;
 
         if (scanner->stop_requested) {
             break;
         }
 
-        /* Only do reporting every REPORT_INTERVAL_MS */
-        if (elapsed_ms < REPORT_INTERVAL_MS) {
-            continue;
+        ble_scanner_params_t params = get_params(scanner);
+        if (snapshot_elapsed_ms >= (int)params.snapshot_interval_ms) {
+            snapshot_elapsed_ms = 0;
+            save_snapshot(scanner);
         }
-        elapsed_ms = 0;
-
-        /* Clean up stale devices first */
-        cleanup_stale_devices(scanner);
-
-        /* Report all active devices */
-        pthread_mutex_lock(&scanner->cache_mutex);
-
-        int reported = 0;
-        for (int i = 0; i < MAX_CACHED_DEVICES; i++) {
-            cached_device_t *device = &scanner->device_cache[i];
-
-            if (!device->valid) {
-                continue;
-            }
-
-            /* Create advertisement from cached state */
-            ble_advertisement_t advert;
-            memcpy(advert.address, device->address, sizeof(advert.address));
-            advert.address_type = device->address_type;
-            advert.rssi = device->rssi;
-            memcpy(advert.data, device->data, device->data_len);
-            advert.data_len = device->data_len;
 
-            pthread_mutex_unlock(&scanner->cache_mutex);
-
-            /* Send to callback */
-            if (scanner->callback) {
-                scanner->callback(&advert, scanner->user_data);
-                reported++;
-            }
-
-            pthread_mutex_lock(&scanner->cache_mutex);
+        /* Only do reporting every report_interval_ms */
+        if (elapsed_ms < (int)params.report_interval_ms) {
+            continue;
         }
+        elapsed_ms = 0;
 
-        pthread_mutex_unlock(&scanner->cache_mutex);
+        /* One lock-free copy of the cache serves the cleanup check and the report */
+        cached_device_t devices[BLE_SCANNER_MAX_DEVICES];
+        int count = cache_sweep(scanner, devices);
+        cleanup_stale_devices(scanner, devices, count, params.device_timeout_ms);
 
+        /* Report all active devices (a device removed just now goes out a last time) */
+        int reported = report_devices(scanner, devices, count, false);
         if (reported > 0) {
             printf(LOG_PREFIX "Reported %d device(s)\n", reported);
         }
@@ -304,6 +569,142 @@ static void *event_loop_thread(void *arg) {
     return NULL;
 }
 
+/* -----------------------------------------------------------------
+ * Scanning control and transport bring-up
+ * ----------------------------------------------------------------- */
+
+/**
+ * Start scanning and the scanner threads
+ *
+ * Caller holds state_mutex and the transport is ready.
+ */
+static int scanner_start_locked(ble_scanner_t *scanner) {
+    scanner->stop_requested = false;
+
+    /* Start BLE scanning (passive mode) */
+    try {
+        scanner->scanner->start(true);  /* true = passive scanning */
+    } catch (const std::exception &e) {
+        fprintf(stderr, LOG_PREFIX "Failed to start BLE scanner: %s\n", e.what());
+        return -1;
+    }
+
+    /* Start event loop thread */
+    scanner->running = true;
+    if (esphome_thread_create(&scanner->event_thread, ESPHOME_THREAD_SCAN, "ble-scan",
+                              event_loop_thread, scanner) != 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to create event thread\n");
+        scanner->scanner->stop();
+        scanner->running = false;
+        return -1;
+    }
+
+    /* Start report thread */
+    if (esphome_thread_create(&scanner->report_thread, ESPHOME_THREAD_BACKGROUND, "ble-report",
+                              report_thread_func, scanner) != 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to create report thread\n");
+        scanner->stop_requested = true;
+        pthread_join(scanner->event_thread, NULL);
+        scanner->scanner->stop();
+        scanner->running = false;
+        return -1;
+    }
+
+    printf(LOG_PREFIX "Scanner started (periodic reporting every %u ms)\n",
+           get_params(scanner).report_interval_ms);
+    return 0;
+}
+
+/**
+ * Stop scanning and join the scanner threads
+ *
+ * Caller holds state_mutex.
+ */
+static int scanner_stop_locked(ble_scanner_t *scanner) {
+    if (!scanner->running) {
+        return -1;
+    }
+
+    printf(LOG_PREFIX "Stopping scanner...\n");
+
+    /* Signal threads to stop */
+    scanner->stop_requested = true;
+
+    /* Stop BLE scanner */
+    try {
+        scanner->scanner->stop();
+    } catch (const std::exception &e) {
+        fprintf(stderr, LOG_PREFIX "Error stopping BLE scanner: %s\n", e.what());
+    }
+
+    /* Wait for threads to finish */
+    pthread_join(scanner->event_thread, NULL);
+    pthread_join(scanner->report_thread, NULL);
+
+    scanner->running = false;
+
+    /* Keep what was heard up to now for the next start */
+    save_snapshot(scanner);
+
+    printf(LOG_PREFIX "Scanner stopped\n");
+    return 0;
+}
+
+/**
+ * Bring-up thread - opens the BLE transport and reports readiness
+ */
+static void *bringup_thread_func(void *arg) {
+    ble_scanner_t *scanner = (ble_scanner_t *)arg;
+    BLEPP::BLEClientTransport *transport = nullptr;
+    BLEPP::BLEScanner *ble_scanner = nullptr;
+    uint64_t start_ms = get_timestamp_ms();
+
+    /* Create BLE client transport */
+    try {
+        transport = BLEPP::create_client_transport();
+        if (!transport) {
+            fprintf(stderr, LOG_PREFIX "Failed to create BLE transport (no BlueZ or Nimble support)\n");
+        } else {
+            printf(LOG_PREFIX "Using transport: %s\n", transport->get_transport_name());
+
+            /* Create BLEScanner with the transport */
+            ble_scanner = new BLEPP::BLEScanner(
+                transport,
+                BLEPP::BLEScanner::FilterDuplicates::Software  /* Software duplicate filtering */
+            );
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, LOG_PREFIX "Failed to create BLEScanner: %s\n", e.what());
+        delete transport;
+        transport = nullptr;
+    }
+
+    pthread_mutex_lock(&scanner->state_mutex);
+    scanner->transport = transport;
+    scanner->scanner = ble_scanner;
+
+    if (ble_scanner) {
+        scanner->transport_state = BLE_TRANSPORT_READY;
+        printf(LOG_PREFIX "Transport ready in %llu ms\n",
+               (unsigned long long)(get_timestamp_ms() - start_ms));
+    } else {
+        scanner->transport_state = BLE_TRANSPORT_FAILED;
+        fprintf(stderr, LOG_PREFIX "No BLE transport after %llu ms, scanning unavailable\n",
+                (unsigned long long)(get_timestamp_ms() - start_ms));
+    }
+
+    /* A client subscribed while the transport was coming up */
+    if (scanner->start_pending) {
+        scanner->start_pending = false;
+        if (ble_scanner) {
+            scanner_start_locked(scanner);
+        }
+    }
+    pthread_mutex_unlock(&scanner->state_mutex);
+
+    return NULL;
+}
+
 /* -----------------------------------------------------------------
  * Public API (C linkage for plugin interface)
  * ----------------------------------------------------------------- */
@@ -324,6 +725,16 @@ ble_scanner_t *ble_scanner_init(ble_advert_callback_t callback, void *user_data)
     memset(scanner->device_cache, 0, sizeof(scanner->device_cache));
     pthread_mutex_init(&scanner->cache_mutex, NULL);
 
+    ble_scanner_params_t defaults = { 0, 0, 0, 0 };
+    if (ble_scanner_set_params(scanner, &defaults) < 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to allocate scanner parameters\n");
+        pthread_mutex_destroy(&scanner->cache_mutex);
+        free(scanner);
+        return NULL;
+    }
+
+    esphome_metrics_register("ble-scanner", scanner_metrics_dump, scanner);
+
     /* Set BLEPP log level from environment variable */
     const char *log_level_env = getenv("LOG_LEVEL");
     if (log_level_env != nullptr) {
@@ -348,107 +759,203 @@ ble_scanner_t *ble_scanner_init(ble_advert_callback_t callback, void *user_data)
         BLEPP::log_level = BLEPP::Info;
     }
 
-    /* Create BLE client transport */
-    try {
-        scanner->transport = BLEPP::create_client_transport();
-        if (!scanner->transport) {
-            fprintf(stderr, LOG_PREFIX "Failed to create BLE transport (no BlueZ or Nimble support)\n");
-            pthread_mutex_destroy(&scanner->cache_mutex);
-            free(scanner);
-            return NULL;
-        }
-
-        printf(LOG_PREFIX "Using transport: %s\n", scanner->transport->get_transport_name());
-
-        /* Create BLEScanner with the transport */
-        scanner->scanner = new BLEPP::BLEScanner(
-            scanner->transport,
-            BLEPP::BLEScanner::FilterDuplicates::Software  /* Software duplicate filtering */
-        );
-    } catch (const std::exception &e) {
-        fprintf(stderr, LOG_PREFIX "Failed to create BLEScanner: %s\n", e.what());
-        if (scanner->transport) {
-            delete scanner->transport;
-        }
-        pthread_mutex_destroy(&scanner->cache_mutex);
-        free(scanner);
-        return NULL;
+    /* Open the transport in the background so plugin init returns at once */
+    pthread_mutex_init(&scanner->state_mutex, NULL);
+    scanner->transport_state = BLE_TRANSPORT_PENDING;
+    if (esphome_thread_create(&scanner->bringup_thread, ESPHOME_THREAD_PIPELINE, "ble-bringup",
+                              bringup_thread_func, scanner) != 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to create bring-up thread, opening transport inline\n");
+        bringup_thread_func(scanner);
+    } else {
+        scanner->bringup_thread_started = true;
     }
 
     printf(LOG_PREFIX "Scanner initialized\n");
     return scanner;
 }
 
-int ble_scanner_start(ble_scanner_t *scanner) {
-    if (!scanner) {
+int ble_scanner_load_cache(ble_scanner_t *scanner, const char *path) {
+    ble_cache_record_t records[BLE_SCANNER_MAX_DEVICES];
+    uint64_t saved_ago_ms = 0;
+
+    if (!scanner || !path || scanner->cache_file) {
         return -1;
     }
 
-    if (scanner->running) {
-        fprintf(stderr, LOG_PREFIX "Scanner already running\n");
+    scanner->cache_file = ble_cache_file_open(path);
+    if (!scanner->cache_file) {
         return -1;
     }
 
-    scanner->stop_requested = false;
+    int count = ble_cache_file_load(scanner->cache_file, records, &saved_ago_ms);
+    if (count <= 0) {
+        printf(LOG_PREFIX "No device cache snapshot in %s\n", path);
+        return 0;
+    }
 
-    /* Start BLE scanning (passive mode) */
-    try {
-        scanner->scanner->start(true);  /* true = passive scanning */
-    } catch (const std::exception &e) {
-        fprintf(stderr, LOG_PREFIX "Failed to start BLE scanner: %s\n", e.what());
+    ble_scanner_params_t params = get_params(scanner);
+    uint64_t now = get_timestamp_ms();
+    int restored = 0;
+
+    cache_lock(scanner);
+    for (int i = 0; i < count && restored < (int)params.max_devices; i++) {
+        const ble_cache_record_t *record = &records[i];
+        uint64_t age = record->age_ms + saved_ago_ms;
+
+        /* Devices that would have timed out by now stay gone */
+        if (age >= params.device_timeout_ms || age >= now ||
+            record->data_len > BLE_ADV_DATA_MAX) {
+            continue;
+        }
+
+        cached_device_t *device = &scanner->device_cache[restored++];
+        device_write_begin(device);
+        device_reset(device);
+        memcpy(device->address, record->address, BLE_MAC_LEN);
+        device->address_type = record->address_type;
+        device->rssi = record->rssi;
+        memcpy(device->data, record->data, record->data_len);
+        device->data_len = record->data_len;
+        ble_ad_scan(device->data, device->data_len, &device->ad);
+        device->valid = true;
+        device->stale = true;
+        device->last_seen = now - age;
+        device_write_end(device);
+    }
+    scanner->restored_pending = restored > 0;
+    pthread_mutex_unlock(&scanner->cache_mutex);
+
+    printf(LOG_PREFIX "Restored %d of %d cached device(s) from %s (snapshot %llu ms old)\n",
+           restored, count, path, (unsigned long long)saved_ago_ms);
+    return restored;
+}
+
+int ble_scanner_open_feed(ble_scanner_t *scanner, const char *name, uint32_t slots) {
+    if (!scanner || !name || scanner->feed) {
         return -1;
     }
 
-    /* Start event loop thread */
-    scanner->running = true;
-    if (pthread_create(&scanner->event_thread, NULL, event_loop_thread, scanner) != 0) {
-        fprintf(stderr, LOG_PREFIX "Failed to create event thread\n");
-        scanner->scanner->stop();
-        scanner->running = false;
+    /* Published before the event thread starts, which is the only writer */
+    scanner->feed = ble_feed_writer_create(name, slots);
+    return scanner->feed ? 0 : -1;
+}
+
+int ble_scanner_open_history(ble_scanner_t *scanner, const char *path, size_t size,
+                             uint32_t interval_ms) {
+    if (!scanner || !path || scanner->history) {
         return -1;
     }
 
-    /* Start report thread */
-    if (pthread_create(&scanner->report_thread, NULL, report_thread_func, scanner) != 0) {
-        fprintf(stderr, LOG_PREFIX "Failed to create report thread\n");
-        scanner->stop_requested = true;
-        pthread_join(scanner->event_thread, NULL);
-        scanner->scanner->stop();
-        scanner->running = false;
+    /* Opened before the event thread starts, which is the only writer */
+    scanner->history = ble_history_writer_open(path, size, interval_ms);
+    return scanner->history ? 0 : -1;
+}
+
+int ble_scanner_set_ranging(ble_scanner_t *scanner, ble_ranging_t *ranging) {
+    if (!scanner || !ranging) {
         return -1;
     }
 
-    printf(LOG_PREFIX "Scanner started (periodic reporting every %d ms)\n", REPORT_INTERVAL_MS);
+    scanner->ranging = ranging;
     return 0;
 }
 
+int ble_scanner_set_report_callback(ble_scanner_t *scanner, ble_report_callback_t callback) {
+    if (!scanner) {
+        return -1;
+    }
+
+    scanner->report_callback = callback;
+    return 0;
+}
+
+int ble_scanner_start(ble_scanner_t *scanner) {
+    if (!scanner) {
+        return -1;
+    }
+
+    /* Announce the restored devices at once, before any radio traffic */
+    if (__atomic_exchange_n(&scanner->restored_pending, false, __ATOMIC_ACQ_REL)) {
+        cached_device_t devices[BLE_SCANNER_MAX_DEVICES];
+        int count = cache_sweep(scanner, devices);
+        printf(LOG_PREFIX "Reported %d restored device(s)\n",
+               report_devices(scanner, devices, count, true));
+    }
+
+    pthread_mutex_lock(&scanner->state_mutex);
+
+    int ret = -1;
+    if (scanner->running || scanner->start_pending) {
+        fprintf(stderr, LOG_PREFIX "Scanner already running\n");
+    } else if (scanner->transport_state == BLE_TRANSPORT_PENDING) {
+        printf(LOG_PREFIX "Transport not ready yet, scanning starts once it is\n");
+        scanner->start_pending = true;
+        ret = 0;
+    } else if (scanner->transport_state == BLE_TRANSPORT_FAILED) {
+        fprintf(stderr, LOG_PREFIX "Cannot start scanning: no BLE transport\n");
+    } else {
+        ret = scanner_start_locked(scanner);
+    }
+
+    pthread_mutex_unlock(&scanner->state_mutex);
+    return ret;
+}
+
 int ble_scanner_stop(ble_scanner_t *scanner) {
-    if (!scanner || !scanner->running) {
+    if (!scanner) {
         return -1;
     }
 
-    printf(LOG_PREFIX "Stopping scanner...\n");
+    pthread_mutex_lock(&scanner->state_mutex);
 
-    /* Signal threads to stop */
-    scanner->stop_requested = true;
+    int ret = 0;
+    if (scanner->start_pending) {
+        scanner->start_pending = false;
+    } else {
+        ret = scanner_stop_locked(scanner);
+    }
 
-    /* Stop BLE scanner */
-    try {
-        scanner->scanner->stop();
-    } catch (const std::exception &e) {
-        fprintf(stderr, LOG_PREFIX "Error stopping BLE scanner: %s\n", e.what());
+    pthread_mutex_unlock(&scanner->state_mutex);
+    return ret;
+}
+
+int ble_scanner_set_params(ble_scanner_t *scanner, const ble_scanner_params_t *params) {
+    if (!scanner || !params) {
+        return -1;
     }
 
-    /* Wait for threads to finish */
-    pthread_join(scanner->event_thread, NULL);
-    pthread_join(scanner->report_thread, NULL);
+    ble_scanner_params_t *copy = (ble_scanner_params_t *)malloc(sizeof(*copy));
+    if (!copy) {
+        return -1;
+    }
 
-    scanner->running = false;
+    copy->report_interval_ms = params->report_interval_ms ? params->report_interval_ms
+                                                          : BLE_SCANNER_REPORT_INTERVAL_MS;
+    copy->device_timeout_ms = params->device_timeout_ms ? params->device_timeout_ms
+                                                        : BLE_SCANNER_DEVICE_TIMEOUT_MS;
+    copy->max_devices = params->max_devices ? params->max_devices : BLE_SCANNER_MAX_DEVICES;
+    copy->snapshot_interval_ms = params->snapshot_interval_ms ? params->snapshot_interval_ms
+                                                              : BLE_SCANNER_SNAPSHOT_INTERVAL_MS;
+    if (copy->max_devices > BLE_SCANNER_MAX_DEVICES) {
+        copy->max_devices = BLE_SCANNER_MAX_DEVICES;
+    }
 
-    printf(LOG_PREFIX "Scanner stopped\n");
+    /* Readers pick up the new values on their next iteration */
+    ESPHOME_RCU_PUBLISH(scanner->params, copy, NULL);
     return 0;
 }
 
+ble_transport_state_t ble_scanner_transport_state(ble_scanner_t *scanner) {
+    if (!scanner) {
+        return BLE_TRANSPORT_FAILED;
+    }
+
+    pthread_mutex_lock(&scanner->state_mutex);
+    ble_transport_state_t state = scanner->transport_state;
+    pthread_mutex_unlock(&scanner->state_mutex);
+    return state;
+}
+
 bool ble_scanner_is_running(ble_scanner_t *scanner) {
     return scanner && scanner->running;
 }
@@ -458,8 +965,10 @@ void ble_scanner_free(ble_scanner_t *scanner) {
         return;
     }
 
-    if (scanner->running) {
-        ble_scanner_stop(scanner);
+    /* Drop a deferred start, then wait for the transport bring-up to finish */
+    ble_scanner_stop(scanner);
+    if (scanner->bringup_thread_started) {
+        pthread_join(scanner->bringup_thread, NULL);
     }
 
     if (scanner->scanner) {
@@ -470,8 +979,17 @@ void ble_scanner_free(ble_scanner_t *scanner) {
         delete scanner->transport;
     }
 
+    /* The scanner is stopped, so the final snapshot is already written */
+    ble_cache_file_close(scanner->cache_file);
+    ble_feed_writer_close(scanner->feed);
+    ble_history_writer_close(scanner->history);
+
+    esphome_metrics_unregister(scanner_metrics_dump, scanner);
     pthread_mutex_destroy(&scanner->cache_mutex);
+    pthread_mutex_destroy(&scanner->state_mutex);
 
+    /* All scanner threads are gone, the current parameters can go now */
+    free((void *)scanner->params);
     free(scanner);
     printf(LOG_PREFIX "Scanner freed\n");
 }
@@ -20,6 +20,15 @@ extern "C" {
 #define BLE_MAC_LEN 6
 #define BLE_ADV_DATA_MAX 62  /* BLE spec: 31 adv + 31 scan response */
 
+/* Scanner parameter defaults (see ble_scanner_params_t) */
+#define BLE_SCANNER_MAX_DEVICES        64     /* Device cache capacity */
+#define BLE_SCANNER_REPORT_INTERVAL_MS 10000  /* Report every 10 seconds */
+#define BLE_SCANNER_DEVICE_TIMEOUT_MS  60000  /* Remove devices not seen in 60 seconds */
+#define BLE_SCANNER_SNAPSHOT_INTERVAL_MS 30000 /* Snapshot the cache every 30 seconds */
+
+/* Default device cache snapshot, see ble_scanner_load_cache() */
+#define BLE_SCANNER_CACHE_FILE "/tmp/esphome-linux-ble-cache"
+
 /**
  * BLE advertisement data
  */
@@ -29,8 +38,28 @@ typedef struct {
     int8_t rssi;                   /* Signal strength in dBm */
     uint8_t data[BLE_ADV_DATA_MAX]; /* Combined advertisement data */
     size_t data_len;               /* Length of data */
+    uint32_t data_hash;            /* Payload hash (ble_ad_scan), for change detection */
+    bool stale;                    /* Restored from the cache snapshot, not heard since start */
+    uint64_t received_ns;          /* CLOCK_MONOTONIC receive time, 0 if unknown (restored) */
+    uint64_t cached_ns;            /* Stored in the device cache, 0 if it was not */
 } ble_advertisement_t;
 
+/**
+ * Tunable scanner parameters
+ *
+ * Can be changed while scanning; the scanner threads pick up the new
+ * values on their next iteration.
+ */
+typedef struct {
+    uint32_t report_interval_ms;   /* Period of cached device reports */
+    uint32_t device_timeout_ms;    /* Cached devices not seen for this long are dropped */
+    uint32_t max_devices;          /* Cached devices (<= BLE_SCANNER_MAX_DEVICES) */
+    uint32_t snapshot_interval_ms; /* Period of cache snapshots (with a cache file) */
+} ble_scanner_params_t;
+
+/* Per-device RSSI filter state, see ble_ranging.h */
+struct ble_ranging;
+
 /**
  * Callback for received BLE advertisements
  *
@@ -39,16 +68,34 @@ typedef struct {
  */
 typedef void (*ble_advert_callback_t)(const ble_advertisement_t *advert, void *user_data);
 
+/**
+ * Callback around a report pass over the device cache
+ *
+ * @param begin true before the pass's first advertisement, false after its last
+ * @param user_data User data of the advertisement callback
+ */
+typedef void (*ble_report_callback_t)(bool begin, void *user_data);
+
 /**
  * BLE scanner instance (opaque)
  */
 typedef struct ble_scanner ble_scanner_t;
 
+/**
+ * BLE transport readiness
+ */
+typedef enum {
+    BLE_TRANSPORT_PENDING = 0,  /* Transport is still being opened */
+    BLE_TRANSPORT_READY,        /* Transport open, scanning can start */
+    BLE_TRANSPORT_FAILED,       /* No usable transport (no BlueZ or Nimble) */
+} ble_transport_state_t;
+
 /**
  * Initialize BLE scanner
  *
- * Connects to BlueZ via D-Bus system bus and sets up
- * monitoring for BLE advertisements.
+ * Returns immediately: the BLE transport (BlueZ or Nimble) is opened on
+ * a background thread, which can take seconds while the controller
+ * comes up. Use ble_scanner_transport_state() to check readiness.
  *
  * @param callback Callback function for advertisements
  * @param user_data User data passed to callback
@@ -56,14 +103,84 @@ typedef struct ble_scanner ble_scanner_t;
  */
 ble_scanner_t *ble_scanner_init(ble_advert_callback_t callback, void *user_data);
 
+/**
+ * Restore the device cache from a snapshot file and keep it updated
+ *
+ * Devices younger than the device timeout are put back into the cache,
+ * marked stale, and reported once on the next ble_scanner_start() so a
+ * restarted service does not wait a report interval to announce them.
+ * From then on the cache is snapshotted periodically and when scanning
+ * stops. Call before ble_scanner_start().
+ *
+ * @param scanner Scanner instance
+ * @param path Snapshot file path
+ * @return Number of restored devices, or -1 if the file cannot be opened
+ */
+int ble_scanner_load_cache(ble_scanner_t *scanner, const char *path);
+
+/**
+ * Publish every processed advertisement to a shared-memory feed
+ *
+ * See ble_feed.h for the ring layout and the reader library. Call before
+ * ble_scanner_start().
+ *
+ * @param scanner Scanner instance
+ * @param name Shared memory object name (leading '/')
+ * @param slots Ring size in advertisements
+ * @return 0 on success, -1 on error
+ */
+int ble_scanner_open_feed(ble_scanner_t *scanner, const char *name, uint32_t slots);
+
+/**
+ * Log processed advertisements to a rolling history file
+ *
+ * See ble_history.h for the file layout and the query library. Call
+ * before ble_scanner_start().
+ *
+ * @param scanner Scanner instance
+ * @param path History file
+ * @param size File size in bytes
+ * @param interval_ms Log a device at most this often while its payload is unchanged
+ * @return 0 on success, -1 on error
+ */
+int ble_scanner_open_history(ble_scanner_t *scanner, const char *path, size_t size,
+                             uint32_t interval_ms);
+
+/**
+ * Filter the RSSI of tracked devices on every processed advertisement
+ *
+ * The ranging state stays owned by the caller and must outlive the
+ * scanner. Call before ble_scanner_start().
+ *
+ * @param scanner Scanner instance
+ * @param ranging Ranging state (see ble_ranging.h)
+ * @return 0 on success, -1 on error
+ */
+int ble_scanner_set_ranging(ble_scanner_t *scanner, struct ble_ranging *ranging);
+
+/**
+ * Bracket each report pass with a callback
+ *
+ * A pass delivers every cached device back to back from one thread; the
+ * callback lets the receiver treat it as one burst. Call before
+ * ble_scanner_start().
+ *
+ * @param scanner Scanner instance
+ * @param callback Called before and after each pass that reports devices
+ * @return 0 on success, -1 on error
+ */
+int ble_scanner_set_report_callback(ble_scanner_t *scanner, ble_report_callback_t callback);
+
 /**
  * Start BLE scanning
  *
  * Starts passive BLE scanning via BlueZ adapter.
  * Scans on all channels and reports all advertisements.
+ * If the transport is still being opened, scanning starts as soon as
+ * it is ready.
  *
  * @param scanner Scanner instance
- * @return 0 on success, -1 on error
+ * @return 0 on success (or start deferred), -1 on error
  */
 int ble_scanner_start(ble_scanner_t *scanner);
 
@@ -77,6 +194,26 @@ int ble_scanner_start(ble_scanner_t *scanner);
  */
 int ble_scanner_stop(ble_scanner_t *scanner);
 
+/**
+ * Replace the scanner parameters
+ *
+ * Safe to call while scanning, but not concurrently with itself. Zero
+ * fields keep their defaults.
+ *
+ * @param scanner Scanner instance
+ * @param params New parameters (copied)
+ * @return 0 on success, -1 on error
+ */
+int ble_scanner_set_params(ble_scanner_t *scanner, const ble_scanner_params_t *params);
+
+/**
+ * Get the readiness of the scanner's BLE transport
+ *
+ * @param scanner Scanner instance
+ * @return Transport state
+ */
+ble_transport_state_t ble_scanner_transport_state(ble_scanner_t *scanner);
+
 /**
  * Check if scanner is running
  *
@@ -0,0 +1,332 @@
+/**
+ * @file ble_trace.c
+ * @brief Sampled advertisement latency tracing
+ */
+
+#include "ble_trace.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#define LOG_PREFIX "[ble-trace] "
+
+/* Histogram buckets: 0 is < 1 us, b covers [2^(b-1), 2^b) us */
+#define TRACE_BUCKETS 32
+
+/* Buffered events are written once this much has accumulated */
+#define TRACE_CHUNK_SIZE (64 * 1024)
+
+/* Events are dropped while this much waits for a slow write */
+#define TRACE_BUFFER_MAX (1024 * 1024)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t buckets[TRACE_BUCKETS];
+} trace_histogram_t;
+
+/**
+ * Growable buffer of formatted trace events
+ */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} trace_buffer_t;
+
+struct ble_trace {
+    uint32_t sample_every;
+    uint32_t counter;              /* Atomic, advertisements offered to ble_trace_sample() */
+    pthread_mutex_t mutex;         /* Guards the histograms and the event buffer */
+    trace_histogram_t points[BLE_TRACE_POINTS];  /* Time before each point; [RECEIVED] is end to end */
+    uint64_t traced;
+    trace_buffer_t events;         /* Formatted events not written yet */
+    uint64_t dropped;              /* Events dropped for a full buffer */
+
+    pthread_mutex_t file_mutex;    /* Guards the trace file; never taken with mutex held */
+    char *path;                    /* NULL without a trace file */
+    FILE *file;
+    uint64_t file_size;
+    uint64_t file_max;
+};
+
+/* Metric and trace event names, [BLE_TRACE_RECEIVED] for the whole span */
+static const char *const point_names[BLE_TRACE_POINTS] = {
+    "total", "cached", "batched", "encoded", "written",
+};
+
+uint64_t ble_trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void histogram_add(trace_histogram_t *hist, uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int bucket = 0;
+
+    while (bucket < TRACE_BUCKETS - 1 && us >= (1ULL << bucket)) {
+        bucket++;
+    }
+
+    hist->count++;
+    hist->sum_us += us;
+    hist->buckets[bucket]++;
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+}
+
+/**
+ * Upper bound of the bucket holding the given fraction of the samples
+ */
+static uint64_t histogram_percentile(const trace_histogram_t *hist, double fraction) {
+    uint64_t target = (uint64_t)((double)hist->count * fraction);
+    uint64_t seen = 0;
+
+    for (int b = 0; b < TRACE_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen > target) {
+            uint64_t bound = 1ULL << b;
+            return bound < hist->max_us ? bound : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
+
+/**
+ * Format one complete event into the event buffer (caller holds the mutex)
+ *
+ * Every event follows the track names, so each starts with a separator.
+ */
+static void buffer_event(ble_trace_t *trace, int point, uint64_t start_ns, uint64_t end_ns) {
+    trace_buffer_t *buf = &trace->events;
+
+    for (;;) {
+        size_t room = buf->size - buf->len;
+        int n = room ? snprintf(buf->data + buf->len, room,
+                                ",\n{\"name\":\"%s\",\"cat\":\"ble\",\"ph\":\"X\",\"pid\":%d,"
+                                "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"advert\":%llu}}",
+                                point_names[point], (int)getpid(), point,
+                                (double)start_ns / 1000.0, (double)(end_ns - start_ns) / 1000.0,
+                                (unsigned long long)trace->traced) : -1;
+        if (n >= 0 && (size_t)n < room) {
+            buf->len += (size_t)n;
+            return;
+        }
+
+        size_t size = buf->size ? buf->size * 2 : TRACE_CHUNK_SIZE * 2;
+        char *data = size <= TRACE_BUFFER_MAX ? realloc(buf->data, size) : NULL;
+        if (!data) {
+            trace->dropped++;
+            return;
+        }
+        buf->data = data;
+        buf->size = size;
+    }
+}
+
+/**
+ * Start a trace file: the opening bracket and the per-point track names
+ *
+ * Caller holds file_mutex.
+ *
+ * @return 0 on success, -1 if the file cannot be written
+ */
+static int trace_file_open(ble_trace_t *trace) {
+    trace->file = fopen(trace->path, "w");
+    if (!trace->file) {
+        fprintf(stderr, LOG_PREFIX "Cannot write %s: %s\n", trace->path, strerror(errno));
+        return -1;
+    }
+
+    int n = fprintf(trace->file, "[\n");
+    for (int point = 0; point < BLE_TRACE_POINTS; point++) {
+        n += fprintf(trace->file,
+                     "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                     "\"args\":{\"name\":\"%s\"}}",
+                     point == 0 ? "" : ",\n", (int)getpid(), point,
+                     point == BLE_TRACE_RECEIVED ? "advertisement" : point_names[point]);
+    }
+    trace->file_size = n > 0 ? (uint64_t)n : 0;
+    return 0;
+}
+
+/**
+ * Close a trace file, leaving valid JSON behind
+ *
+ * Caller holds file_mutex.
+ */
+static void trace_file_close(ble_trace_t *trace) {
+    fputs("\n]\n", trace->file);
+    fclose(trace->file);
+    trace->file = NULL;
+}
+
+/**
+ * Write a chunk of formatted events, rotating the file at its limit
+ *
+ * Takes file_mutex; the caller must not hold mutex.
+ */
+static void trace_file_write(ble_trace_t *trace, const char *data, size_t len) {
+    pthread_mutex_lock(&trace->file_mutex);
+
+    if (trace->file && trace->file_size + len > trace->file_max) {
+        /* Keep one older file: <file>.1 */
+        size_t path_len = strlen(trace->path);
+        char *old_path = malloc(path_len + 3);
+        trace_file_close(trace);
+        if (old_path) {
+            memcpy(old_path, trace->path, path_len);
+            memcpy(old_path + path_len, ".1", 3);
+            if (rename(trace->path, old_path) < 0) {
+                fprintf(stderr, LOG_PREFIX "Cannot rotate %s: %s\n", trace->path, strerror(errno));
+            }
+            free(old_path);
+        }
+        trace_file_open(trace);
+    }
+
+    if (trace->file) {
+        fwrite(data, 1, len, trace->file);
+        fflush(trace->file);
+        trace->file_size += len;
+    }
+
+    pthread_mutex_unlock(&trace->file_mutex);
+}
+
+/**
+ * Write the buffered events if at least min_len have accumulated
+ *
+ * The buffer is swapped out under mutex and written without it, so the
+ * histograms and other recorders are not held up by the file.
+ */
+static void trace_flush(ble_trace_t *trace, size_t min_len) {
+    if (!trace->path) {
+        return;
+    }
+
+    pthread_mutex_lock(&trace->mutex);
+    trace_buffer_t chunk = trace->events;
+    if (chunk.len < min_len || chunk.len == 0) {
+        pthread_mutex_unlock(&trace->mutex);
+        return;
+    }
+    memset(&trace->events, 0, sizeof(trace->events));
+    pthread_mutex_unlock(&trace->mutex);
+
+    trace_file_write(trace, chunk.data, chunk.len);
+    free(chunk.data);
+}
+
+ble_trace_t *ble_trace_create(uint32_t sample_every, const char *trace_file, uint64_t file_max) {
+    ble_trace_t *trace = calloc(1, sizeof(*trace));
+    if (!trace) {
+        return NULL;
+    }
+
+    trace->sample_every = sample_every ? sample_every : 1;
+    trace->file_max = file_max > TRACE_CHUNK_SIZE ? file_max : TRACE_CHUNK_SIZE;
+    pthread_mutex_init(&trace->mutex, NULL);
+    pthread_mutex_init(&trace->file_mutex, NULL);
+
+    if (trace_file && trace_file[0] != '\0') {
+        trace->path = strdup(trace_file);
+        if (!trace->path || trace_file_open(trace) < 0) {
+            fprintf(stderr, LOG_PREFIX "Keeping histograms only\n");
+            free(trace->path);
+            trace->path = NULL;
+        } else {
+            printf(LOG_PREFIX "Writing Chrome trace events to %s (rotated at %llu KiB)\n",
+                   trace_file, (unsigned long long)(trace->file_max / 1024));
+        }
+    }
+
+    printf(LOG_PREFIX "Tracing 1 in %u advertisements\n", trace->sample_every);
+    return trace;
+}
+
+bool ble_trace_sample(ble_trace_t *trace) {
+    return __atomic_fetch_add(&trace->counter, 1, __ATOMIC_RELAXED) % trace->sample_every == 0;
+}
+
+void ble_trace_record(ble_trace_t *trace, const ble_trace_span_t *span) {
+    uint64_t received = span->at_ns[BLE_TRACE_RECEIVED];
+    uint64_t written = span->at_ns[BLE_TRACE_WRITTEN];
+
+    if (received == 0 || written < received) {
+        return;
+    }
+
+    pthread_mutex_lock(&trace->mutex);
+
+    trace->traced++;
+    histogram_add(&trace->points[BLE_TRACE_RECEIVED], written - received);
+    if (trace->path) {
+        buffer_event(trace, BLE_TRACE_RECEIVED, received, written);
+    }
+
+    /* Each point accounts the time since the previous one it passed */
+    uint64_t previous = received;
+    for (int point = BLE_TRACE_CACHED; point < BLE_TRACE_POINTS; point++) {
+        uint64_t at = span->at_ns[point];
+        if (at == 0 || at < previous) {
+            continue;
+        }
+        histogram_add(&trace->points[point], at - previous);
+        if (trace->path) {
+            buffer_event(trace, point, previous, at);
+        }
+        previous = at;
+    }
+
+    pthread_mutex_unlock(&trace->mutex);
+
+    trace_flush(trace, TRACE_CHUNK_SIZE);
+}
+
+void ble_trace_dump(ble_trace_t *trace, FILE *out) {
+    /* The trace file is complete up to now when the metrics are */
+    trace_flush(trace, 0);
+
+    pthread_mutex_lock(&trace->mutex);
+
+    fprintf(out, "trace.sampled %llu every=%u dropped_events=%llu\n",
+            (unsigned long long)trace->traced, trace->sample_every,
+            (unsigned long long)trace->dropped);
+    for (int point = 0; point < BLE_TRACE_POINTS; point++) {
+        const trace_histogram_t *hist = &trace->points[point];
+        if (hist->count == 0) {
+            continue;
+        }
+        fprintf(out, "trace.%s count=%llu mean_us=%llu p50_us=%llu p99_us=%llu max_us=%llu\n",
+                point_names[point], (unsigned long long)hist->count,
+                (unsigned long long)(hist->sum_us / hist->count),
+                (unsigned long long)histogram_percentile(hist, 0.50),
+                (unsigned long long)histogram_percentile(hist, 0.99),
+                (unsigned long long)hist->max_us);
+    }
+
+    pthread_mutex_unlock(&trace->mutex);
+}
+
+void ble_trace_free(ble_trace_t *trace) {
+    if (!trace) {
+        return;
+    }
+
+    trace_flush(trace, 0);
+    if (trace->file) {
+        trace_file_close(trace);
+    }
+    free(trace->events.data);
+    free(trace->path);
+    pthread_mutex_destroy(&trace->file_mutex);
+    pthread_mutex_destroy(&trace->mutex);
+    free(trace);
+}
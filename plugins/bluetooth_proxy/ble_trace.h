@@ -0,0 +1,107 @@
+/**
+ * @file ble_trace.h
+ * @brief Sampled advertisement latency tracing
+ *
+ * Follows one advertisement in every N through the proxy: received from
+ * the radio or an upstream, stored in the device cache, added to a batch,
+ * encoded and written to the API clients. The time spent before each
+ * point feeds a log2 histogram per point, printed on SIGUSR1. With a trace
+ * file, every traced advertisement is also written as Chrome trace events,
+ * one track per point, for chrome://tracing or ui.perfetto.dev. Events are
+ * buffered and written in chunks; a file that reaches its size limit is
+ * renamed to <file>.1 and a new one started.
+ */
+
+#ifndef BLE_TRACE_H
+#define BLE_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Trace one advertisement in this many by default (0 = off) */
+#define BLE_TRACE_DEFAULT_SAMPLE 0
+
+/* Default size limit of a trace file before it is rotated */
+#define BLE_TRACE_DEFAULT_FILE_MAX_MB 16
+
+/**
+ * Points an advertisement passes, in order
+ */
+typedef enum {
+    BLE_TRACE_RECEIVED = 0,        /* Taken from libblepp, or decoded from an upstream */
+    BLE_TRACE_CACHED,              /* Stored in the device cache (local radio only) */
+    BLE_TRACE_BATCHED,             /* Added to a batch, after waiting for the report sweep */
+    BLE_TRACE_ENCODED,             /* Batch encoded */
+    BLE_TRACE_WRITTEN,             /* Batch handed to the connection backend */
+    BLE_TRACE_POINTS,
+} ble_trace_point_t;
+
+/**
+ * Monotonic timestamps of a traced advertisement, 0 for points it skipped
+ */
+typedef struct {
+    uint64_t at_ns[BLE_TRACE_POINTS];
+} ble_trace_span_t;
+
+/* Tracer (opaque) */
+typedef struct ble_trace ble_trace_t;
+
+/**
+ * Create a tracer
+ *
+ * @param sample_every Trace one advertisement in this many
+ * @param trace_file Chrome trace JSON output, NULL or "" for none
+ * @param file_max Size at which the trace file is rotated, in bytes
+ * @return Tracer, or NULL on error
+ */
+ble_trace_t *ble_trace_create(uint32_t sample_every, const char *trace_file, uint64_t file_max);
+
+/**
+ * Decide whether to trace the next advertisement
+ *
+ * @param trace Tracer
+ * @return true for one call in sample_every
+ */
+bool ble_trace_sample(ble_trace_t *trace);
+
+/**
+ * Account a traced advertisement that reached BLE_TRACE_WRITTEN
+ *
+ * May write a chunk of the trace file: do not call with locks held that
+ * the advertisement path needs.
+ *
+ * @param trace Tracer
+ * @param span Timestamps (at_ns[BLE_TRACE_RECEIVED] must be set)
+ */
+void ble_trace_record(ble_trace_t *trace, const ble_trace_span_t *span);
+
+/**
+ * Write the per-point latency percentiles as metric lines
+ *
+ * @param trace Tracer
+ * @param out Stream
+ */
+void ble_trace_dump(ble_trace_t *trace, FILE *out);
+
+/**
+ * Write buffered events, close the trace file and free the tracer
+ *
+ * @param trace Tracer (NULL is ignored)
+ */
+void ble_trace_free(ble_trace_t *trace);
+
+/**
+ * Current CLOCK_MONOTONIC time in nanoseconds, the clock of all points
+ */
+uint64_t ble_trace_now_ns(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_TRACE_H */
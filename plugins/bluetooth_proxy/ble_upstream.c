@@ -0,0 +1,552 @@
+/**
+ * @file ble_upstream.c
+ * @brief Native API client for upstream Bluetooth proxies
+ */
+
+#include "ble_upstream.h"
+#include "ble_ad.h"
+#include "ble_trace.h"
+#include "../../src/include/esphome_proto.h"
+#include "../../src/include/esphome_thread.h"
+#include "../../src/include/esphome_metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define LOG_PREFIX "[ble-upstream] "
+
+/* Receive buffer per upstream (one complete frame must fit) */
+#define UPSTREAM_RX_SIZE ESPHOME_MAX_MESSAGE_SIZE
+
+/* Reconnect backoff */
+#define UPSTREAM_BACKOFF_MIN_MS 1000
+#define UPSTREAM_BACKOFF_MAX_MS 30000
+
+/* Ping an idle upstream, drop it when nothing arrives for this long */
+#define UPSTREAM_PING_INTERVAL_MS 20000
+#define UPSTREAM_DEAD_TIMEOUT_MS  60000
+
+/* Poll timeout, bounds the reaction to stop requests and timers */
+#define UPSTREAM_POLL_MS 200
+
+/* API version announced in the hello request */
+#define UPSTREAM_API_VERSION_MAJOR 1
+#define UPSTREAM_API_VERSION_MINOR 10
+
+typedef enum {
+    UPSTREAM_IDLE = 0,
+    UPSTREAM_CONNECTING,
+    UPSTREAM_CONNECTED,
+} upstream_state_t;
+
+static const char *const state_names[] = { "idle", "connecting", "connected" };
+
+/**
+ * One upstream proxy
+ */
+typedef struct {
+    char host[64];
+    uint16_t port;
+    int fd;
+    upstream_state_t state;
+    uint8_t rx[UPSTREAM_RX_SIZE];
+    size_t rx_len;
+    uint64_t retry_at_ms;
+    uint32_t backoff_ms;
+    uint64_t last_rx_ms;
+    uint64_t last_ping_ms;
+
+    /* Metrics */
+    uint32_t advertisements;
+    uint32_t connects;
+} upstream_conn_t;
+
+struct ble_upstream {
+    upstream_conn_t conns[BLE_UPSTREAM_MAX];
+    int count;
+    char client_name[ESPHOME_MAX_STRING_LEN];
+    char password[ESPHOME_MAX_STRING_LEN];
+    ble_upstream_callback_t callback;
+    void *user_data;
+    pthread_t thread;
+    volatile bool running;
+};
+
+static uint64_t get_timestamp_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* -----------------------------------------------------------------
+ * Connection handling
+ * ----------------------------------------------------------------- */
+
+static int send_frame(upstream_conn_t *conn, uint16_t type, const uint8_t *payload, size_t len) {
+    static const uint8_t no_payload[1];
+    uint8_t frame[256];
+    size_t frame_len = esphome_frame_message(frame, sizeof(frame), type,
+                                             payload ? payload : no_payload, len);
+    if (frame_len == 0) {
+        return -1;
+    }
+
+    /* Requests are tiny: a short write means the connection is unusable */
+    ssize_t sent = send(conn->fd, frame, frame_len, MSG_NOSIGNAL);
+    return sent == (ssize_t)frame_len ? 0 : -1;
+}
+
+static void disconnect_upstream(upstream_conn_t *conn, uint64_t now, const char *reason) {
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+
+    if (conn->state == UPSTREAM_CONNECTED) {
+        printf(LOG_PREFIX "%s:%u disconnected (%s), retrying in %u ms\n",
+               conn->host, conn->port, reason, conn->backoff_ms);
+    }
+
+    conn->state = UPSTREAM_IDLE;
+    conn->rx_len = 0;
+    conn->retry_at_ms = now + conn->backoff_ms;
+    conn->backoff_ms = conn->backoff_ms * 2 > UPSTREAM_BACKOFF_MAX_MS
+                           ? UPSTREAM_BACKOFF_MAX_MS : conn->backoff_ms * 2;
+}
+
+/**
+ * Start a non-blocking connect
+ */
+static void connect_upstream(upstream_conn_t *conn, uint64_t now) {
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    char port[8];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", conn->port);
+
+    if (getaddrinfo(conn->host, port, &hints, &res) != 0 || !res) {
+        disconnect_upstream(conn, now, "resolve failed");
+        return;
+    }
+
+    conn->fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (conn->fd < 0) {
+        freeaddrinfo(res);
+        disconnect_upstream(conn, now, "socket failed");
+        return;
+    }
+
+    int flag = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    int rc = connect(conn->fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+
+    if (rc < 0 && errno != EINPROGRESS) {
+        disconnect_upstream(conn, now, "connect failed");
+        return;
+    }
+
+    conn->state = UPSTREAM_CONNECTING;
+}
+
+/**
+ * Connection established: hello, authenticate and subscribe in one go
+ */
+static int start_session(ble_upstream_t *up, upstream_conn_t *conn, uint64_t now) {
+    uint8_t buf[ESPHOME_MAX_STRING_LEN + 16];
+    size_t len;
+
+    esphome_hello_request_t hello;
+    memset(&hello, 0, sizeof(hello));
+    snprintf(hello.client, sizeof(hello.client), "%s", up->client_name);
+    hello.api_version_major = UPSTREAM_API_VERSION_MAJOR;
+    hello.api_version_minor = UPSTREAM_API_VERSION_MINOR;
+    len = esphome_encode_hello_request(buf, sizeof(buf), &hello);
+    if (len == 0 || send_frame(conn, ESPHOME_MSG_HELLO_REQUEST, buf, len) < 0) {
+        return -1;
+    }
+
+    esphome_connect_request_t connect_req;
+    snprintf(connect_req.password, sizeof(connect_req.password), "%s", up->password);
+    len = esphome_encode_connect_request(buf, sizeof(buf), &connect_req);
+    if (send_frame(conn, ESPHOME_MSG_CONNECT_REQUEST, buf, len) < 0) {
+        return -1;
+    }
+
+    esphome_subscribe_ble_advertisements_t subscribe;
+    subscribe.flags = BLE_SUBSCRIPTION_FLAG_RAW_ADVERTISEMENTS;
+    len = esphome_encode_subscribe_ble_advertisements(buf, sizeof(buf), &subscribe);
+    if (send_frame(conn, ESPHOME_MSG_SUBSCRIBE_BLUETOOTH_LE_ADVERTISEMENTS_REQUEST, buf, len) < 0) {
+        return -1;
+    }
+
+    conn->state = UPSTREAM_CONNECTED;
+    conn->last_rx_ms = now;
+    conn->last_ping_ms = now;
+    conn->connects++;
+    return 0;
+}
+
+/**
+ * Hand the advertisements of a raw advertisements response to the callback
+ */
+static void handle_advertisements(ble_upstream_t *up, int index, const uint8_t *payload,
+                                  size_t len) {
+    upstream_conn_t *conn = &up->conns[index];
+    esphome_ble_advertisements_response_t msg;
+
+    if (!esphome_decode_ble_advertisements(payload, len, &msg)) {
+        return;
+    }
+
+    for (size_t i = 0; i < msg.count; i++) {
+        const esphome_ble_advertisement_t *pb_adv = &msg.advertisements[i];
+        ble_advertisement_t advert;
+        ble_ad_index_t ad;
+
+        /* Address is the MAC as a big-endian integer */
+        for (int b = 0; b < BLE_MAC_LEN; b++) {
+            advert.address[b] = (uint8_t)(pb_adv->address >> ((5 - b) * 8));
+        }
+        advert.address_type = (uint8_t)pb_adv->address_type;
+        advert.rssi = (int8_t)pb_adv->rssi;
+        memcpy(advert.data, pb_adv->data, pb_adv->data_len);
+        advert.data_len = pb_adv->data_len;
+
+        ble_ad_scan(advert.data, advert.data_len, &ad);
+        advert.data_hash = ad.hash;
+        advert.stale = false;
+        advert.received_ns = ble_trace_now_ns();
+        advert.cached_ns = 0;
+
+        conn->advertisements++;
+        up->callback(index, &advert, up->user_data);
+    }
+}
+
+/**
+ * Handle one message from an upstream
+ *
+ * @return 0 to keep the connection, -1 to drop it
+ */
+static int handle_message(ble_upstream_t *up, int index, uint16_t type,
+                          const uint8_t *payload, size_t len) {
+    upstream_conn_t *conn = &up->conns[index];
+
+    switch (type) {
+    case ESPHOME_MSG_HELLO_RESPONSE:
+        printf(LOG_PREFIX "Connected to %s:%u\n", conn->host, conn->port);
+        conn->backoff_ms = UPSTREAM_BACKOFF_MIN_MS;
+        return 0;
+
+    case ESPHOME_MSG_CONNECT_RESPONSE: {
+        esphome_connect_response_t response;
+        if (esphome_decode_connect_response(payload, len, &response) &&
+            response.invalid_password) {
+            fprintf(stderr, LOG_PREFIX "%s:%u rejected the password\n", conn->host, conn->port);
+            conn->backoff_ms = UPSTREAM_BACKOFF_MAX_MS;
+            return -1;
+        }
+        return 0;
+    }
+
+    case ESPHOME_MSG_PING_REQUEST:
+        return send_frame(conn, ESPHOME_MSG_PING_RESPONSE, NULL, 0);
+
+    case ESPHOME_MSG_DISCONNECT_REQUEST:
+        send_frame(conn, ESPHOME_MSG_DISCONNECT_RESPONSE, NULL, 0);
+        return -1;
+
+    case ESPHOME_MSG_BLUETOOTH_LE_RAW_ADVERTISEMENTS_RESPONSE:
+        handle_advertisements(up, index, payload, len);
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Read available data and dispatch complete frames
+ */
+static int receive_upstream(ble_upstream_t *up, int index, uint64_t now) {
+    upstream_conn_t *conn = &up->conns[index];
+
+    ssize_t received = recv(conn->fd, conn->rx + conn->rx_len,
+                            sizeof(conn->rx) - conn->rx_len, 0);
+    if (received == 0) {
+        return -1;
+    }
+    if (received < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+
+    conn->rx_len += (size_t)received;
+    conn->last_rx_ms = now;
+
+    while (conn->rx_len > 0) {
+        if (conn->rx[0] != 0x00) {
+            fprintf(stderr, LOG_PREFIX "%s:%u is not a plaintext API server "
+                    "(encryption is not supported)\n", conn->host, conn->port);
+            return -1;
+        }
+
+        uint32_t msg_len;
+        uint16_t msg_type;
+        size_t header = esphome_decode_frame_header(conn->rx, conn->rx_len, &msg_len, &msg_type);
+        if (header == 0) {
+            /* Incomplete: a frame that cannot fit is a protocol error */
+            return conn->rx_len == sizeof(conn->rx) ? -1 : 0;
+        }
+
+        if (handle_message(up, index, msg_type, conn->rx + header, msg_len) < 0) {
+            return -1;
+        }
+
+        size_t consumed = header + msg_len;
+        memmove(conn->rx, conn->rx + consumed, conn->rx_len - consumed);
+        conn->rx_len -= consumed;
+    }
+
+    return 0;
+}
+
+/**
+ * Timers of a connected upstream: keepalive pings and dead connections
+ */
+static int check_idle(upstream_conn_t *conn, uint64_t now) {
+    if (now - conn->last_rx_ms >= UPSTREAM_DEAD_TIMEOUT_MS) {
+        return -1;
+    }
+
+    if (now - conn->last_rx_ms >= UPSTREAM_PING_INTERVAL_MS &&
+        now - conn->last_ping_ms >= UPSTREAM_PING_INTERVAL_MS) {
+        conn->last_ping_ms = now;
+        return send_frame(conn, ESPHOME_MSG_PING_REQUEST, NULL, 0);
+    }
+
+    return 0;
+}
+
+/**
+ * Upstream thread - connects, reconnects and reads all upstreams
+ */
+static void *upstream_thread_func(void *arg) {
+    ble_upstream_t *up = (ble_upstream_t *)arg;
+    struct pollfd fds[BLE_UPSTREAM_MAX];
+    int fd_conn[BLE_UPSTREAM_MAX];
+
+    printf(LOG_PREFIX "Upstream thread started (%d upstream(s))\n", up->count);
+
+    while (up->running) {
+        uint64_t now = get_timestamp_ms();
+        int nfds = 0;
+
+        for (int i = 0; i < up->count; i++) {
+            upstream_conn_t *conn = &up->conns[i];
+
+            if (conn->state == UPSTREAM_IDLE && now >= conn->retry_at_ms) {
+                connect_upstream(conn, now);
+            }
+            if (conn->state == UPSTREAM_CONNECTED && check_idle(conn, now) < 0) {
+                disconnect_upstream(conn, now, "timeout");
+            }
+
+            if (conn->state != UPSTREAM_IDLE) {
+                fds[nfds].fd = conn->fd;
+                fds[nfds].events = conn->state == UPSTREAM_CONNECTING ? POLLOUT : POLLIN;
+                fds[nfds].revents = 0;
+                fd_conn[nfds] = i;
+                nfds++;
+            }
+        }
+
+        int ready = poll(fds, (nfds_t)nfds, UPSTREAM_POLL_MS);
+        if (ready <= 0) {
+            continue;
+        }
+
+        now = get_timestamp_ms();
+        for (int f = 0; f < nfds; f++) {
+            upstream_conn_t *conn = &up->conns[fd_conn[f]];
+            if (fds[f].revents == 0) {
+                continue;
+            }
+
+            if (conn->state == UPSTREAM_CONNECTING) {
+                int err = 0;
+                socklen_t err_len = sizeof(err);
+                getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+                if (err != 0 || start_session(up, conn, now) < 0) {
+                    disconnect_upstream(conn, now, "connect failed");
+                }
+            } else if (receive_upstream(up, fd_conn[f], now) < 0) {
+                disconnect_upstream(conn, now, "connection lost");
+            }
+        }
+    }
+
+    printf(LOG_PREFIX "Upstream thread stopped\n");
+    return NULL;
+}
+
+/* -----------------------------------------------------------------
+ * Metrics
+ * ----------------------------------------------------------------- */
+
+static void upstream_metrics_dump(FILE *out, void *user_data) {
+    ble_upstream_t *up = (ble_upstream_t *)user_data;
+
+    for (int i = 0; i < up->count; i++) {
+        upstream_conn_t *conn = &up->conns[i];
+        fprintf(out, "upstream.%d %s:%u %s advertisements=%u connects=%u\n", i,
+                conn->host, conn->port,
+                state_names[__atomic_load_n(&conn->state, __ATOMIC_RELAXED)],
+                __atomic_load_n(&conn->advertisements, __ATOMIC_RELAXED),
+                __atomic_load_n(&conn->connects, __ATOMIC_RELAXED));
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Public API
+ * ----------------------------------------------------------------- */
+
+/**
+ * Parse "host[:port]" into an upstream entry
+ */
+static int parse_upstream(const char *entry, upstream_conn_t *conn) {
+    while (*entry == ' ' || *entry == '\t') {
+        entry++;
+    }
+
+    size_t len = strlen(entry);
+    while (len > 0 && (entry[len - 1] == ' ' || entry[len - 1] == '\t')) {
+        len--;
+    }
+    if (len == 0) {
+        return -1;
+    }
+
+    const char *colon = memchr(entry, ':', len);
+    size_t host_len = colon ? (size_t)(colon - entry) : len;
+    if (host_len == 0 || host_len >= sizeof(conn->host)) {
+        return -1;
+    }
+
+    memcpy(conn->host, entry, host_len);
+    conn->host[host_len] = '\0';
+    conn->port = BLE_UPSTREAM_DEFAULT_PORT;
+
+    if (colon) {
+        char *end;
+        long port = strtol(colon + 1, &end, 10);
+        if (end != entry + len || port < 1 || port > 65535) {
+            return -1;
+        }
+        conn->port = (uint16_t)port;
+    }
+
+    return 0;
+}
+
+ble_upstream_t *ble_upstream_start(const char *list, const char *client_name,
+                                   const char *password, ble_upstream_callback_t callback,
+                                   void *user_data) {
+    if (!list || !callback) {
+        return NULL;
+    }
+
+    ble_upstream_t *up = calloc(1, sizeof(*up));
+    if (!up) {
+        return NULL;
+    }
+
+    char *copy = strdup(list);
+    if (!copy) {
+        free(up);
+        return NULL;
+    }
+
+    char *saveptr = NULL;
+    for (char *entry = strtok_r(copy, ",", &saveptr); entry;
+         entry = strtok_r(NULL, ",", &saveptr)) {
+        if (up->count == BLE_UPSTREAM_MAX) {
+            fprintf(stderr, LOG_PREFIX "More than %d upstreams, ignoring the rest\n",
+                    BLE_UPSTREAM_MAX);
+            break;
+        }
+
+        upstream_conn_t *conn = &up->conns[up->count];
+        if (parse_upstream(entry, conn) < 0) {
+            fprintf(stderr, LOG_PREFIX "Invalid upstream '%s'\n", entry);
+            continue;
+        }
+        conn->fd = -1;
+        conn->backoff_ms = UPSTREAM_BACKOFF_MIN_MS;
+        up->count++;
+    }
+    free(copy);
+
+    if (up->count == 0) {
+        free(up);
+        return NULL;
+    }
+
+    snprintf(up->client_name, sizeof(up->client_name), "%s", client_name ? client_name : "");
+    snprintf(up->password, sizeof(up->password), "%s", password ? password : "");
+    up->callback = callback;
+    up->user_data = user_data;
+    up->running = true;
+
+    if (esphome_thread_create(&up->thread, ESPHOME_THREAD_NETWORK, "ble-upstream",
+                              upstream_thread_func, up) != 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to create upstream thread\n");
+        free(up);
+        return NULL;
+    }
+
+    esphome_metrics_register("upstream", upstream_metrics_dump, up);
+
+    return up;
+}
+
+int ble_upstream_count(const ble_upstream_t *upstream) {
+    return upstream ? upstream->count : 0;
+}
+
+void ble_upstream_stop(ble_upstream_t *upstream) {
+    if (!upstream) {
+        return;
+    }
+
+    esphome_metrics_unregister(upstream_metrics_dump, upstream);
+
+    upstream->running = false;
+    pthread_join(upstream->thread, NULL);
+
+    for (int i = 0; i < upstream->count; i++) {
+        upstream_conn_t *conn = &upstream->conns[i];
+        if (conn->state == UPSTREAM_CONNECTED) {
+            send_frame(conn, ESPHOME_MSG_DISCONNECT_REQUEST, NULL, 0);
+        }
+        if (conn->fd >= 0) {
+            close(conn->fd);
+        }
+    }
+
+    free(upstream);
+}
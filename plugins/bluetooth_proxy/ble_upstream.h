@@ -0,0 +1,80 @@
+/**
+ * @file ble_upstream.h
+ * @brief Native API client for upstream Bluetooth proxies
+ *
+ * Connects to other esphome-linux or ESPHome Bluetooth proxies as an API
+ * client, subscribes to their raw advertisements and hands every received
+ * advertisement to a callback, tagged with the index of the upstream that
+ * heard it. Used by the aggregation mode of the Bluetooth proxy plugin.
+ *
+ * All upstreams are served by one thread. Connections are plaintext (no
+ * Noise encryption); lost connections are retried with exponential
+ * backoff.
+ */
+
+#ifndef BLE_UPSTREAM_H
+#define BLE_UPSTREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ble_scanner.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of upstream proxies */
+#define BLE_UPSTREAM_MAX 8
+
+/* Port used when an upstream is given without one */
+#define BLE_UPSTREAM_DEFAULT_PORT 6053
+
+/**
+ * Callback for advertisements received from an upstream
+ *
+ * Runs on the upstream thread.
+ *
+ * @param upstream Upstream index (0 .. ble_upstream_count() - 1)
+ * @param advert Advertisement (data_hash is set)
+ * @param user_data User-provided context
+ */
+typedef void (*ble_upstream_callback_t)(int upstream, const ble_advertisement_t *advert,
+                                        void *user_data);
+
+/* Upstream client (opaque) */
+typedef struct ble_upstream ble_upstream_t;
+
+/**
+ * Parse the upstream list and start connecting
+ *
+ * @param list Comma-separated "host[:port]" entries
+ * @param client_name Client name sent in the hello request
+ * @param password API password of the upstreams (may be NULL)
+ * @param callback Advertisement callback
+ * @param user_data Passed to callback
+ * @return Client, or NULL if the list is empty or invalid or the thread cannot start
+ */
+ble_upstream_t *ble_upstream_start(const char *list, const char *client_name,
+                                   const char *password, ble_upstream_callback_t callback,
+                                   void *user_data);
+
+/**
+ * Get the number of configured upstreams
+ *
+ * @param upstream Client
+ * @return Number of upstreams
+ */
+int ble_upstream_count(const ble_upstream_t *upstream);
+
+/**
+ * Disconnect from all upstreams and free the client
+ *
+ * @param upstream Client (NULL is ignored)
+ */
+void ble_upstream_stop(ble_upstream_t *upstream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_UPSTREAM_H */
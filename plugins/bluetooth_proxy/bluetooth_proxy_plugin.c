@@ -15,12 +15,69 @@
 #include "../../src/include/esphome_plugin.h"
 #include "../../src/include/esphome_api.h"
 #include "../../src/include/esphome_proto.h"
+#include "../../src/include/esphome_thread.h"
+#include "../../src/include/esphome_config.h"
+#include "../../src/include/esphome_rcu.h"
+#include "../../src/include/esphome_metrics.h"
 #include "ble_scanner.h"
-
-/* BLE Advertisement batching configuration */
-#define BLE_MAX_ADV_BATCH 16
+#include "ble_decoder.h"
+#include "ble_upstream.h"
+#include "ble_aggregator.h"
+#include "ble_feed_writer.h"
+#include "ble_trace.h"
+#include "ble_history_writer.h"
+#include "ble_ranging.h"
+
+/* BLE Advertisement batching defaults ([bluetooth_proxy] batch_size, flush_interval_ms) */
+#define BLE_MAX_ADV_BATCH ESPHOME_MAX_ADV_BATCH
 #define BLE_BATCH_FLUSH_INTERVAL_MS 100
 
+/* Devices whose advertisements are decoded into sensor entities */
+#define BLE_DECODED_MAX_DEVICES 32
+
+/* Aggregation mode default ([bluetooth_proxy] aggregate_window_ms) */
+#define BLE_AGGREGATE_WINDOW_MS 200
+
+/* Ranging default ([bluetooth_proxy] ranging_interval_ms) */
+#define BLE_RANGING_INTERVAL_MS 2000
+
+/* Filtered RSSI change (1/256 dB) that is worth a state update */
+#define BLE_RANGING_RSSI_STEP_Q8 256
+
+/**
+ * Hot-reloadable batching parameters
+ */
+typedef struct {
+    uint32_t batch_size;           /* Advertisements per message (<= BLE_MAX_ADV_BATCH) */
+    uint32_t flush_interval_ms;    /* Flush a partial batch after this long */
+    bool decode;                   /* Decode known sensor formats into entities */
+    bool forward_decoded;          /* Keep forwarding raw advertisements of decoded devices */
+    uint32_t aggregate_window_ms;  /* Merge copies of an advertisement heard within this window */
+    uint32_t ranging_interval_ms;  /* Publish filtered RSSI and distance at most this often */
+} bluetooth_proxy_params_t;
+
+/**
+ * Device decoded at the edge, one sensor entity per reading kind
+ */
+typedef struct {
+    bool valid;
+    uint8_t address[BLE_MAC_LEN];
+    const char *format;            /* Static string from the decoder */
+    uint32_t kinds;                /* Reading kinds seen (bit per ble_reading_kind_t) */
+    uint32_t listed_kinds;         /* Kinds in the cached entity listing */
+    uint32_t listed_generation[BLE_READING_KIND_COUNT]; /* Entity generation that first listed each kind */
+    uint32_t data_hash;            /* Payload hash of the last decoded advertisement */
+    float values[BLE_READING_KIND_COUNT];
+} decoded_device_t;
+
+/**
+ * Last ranging states sent to clients, per tracked device
+ */
+typedef struct {
+    bool present;
+    int32_t rssi_q8;
+} ranging_published_t;
+
 /**
  * Plugin state (needs context reference for flush thread)
  */
@@ -35,6 +92,29 @@ typedef struct {
     pthread_t flush_thread;
     bool flush_thread_running;
 
+    /* Batching parameters, RCU-published on configuration reload */
+    const bluetooth_proxy_params_t *params;
+
+    /* Decoded devices */
+    decoded_device_t decoded[BLE_DECODED_MAX_DEVICES];
+    pthread_mutex_t decoded_mutex;
+
+    /* Aggregation mode: upstream proxies merged with the local radio */
+    char *upstreams;               /* "host[:port]" list, NULL if not aggregating */
+    char *upstream_password;
+    ble_upstream_t *upstream;      /* Running while subscribed */
+    ble_aggregator_t *aggregator;
+
+    /* Latency tracing, NULL if disabled; traced entries of ble_batch under batch_mutex */
+    ble_trace_t *trace;
+    ble_trace_span_t batch_trace[BLE_MAX_ADV_BATCH];
+    size_t batch_trace_count;
+
+    /* Ranging of tracked devices, NULL if none; published by the flush thread */
+    ble_ranging_t *ranging;
+    ranging_published_t ranging_published[BLE_RANGING_MAX_DEVICES];
+    uint64_t ranging_published_ms;
+
     /* Context reference (for flush thread) */
     esphome_plugin_context_t *ctx;
 } bluetooth_proxy_state_t;
@@ -54,6 +134,9 @@ static uint64_t mac_to_uint64(const uint8_t *mac) {
  * Flush BLE batch to all connected clients
  */
 static void flush_ble_batch(bluetooth_proxy_state_t *state, esphome_plugin_context_t *ctx) {
+    ble_trace_span_t traced[BLE_MAX_ADV_BATCH];
+    size_t traced_count = 0;
+
     pthread_mutex_lock(&state->batch_mutex);
 
     if (state->ble_batch.count == 0) {
@@ -67,18 +150,52 @@ static void flush_ble_batch(bluetooth_proxy_state_t *state, esphome_plugin_conte
                                                      &state->ble_batch);
 
     if (len > 0) {
+        uint64_t encoded_ns = state->batch_trace_count ? ble_trace_now_ns() : 0;
+
         /* Broadcast to all clients */
         esphome_plugin_send_message(ctx, ESPHOME_MSG_BLUETOOTH_LE_RAW_ADVERTISEMENTS_RESPONSE,
                                     encode_buf, len);
 
         printf("[bluetooth_proxy] Sent BLE batch: %zu advertisements\n", state->ble_batch.count);
+
+        /* Recorded after the unlock: recording may write the trace file */
+        if (state->batch_trace_count) {
+            uint64_t written_ns = ble_trace_now_ns();
+            traced_count = state->batch_trace_count;
+            memcpy(traced, state->batch_trace, traced_count * sizeof(traced[0]));
+            for (size_t i = 0; i < traced_count; i++) {
+                traced[i].at_ns[BLE_TRACE_ENCODED] = encoded_ns;
+                traced[i].at_ns[BLE_TRACE_WRITTEN] = written_ns;
+            }
+        }
     }
 
     /* Reset batch */
     state->ble_batch.count = 0;
+    state->batch_trace_count = 0;
     clock_gettime(CLOCK_MONOTONIC, &state->last_flush);
 
     pthread_mutex_unlock(&state->batch_mutex);
+
+    for (size_t i = 0; i < traced_count; i++) {
+        ble_trace_record(state->trace, &traced[i]);
+    }
+}
+
+static void publish_ranging(bluetooth_proxy_state_t *state, esphome_plugin_context_t *ctx,
+                            uint32_t interval_ms);
+
+/**
+ * Copy the current parameters
+ *
+ * The published block may be replaced by a reload at any time; callers
+ * work on the copy, also across blocking sends.
+ */
+static bluetooth_proxy_params_t get_params(const bluetooth_proxy_state_t *state) {
+    int rcu = esphome_rcu_read_lock();
+    bluetooth_proxy_params_t params = *esphome_rcu_dereference(state->params);
+    esphome_rcu_read_unlock(rcu);
+    return params;
 }
 
 /**
@@ -100,37 +217,471 @@ static void *flush_thread_func(void *arg) {
             break;
         }
 
-        /* Only check flush interval every BLE_BATCH_FLUSH_INTERVAL_MS */
-        if (sleep_count * sleep_interval_ms < BLE_BATCH_FLUSH_INTERVAL_MS) {
-            continue;
+        /* A copy: the sends below may block */
+        bluetooth_proxy_params_t params = get_params(state);
+
+        /* Everything this pass sends leaves in one write per client */
+        esphome_plugin_cork(state->ctx);
+
+        /* Merged advertisements are emitted when their window ends */
+        if (state->aggregator) {
+            ble_aggregator_expire(state->aggregator, params.aggregate_window_ms);
         }
-        sleep_count = 0;
 
-        struct timespec now;
-        clock_gettime(CLOCK_MONOTONIC, &now);
+        /* Filtered RSSI and distance go out at their own, slower pace */
+        if (state->ranging) {
+            publish_ranging(state, state->ctx, params.ranging_interval_ms);
+        }
+
+        /* Only check flush interval every flush_interval_ms */
+        if ((uint32_t)(sleep_count * sleep_interval_ms) >= params.flush_interval_ms) {
+            sleep_count = 0;
+
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
 
-        uint64_t elapsed_ms = (now.tv_sec - state->last_flush.tv_sec) * 1000 +
-                             (now.tv_nsec - state->last_flush.tv_nsec) / 1000000;
+            uint64_t elapsed_ms = (now.tv_sec - state->last_flush.tv_sec) * 1000 +
+                                 (now.tv_nsec - state->last_flush.tv_nsec) / 1000000;
 
-        if (elapsed_ms >= BLE_BATCH_FLUSH_INTERVAL_MS && state->ble_batch.count > 0) {
-            flush_ble_batch(state, state->ctx);
+            if (elapsed_ms >= params.flush_interval_ms && state->ble_batch.count > 0) {
+                flush_ble_batch(state, state->ctx);
+            }
         }
+
+        esphome_plugin_uncork(state->ctx);
     }
 
     return NULL;
 }
 
 /**
- * BLE advertisement callback - queues for batching
+ * FNV-1a hash of the object ID, used as the entity key
  */
-static void on_ble_advertisement(const ble_advertisement_t *advert, void *user_data) {
+static uint32_t entity_key(const char *object_id) {
+    uint32_t hash = 2166136261u;
+    for (const char *p = object_id; *p; p++) {
+        hash ^= (uint8_t)*p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void entity_object_id(const decoded_device_t *device, ble_reading_kind_t kind,
+                             char *buf, size_t size) {
+    char format[16];
+    size_t i;
+
+    for (i = 0; device->format[i] && i + 1 < sizeof(format); i++) {
+        format[i] = (char)((device->format[i] >= 'A' && device->format[i] <= 'Z')
+                           ? device->format[i] - 'A' + 'a' : device->format[i]);
+    }
+    format[i] = '\0';
+
+    snprintf(buf, size, "%s_%02x%02x%02x%02x%02x%02x_%s", format,
+             device->address[0], device->address[1], device->address[2],
+             device->address[3], device->address[4], device->address[5],
+             ble_reading_info(kind)->id);
+}
+
+/**
+ * Send a sensor state (client_id < 0: every client listed at generation or later)
+ */
+static void send_sensor_state(esphome_plugin_context_t *ctx, int client_id, uint32_t generation,
+                              const char *object_id, float state, bool missing) {
+    esphome_sensor_state_response_t msg;
+    uint8_t buf[32];
+
+    msg.key = entity_key(object_id);
+    msg.state = state;
+    msg.missing_state = missing;
+
+    size_t len = esphome_encode_sensor_state(buf, sizeof(buf), &msg);
+    if (len == 0) {
+        return;
+    }
+
+    if (client_id < 0) {
+        esphome_plugin_send_entity_state(ctx, generation, ESPHOME_MSG_SENSOR_STATE_RESPONSE,
+                                         buf, len);
+    } else {
+        esphome_plugin_send_message_to_client(ctx, client_id, ESPHOME_MSG_SENSOR_STATE_RESPONSE,
+                                              buf, len);
+    }
+}
+
+/**
+ * Send the state of one decoded entity (client_id < 0: every client that listed it)
+ */
+static void send_decoded_state(esphome_plugin_context_t *ctx, int client_id,
+                               const decoded_device_t *device, ble_reading_kind_t kind) {
+    char object_id[64];
+
+    entity_object_id(device, kind, object_id, sizeof(object_id));
+    send_sensor_state(ctx, client_id, device->listed_generation[kind], object_id,
+                      device->values[kind], false);
+}
+
+/**
+ * Check whether the raw advertisements of a decoded device can be dropped
+ *
+ * Raw copies go to every client, so only once every connected client has
+ * been sent all of the device's entities. Caller holds decoded_mutex.
+ */
+static bool decoded_fully_listed(esphome_plugin_context_t *ctx, const decoded_device_t *device) {
+    uint32_t generation = 0;
+
+    if (device->listed_kinds != device->kinds) {
+        return false;
+    }
+    for (int kind = 0; kind < BLE_READING_KIND_COUNT; kind++) {
+        if ((device->kinds & (1U << kind)) &&
+            (int32_t)(device->listed_generation[kind] - generation) > 0) {
+            generation = device->listed_generation[kind];
+        }
+    }
+    return esphome_plugin_client_listed(ctx, -1, generation);
+}
+
+/**
+ * Decoder stage - turn a known sensor advertisement into entity states
+ *
+ * @return true if the raw advertisement should not be forwarded
+ */
+static decoded_device_t *find_decoded(bluetooth_proxy_state_t *state, const uint8_t *address,
+                                      decoded_device_t **free_slot) {
+    for (int i = 0; i < BLE_DECODED_MAX_DEVICES; i++) {
+        decoded_device_t *d = &state->decoded[i];
+        if (d->valid && memcmp(d->address, address, BLE_MAC_LEN) == 0) {
+            return d;
+        }
+        if (!d->valid && free_slot && !*free_slot) {
+            *free_slot = d;
+        }
+    }
+    return NULL;
+}
+
+static bool decode_advertisement(bluetooth_proxy_state_t *state, esphome_plugin_context_t *ctx,
+                                 const ble_advertisement_t *advert, bool forward_decoded) {
+    /* Unchanged payload (periodic re-report): nothing to decode */
+    pthread_mutex_lock(&state->decoded_mutex);
+    decoded_device_t *known = find_decoded(state, advert->address, NULL);
+    if (known && known->data_hash == advert->data_hash) {
+        bool suppress_raw = !forward_decoded && decoded_fully_listed(ctx, known);
+        pthread_mutex_unlock(&state->decoded_mutex);
+        return suppress_raw;
+    }
+    pthread_mutex_unlock(&state->decoded_mutex);
+
+    ble_decoded_t decoded;
+    if (!ble_decode_advertisement(advert->data, advert->data_len, &decoded)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&state->decoded_mutex);
+
+    decoded_device_t *free_slot = NULL;
+    decoded_device_t *device = find_decoded(state, advert->address, &free_slot);
+
+    if (!device) {
+        if (!free_slot) {
+            pthread_mutex_unlock(&state->decoded_mutex);
+            return false;  /* Table full: keep forwarding it raw */
+        }
+        device = free_slot;
+        memset(device, 0, sizeof(*device));
+        memcpy(device->address, advert->address, BLE_MAC_LEN);
+        device->format = decoded.format;
+        device->valid = true;
+
+        printf("[bluetooth_proxy] Decoding %s sensor %02X:%02X:%02X:%02X:%02X:%02X "
+               "(entities appear at the next entity listing)\n", decoded.format,
+               advert->address[0], advert->address[1], advert->address[2],
+               advert->address[3], advert->address[4], advert->address[5]);
+    }
+
+    device->data_hash = advert->data_hash;
+
+    /* Update values; only changed values are sent */
+    uint32_t known_kinds = device->kinds;
+    uint32_t changed = 0;
+    for (int i = 0; i < decoded.count; i++) {
+        ble_reading_kind_t kind = decoded.readings[i].kind;
+        uint32_t bit = 1U << kind;
+        if (!(device->kinds & bit) || device->values[kind] != decoded.readings[i].value) {
+            device->values[kind] = decoded.readings[i].value;
+            device->kinds |= bit;
+            changed |= bit;
+        }
+    }
+    changed &= device->listed_kinds;
+
+    /* Raw copies are only dropped once every entity of the device is known to clients */
+    bool suppress_raw = !forward_decoded && decoded_fully_listed(ctx, device);
+    bool new_entities = device->kinds != known_kinds;
+    decoded_device_t snapshot = *device;
+
+    pthread_mutex_unlock(&state->decoded_mutex);
+
+    /* New entities: the cached listing is stale */
+    if (new_entities) {
+        esphome_plugin_invalidate_entities(ctx);
+    }
+
+    for (int kind = 0; kind < BLE_READING_KIND_COUNT; kind++) {
+        if (changed & (1U << kind)) {
+            send_decoded_state(ctx, -1, &snapshot, (ble_reading_kind_t)kind);
+        }
+    }
+
+    return suppress_raw;
+}
+
+/**
+ * Copy the decoded device table (sending happens outside the lock)
+ *
+ * With ctx set (list_entities), records the kinds being listed and the
+ * entity generation of the listing that first carries them.
+ */
+static int snapshot_decoded(bluetooth_proxy_state_t *state, decoded_device_t *out,
+                            esphome_plugin_context_t *ctx) {
+    uint32_t generation = ctx ? esphome_plugin_entity_generation(ctx) : 0;
+    int count = 0;
+
+    pthread_mutex_lock(&state->decoded_mutex);
+    for (int i = 0; i < BLE_DECODED_MAX_DEVICES; i++) {
+        decoded_device_t *device = &state->decoded[i];
+        if (!device->valid) {
+            continue;
+        }
+        if (ctx) {
+            for (int kind = 0; kind < BLE_READING_KIND_COUNT; kind++) {
+                if ((device->kinds & ~device->listed_kinds) & (1U << kind)) {
+                    device->listed_generation[kind] = generation;
+                }
+            }
+            device->listed_kinds = device->kinds;
+        }
+        out[count++] = *device;
+    }
+    pthread_mutex_unlock(&state->decoded_mutex);
+
+    return count;
+}
+
+/**
+ * Ranging entities of a tracked device
+ */
+typedef enum {
+    RANGING_ENTITY_RSSI = 0,
+    RANGING_ENTITY_DISTANCE,
+    RANGING_ENTITY_COUNT
+} ranging_entity_t;
+
+static const ble_reading_info_t ranging_entity_info[RANGING_ENTITY_COUNT] = {
+    [RANGING_ENTITY_RSSI]     = { "rssi", "RSSI", "dBm", "signal_strength", 1,
+                                  SENSOR_STATE_CLASS_MEASUREMENT },
+    [RANGING_ENTITY_DISTANCE] = { "distance", "Distance", "m", "distance", 2,
+                                  SENSOR_STATE_CLASS_MEASUREMENT },
+};
+
+static void ranging_object_id(const uint8_t *address, ranging_entity_t entity, char *buf,
+                              size_t size) {
+    snprintf(buf, size, "ranging_%02x%02x%02x%02x%02x%02x_%s", address[0], address[1],
+             address[2], address[3], address[4], address[5], ranging_entity_info[entity].id);
+}
+
+/**
+ * Send the ranging states of one device (client_id < 0: every client that listed them)
+ *
+ * The only float conversions of the ranging path happen here, at the
+ * publish rate rather than per advertisement.
+ */
+static void send_ranging_states(esphome_plugin_context_t *ctx, int client_id,
+                                const ble_ranging_estimate_t *estimate) {
+    char object_id[64];
+
+    ranging_object_id(estimate->address, RANGING_ENTITY_RSSI, object_id, sizeof(object_id));
+    send_sensor_state(ctx, client_id, 0, object_id, (float)estimate->rssi_q8 / 256.0f,
+                      !estimate->present);
+
+    ranging_object_id(estimate->address, RANGING_ENTITY_DISTANCE, object_id, sizeof(object_id));
+    send_sensor_state(ctx, client_id, 0, object_id, (float)estimate->distance_cm / 100.0f,
+                      !estimate->present);
+}
+
+/**
+ * Publish the ranging states that changed (flush thread)
+ *
+ * Runs at most every interval_ms: a device's states go out when it
+ * appears or disappears, or when its filtered RSSI moved by a dB since
+ * the last update sent.
+ */
+static void publish_ranging(bluetooth_proxy_state_t *state, esphome_plugin_context_t *ctx,
+                            uint32_t interval_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    if (now_ms - state->ranging_published_ms < interval_ms) {
+        return;
+    }
+    state->ranging_published_ms = now_ms;
+
+    for (int i = 0; i < ble_ranging_count(state->ranging); i++) {
+        ranging_published_t *published = &state->ranging_published[i];
+        ble_ranging_estimate_t estimate;
+
+        ble_ranging_read(state->ranging, i, now_ms, &estimate);
+        if (estimate.present == published->present &&
+            (!estimate.present ||
+             abs(estimate.rssi_q8 - published->rssi_q8) < BLE_RANGING_RSSI_STEP_Q8)) {
+            continue;
+        }
+
+        published->present = estimate.present;
+        published->rssi_q8 = estimate.rssi_q8;
+        send_ranging_states(ctx, -1, &estimate);
+    }
+}
+
+/**
+ * List the ranging entities of the tracked devices
+ */
+static void list_ranging_entities(bluetooth_proxy_state_t *state, esphome_plugin_context_t *ctx,
+                                  int client_id) {
+    for (int i = 0; i < ble_ranging_count(state->ranging); i++) {
+        const uint8_t *address = ble_ranging_address(state->ranging, i);
+
+        for (int entity = 0; entity < RANGING_ENTITY_COUNT; entity++) {
+            const ble_reading_info_t *info = &ranging_entity_info[entity];
+            esphome_list_entities_sensor_response_t msg;
+            uint8_t buf[512];
+
+            memset(&msg, 0, sizeof(msg));
+            ranging_object_id(address, (ranging_entity_t)entity, msg.object_id,
+                              sizeof(msg.object_id));
+            msg.key = entity_key(msg.object_id);
+            snprintf(msg.name, sizeof(msg.name), "BLE %02X:%02X:%02X %s", address[3], address[4],
+                     address[5], info->name);
+            snprintf(msg.unit_of_measurement, sizeof(msg.unit_of_measurement), "%s", info->unit);
+            snprintf(msg.device_class, sizeof(msg.device_class), "%s", info->device_class);
+            msg.accuracy_decimals = info->accuracy_decimals;
+            msg.state_class = info->state_class;
+
+            size_t len = esphome_encode_list_entities_sensor(buf, sizeof(buf), &msg);
+            if (len > 0) {
+                esphome_plugin_send_message_to_client(ctx, client_id,
+                                                      ESPHOME_MSG_LIST_ENTITIES_SENSOR_RESPONSE,
+                                                      buf, len);
+            }
+        }
+    }
+}
+
+/**
+ * List decoded and tracked devices as sensor entities
+ */
+static int bluetooth_proxy_list_entities(esphome_plugin_context_t *ctx, int client_id) {
+    bluetooth_proxy_state_t *state = (bluetooth_proxy_state_t *)ctx->plugin_data;
+    decoded_device_t devices[BLE_DECODED_MAX_DEVICES];
+
+    if (!state) {
+        return 0;
+    }
+
+    int count = snapshot_decoded(state, devices, ctx);
+    for (int i = 0; i < count; i++) {
+        for (int kind = 0; kind < BLE_READING_KIND_COUNT; kind++) {
+            if (!(devices[i].kinds & (1U << kind))) {
+                continue;
+            }
+
+            const ble_reading_info_t *info = ble_reading_info((ble_reading_kind_t)kind);
+            esphome_list_entities_sensor_response_t msg;
+            uint8_t buf[512];
+
+            memset(&msg, 0, sizeof(msg));
+            entity_object_id(&devices[i], (ble_reading_kind_t)kind, msg.object_id,
+                             sizeof(msg.object_id));
+            msg.key = entity_key(msg.object_id);
+            snprintf(msg.name, sizeof(msg.name), "%s %02X:%02X:%02X %s", devices[i].format,
+                     devices[i].address[3], devices[i].address[4], devices[i].address[5],
+                     info->name);
+            snprintf(msg.unit_of_measurement, sizeof(msg.unit_of_measurement), "%s", info->unit);
+            snprintf(msg.device_class, sizeof(msg.device_class), "%s", info->device_class);
+            msg.accuracy_decimals = info->accuracy_decimals;
+            msg.state_class = info->state_class;
+
+            size_t len = esphome_encode_list_entities_sensor(buf, sizeof(buf), &msg);
+            if (len > 0) {
+                esphome_plugin_send_message_to_client(ctx, client_id,
+                                                      ESPHOME_MSG_LIST_ENTITIES_SENSOR_RESPONSE,
+                                                      buf, len);
+            }
+        }
+    }
+
+    list_ranging_entities(state, ctx, client_id);
+
+    return 0;
+}
+
+/**
+ * Send the current state of every decoded and ranging entity to a new subscriber
+ */
+static int bluetooth_proxy_subscribe_states(esphome_plugin_context_t *ctx, int client_id) {
+    bluetooth_proxy_state_t *state = (bluetooth_proxy_state_t *)ctx->plugin_data;
+    decoded_device_t devices[BLE_DECODED_MAX_DEVICES];
+
+    if (!state) {
+        return 0;
+    }
+
+    int count = snapshot_decoded(state, devices, NULL);
+    for (int i = 0; i < count; i++) {
+        for (int kind = 0; kind < BLE_READING_KIND_COUNT; kind++) {
+            if ((devices[i].listed_kinds & (1U << kind)) &&
+                esphome_plugin_client_listed(ctx, client_id, devices[i].listed_generation[kind])) {
+                send_decoded_state(ctx, client_id, &devices[i], (ble_reading_kind_t)kind);
+            }
+        }
+    }
+
+    /* Ranging entities are in every listing since init */
+    if (state->ranging && esphome_plugin_client_listed(ctx, client_id, 0)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t now_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+        for (int i = 0; i < ble_ranging_count(state->ranging); i++) {
+            ble_ranging_estimate_t estimate;
+            ble_ranging_read(state->ranging, i, now_ms, &estimate);
+            send_ranging_states(ctx, client_id, &estimate);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Decode or queue an advertisement for batching
+ */
+static void forward_advertisement(const ble_advertisement_t *advert, void *user_data) {
     esphome_plugin_context_t *ctx = (esphome_plugin_context_t *)user_data;
     bluetooth_proxy_state_t *state = (bluetooth_proxy_state_t *)ctx->plugin_data;
+    bluetooth_proxy_params_t params = get_params(state);
+    uint32_t batch_size = params.batch_size;
+
+    /* Decoder stage: known sensors become entity states */
+    if (params.decode && decode_advertisement(state, ctx, advert, params.forward_decoded)) {
+        return;
+    }
 
     pthread_mutex_lock(&state->batch_mutex);
 
     /* Flush if batch is full */
-    if (state->ble_batch.count >= BLE_MAX_ADV_BATCH) {
+    if (state->ble_batch.count >= batch_size) {
         pthread_mutex_unlock(&state->batch_mutex);
         flush_ble_batch(state, ctx);
         pthread_mutex_lock(&state->batch_mutex);
@@ -153,14 +704,132 @@ static void on_ble_advertisement(const ble_advertisement_t *advert, void *user_d
 
     state->ble_batch.count++;
 
+    /* Restored devices have no receive time to trace from */
+    if (state->trace && advert->received_ns && ble_trace_sample(state->trace)) {
+        ble_trace_span_t *span = &state->batch_trace[state->batch_trace_count++];
+        memset(span, 0, sizeof(*span));
+        span->at_ns[BLE_TRACE_RECEIVED] = advert->received_ns;
+        span->at_ns[BLE_TRACE_CACHED] = advert->cached_ns;
+        span->at_ns[BLE_TRACE_BATCHED] = ble_trace_now_ns();
+    }
+
     pthread_mutex_unlock(&state->batch_mutex);
 
     /* Flush immediately if batch is full */
-    if (state->ble_batch.count >= BLE_MAX_ADV_BATCH) {
+    if (state->ble_batch.count >= batch_size) {
         flush_ble_batch(state, ctx);
     }
 }
 
+/**
+ * BLE advertisement callback - local radio
+ */
+static void on_ble_advertisement(const ble_advertisement_t *advert, void *user_data) {
+    esphome_plugin_context_t *ctx = (esphome_plugin_context_t *)user_data;
+    bluetooth_proxy_state_t *state = (bluetooth_proxy_state_t *)ctx->plugin_data;
+
+    if (state->aggregator) {
+        ble_aggregator_add(state->aggregator, 0, advert, get_params(state).aggregate_window_ms);
+    } else {
+        forward_advertisement(advert, ctx);
+    }
+}
+
+/**
+ * Report pass callback - local radio
+ *
+ * A pass fills batches back to back: their frames leave in one write per client.
+ */
+static void on_ble_report(bool begin, void *user_data) {
+    esphome_plugin_context_t *ctx = (esphome_plugin_context_t *)user_data;
+
+    if (begin) {
+        esphome_plugin_cork(ctx);
+    } else {
+        esphome_plugin_uncork(ctx);
+    }
+}
+
+/**
+ * Advertisement callback - upstream proxies (receivers 1..)
+ */
+static void on_upstream_advertisement(int upstream, const ble_advertisement_t *advert,
+                                      void *user_data) {
+    esphome_plugin_context_t *ctx = (esphome_plugin_context_t *)user_data;
+    bluetooth_proxy_state_t *state = (bluetooth_proxy_state_t *)ctx->plugin_data;
+
+    ble_aggregator_add(state->aggregator, 1 + upstream, advert,
+                       get_params(state).aggregate_window_ms);
+}
+
+static void aggregator_metrics_dump(FILE *out, void *user_data) {
+    ble_aggregator_dump((ble_aggregator_t *)user_data, out);
+}
+
+static void trace_metrics_dump(FILE *out, void *user_data) {
+    ble_trace_dump((ble_trace_t *)user_data, out);
+}
+
+static void ranging_metrics_dump(FILE *out, void *user_data) {
+    ble_ranging_dump((ble_ranging_t *)user_data, out);
+}
+
+/**
+ * Publish the [bluetooth_proxy] settings of a configuration snapshot
+ *
+ * Runs at init and on every reload (serialized by the config module).
+ */
+static int apply_config(bluetooth_proxy_state_t *state, const esphome_config_t *config) {
+    bluetooth_proxy_params_t *params = malloc(sizeof(*params));
+    if (!params) {
+        return -1;
+    }
+
+    params->batch_size = (uint32_t)esphome_config_get_int(
+        config, "bluetooth_proxy.batch_size", BLE_MAX_ADV_BATCH, 1, BLE_MAX_ADV_BATCH);
+    params->flush_interval_ms = (uint32_t)esphome_config_get_int(
+        config, "bluetooth_proxy.flush_interval_ms", BLE_BATCH_FLUSH_INTERVAL_MS, 10, 60000);
+    params->decode = esphome_config_get_bool(config, "bluetooth_proxy.decode", false);
+    params->forward_decoded = esphome_config_get_bool(config, "bluetooth_proxy.forward_decoded",
+                                                      false);
+    params->aggregate_window_ms = (uint32_t)esphome_config_get_int(
+        config, "bluetooth_proxy.aggregate_window_ms", BLE_AGGREGATE_WINDOW_MS, 10, 10000);
+    params->ranging_interval_ms = (uint32_t)esphome_config_get_int(
+        config, "bluetooth_proxy.ranging_interval_ms", BLE_RANGING_INTERVAL_MS, 100, 600000);
+    ESPHOME_RCU_PUBLISH(state->params, params, NULL);
+
+    if (state->scanner) {
+        ble_scanner_params_t scanner_params;
+        scanner_params.report_interval_ms = (uint32_t)esphome_config_get_int(
+            config, "bluetooth_proxy.report_interval_ms", BLE_SCANNER_REPORT_INTERVAL_MS,
+            100, 3600000);
+        scanner_params.device_timeout_ms = (uint32_t)esphome_config_get_int(
+            config, "bluetooth_proxy.device_timeout_ms", BLE_SCANNER_DEVICE_TIMEOUT_MS,
+            1000, 86400000);
+        scanner_params.max_devices = (uint32_t)esphome_config_get_int(
+            config, "bluetooth_proxy.max_devices", BLE_SCANNER_MAX_DEVICES,
+            1, BLE_SCANNER_MAX_DEVICES);
+        scanner_params.snapshot_interval_ms = (uint32_t)esphome_config_get_int(
+            config, "bluetooth_proxy.cache_snapshot_interval_ms",
+            BLE_SCANNER_SNAPSHOT_INTERVAL_MS, 1000, 3600000);
+        ble_scanner_set_params(state->scanner, &scanner_params);
+    }
+
+    return 0;
+}
+
+/**
+ * Configuration reload watcher
+ */
+static void on_config_reload(const esphome_config_t *config, void *user_data) {
+    bluetooth_proxy_state_t *state = (bluetooth_proxy_state_t *)user_data;
+
+    if (apply_config(state, config) == 0) {
+        printf("[bluetooth_proxy] Applied configuration generation %u\n",
+               esphome_config_generation(config));
+    }
+}
+
 /**
  * Configure device info with Bluetooth proxy capabilities
  */
@@ -200,28 +869,149 @@ static int bluetooth_proxy_init(esphome_plugin_context_t *ctx) {
     /* Initialize batching system */
     memset(&state->ble_batch, 0, sizeof(state->ble_batch));
     pthread_mutex_init(&state->batch_mutex, NULL);
+    pthread_mutex_init(&state->decoded_mutex, NULL);
     clock_gettime(CLOCK_MONOTONIC, &state->last_flush);
 
+    /* The snapshot is read until the trace settings below; a client
+     * thread may start the plugin while the main thread reloads */
+    int rcu = esphome_rcu_read_lock();
+    const esphome_config_t *config = esphome_config_get();
+
+    /* Aggregation mode (upstreams are connected on subscription) */
+    const char *upstreams = esphome_config_get_string(config, "bluetooth_proxy.upstreams", "");
+    if (upstreams[0] != '\0') {
+        state->upstreams = strdup(upstreams);
+        state->upstream_password = strdup(
+            esphome_config_get_string(config, "bluetooth_proxy.upstream_password", ""));
+        state->aggregator = ble_aggregator_create(forward_advertisement, ctx);
+        if (!state->upstreams || !state->upstream_password || !state->aggregator) {
+            fprintf(stderr, "[bluetooth_proxy] Failed to set up aggregation mode\n");
+            ble_aggregator_free(state->aggregator);
+            free(state->upstreams);
+            free(state->upstream_password);
+            pthread_mutex_destroy(&state->batch_mutex);
+            pthread_mutex_destroy(&state->decoded_mutex);
+            free(state);
+            esphome_rcu_read_unlock(rcu);
+            return -1;
+        }
+        printf("[bluetooth_proxy] Aggregation mode, upstreams: %s\n", state->upstreams);
+    }
+
+    /* Initialize BLE scanner (an aggregator may run without a local radio) */
+    if (esphome_config_get_bool(config, "bluetooth_proxy.scan", true)) {
+        state->scanner = ble_scanner_init(on_ble_advertisement, ctx);
+        if (state->scanner) {
+            ble_scanner_set_report_callback(state->scanner, on_ble_report);
+        } else {
+            fprintf(stderr, "[bluetooth_proxy] Warning: Failed to initialize BLE scanner\n");
+            fprintf(stderr, "[bluetooth_proxy] Plugin will run without BLE scanning\n");
+            /* Don't fail - plugin can still handle subscription messages */
+        }
+    }
+
+    /* Apply [bluetooth_proxy] settings before any thread reads them */
+    if (apply_config(state, config) < 0) {
+        fprintf(stderr, "[bluetooth_proxy] Failed to allocate parameters\n");
+        ble_scanner_free(state->scanner);
+        ble_aggregator_free(state->aggregator);
+        free(state->upstreams);
+        free(state->upstream_password);
+        pthread_mutex_destroy(&state->batch_mutex);
+        pthread_mutex_destroy(&state->decoded_mutex);
+        free(state);
+        esphome_rcu_read_unlock(rcu);
+        return -1;
+    }
+
+    /* Warm restart: restored devices go out on the first subscription */
+    const char *cache_file = esphome_config_get_string(config, "bluetooth_proxy.cache_file",
+                                                       BLE_SCANNER_CACHE_FILE);
+    if (state->scanner && cache_file[0] != '\0') {
+        ble_scanner_load_cache(state->scanner, cache_file);
+    }
+
+    /* Local consumers follow the radio through shared memory (opt-in) */
+    const char *feed = esphome_config_get_string(config, "bluetooth_proxy.feed", "");
+    if (state->scanner && feed[0] != '\0') {
+        ble_scanner_open_feed(state->scanner, feed,
+                              (uint32_t)esphome_config_get_int(config, "bluetooth_proxy.feed_slots",
+                                                               BLE_FEED_DEFAULT_SLOTS, 16, 65536));
+    }
+
+    /* Rolling history of what the radio heard, for troubleshooting */
+    const char *history = esphome_config_get_string(config, "bluetooth_proxy.history_file", "");
+    if (state->scanner && history[0] != '\0') {
+        size_t history_mb = (size_t)esphome_config_get_int(
+            config, "bluetooth_proxy.history_size_mb", BLE_HISTORY_DEFAULT_SIZE_MB, 1, 1024);
+        ble_scanner_open_history(state->scanner, history, history_mb * 1024 * 1024,
+                                 (uint32_t)esphome_config_get_int(
+                                     config, "bluetooth_proxy.history_interval_ms",
+                                     BLE_HISTORY_DEFAULT_INTERVAL_MS, 0, 3600000));
+    }
+
+    /* Per-advertisement RSSI filtering and distance of selected devices (local radio only) */
+    const char *ranging = esphome_config_get_string(config, "bluetooth_proxy.ranging_devices", "");
+    if (state->scanner && ranging[0] != '\0') {
+        state->ranging = ble_ranging_create(
+            ranging,
+            (int)esphome_config_get_int(config, "bluetooth_proxy.ranging_tx_power",
+                                        BLE_RANGING_DEFAULT_TX_POWER, -127, 20),
+            (int)esphome_config_get_int(config, "bluetooth_proxy.ranging_path_loss",
+                                        BLE_RANGING_DEFAULT_PATH_LOSS, 10, 60),
+            (uint32_t)esphome_config_get_int(config, "bluetooth_proxy.ranging_timeout_ms",
+                                             BLE_RANGING_DEFAULT_TIMEOUT_MS, 1000, 3600000));
+        if (state->ranging) {
+            ble_scanner_set_ranging(state->scanner, state->ranging);
+        }
+    }
+
+    /* Sampled latency tracing from radio to socket */
+    uint32_t trace_sample = (uint32_t)esphome_config_get_int(
+        config, "bluetooth_proxy.trace_sample", BLE_TRACE_DEFAULT_SAMPLE, 0, 1000000);
+    if (trace_sample > 0) {
+        uint64_t trace_file_mb = (uint64_t)esphome_config_get_int(
+            config, "bluetooth_proxy.trace_file_max_mb", BLE_TRACE_DEFAULT_FILE_MAX_MB, 1, 1024);
+        state->trace = ble_trace_create(
+            trace_sample, esphome_config_get_string(config, "bluetooth_proxy.trace_file", ""),
+            trace_file_mb * 1024 * 1024);
+    }
+    esphome_rcu_read_unlock(rcu);
+
     /* Start flush thread */
     state->flush_thread_running = true;
-    if (pthread_create(&state->flush_thread, NULL, flush_thread_func, state) != 0) {
+    if (esphome_thread_create(&state->flush_thread, ESPHOME_THREAD_PIPELINE, "ble-flush",
+                              flush_thread_func, state) != 0) {
         fprintf(stderr, "[bluetooth_proxy] Failed to create flush thread\n");
+        ble_scanner_free(state->scanner);
+        ble_ranging_free(state->ranging);
+        ble_trace_free(state->trace);
+        ble_aggregator_free(state->aggregator);
+        free(state->upstreams);
+        free(state->upstream_password);
+        free((void *)state->params);
         pthread_mutex_destroy(&state->batch_mutex);
+        pthread_mutex_destroy(&state->decoded_mutex);
         free(state);
         return -1;
     }
 
-    /* Initialize BLE scanner */
-    state->scanner = ble_scanner_init(on_ble_advertisement, ctx);
-    if (!state->scanner) {
-        fprintf(stderr, "[bluetooth_proxy] Warning: Failed to initialize BLE scanner\n");
-        fprintf(stderr, "[bluetooth_proxy] Plugin will run without BLE scanning\n");
-        /* Don't fail - plugin can still handle subscription messages */
-    }
-
     /* Store in context */
     ctx->plugin_data = state;
 
+    /* Pick up new settings on SIGHUP */
+    esphome_config_watch(on_config_reload, state);
+
+    if (state->aggregator) {
+        esphome_metrics_register("aggregator", aggregator_metrics_dump, state->aggregator);
+    }
+    if (state->trace) {
+        esphome_metrics_register("trace", trace_metrics_dump, state->trace);
+    }
+    if (state->ranging) {
+        esphome_metrics_register("ranging", ranging_metrics_dump, state->ranging);
+    }
+
     printf("[bluetooth_proxy] Plugin initialized successfully\n");
     printf("[bluetooth_proxy] Device: %s\n", ctx->config->device_name);
 
@@ -237,6 +1027,13 @@ static void bluetooth_proxy_cleanup(esphome_plugin_context_t *ctx) {
     if (ctx->plugin_data) {
         bluetooth_proxy_state_t *state = (bluetooth_proxy_state_t *)ctx->plugin_data;
 
+        /* No reload may publish parameters past this point */
+        esphome_config_unwatch(on_config_reload, state);
+
+        /* Stop the upstream thread before the aggregator it feeds */
+        ble_upstream_stop(state->upstream);
+        state->upstream = NULL;
+
         /* Stop flush thread */
         if (state->flush_thread_running) {
             state->flush_thread_running = false;
@@ -248,9 +1045,30 @@ static void bluetooth_proxy_cleanup(esphome_plugin_context_t *ctx) {
             ble_scanner_free(state->scanner);
         }
 
+        /* The scanner that updated it is gone */
+        if (state->ranging) {
+            esphome_metrics_unregister(ranging_metrics_dump, state->ranging);
+            ble_ranging_free(state->ranging);
+        }
+
+        if (state->aggregator) {
+            esphome_metrics_unregister(aggregator_metrics_dump, state->aggregator);
+            ble_aggregator_free(state->aggregator);
+        }
+        free(state->upstreams);
+        free(state->upstream_password);
+
+        /* Nothing feeds the batch any more */
+        if (state->trace) {
+            esphome_metrics_unregister(trace_metrics_dump, state->trace);
+            ble_trace_free(state->trace);
+        }
+
         /* Cleanup batching */
         pthread_mutex_destroy(&state->batch_mutex);
+        pthread_mutex_destroy(&state->decoded_mutex);
 
+        free((void *)state->params);
         free(state);
         ctx->plugin_data = NULL;
     }
@@ -269,16 +1087,31 @@ static int handle_subscribe_ble_advertisements(esphome_plugin_context_t *ctx) {
         return -1;
     }
 
-    if (!state->scanner) {
+    if (!state->scanner && !state->upstreams) {
         fprintf(stderr, "[bluetooth_proxy] Cannot subscribe: BLE scanner not initialized\n");
         return -1;
     }
 
     if (!state->subscribed) {
         /* Start BLE scanning */
-        if (ble_scanner_start(state->scanner) < 0) {
+        if (state->scanner && ble_scanner_start(state->scanner) < 0) {
             fprintf(stderr, "[bluetooth_proxy] Failed to start BLE scanning\n");
-            return -1;
+            if (!state->upstreams) {
+                return -1;
+            }
+        }
+
+        /* Connect to the upstream proxies */
+        if (state->upstreams) {
+            char client_name[ESPHOME_MAX_STRING_LEN];
+            snprintf(client_name, sizeof(client_name), "%.100s (aggregator)",
+                     ctx->config->device_name);
+            state->upstream = ble_upstream_start(state->upstreams, client_name,
+                                                 state->upstream_password,
+                                                 on_upstream_advertisement, ctx);
+            if (!state->upstream) {
+                fprintf(stderr, "[bluetooth_proxy] Failed to start upstream connections\n");
+            }
         }
 
         state->subscribed = true;
@@ -298,13 +1131,16 @@ static int handle_unsubscribe_ble_advertisements(esphome_plugin_context_t *ctx)
 
     printf("[bluetooth_proxy] Received UNSUBSCRIBE_BLUETOOTH_LE_ADVERTISEMENTS_REQUEST\n");
 
-    if (!state || !state->scanner) {
+    if (!state || (!state->scanner && !state->upstreams)) {
         return 0; /* Nothing to do */
     }
 
     if (state->subscribed) {
+        ble_upstream_stop(state->upstream);
+        state->upstream = NULL;
+
         /* Stop BLE scanning */
-        if (ble_scanner_stop(state->scanner) < 0) {
+        if (state->scanner && ble_scanner_stop(state->scanner) < 0) {
             fprintf(stderr, "[bluetooth_proxy] Failed to stop BLE scanning\n");
             return -1;
         }
@@ -347,17 +1183,33 @@ static int bluetooth_proxy_handle_message(esphome_plugin_context_t *ctx,
     }
 }
 
+/* Messages owned by this plugin */
+static const uint32_t bluetooth_proxy_messages[] = {
+    ESPHOME_MSG_SUBSCRIBE_BLUETOOTH_LE_ADVERTISEMENTS_REQUEST,
+    ESPHOME_MSG_UNSUBSCRIBE_BLUETOOTH_LE_ADVERTISEMENTS_REQUEST,
+};
+
 /**
  * Register the plugin
  *
  * This macro uses GCC constructor attribute to auto-register
- * the plugin when the binary loads.
- */
-ESPHOME_PLUGIN_REGISTER(bluetooth_proxy_plugin, "BluetoothProxy", "1.0.0",
-    bluetooth_proxy_init,
-    bluetooth_proxy_cleanup,
-    bluetooth_proxy_handle_message,
-    bluetooth_proxy_configure_device_info,
-    NULL,  /* No entities exposed by this plugin */
-    NULL
+ * the plugin when the binary loads. Subscribing starts the HCI scanner,
+ * which can block for seconds, so messages run on a dedicated executor
+ * instead of the client's receive thread. The plugin is initialized on the
+ * first subscription only, so devices whose clients never use the proxy
+ * do not open the HCI transport or run the flush thread.
+ */
+ESPHOME_PLUGIN_REGISTER_EX(bluetooth_proxy_plugin,
+    .name = "BluetoothProxy",
+    .version = "1.0.0",
+    .init = bluetooth_proxy_init,
+    .cleanup = bluetooth_proxy_cleanup,
+    .handle_message = bluetooth_proxy_handle_message,
+    .configure_device_info = bluetooth_proxy_configure_device_info,
+    .list_entities = bluetooth_proxy_list_entities,
+    .subscribe_states = bluetooth_proxy_subscribe_states,
+    .message_types = bluetooth_proxy_messages,
+    .message_type_count = sizeof(bluetooth_proxy_messages) / sizeof(bluetooth_proxy_messages[0]),
+    .executor = ESPHOME_PLUGIN_EXECUTOR_DEDICATED,
+    .lazy_init = true
 );
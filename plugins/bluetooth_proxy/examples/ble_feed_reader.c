@@ -0,0 +1,67 @@
+/**
+ * @file ble_feed_reader.c
+ * @brief Example consumer of the shared-memory advertisement feed
+ *
+ * Prints every advertisement the running esphome-linux scanner processes:
+ *
+ *   ble-feed-reader [-x] [name]
+ *
+ * With -x each line ends with the AD data in hex, which makes the output
+ * a trace for tools/ble_ad_replay.c. Reopens the feed when esphome-linux
+ * restarts.
+ */
+
+#include "ble_feed.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+    int arg = 1;
+    int hex = 0;
+
+    if (arg < argc && strcmp(argv[arg], "-x") == 0) {
+        hex = 1;
+        arg++;
+    }
+    const char *name = arg < argc ? argv[arg] : BLE_FEED_DEFAULT_NAME;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    for (;;) {
+        ble_feed_reader_t *reader = ble_feed_reader_open(name);
+        if (!reader) {
+            sleep(1);
+            continue;
+        }
+
+        fprintf(stderr, "Reading %s\n", name);
+
+        int ret;
+        while ((ret = ble_feed_reader_wait(reader, 1000)) >= 0) {
+            ble_feed_record_t record;
+
+            while (ble_feed_reader_next(reader, &record) == 1) {
+                printf("%llu.%06llu %02X:%02X:%02X:%02X:%02X:%02X %4d dBm %2u bytes hash %08x",
+                       (unsigned long long)(record.timestamp_ns / 1000000000ULL),
+                       (unsigned long long)(record.timestamp_ns / 1000 % 1000000),
+                       record.address[0], record.address[1], record.address[2],
+                       record.address[3], record.address[4], record.address[5],
+                       record.rssi, record.data_len, record.data_hash);
+                if (hex) {
+                    putchar(' ');
+                    for (unsigned i = 0; i < record.data_len && i < BLE_FEED_DATA_MAX; i++) {
+                        printf("%02X", record.data[i]);
+                    }
+                }
+                putchar('\n');
+            }
+        }
+
+        fprintf(stderr, "Feed closed (%llu advertisements lost), reopening\n",
+                (unsigned long long)ble_feed_reader_lost(reader));
+        ble_feed_reader_close(reader);
+    }
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+/**
+ * @file ble_history_query.c
+ * @brief Query tool for the advertisement history log
+ *
+ * Lists the devices in the log, or prints one device's records, newest
+ * first, with the gap to the previous record:
+ *
+ *   ble-history [-H hours] [-n max] file [AA:BB:CC:DD:EE:FF]
+ */
+
+#include "ble_history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define QUERY_DEFAULT_MAX 100000
+
+static uint64_t realtime_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void format_time(uint64_t time_ms, char *buf, size_t size) {
+    time_t seconds = (time_t)(time_ms / 1000);
+    struct tm tm;
+
+    localtime_r(&seconds, &tm);
+    size_t len = strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buf + len, size - len, ".%03u", (unsigned)(time_ms % 1000));
+}
+
+static int compare_last_seen(const void *a, const void *b) {
+    const ble_history_device_t *da = (const ble_history_device_t *)a;
+    const ble_history_device_t *db = (const ble_history_device_t *)b;
+    return da->last_ms < db->last_ms ? 1 : da->last_ms > db->last_ms ? -1 : 0;
+}
+
+static int list_devices(ble_history_reader_t *reader) {
+    ble_history_device_t *devices = calloc(BLE_HISTORY_INDEX_SIZE, sizeof(*devices));
+    if (!devices) {
+        return 1;
+    }
+
+    int count = ble_history_devices(reader, devices, BLE_HISTORY_INDEX_SIZE);
+    qsort(devices, (size_t)count, sizeof(*devices), compare_last_seen);
+
+    for (int i = 0; i < count; i++) {
+        char when[32];
+        format_time(devices[i].last_ms, when, sizeof(when));
+        printf("%02X:%02X:%02X:%02X:%02X:%02X  last %s  %4d dBm\n",
+               devices[i].address[0], devices[i].address[1], devices[i].address[2],
+               devices[i].address[3], devices[i].address[4], devices[i].address[5],
+               when, devices[i].rssi);
+    }
+
+    free(devices);
+    return 0;
+}
+
+static int show_device(ble_history_reader_t *reader, const uint8_t *address, uint64_t since_ms,
+                       int max) {
+    ble_history_record_t *records = calloc((size_t)max, sizeof(*records));
+    if (!records) {
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int count = ble_history_query(reader, address, since_ms, records, max);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (int i = 0; i < count; i++) {
+        char when[32];
+        format_time(records[i].time_ms, when, sizeof(when));
+        printf("%s  %4d dBm  %2u bytes  hash %08x", when, records[i].rssi, records[i].data_len,
+               records[i].data_hash);
+        if (i + 1 < count) {
+            printf("  +%.1fs", (double)(records[i].time_ms - records[i + 1].time_ms) / 1000.0);
+        }
+        printf("\n");
+    }
+
+    fprintf(stderr, "%d record(s) in %.3f ms\n", count,
+            (double)(end.tv_sec - start.tv_sec) * 1000.0 +
+            (double)(end.tv_nsec - start.tv_nsec) / 1000000.0);
+    free(records);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    double hours = 24.0;
+    int max = QUERY_DEFAULT_MAX;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:n:")) != -1) {
+        if (opt == 'H') {
+            hours = atof(optarg);
+        } else if (opt == 'n') {
+            max = atoi(optarg);
+        } else {
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if (optind >= argc || argc - optind > 2 || max <= 0) {
+        fprintf(stderr, "Usage: %s [-H hours] [-n max] file [AA:BB:CC:DD:EE:FF]\n", argv[0]);
+        return 2;
+    }
+
+    ble_history_reader_t *reader = ble_history_open(argv[optind]);
+    if (!reader) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    int ret;
+    if (argc - optind == 1) {
+        ret = list_devices(reader);
+    } else {
+        unsigned int values[6];
+        uint8_t address[6];
+
+        if (sscanf(argv[optind + 1], "%x:%x:%x:%x:%x:%x", &values[0], &values[1], &values[2],
+                   &values[3], &values[4], &values[5]) != 6) {
+            fprintf(stderr, "Invalid MAC address: %s\n", argv[optind + 1]);
+            ble_history_close(reader);
+            return 2;
+        }
+        for (int i = 0; i < 6; i++) {
+            address[i] = (uint8_t)values[i];
+        }
+
+        uint64_t now = realtime_ms();
+        uint64_t range_ms = (uint64_t)(hours * 3600000.0);
+        ret = show_device(reader, address, range_ms < now ? now - range_ms : 0, max);
+    }
+
+    ble_history_close(reader);
+    return ret;
+}
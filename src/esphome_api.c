@@ -4,51 +4,41 @@
  */
 
 #include "include/esphome_api.h"
+#include "include/esphome_api_internal.h"
 #include "include/esphome_proto.h"
 #include "include/esphome_plugin_internal.h"
+#include "include/esphome_thread.h"
+#include "include/esphome_mdns.h"
+#include "include/esphome_metrics.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/in.h>
-#include <netinet/tcp.h>
+#include <linux/tcp.h>
 #include <arpa/inet.h>
 #include <time.h>
+#include <poll.h>
+#include <ctype.h>
+#include <grp.h>
+#include <pwd.h>
 
-#define RECV_BUFFER_SIZE 4096
 #define SEND_BUFFER_SIZE 8192
+#define LISTEN_POLL_MAX_MS 1000   /* Bounds how long stop waits for the listen thread */
+#define PAUSE_WAIT_MS 2000        /* How long a handoff waits for client threads to stop reading */
+#define PAUSE_SIGNAL SIGURG       /* Interrupts blocking calls for a handoff (ignored by default) */
 #define LOG_PREFIX "[esphome-api] "
 
-/**
- * Client connection state
- */
-typedef struct {
-    int fd;
-    bool authenticated;
-    uint8_t recv_buffer[RECV_BUFFER_SIZE];
-    size_t recv_pos;
-    pthread_mutex_t send_mutex;
-    pthread_t thread;
-    bool thread_running;
-    struct esphome_api_server *server;
-    struct sockaddr_in addr;  /* Client's IP address */
-} client_connection_t;
-
-/**
- * API server instance
- */
-struct esphome_api_server {
-    esphome_device_config_t config;
-    int listen_fd;
-    bool running;
-    pthread_t listen_thread;
-
-    /* Client connections */
-    client_connection_t clients[ESPHOME_MAX_CLIENTS];
-    pthread_mutex_t clients_mutex;
-};
+/* tcp_info.tcpi_data_segs_out (Linux 4.6) is in headers that have TCP_REPAIR_WINDOW (4.8) */
+#ifdef TCP_REPAIR_WINDOW
+#define HAVE_TCP_DATA_SEGS_OUT 1
+#endif
 
 /* -----------------------------------------------------------------
  * Utility functions
@@ -58,24 +48,69 @@ struct esphome_api_server {
  * Client management
  * ----------------------------------------------------------------- */
 
-static void client_init(client_connection_t *client) {
+static int client_init(client_connection_t *client, size_t recv_buffer_size) {
     memset(client, 0, sizeof(*client));
     client->fd = -1;
+
+    client->recv_buffer = malloc(recv_buffer_size);
+    if (!client->recv_buffer) {
+        return -1;
+    }
+    client->recv_buffer_size = recv_buffer_size;
+
+    client->out_buffer = malloc(ESPHOME_API_SEND_BATCH_SIZE);
+    if (!client->out_buffer) {
+        free(client->recv_buffer);
+        client->recv_buffer = NULL;
+        return -1;
+    }
+
     pthread_mutex_init(&client->send_mutex, NULL);
+    return 0;
+}
+
+/**
+ * Data segments sent on a TCP connection so far (0 if unknown)
+ */
+static uint32_t client_tcp_segments(const client_connection_t *client) {
+#ifdef HAVE_TCP_DATA_SEGS_OUT
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    if (client->fd >= 0 && !client->local &&
+        getsockopt(client->fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 &&
+        len >= offsetof(struct tcp_info, tcpi_data_segs_out) + sizeof(info.tcpi_data_segs_out)) {
+        return info.tcpi_data_segs_out;
+    }
+#else
+    (void)client;
+#endif
+    return 0;
 }
 
 static void client_close(client_connection_t *client) {
     if (client->fd >= 0) {
+        __atomic_add_fetch(&client->server->tcp_segments_closed, client_tcp_segments(client),
+                           __ATOMIC_RELAXED);
         close(client->fd);
         client->fd = -1;
     }
     client->authenticated = false;
     client->recv_pos = 0;
+    client->corked = false;
+    client->out_len = 0;
+    client->out_frames = 0;
+    client->replay_len = 0;
+    client->replay_overflow = false;
 }
 
 static void client_cleanup(client_connection_t *client) {
     client_close(client);
     pthread_mutex_destroy(&client->send_mutex);
+    free(client->recv_buffer);
+    client->recv_buffer = NULL;
+    free(client->out_buffer);
+    client->out_buffer = NULL;
 }
 
 /* -----------------------------------------------------------------
@@ -109,6 +144,90 @@ static const char* message_type_name(uint16_t msg_type) {
  * Message sending
  * ----------------------------------------------------------------- */
 
+/* Cork sections of the calling thread (esphome_api_cork()), and the
+ * clients it has held frames back for, bit per client slot */
+static __thread int thread_cork_depth;
+static __thread uint32_t thread_cork_clients;
+
+_Static_assert(ESPHOME_MAX_CLIENTS_LIMIT <= 32, "thread_cork_clients has a bit per client");
+
+/**
+ * Frames that must not wait for the end of the receive iteration
+ */
+static bool frame_is_urgent(uint16_t msg_type) {
+    switch (msg_type) {
+        case ESPHOME_MSG_PING_REQUEST:
+        case ESPHOME_MSG_PING_RESPONSE:
+        case ESPHOME_MSG_DISCONNECT_REQUEST:
+        case ESPHOME_MSG_DISCONNECT_RESPONSE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Write the coalesced frames, followed by count more if given, in one
+ * sendmsg() (caller holds send_mutex)
+ */
+static int flush_client(client_connection_t *client, const uint8_t *frame, size_t frame_len,
+                        int count) {
+    esphome_api_server_t *server = client->server;
+    struct iovec iov[2];
+    struct msghdr msg;
+    size_t total = client->out_len + frame_len;
+    int frames = client->out_frames + count;
+
+    if (total == 0) {
+        return 0;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    if (client->out_len > 0) {
+        iov[msg.msg_iovlen].iov_base = client->out_buffer;
+        iov[msg.msg_iovlen++].iov_len = client->out_len;
+    }
+    if (frame_len > 0) {
+        iov[msg.msg_iovlen].iov_base = (void *)frame;
+        iov[msg.msg_iovlen++].iov_len = frame_len;
+    }
+
+    client->out_len = 0;
+    client->out_frames = 0;
+
+    /* A handoff interrupts blocking sends with PAUSE_SIGNAL: finish the frames */
+    for (size_t done = 0; done < total; ) {
+        ssize_t sent = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+        __atomic_add_fetch(&server->send_syscalls, 1, __ATOMIC_RELAXED);
+
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            fprintf(stderr, LOG_PREFIX "Send failed: %s\n", sent < 0 ? strerror(errno) : "no progress");
+            return -1;
+        }
+
+        done += (size_t)sent;
+        while (msg.msg_iovlen > 0 && (size_t)sent >= msg.msg_iov[0].iov_len) {
+            sent -= (ssize_t)msg.msg_iov[0].iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov[0].iov_base = (uint8_t *)msg.msg_iov[0].iov_base + sent;
+            msg.msg_iov[0].iov_len -= (size_t)sent;
+        }
+    }
+
+    __atomic_add_fetch(&server->frames_sent, frames, __ATOMIC_RELAXED);
+    if (!client->local) {
+        __atomic_add_fetch(&server->tcp_frames_sent, frames, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
 static int send_message(client_connection_t *client, uint16_t msg_type,
                         const uint8_t *payload, size_t payload_len) {
     uint8_t send_buf[SEND_BUFFER_SIZE];
@@ -121,26 +240,65 @@ static int send_message(client_connection_t *client, uint16_t msg_type,
         return -1;
     }
 
-    pthread_mutex_lock(&client->send_mutex);
-    ssize_t sent = send(client->fd, send_buf, frame_len, MSG_NOSIGNAL);
-    pthread_mutex_unlock(&client->send_mutex);
+    /* The event loop sends asynchronously, in order */
+    if (client->server->uring) {
+        if (esphome_api_uring_send(client->server->uring, client, send_buf, frame_len, 1,
+                                   frame_is_urgent(msg_type)) < 0) {
+            return -1;
+        }
+        printf(LOG_PREFIX ">>> Queued %s (type=%u, payload=%zu bytes, total=%zu bytes)\n",
+               message_type_name(msg_type), msg_type, payload_len, frame_len);
+        return 0;
+    }
 
-    if (sent < 0) {
-        fprintf(stderr, LOG_PREFIX "Send failed: %s\n", strerror(errno));
-        return -1;
+    /* During a receive iteration or a cork section, frames collect until its
+     * end (or an urgent one); SOCK_SEQPACKET keeps one frame per packet */
+    esphome_api_server_t *server = client->server;
+    bool thread_corked = thread_cork_depth > 0 &&
+                         !(client->local && server->config.unix_seqpacket);
+    int result = 0;
+    bool queued = false;
+
+    pthread_mutex_lock(&client->send_mutex);
+    if ((client->corked || thread_corked) && !frame_is_urgent(msg_type) &&
+        frame_len <= ESPHOME_API_SEND_BATCH_SIZE - client->out_len) {
+        memcpy(client->out_buffer + client->out_len, send_buf, frame_len);
+        client->out_len += frame_len;
+        client->out_frames++;
+        queued = true;
+        /* A corked client thread writes them at the end of its iteration */
+        if (!client->corked) {
+            thread_cork_clients |= 1U << (client - server->clients);
+        }
+    } else {
+        result = flush_client(client, send_buf, frame_len, 1);
     }
+    pthread_mutex_unlock(&client->send_mutex);
 
-    if ((size_t)sent != frame_len) {
-        fprintf(stderr, LOG_PREFIX "Partial send: %zd/%zu\n", sent, frame_len);
+    if (result < 0) {
         return -1;
     }
 
-    printf(LOG_PREFIX ">>> Sent %s (type=%u, payload=%zu bytes, total=%zu bytes)\n",
-           message_type_name(msg_type), msg_type, payload_len, frame_len);
+    printf(LOG_PREFIX ">>> %s %s (type=%u, payload=%zu bytes, total=%zu bytes)\n",
+           queued ? "Queued" : "Sent", message_type_name(msg_type), msg_type, payload_len, frame_len);
 
     return 0;
 }
 
+/**
+ * Send messages framed back to back in one write, after anything coalesced
+ */
+static int send_frames(client_connection_t *client, const uint8_t *frames, size_t len, int count) {
+    if (client->server->uring) {
+        return esphome_api_uring_send(client->server->uring, client, frames, len, count, false);
+    }
+
+    pthread_mutex_lock(&client->send_mutex);
+    int result = flush_client(client, frames, len, count);
+    pthread_mutex_unlock(&client->send_mutex);
+    return result;
+}
+
 /* -----------------------------------------------------------------
  * Message handlers
  * ----------------------------------------------------------------- */
@@ -278,7 +436,7 @@ static void handle_list_entities_request(esphome_api_server_t *server,
     /* Find client ID */
     int client_id = -1;
     pthread_mutex_lock(&server->clients_mutex);
-    for (int i = 0; i < ESPHOME_MAX_CLIENTS; i++) {
+    for (int i = 0; i < server->max_clients; i++) {
         if (&server->clients[i] == client) {
             client_id = i;
             break;
@@ -286,13 +444,21 @@ static void handle_list_entities_request(esphome_api_server_t *server,
     }
     pthread_mutex_unlock(&server->clients_mutex);
 
-    /* Allow plugins to list their entities */
-    if (client_id >= 0) {
-        esphome_plugin_list_entities_all(server, &server->config, client_id);
+    /* Plugins' cached listings and the done message, in one write */
+    esphome_frame_buffer_t frames;
+    memset(&frames, 0, sizeof(frames));
+
+    if (client_id >= 0 &&
+        esphome_plugin_list_entities_all(server, &server->config, client_id, &frames) < 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to collect entity listings\n");
     }
 
-    /* Send done message */
-    send_message(client, ESPHOME_MSG_LIST_ENTITIES_DONE_RESPONSE, NULL, 0);
+    if (esphome_frame_buffer_append(&frames, ESPHOME_MSG_LIST_ENTITIES_DONE_RESPONSE, NULL, 0) == 0 &&
+        send_frames(client, frames.data, frames.len, frames.frames) == 0) {
+        printf(LOG_PREFIX ">>> Sent %d entity message(s) and LIST_ENTITIES_DONE_RESPONSE (%zu bytes)\n",
+               frames.frames - 1, frames.len);
+    }
+    free(frames.data);
 }
 
 static void handle_subscribe_states_request(esphome_api_server_t *server,
@@ -304,7 +470,7 @@ static void handle_subscribe_states_request(esphome_api_server_t *server,
     /* Find client ID */
     int client_id = -1;
     pthread_mutex_lock(&server->clients_mutex);
-    for (int i = 0; i < ESPHOME_MAX_CLIENTS; i++) {
+    for (int i = 0; i < server->max_clients; i++) {
         if (&server->clients[i] == client) {
             client_id = i;
             break;
@@ -401,10 +567,59 @@ static void dispatch_message(esphome_api_server_t *server,
  * Client handling
  * ----------------------------------------------------------------- */
 
-static void handle_client_data(esphome_api_server_t *server,
-                                client_connection_t *client,
-                                int client_id) {
-    while (client->recv_pos > 0) {
+/**
+ * Requests whose effect outlasts them: the process taking over on an
+ * upgrade replays them to restore the client's subscriptions
+ */
+static bool message_is_subscription(uint16_t msg_type) {
+    switch (msg_type) {
+        case ESPHOME_MSG_SUBSCRIBE_STATES_REQUEST:
+        case ESPHOME_MSG_SUBSCRIBE_LOGS_REQUEST:
+        case ESPHOME_MSG_SUBSCRIBE_HOMEASSISTANT_SERVICES_REQUEST:
+        case ESPHOME_MSG_SUBSCRIBE_HOMEASSISTANT_STATES_REQUEST:
+        case ESPHOME_MSG_SUBSCRIBE_BLUETOOTH_LE_ADVERTISEMENTS_REQUEST:
+        case ESPHOME_MSG_UNSUBSCRIBE_BLUETOOTH_LE_ADVERTISEMENTS_REQUEST:
+        case ESPHOME_MSG_SUBSCRIBE_BLUETOOTH_CONNECTIONS_FREE_REQUEST:
+        case ESPHOME_MSG_BLUETOOTH_SCANNER_SET_MODE_REQUEST:
+        case ESPHOME_MSG_SUBSCRIBE_VOICE_ASSISTANT_REQUEST:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Requests whose handlers may block: they wait for plugin startup, take
+ * plugin locks or run plugin code. The io_uring backend hands them to its
+ * worker instead of running them on the event loop.
+ */
+static bool message_may_block(uint16_t msg_type) {
+    switch (msg_type) {
+        case ESPHOME_MSG_HELLO_REQUEST:
+        case ESPHOME_MSG_CONNECT_REQUEST:
+        case ESPHOME_MSG_PING_REQUEST:
+        case ESPHOME_MSG_DISCONNECT_REQUEST:
+        case ESPHOME_MSG_SUBSCRIBE_HOMEASSISTANT_SERVICES_REQUEST:
+        case ESPHOME_MSG_SUBSCRIBE_HOMEASSISTANT_STATES_REQUEST:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static void record_subscription(client_connection_t *client, const uint8_t *frame, size_t len) {
+    if (len > sizeof(client->replay) - client->replay_len) {
+        client->replay_overflow = true;
+        return;
+    }
+    memcpy(client->replay + client->replay_len, frame, len);
+    client->replay_len += len;
+}
+
+void esphome_api_handle_client_data(esphome_api_server_t *server,
+                                    client_connection_t *client, int client_id) {
+    /* A deferred request is still running: its successors wait for it */
+    while (client->recv_pos > 0 && !client->deferred) {
         uint32_t msg_len;
         uint16_t msg_type;
 
@@ -446,11 +661,18 @@ static void handle_client_data(esphome_api_server_t *server,
             break;
         }
 
+        if (message_is_subscription(msg_type)) {
+            record_subscription(client, client->recv_buffer, total_len);
+        }
+
         /* Dispatch message */
         const uint8_t *payload = client->recv_buffer + header_len;
         size_t payload_len = msg_len;
 
-        dispatch_message(server, client, client_id, msg_type, payload, payload_len);
+        if (!server->uring || !message_may_block(msg_type) ||
+            esphome_api_uring_defer(server->uring, client_id, msg_type, payload, payload_len) < 0) {
+            dispatch_message(server, client, client_id, msg_type, payload, payload_len);
+        }
 
         /* Remove processed message from buffer */
         memmove(client->recv_buffer, client->recv_buffer + total_len,
@@ -460,6 +682,11 @@ static void handle_client_data(esphome_api_server_t *server,
     }
 }
 
+void esphome_api_dispatch_deferred(esphome_api_server_t *server, int client_id, uint16_t msg_type,
+                                   const uint8_t *payload, size_t payload_len) {
+    dispatch_message(server, &server->clients[client_id], client_id, msg_type, payload, payload_len);
+}
+
 static void *client_thread(void *arg) {
     esphome_api_server_t *server = (esphome_api_server_t *)arg;
     client_connection_t *client = NULL;
@@ -474,6 +701,28 @@ static void *client_thread(void *arg) {
  * TCP server
  * ----------------------------------------------------------------- */
 
+/**
+ * Handle the frames in a client's receive buffer, replying in one write
+ *
+ * @return 0 on success, -1 if the replies could not be sent
+ */
+static int serve_client_data(esphome_api_server_t *server, client_connection_t *client,
+                             int client_id) {
+    /* Coalesce the replies (and plugin frames) of this iteration into one write;
+     * SOCK_SEQPACKET keeps one frame per packet */
+    pthread_mutex_lock(&client->send_mutex);
+    client->corked = !(client->local && server->config.unix_seqpacket);
+    pthread_mutex_unlock(&client->send_mutex);
+
+    esphome_api_handle_client_data(server, client, client_id);
+
+    pthread_mutex_lock(&client->send_mutex);
+    client->corked = false;
+    int flushed = flush_client(client, NULL, 0, 0);
+    pthread_mutex_unlock(&client->send_mutex);
+    return flushed;
+}
+
 /**
  * Client handling thread
  */
@@ -481,19 +730,42 @@ static void *client_thread_func(void *arg) {
     client_connection_t *client = (client_connection_t *)arg;
     esphome_api_server_t *server = client->server;
     int client_id = (int)(client - server->clients);  /* Calculate client index */
+    bool lost = false;
+
+    /* SOCK_SEQPACKET: one frame per packet, MSG_TRUNC reports oversized ones */
+    int recv_flags = client->local && server->config.unix_seqpacket ? MSG_TRUNC : 0;
+
+    /* Input adopted from the previous process goes first */
+    if (client->recv_pos > 0 && serve_client_data(server, client, client_id) < 0) {
+        lost = true;
+    }
 
     /* Handle client messages */
-    while (server->running && client->fd >= 0) {
+    while (!lost && server->running && client->fd >= 0) {
+        size_t space = client->recv_buffer_size - client->recv_pos;
         ssize_t received = recv(client->fd,
                                client->recv_buffer + client->recv_pos,
-                               sizeof(client->recv_buffer) - client->recv_pos,
-                               0);
+                               space,
+                               recv_flags);
+
+        /* Woken by esphome_api_pause() */
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
 
         if (received <= 0) {
             if (received < 0) {
                 fprintf(stderr, LOG_PREFIX "Recv failed: %s\n", strerror(errno));
             }
             printf(LOG_PREFIX "Client disconnected\n");
+            lost = true;
+            break;
+        }
+
+        if ((size_t)received > space) {
+            fprintf(stderr, LOG_PREFIX "Packet of %zd bytes exceeds the receive buffer, disconnecting\n",
+                    received);
+            lost = true;
             break;
         }
 
@@ -501,79 +773,369 @@ static void *client_thread_func(void *arg) {
                received, client->recv_pos + received);
 
         client->recv_pos += received;
-        handle_client_data(server, client, client_id);
+
+        if (serve_client_data(server, client, client_id) < 0) {
+            lost = true;
+        }
+    }
+
+    /* Paused for a handoff: the connection lives on in the new process */
+    if (lost || !server->handoff) {
+        esphome_api_release_client(server, client_id);
     }
 
-    /* Cleanup client */
     pthread_mutex_lock(&server->clients_mutex);
-    client_close(client);
     client->thread_running = false;
     pthread_mutex_unlock(&server->clients_mutex);
 
     return NULL;
 }
 
-static void *listen_thread_func(void *arg) {
-    esphome_api_server_t *server = (esphome_api_server_t *)arg;
+void esphome_api_release_client(esphome_api_server_t *server, int client_id) {
+    /* Release lazy plugins used by this client */
+    esphome_plugin_client_disconnected(server, client_id);
 
-    while (server->running) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
+    /* Cleanup client; no queued send may reach the fd once it is closed */
+    client_connection_t *client = &server->clients[client_id];
+    pthread_mutex_lock(&server->clients_mutex);
+    pthread_mutex_lock(&client->send_mutex);
+    if (server->uring) {
+        esphome_api_uring_drop_sends(client);
+    }
+    client_close(client);
+    pthread_mutex_unlock(&client->send_mutex);
+    pthread_mutex_unlock(&server->clients_mutex);
+}
 
-        int client_fd = accept(server->listen_fd,
-                              (struct sockaddr *)&client_addr,
-                              &client_len);
+/**
+ * Check a local peer against the allowed users and group
+ */
+static bool peer_allowed(const esphome_api_server_t *server, const struct ucred *peer) {
+    const esphome_device_config_t *config = &server->config;
 
-        if (client_fd < 0) {
-            if (server->running) {
-                fprintf(stderr, LOG_PREFIX "Accept failed: %s\n", strerror(errno));
-            }
-            continue;
+    if (peer->uid == 0 || peer->uid == geteuid()) {
+        return true;
+    }
+    for (uint32_t i = 0; i < config->unix_allowed_uid_count; i++) {
+        if (peer->uid == config->unix_allowed_uids[i]) {
+            return true;
         }
+    }
 
+    if (config->unix_allowed_gid < 0) {
+        return false;
+    }
+    gid_t gid = (gid_t)config->unix_allowed_gid;
+    if (peer->gid == gid) {
+        return true;
+    }
+
+    /* Supplementary groups of the peer's user */
+    struct passwd pw, *result = NULL;
+    char buf[1024];
+    gid_t groups[64];
+    int ngroups = (int)(sizeof(groups) / sizeof(groups[0]));
+
+    if (getpwuid_r(peer->uid, &pw, buf, sizeof(buf), &result) != 0 || !result ||
+        getgrouplist(pw.pw_name, pw.pw_gid, groups, &ngroups) < 0) {
+        return false;
+    }
+    for (int i = 0; i < ngroups; i++) {
+        if (groups[i] == gid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int esphome_api_admit_client(esphome_api_server_t *server, int client_fd, bool local) {
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    struct ucred peer;
+
+    memset(&client_addr, 0, sizeof(client_addr));
+    memset(&peer, 0, sizeof(peer));
+
+    if (local) {
+        /* Peer credentials replace network authentication */
+        socklen_t peer_len = sizeof(peer);
+        if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) < 0 ||
+            !peer_allowed(server, &peer)) {
+            fprintf(stderr, LOG_PREFIX "Rejecting local client (pid %d, uid %u): not allowed\n",
+                    (int)peer.pid, (unsigned)peer.uid);
+            close(client_fd);
+            return -1;
+        }
+
+        printf(LOG_PREFIX "Local client connected (pid %d, uid %u)\n",
+               (int)peer.pid, (unsigned)peer.uid);
+    } else {
         /* Set TCP_NODELAY for low latency */
         int flag = 1;
         setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
 
+        getpeername(client_fd, (struct sockaddr *)&client_addr, &client_len);
         printf(LOG_PREFIX "Client connected from %s:%d\n",
                inet_ntoa(client_addr.sin_addr),
                ntohs(client_addr.sin_port));
+    }
+
+    /* Find free slot (local clients have their own) */
+    int first = local ? server->tcp_clients : 0;
+    int last = local ? server->max_clients : server->tcp_clients;
+
+    pthread_mutex_lock(&server->clients_mutex);
+    int slot = -1;
+    for (int i = first; i < last; i++) {
+        if (server->clients[i].fd < 0) {
+            client_connection_t *client = &server->clients[i];
+            client->fd = client_fd;
+            client->server = server;
+            client->addr = client_addr;  /* Store client address */
+            client->local = local;
+            client->peer = peer;
+            slot = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server->clients_mutex);
+
+    if (slot < 0) {
+        fprintf(stderr, LOG_PREFIX "Max %sclients reached, rejecting connection\n",
+                local ? "local " : "");
+        close(client_fd);
+    }
+    return slot;
+}
+
+/**
+ * Start a client's thread
+ *
+ * @return 0 on success, -1 if it cannot be created (the client is closed)
+ */
+static int start_client_thread(esphome_api_server_t *server, int slot) {
+    client_connection_t *client = &server->clients[slot];
+    client->thread_running = true;
 
-        /* Find free slot */
+    if (esphome_thread_create(&client->thread, ESPHOME_THREAD_NETWORK, "api-client",
+                              client_thread_func, client) != 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to create client thread\n");
         pthread_mutex_lock(&server->clients_mutex);
-        int slot = -1;
-        for (int i = 0; i < ESPHOME_MAX_CLIENTS; i++) {
-            if (server->clients[i].fd < 0) {
-                server->clients[i].fd = client_fd;
-                slot = i;
-                break;
+        client_close(client);
+        client->thread_running = false;
+        pthread_mutex_unlock(&server->clients_mutex);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Accept a connection on a listener and start its client thread
+ *
+ * @param local Listener is the Unix domain socket
+ */
+static void accept_client(esphome_api_server_t *server, int listen_fd, bool local) {
+    int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (client_fd < 0) {
+        if (server->running) {
+            fprintf(stderr, LOG_PREFIX "Accept failed: %s\n", strerror(errno));
+        }
+        return;
+    }
+
+    int slot = esphome_api_admit_client(server, client_fd, local);
+    if (slot >= 0) {
+        start_client_thread(server, slot);
+    }
+}
+
+static void *listen_thread_func(void *arg) {
+    esphome_api_server_t *server = (esphome_api_server_t *)arg;
+
+    while (server->running) {
+        struct pollfd fds[3];
+        nfds_t nfds = 1;
+        int unix_index = -1;
+        int mdns_index = -1;
+        int timeout_ms = LISTEN_POLL_MAX_MS;
+
+        /* The io_uring event loop accepts by itself (poll skips negative fds) */
+        fds[0].fd = server->uring ? -1 : server->listen_fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+
+        if (server->unix_fd >= 0 && !server->uring) {
+            unix_index = (int)nfds++;
+            fds[unix_index].fd = server->unix_fd;
+            fds[unix_index].events = POLLIN;
+            fds[unix_index].revents = 0;
+        }
+
+        if (server->mdns) {
+            mdns_index = (int)nfds++;
+            fds[mdns_index].fd = esphome_mdns_fd(server->mdns);
+            fds[mdns_index].events = POLLIN;
+            fds[mdns_index].revents = 0;
+
+            int mdns_timeout_ms = esphome_mdns_timeout_ms(server->mdns);
+            if (mdns_timeout_ms < timeout_ms) {
+                timeout_ms = mdns_timeout_ms;
             }
         }
-        pthread_mutex_unlock(&server->clients_mutex);
 
-        if (slot < 0) {
-            fprintf(stderr, LOG_PREFIX "Max clients reached, rejecting connection\n");
-            close(client_fd);
-            continue;
+        int ready = poll(fds, nfds, timeout_ms);
+        if (ready < 0 && errno != EINTR) {
+            fprintf(stderr, LOG_PREFIX "Poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if (!server->running) {
+            break;
+        }
+
+        if (server->mdns) {
+            esphome_mdns_process(server->mdns, ready > 0 && (fds[mdns_index].revents & POLLIN));
         }
 
-        /* Start client thread */
-        client_connection_t *client = &server->clients[slot];
-        client->server = server;
-        client->thread_running = true;
-        client->addr = client_addr;  /* Store client address */
+        if (ready <= 0) {
+            continue;
+        }
 
-        if (pthread_create(&client->thread, NULL, client_thread_func, client) != 0) {
-            fprintf(stderr, LOG_PREFIX "Failed to create client thread\n");
-            pthread_mutex_lock(&server->clients_mutex);
-            client_close(client);
-            pthread_mutex_unlock(&server->clients_mutex);
+        if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            accept_client(server, server->listen_fd, false);
+        }
+        if (unix_index >= 0 && (fds[unix_index].revents & (POLLIN | POLLERR | POLLHUP))) {
+            accept_client(server, server->unix_fd, true);
         }
     }
 
     return NULL;
 }
 
+/**
+ * Listen on the configured Unix domain socket
+ *
+ * Failure only costs local access, so it is logged and otherwise ignored.
+ */
+static void start_unix_listener(esphome_api_server_t *server) {
+    const char *path = server->config.unix_socket;
+    int type = server->config.unix_seqpacket ? SOCK_SEQPACKET : SOCK_STREAM;
+    struct sockaddr_un addr;
+    struct stat st;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, LOG_PREFIX "Unix socket path too long: %s\n", path);
+        return;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to create Unix socket: %s\n", strerror(errno));
+        return;
+    }
+
+    /* A previous instance leaves its socket file behind; never remove anything else */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to bind %s: %s\n", path, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    /* Anyone may connect; peer credentials decide who stays */
+    chmod(path, 0666);
+
+    if (listen(fd, server->max_clients - server->tcp_clients) < 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        unlink(path);
+        return;
+    }
+
+    server->unix_fd = fd;
+    printf(LOG_PREFIX "Listening on %s (%s, up to %d local clients)\n", path,
+           server->config.unix_seqpacket ? "seqpacket" : "stream",
+           server->max_clients - server->tcp_clients);
+}
+
+/**
+ * Start the built-in mDNS responder with ESPHome's TXT records
+ *
+ * Failure only costs discovery, so it is logged and otherwise ignored.
+ */
+static void start_mdns(esphome_api_server_t *server) {
+    char friendly_name[160];
+    char version[48];
+    char mac[24];
+    size_t mac_len = 0;
+
+    snprintf(friendly_name, sizeof(friendly_name), "friendly_name=%s",
+             server->config.friendly_name);
+    snprintf(version, sizeof(version), "version=%s", server->config.esphome_version);
+
+    /* ESPHome publishes the MAC as lowercase hex without separators */
+    mac_len = (size_t)snprintf(mac, sizeof(mac), "mac=");
+    for (const char *p = server->config.mac_address; *p && mac_len + 1 < sizeof(mac); p++) {
+        if (isxdigit((unsigned char)*p)) {
+            mac[mac_len++] = (char)tolower((unsigned char)*p);
+        }
+    }
+    mac[mac_len] = '\0';
+
+    esphome_mdns_config_t mdns_config;
+    memset(&mdns_config, 0, sizeof(mdns_config));
+    mdns_config.name = server->config.device_name;
+    mdns_config.port = server->port;
+    mdns_config.ipv6 = false;  /* The API socket is IPv4 only */
+    mdns_config.txt[0] = friendly_name;
+    mdns_config.txt[1] = version;
+    mdns_config.txt[2] = mac;
+    mdns_config.txt[3] = "platform=Linux";
+
+    server->mdns = esphome_mdns_init(&mdns_config);
+    if (!server->mdns) {
+        fprintf(stderr, LOG_PREFIX "mDNS responder unavailable, use an external one for discovery\n");
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Metrics
+ * ----------------------------------------------------------------- */
+
+static double per_frame(uint32_t count, uint32_t frames) {
+    return frames ? (double)count / (double)frames : 0.0;
+}
+
+static void api_metrics_dump(FILE *out, void *user_data) {
+    esphome_api_server_t *server = (esphome_api_server_t *)user_data;
+    uint32_t frames = __atomic_load_n(&server->frames_sent, __ATOMIC_RELAXED);
+    uint32_t syscalls = __atomic_load_n(&server->send_syscalls, __ATOMIC_RELAXED);
+    uint32_t tcp_frames = __atomic_load_n(&server->tcp_frames_sent, __ATOMIC_RELAXED);
+    uint32_t segments = __atomic_load_n(&server->tcp_segments_closed, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&server->clients_mutex);
+    for (int i = 0; i < server->max_clients; i++) {
+        segments += client_tcp_segments(&server->clients[i]);
+    }
+    pthread_mutex_unlock(&server->clients_mutex);
+
+    fprintf(out, "api.backend %s\n", server->uring ? "io_uring" : "threads");
+    fprintf(out, "api.frames_sent %u\n", frames);
+    fprintf(out, "api.send_syscalls %u per_frame=%.2f\n", syscalls, per_frame(syscalls, frames));
+#ifdef HAVE_TCP_DATA_SEGS_OUT
+    fprintf(out, "api.tcp_segments %u per_frame=%.2f\n", segments, per_frame(segments, tcp_frames));
+#else
+    (void)segments;
+    (void)tcp_frames;
+#endif
+}
+
 /* -----------------------------------------------------------------
  * Public API
  * ----------------------------------------------------------------- */
@@ -586,18 +1148,59 @@ esphome_api_server_t *esphome_api_init(const esphome_device_config_t *config) {
 
     server->config = *config;
     server->listen_fd = -1;
+    server->unix_fd = -1;
     server->running = false;
+    server->port = config->api_port ? config->api_port : ESPHOME_API_PORT;
+
+    uint32_t max_clients = config->max_clients ? config->max_clients : ESPHOME_MAX_CLIENTS;
+    if (max_clients > ESPHOME_MAX_CLIENTS_LIMIT) {
+        fprintf(stderr, LOG_PREFIX "max_clients %u exceeds %d, capping\n",
+                max_clients, ESPHOME_MAX_CLIENTS_LIMIT);
+        max_clients = ESPHOME_MAX_CLIENTS_LIMIT;
+    }
+    server->tcp_clients = (int)max_clients;
+
+    /* Local clients get slots of their own, within the same limit */
+    if (config->unix_socket[0] != '\0') {
+        uint32_t unix_clients = config->unix_max_clients ? config->unix_max_clients
+                                                         : ESPHOME_UNIX_MAX_CLIENTS;
+        if (unix_clients > ESPHOME_MAX_CLIENTS_LIMIT - max_clients) {
+            unix_clients = ESPHOME_MAX_CLIENTS_LIMIT - max_clients;
+            fprintf(stderr, LOG_PREFIX "Capping local clients to %u\n", unix_clients);
+        }
+        max_clients += unix_clients;
+    }
+    server->max_clients = (int)max_clients;
+
+    size_t recv_buffer_size = config->recv_buffer_size ? config->recv_buffer_size
+                                                       : ESPHOME_API_RECV_BUFFER_SIZE;
+
+    server->clients = calloc((size_t)server->max_clients, sizeof(client_connection_t));
+    if (!server->clients) {
+        free(server);
+        return NULL;
+    }
 
     pthread_mutex_init(&server->clients_mutex, NULL);
 
-    for (int i = 0; i < ESPHOME_MAX_CLIENTS; i++) {
-        client_init(&server->clients[i]);
+    for (int i = 0; i < server->max_clients; i++) {
+        if (client_init(&server->clients[i], recv_buffer_size) < 0) {
+            fprintf(stderr, LOG_PREFIX "Failed to allocate client buffers\n");
+            server->max_clients = i;
+            esphome_api_free(server);
+            return NULL;
+        }
     }
 
+    esphome_metrics_register("api", api_metrics_dump, server);
+
     return server;
 }
 
-int esphome_api_start(esphome_api_server_t *server) {
+/**
+ * Listen on the configured TCP port
+ */
+static int start_tcp_listener(esphome_api_server_t *server) {
     /* Create TCP socket */
     server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server->listen_fd < 0) {
@@ -613,7 +1216,7 @@ int esphome_api_start(esphome_api_server_t *server) {
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(ESPHOME_API_PORT);
+    addr.sin_port = htons(server->port);
     addr.sin_addr.s_addr = INADDR_ANY;
 
     if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
@@ -624,22 +1227,144 @@ int esphome_api_start(esphome_api_server_t *server) {
     }
 
     /* Listen */
-    if (listen(server->listen_fd, 2) < 0) {
+    if (listen(server->listen_fd, server->tcp_clients) < 0) {
         fprintf(stderr, LOG_PREFIX "Failed to listen: %s\n", strerror(errno));
         close(server->listen_fd);
         server->listen_fd = -1;
         return -1;
     }
 
-    printf(LOG_PREFIX "Listening on port %d\n", ESPHOME_API_PORT);
+    printf(LOG_PREFIX "Listening on port %u (up to %d clients)\n",
+           server->port, server->tcp_clients);
+    return 0;
+}
+
+int esphome_api_start(esphome_api_server_t *server) {
+    /* Listeners adopted from the previous process are already open */
+    if (server->listen_fd < 0 && start_tcp_listener(server) < 0) {
+        return -1;
+    }
+
+    if (server->config.unix_socket[0] != '\0' && server->max_clients > server->tcp_clients &&
+        server->unix_fd < 0) {
+        start_unix_listener(server);
+    }
+
+    /* Advertise the port before accepting, so discovery starts right away */
+    if (!server->config.disable_mdns) {
+        start_mdns(server);
+    }
+
+    /* Connection backend: io_uring event loop where available */
+    if (server->config.backend != ESPHOME_API_BACKEND_THREADS) {
+        server->uring = esphome_api_uring_create(server);
+        if (!server->uring && server->config.backend == ESPHOME_API_BACKEND_IO_URING) {
+            fprintf(stderr, LOG_PREFIX "io_uring backend unavailable, using a thread per client\n");
+        }
+    }
+    printf(LOG_PREFIX "Connection backend: %s\n", server->uring ? "io_uring" : "threads");
 
     /* Start listen thread */
     server->running = true;
-    pthread_create(&server->listen_thread, NULL, listen_thread_func, server);
+    if (server->uring && esphome_api_uring_start(server->uring) < 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to start the io_uring event loop, using threads\n");
+        esphome_api_uring_free(server->uring);
+        server->uring = NULL;
+    }
+    if (esphome_thread_create(&server->listen_thread, ESPHOME_THREAD_NETWORK, "api-listen",
+                              listen_thread_func, server) != 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to create listen thread\n");
+        server->running = false;
+        if (server->uring) {
+            esphome_api_uring_stop(server->uring);
+            esphome_api_uring_free(server->uring);
+            server->uring = NULL;
+        }
+        esphome_mdns_free(server->mdns);
+        server->mdns = NULL;
+        if (server->unix_fd >= 0) {
+            close(server->unix_fd);
+            server->unix_fd = -1;
+            unlink(server->config.unix_socket);
+        }
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        return -1;
+    }
+
+    /* Clients adopted from the previous process (the event loop serves its own) */
+    for (int i = 0; i < server->max_clients && !server->uring; i++) {
+        if (server->clients[i].fd >= 0) {
+            start_client_thread(server, i);
+        }
+    }
 
     return 0;
 }
 
+static void pause_signal_handler(int sig) {
+    (void)sig;
+}
+
+void esphome_api_pause(esphome_api_server_t *server) {
+    /* Interrupt blocking recv() and poll() (no SA_RESTART) */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = pause_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(PAUSE_SIGNAL, &sa, NULL);
+
+    server->handoff = true;
+    server->running = false;
+
+    pthread_kill(server->listen_thread, PAUSE_SIGNAL);
+    pthread_join(server->listen_thread, NULL);
+
+    if (server->uring) {
+        if (esphome_api_uring_pause(server->uring) < 0) {
+            fprintf(stderr, LOG_PREFIX "io_uring receives still active after %d ms\n", PAUSE_WAIT_MS);
+        }
+    } else {
+        /* A thread can miss the signal just before it blocks: repeat until it stops */
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (int i = 0; i < server->max_clients; i++) {
+            client_connection_t *client = &server->clients[i];
+
+            for (;;) {
+                pthread_mutex_lock(&server->clients_mutex);
+                bool running = client->thread_running;
+                pthread_mutex_unlock(&server->clients_mutex);
+
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                long waited_ms = (now.tv_sec - start.tv_sec) * 1000 +
+                                 (now.tv_nsec - start.tv_nsec) / 1000000;
+                if (!running || waited_ms > PAUSE_WAIT_MS) {
+                    break;
+                }
+
+                pthread_kill(client->thread, PAUSE_SIGNAL);
+                usleep(10000);
+            }
+
+            /* Still running: left out of the handoff, shut down by esphome_api_stop() */
+            if (client->fd >= 0 && !client->thread_running) {
+                pthread_join(client->thread, NULL);
+            } else if (client->fd >= 0) {
+                fprintf(stderr, LOG_PREFIX "Client %d is busy, not handing it over\n", i);
+            }
+        }
+    }
+
+    /* The new process announces the same name right away */
+    esphome_mdns_free_silent(server->mdns);
+    server->mdns = NULL;
+
+    printf(LOG_PREFIX "Paused for a handoff\n");
+}
+
 void esphome_api_stop(esphome_api_server_t *server) {
     if (!server) {
         return;
@@ -653,13 +1378,29 @@ void esphome_api_stop(esphome_api_server_t *server) {
         close(server->listen_fd);
         server->listen_fd = -1;
     }
+    if (server->unix_fd >= 0) {
+        close(server->unix_fd);
+        server->unix_fd = -1;
+        unlink(server->config.unix_socket);
+    }
 
-    /* Wait for listen thread */
-    pthread_join(server->listen_thread, NULL);
+    /* Wait for listen thread (esphome_api_pause() already did) */
+    if (!server->handoff) {
+        pthread_join(server->listen_thread, NULL);
+    }
+
+    /* The event loop releases the clients it served */
+    if (server->uring) {
+        esphome_api_uring_stop(server->uring);
+    }
+
+    /* The listen thread drove the responder, say goodbye now */
+    esphome_mdns_free(server->mdns);
+    server->mdns = NULL;
 
     /* Close all client sockets FIRST to unblock recv() in client threads */
     pthread_mutex_lock(&server->clients_mutex);
-    for (int i = 0; i < ESPHOME_MAX_CLIENTS; i++) {
+    for (int i = 0; i < server->max_clients; i++) {
         if (server->clients[i].fd >= 0) {
             shutdown(server->clients[i].fd, SHUT_RDWR);
             close(server->clients[i].fd);
@@ -669,7 +1410,7 @@ void esphome_api_stop(esphome_api_server_t *server) {
     pthread_mutex_unlock(&server->clients_mutex);
 
     /* Now wait for all client threads to finish (they should exit quickly now) */
-    for (int i = 0; i < ESPHOME_MAX_CLIENTS; i++) {
+    for (int i = 0; i < server->max_clients; i++) {
         if (server->clients[i].thread_running) {
             pthread_join(server->clients[i].thread, NULL);
         }
@@ -681,12 +1422,16 @@ void esphome_api_free(esphome_api_server_t *server) {
         return;
     }
 
-    for (int i = 0; i < ESPHOME_MAX_CLIENTS; i++) {
+    esphome_metrics_unregister(api_metrics_dump, server);
+    esphome_api_uring_free(server->uring);
+
+    for (int i = 0; i < server->max_clients; i++) {
         client_cleanup(&server->clients[i]);
     }
 
     pthread_mutex_destroy(&server->clients_mutex);
 
+    free(server->clients);
     free(server);
 }
 
@@ -698,7 +1443,7 @@ int esphome_api_send_to_client(esphome_api_server_t *server,
                                 uint16_t msg_type,
                                 const uint8_t *payload,
                                 size_t payload_len) {
-    if (!server || client_id < 0 || client_id >= ESPHOME_MAX_CLIENTS) {
+    if (!server || client_id < 0 || client_id >= server->max_clients) {
         return -1;
     }
 
@@ -732,7 +1477,7 @@ int esphome_api_broadcast(esphome_api_server_t *server,
 
     pthread_mutex_lock(&server->clients_mutex);
 
-    for (int i = 0; i < ESPHOME_MAX_CLIENTS; i++) {
+    for (int i = 0; i < server->max_clients; i++) {
         client_connection_t *client = &server->clients[i];
         if (client->fd >= 0) {
             if (send_message(client, msg_type, payload, payload_len) == 0) {
@@ -746,6 +1491,60 @@ int esphome_api_broadcast(esphome_api_server_t *server,
     return sent_count;
 }
 
+void esphome_api_cork(esphome_api_server_t *server) {
+    (void)server;
+    thread_cork_depth++;
+}
+
+void esphome_api_uncork(esphome_api_server_t *server) {
+    if (!server || thread_cork_depth == 0 || --thread_cork_depth > 0) {
+        return;
+    }
+
+    uint32_t pending = thread_cork_clients;
+    thread_cork_clients = 0;
+    if (pending == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&server->clients_mutex);
+    for (int i = 0; i < server->max_clients; i++) {
+        if (!(pending & (1U << i))) {
+            continue;
+        }
+
+        client_connection_t *client = &server->clients[i];
+        pthread_mutex_lock(&client->send_mutex);
+        /* Closed meanwhile (frames dropped), or taken over by a receive iteration */
+        if (client->fd >= 0 && !client->corked) {
+            flush_client(client, NULL, 0, 0);
+        }
+        pthread_mutex_unlock(&client->send_mutex);
+    }
+    pthread_mutex_unlock(&server->clients_mutex);
+}
+
+/**
+ * Get the clients currently connected
+ */
+uint32_t esphome_api_connected_clients(esphome_api_server_t *server) {
+    uint32_t mask = 0;
+
+    if (!server) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&server->clients_mutex);
+    for (int i = 0; i < server->max_clients && i < 32; i++) {
+        if (server->clients[i].fd >= 0) {
+            mask |= 1U << i;
+        }
+    }
+    pthread_mutex_unlock(&server->clients_mutex);
+
+    return mask;
+}
+
 /**
  * Get the hostname/IP address of a connected client
  */
@@ -754,7 +1553,7 @@ int esphome_api_get_client_host(esphome_api_server_t *server,
                                  char *host_buf,
                                  size_t host_buf_size) {
     if (!server || !host_buf || host_buf_size == 0 ||
-        client_id < 0 || client_id >= ESPHOME_MAX_CLIENTS) {
+        client_id < 0 || client_id >= server->max_clients) {
         return -1;
     }
 
@@ -767,7 +1566,7 @@ int esphome_api_get_client_host(esphome_api_server_t *server,
     }
 
     /* Convert IP address to string */
-    const char *ip_str = inet_ntoa(client->addr.sin_addr);
+    const char *ip_str = client->local ? "localhost" : inet_ntoa(client->addr.sin_addr);
     if (!ip_str) {
         pthread_mutex_unlock(&server->clients_mutex);
         return -1;
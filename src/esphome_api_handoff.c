@@ -0,0 +1,464 @@
+/**
+ * @file esphome_api_handoff.c
+ * @brief Connection handoff to a new process, for upgrades without reconnects
+ *
+ * The running process starts the new binary with one end of a
+ * SOCK_SEQPACKET socket pair. Once the new process reports ready, the
+ * running one pauses its server and sends the listening sockets and then
+ * every client connection with SCM_RIGHTS, one packet each. A client's
+ * packet carries its authentication state, the subscription requests it
+ * made and its unparsed input. The new process replays the subscriptions
+ * ahead of the input, so plugins rebuild their per-client state through
+ * their usual message handlers; the clients see a short pause in traffic
+ * instead of a disconnect.
+ */
+
+#include "include/esphome_api.h"
+#include "include/esphome_api_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#define LOG_PREFIX "[esphome-api] "
+
+#define HANDOFF_MAGIC      0x45484f46u    /* "EHOF" */
+#define HANDOFF_VERSION    1              /* Bump when a packet layout changes */
+#define HANDOFF_WAIT_MS    30000          /* Pause and plugin cleanup of the previous process */
+#define HANDOFF_SNDBUF     (1024 * 1024)  /* Room for a client packet with a large partial frame */
+
+typedef enum {
+    HANDOFF_READY = 1,             /* New -> previous process */
+    HANDOFF_LISTENERS,             /* TCP listener, then the Unix one if any */
+    HANDOFF_CLIENT,                /* One client's socket */
+} handoff_type_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t type;
+    uint32_t count;                /* HANDOFF_LISTENERS: client packets that follow */
+} handoff_header_t;
+
+/* Followed by replay_len bytes of subscription requests and input_len bytes of input */
+typedef struct {
+    handoff_header_t header;
+    uint32_t slot;
+    uint8_t local;
+    uint8_t authenticated;
+    struct sockaddr_in addr;
+    struct ucred peer;
+    uint32_t replay_len;
+    uint32_t input_len;
+} handoff_client_t;
+
+static void header_init(handoff_header_t *header, handoff_type_t type, uint32_t count) {
+    header->magic = HANDOFF_MAGIC;
+    header->version = HANDOFF_VERSION;
+    header->type = type;
+    header->count = count;
+}
+
+/**
+ * Send one packet with up to two file descriptors
+ */
+static int send_packet(int channel, struct iovec *iov, int iovcnt, const int *fds, int nfds) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size_t)iovcnt;
+
+    if (nfds > 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE((size_t)nfds * sizeof(int));
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN((size_t)nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, (size_t)nfds * sizeof(int));
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(channel, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    if (sent < 0) {
+        fprintf(stderr, LOG_PREFIX "Handoff send failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Receive one packet and the file descriptors that came with it
+ *
+ * @return Packet length, 0 if the peer is gone, -1 on error or timeout
+ */
+static ssize_t recv_packet(int channel, void *buf, size_t size, int *fds, int *nfds,
+                           bool *truncated, int timeout_ms) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct iovec iov = { buf, size };
+    struct msghdr msg;
+    struct pollfd pfd = { channel, POLLIN, 0 };
+
+    *nfds = 0;
+    *truncated = false;
+
+    int ready;
+    do {
+        ready = poll(&pfd, 1, timeout_ms);
+    } while (ready < 0 && errno == EINTR);
+    if (ready <= 0) {
+        fprintf(stderr, LOG_PREFIX "Handoff timed out\n");
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t len;
+    do {
+        len = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+    } while (len < 0 && errno == EINTR);
+
+    if (len < 0) {
+        fprintf(stderr, LOG_PREFIX "Handoff receive failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            *nfds = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(fds, CMSG_DATA(cmsg), (size_t)*nfds * sizeof(int));
+        }
+    }
+
+    *truncated = (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0;
+    return len;
+}
+
+static bool header_valid(const handoff_header_t *header, ssize_t len, size_t size,
+                         handoff_type_t type) {
+    return len >= (ssize_t)size && header->magic == HANDOFF_MAGIC &&
+           header->version == HANDOFF_VERSION && header->type == (uint32_t)type;
+}
+
+/* -----------------------------------------------------------------
+ * Previous process
+ * ----------------------------------------------------------------- */
+
+int esphome_api_handoff_wait_ready(int channel, int timeout_ms) {
+    handoff_header_t header;
+    int fds[2];
+    int nfds;
+    bool truncated;
+
+    memset(&header, 0, sizeof(header));
+    ssize_t len = recv_packet(channel, &header, sizeof(header), fds, &nfds, &truncated, timeout_ms);
+    if (len == 0) {
+        fprintf(stderr, LOG_PREFIX "New process exited before taking over\n");
+    }
+    if (len <= 0) {
+        return -1;
+    }
+
+    if (!header_valid(&header, len, sizeof(header), HANDOFF_READY)) {
+        fprintf(stderr, LOG_PREFIX "New process speaks handoff version %u, not %u\n",
+                header.magic == HANDOFF_MAGIC ? header.version : 0, HANDOFF_VERSION);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Close a client handed over, in this process only (no shutdown)
+ */
+static void client_forget(esphome_api_server_t *server, client_connection_t *client) {
+    pthread_mutex_lock(&server->clients_mutex);
+    pthread_mutex_lock(&client->send_mutex);
+    close(client->fd);
+    client->fd = -1;
+    client->authenticated = false;
+    client->recv_pos = 0;
+    client->replay_len = 0;
+    client->replay_overflow = false;
+    pthread_mutex_unlock(&client->send_mutex);
+    pthread_mutex_unlock(&server->clients_mutex);
+}
+
+int esphome_api_handoff(esphome_api_server_t *server, int channel) {
+    /* The event loop sends what is queued and leaves the connections open */
+    if (server->uring) {
+        esphome_api_uring_stop(server->uring);
+    }
+
+    int sndbuf = HANDOFF_SNDBUF;
+    setsockopt(channel, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    /* Clients whose subscriptions cannot be replayed have to reconnect */
+    uint32_t count = 0;
+    for (int i = 0; i < server->max_clients; i++) {
+        client_connection_t *client = &server->clients[i];
+        if (client->fd < 0 || client->thread_running) {
+            continue;
+        }
+        if (client->replay_overflow) {
+            fprintf(stderr, LOG_PREFIX "Client %d made too many subscription requests to replay, "
+                    "not handing it over\n", i);
+            continue;
+        }
+        count++;
+    }
+
+    handoff_header_t header;
+    header_init(&header, HANDOFF_LISTENERS, count);
+    struct iovec iov[3] = { { &header, sizeof(header) } };
+    int listeners[2] = { server->listen_fd, server->unix_fd };
+    if (send_packet(channel, iov, 1, listeners, server->unix_fd >= 0 ? 2 : 1) < 0) {
+        return -1;
+    }
+
+    /* The new process accepts from here on; keep the socket file for it */
+    close(server->listen_fd);
+    server->listen_fd = -1;
+    if (server->unix_fd >= 0) {
+        close(server->unix_fd);
+        server->unix_fd = -1;
+    }
+
+    int handed = 0;
+    for (int i = 0; i < server->max_clients && (uint32_t)handed < count; i++) {
+        client_connection_t *client = &server->clients[i];
+        if (client->fd < 0 || client->thread_running || client->replay_overflow) {
+            continue;
+        }
+
+        handoff_client_t record;
+        memset(&record, 0, sizeof(record));
+        header_init(&record.header, HANDOFF_CLIENT, 0);
+        record.slot = (uint32_t)i;
+        record.local = client->local;
+        record.authenticated = client->authenticated;
+        record.addr = client->addr;
+        record.peer = client->peer;
+        record.replay_len = (uint32_t)client->replay_len;
+        record.input_len = (uint32_t)client->recv_pos;
+
+        iov[0].iov_base = &record;
+        iov[0].iov_len = sizeof(record);
+        iov[1].iov_base = client->replay;
+        iov[1].iov_len = client->replay_len;
+        iov[2].iov_base = client->recv_buffer;
+        iov[2].iov_len = client->recv_pos;
+
+        if (send_packet(channel, iov, 3, &client->fd, 1) < 0) {
+            return -1;
+        }
+        client_forget(server, client);
+        handed++;
+    }
+
+    printf(LOG_PREFIX "Handed over %d client(s)\n", handed);
+    return handed;
+}
+
+/* -----------------------------------------------------------------
+ * New process
+ * ----------------------------------------------------------------- */
+
+/**
+ * Keep the TCP listener if it is on the configured port
+ */
+static void adopt_tcp_listener(esphome_api_server_t *server, int fd) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    if (getsockname(fd, (struct sockaddr *)&addr, &len) < 0 || addr.sin_family != AF_INET ||
+        ntohs(addr.sin_port) != server->port) {
+        printf(LOG_PREFIX "API port changed, listening anew\n");
+        close(fd);
+        return;
+    }
+
+    server->listen_fd = fd;
+    printf(LOG_PREFIX "Adopted the listener on port %u\n", server->port);
+}
+
+/**
+ * Keep the Unix domain socket listener if the settings still match
+ */
+static void adopt_unix_listener(esphome_api_server_t *server, int fd) {
+    struct sockaddr_un addr;
+    socklen_t len = sizeof(addr);
+    int type = 0;
+    socklen_t type_len = sizeof(type);
+    bool wanted = server->config.unix_socket[0] != '\0' && server->max_clients > server->tcp_clients;
+
+    memset(&addr, 0, sizeof(addr));
+    if (getsockname(fd, (struct sockaddr *)&addr, &len) < 0 ||
+        getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len) < 0) {
+        close(fd);
+        return;
+    }
+
+    if (wanted && strcmp(addr.sun_path, server->config.unix_socket) == 0 &&
+        type == (server->config.unix_seqpacket ? SOCK_SEQPACKET : SOCK_STREAM)) {
+        server->unix_fd = fd;
+        printf(LOG_PREFIX "Adopted the listener on %s\n", addr.sun_path);
+        return;
+    }
+
+    /* Left behind for us by the previous process; a new one is bound if configured */
+    struct stat st;
+    if (strcmp(addr.sun_path, server->config.unix_socket) != 0 &&
+        lstat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(addr.sun_path);
+    }
+    printf(LOG_PREFIX "Unix socket settings changed, not adopting %s\n", addr.sun_path);
+    close(fd);
+}
+
+/**
+ * Put a client into its previous slot, or another free one of its kind
+ *
+ * @return Client index, or -1 if there is none
+ */
+static int adopt_slot(esphome_api_server_t *server, uint32_t slot, bool local) {
+    int first = local ? server->tcp_clients : 0;
+    int last = local ? server->max_clients : server->tcp_clients;
+
+    if ((int)slot >= first && (int)slot < last && server->clients[slot].fd < 0) {
+        return (int)slot;
+    }
+    for (int i = first; i < last; i++) {
+        if (server->clients[i].fd < 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Receive one client and queue its replayed subscriptions and input
+ *
+ * @return 1 if adopted, 0 if dropped, -1 if the channel failed
+ */
+static int adopt_client(esphome_api_server_t *server, int channel, uint8_t *buf, size_t size) {
+    int fds[2];
+    int nfds;
+    bool truncated;
+
+    ssize_t len = recv_packet(channel, buf, size, fds, &nfds, &truncated, HANDOFF_WAIT_MS);
+    if (len <= 0) {
+        return -1;
+    }
+
+    handoff_client_t record;
+    memcpy(&record, buf, len < (ssize_t)sizeof(record) ? (size_t)len : sizeof(record));
+
+    if (nfds != 1 || !header_valid(&record.header, len, sizeof(record), HANDOFF_CLIENT)) {
+        fprintf(stderr, LOG_PREFIX "Malformed handoff packet\n");
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        return -1;
+    }
+
+    size_t data_len = (size_t)record.replay_len + record.input_len;
+    int slot = adopt_slot(server, record.slot, record.local);
+    client_connection_t *client = slot >= 0 ? &server->clients[slot] : NULL;
+
+    if (!client || truncated || sizeof(record) + data_len != (size_t)len ||
+        data_len > client->recv_buffer_size) {
+        fprintf(stderr, LOG_PREFIX "Cannot adopt client %u (%s), closing it\n", record.slot,
+                client ? "input exceeds the receive buffer" : "no free slot");
+        close(fds[0]);
+        return 0;
+    }
+
+    client->fd = fds[0];
+    client->server = server;
+    client->local = record.local;
+    client->authenticated = record.authenticated;
+    client->addr = record.addr;
+    client->peer = record.peer;
+
+    /* Subscriptions first: dispatching them records them again for the next upgrade */
+    memcpy(client->recv_buffer, buf + sizeof(record), data_len);
+    client->recv_pos = data_len;
+
+    printf(LOG_PREFIX "Adopted client %d (%u bytes of subscriptions, %u bytes of input)\n",
+           slot, record.replay_len, record.input_len);
+    return 1;
+}
+
+int esphome_api_adopt(esphome_api_server_t *server, int channel) {
+    handoff_header_t header;
+    int fds[2];
+    int nfds;
+    bool truncated;
+
+    header_init(&header, HANDOFF_READY, 0);
+    struct iovec iov = { &header, sizeof(header) };
+    if (send_packet(channel, &iov, 1, NULL, 0) < 0) {
+        return -1;
+    }
+
+    printf(LOG_PREFIX "Waiting for the previous process to hand over\n");
+    memset(&header, 0, sizeof(header));
+    ssize_t len = recv_packet(channel, &header, sizeof(header), fds, &nfds, &truncated,
+                              HANDOFF_WAIT_MS);
+    if (len <= 0 || nfds < 1 || !header_valid(&header, len, sizeof(header), HANDOFF_LISTENERS)) {
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        return -1;
+    }
+
+    adopt_tcp_listener(server, fds[0]);
+    if (nfds > 1) {
+        adopt_unix_listener(server, fds[1]);
+    }
+
+    size_t size = sizeof(handoff_client_t) + ESPHOME_API_REPLAY_SIZE +
+                  server->clients[0].recv_buffer_size;
+    uint8_t *buf = malloc(size);
+    if (!buf) {
+        return 0;
+    }
+
+    /* A failure now leaves the rest to reconnect; what was adopted is kept */
+    int adopted = 0;
+    for (uint32_t i = 0; i < header.count; i++) {
+        int result = adopt_client(server, channel, buf, size);
+        if (result < 0) {
+            fprintf(stderr, LOG_PREFIX "Handoff interrupted after %d client(s)\n", adopted);
+            break;
+        }
+        adopted += result;
+    }
+
+    free(buf);
+    return adopted;
+}
@@ -0,0 +1,1152 @@
+/**
+ * @file esphome_api_uring.c
+ * @brief io_uring connection backend for the API server
+ *
+ * One thread serves every client: multishot accept on the listeners,
+ * multishot recv into a ring of provided buffers, and sends queued per
+ * client and submitted as chains of linked SQEs, so a burst of frames
+ * costs one io_uring_enter() instead of a send() each. Cheap requests
+ * (handshake, ping) are handled on the event loop thread; those that may
+ * block (device info, entity listing, state subscription, plugin messages)
+ * run on worker threads, which hand the client back to the loop with a
+ * NOP on the ring. Workers and plugins send through the same queues.
+ *
+ * Uses the raw system calls (no liburing). Where the headers or the
+ * kernel lack multishot recv or provided buffer rings (Linux < 6.0, the
+ * T31 toolchain), esphome_api_uring_create() returns NULL and the server
+ * uses a thread per client.
+ */
+
+#include "include/esphome_api_internal.h"
+#include "include/esphome_plugin_internal.h"
+#include "include/esphome_thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+/* Multishot recv (6.0) implies multishot accept and provided buffer rings (5.19) */
+#if defined(IORING_RECV_MULTISHOT)
+#define HAVE_IO_URING_MULTISHOT 1
+#endif
+
+#define LOG_PREFIX "[esphome-api] "
+
+#ifdef HAVE_IO_URING_MULTISHOT
+
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+#define URING_ENTRIES     256
+#define URING_BUFFERS     32      /* Provided receive buffers (power of two) */
+#define URING_BUFFER_MAX  65536   /* Provided buffers are the receive buffer size, up to this */
+#define URING_BUFFER_GROUP 1
+#define URING_CHAIN_MAX   16      /* Linked sends per submission */
+#define URING_DRAIN_MS    2000    /* How long stop waits for in-flight requests */
+#define URING_WORKERS     2       /* Threads running requests that may block */
+
+/* user_data of requests without a payload pointer; receives set URING_RECV */
+enum {
+    URING_WAKE = 1,
+    URING_ACCEPT_TCP,
+    URING_ACCEPT_UNIX,
+    URING_TIMEOUT,
+};
+#define URING_RECV (1ULL << 63)   /* | slot << 32 | generation */
+#define URING_RESUME (1ULL << 62) /* | slot << 32 | generation; user pointers never set either bit */
+
+/**
+ * Frame queued for a client; in flight, its address is the send's user_data
+ */
+struct esphome_api_uring_send {
+    struct esphome_api_uring_send *next;
+    int slot;
+    bool orphan;                   /* Client closed while in flight, free on completion */
+    int frames;                    /* Messages in data */
+    size_t len;
+    uint8_t data[];
+};
+
+/**
+ * Request deferred to a worker
+ */
+struct esphome_api_uring_job {
+    struct esphome_api_uring_job *next;
+    int slot;
+    uint32_t generation;
+    uint16_t msg_type;
+    size_t len;
+    uint8_t payload[];
+};
+
+struct esphome_api_uring {
+    esphome_api_server_t *server;
+    int ring_fd;
+    pthread_t thread;
+    bool thread_started;
+
+    /* Submission queue, shared by all sending threads */
+    pthread_mutex_t sq_mutex;
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    /* Completion queue, event loop thread only */
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Provided receive buffers */
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    uint8_t *buffers;
+    size_t buffer_size;
+
+    int pending;                   /* Requests that will still complete (atomic) */
+    int receiving;                 /* Accepts and receives among them (atomic) */
+
+    /* Handoff: receives cancelled, frames still sent until stop */
+    pthread_mutex_t pause_mutex;
+    pthread_cond_t pause_cond;
+    bool paused;
+    bool stopping;
+
+    /* Workers for requests that may block */
+    pthread_mutex_t job_mutex;
+    pthread_cond_t job_cond;
+    struct esphome_api_uring_job *job_head;
+    struct esphome_api_uring_job *job_tail;
+    pthread_t workers[URING_WORKERS];
+    int worker_count;
+    bool workers_stopping;
+
+    /* Clients with frames queued during the current completion batch (loop thread) */
+    int flush_slots[ESPHOME_MAX_CLIENTS_LIMIT];
+    int flush_count;
+    struct __kernel_timespec drain_timeout;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* -----------------------------------------------------------------
+ * Submission
+ * ----------------------------------------------------------------- */
+
+/* Event loop of the calling thread, NULL outside the event loop thread */
+static __thread struct esphome_api_uring *current_loop;
+
+/**
+ * Enter the kernel for the SQEs published but not yet consumed
+ */
+static void enter_submit(struct esphome_api_uring *uring) {
+    unsigned count = *uring->sq_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (count == 0) {
+        return;
+    }
+
+    /* A partial submission is picked up by the event loop's next wait */
+    __atomic_add_fetch(&uring->server->send_syscalls, 1, __ATOMIC_RELAXED);
+    if (sys_io_uring_enter(uring->ring_fd, count, 0, 0) < 0 &&
+        errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        fprintf(stderr, LOG_PREFIX "io_uring submit failed: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Get a zeroed SQE (caller holds sq_mutex), NULL if the queue is full
+ *
+ * With flush, a full queue is first submitted to make room; callers in
+ * the middle of a linked chain must not flush, it would split the chain.
+ */
+static struct io_uring_sqe *get_sqe(struct esphome_api_uring *uring, unsigned *tail, bool flush) {
+    unsigned head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (*tail - head >= uring->sq_entries && flush) {
+        __atomic_store_n(uring->sq_tail, *tail, __ATOMIC_RELEASE);
+        enter_submit(uring);
+        head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+    }
+    if (*tail - head >= uring->sq_entries) {
+        return NULL;
+    }
+
+    unsigned index = *tail & uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    uring->sq_array[index] = index;
+    (*tail)++;
+    return sqe;
+}
+
+/**
+ * Publish the SQEs prepared up to tail (caller holds sq_mutex)
+ *
+ * Other threads submit right away. The event loop thread leaves it to its
+ * next wait, so the replies to a whole batch of completions go out with
+ * one io_uring_enter().
+ */
+static void submit(struct esphome_api_uring *uring, unsigned tail) {
+    __atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+    if (current_loop != uring) {
+        enter_submit(uring);
+    }
+}
+
+/**
+ * Submit a request without payload (accept, receive, wake-up)
+ */
+static int submit_simple(struct esphome_api_uring *uring, uint8_t opcode, int fd, uint64_t user_data) {
+    pthread_mutex_lock(&uring->sq_mutex);
+
+    unsigned tail = *uring->sq_tail;
+    struct io_uring_sqe *sqe = get_sqe(uring, &tail, true);
+    if (!sqe) {
+        pthread_mutex_unlock(&uring->sq_mutex);
+        return -1;
+    }
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+
+    if (opcode == IORING_OP_ACCEPT) {
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+    } else if (opcode == IORING_OP_RECV) {
+        /* Data lands in a provided buffer, one completion per read */
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+    } else if (opcode == IORING_OP_TIMEOUT) {
+        sqe->addr = (uint64_t)(uintptr_t)&uring->drain_timeout;
+        sqe->len = 1;
+    }
+
+    if (opcode == IORING_OP_ACCEPT || opcode == IORING_OP_RECV) {
+        __atomic_add_fetch(&uring->pending, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&uring->receiving, 1, __ATOMIC_RELAXED);
+    }
+
+    submit(uring, tail);
+    pthread_mutex_unlock(&uring->sq_mutex);
+    return 0;
+}
+
+/**
+ * Cancel a request without payload by its user_data
+ */
+static void submit_cancel(struct esphome_api_uring *uring, uint64_t target) {
+    pthread_mutex_lock(&uring->sq_mutex);
+
+    unsigned tail = *uring->sq_tail;
+    struct io_uring_sqe *sqe = get_sqe(uring, &tail, true);
+    if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = URING_WAKE;
+        submit(uring, tail);
+    }
+
+    pthread_mutex_unlock(&uring->sq_mutex);
+}
+
+/**
+ * Submit the client's queued frames as one chain of linked sends
+ *
+ * Caller holds the client's send_mutex and nothing is in flight. Links
+ * keep the frames in order; MSG_WAITALL makes the kernel finish short
+ * sends instead of breaking the chain. On TCP, MSG_MORE on all but the
+ * last frame lets the stack pack the chain into full segments despite
+ * TCP_NODELAY.
+ */
+static void submit_sends(struct esphome_api_uring *uring, client_connection_t *client) {
+    pthread_mutex_lock(&uring->sq_mutex);
+
+    unsigned tail = *uring->sq_tail;
+    struct io_uring_sqe *last = NULL;
+    int more = client->local ? 0 : MSG_MORE;
+    int count = 0;
+
+    for (struct esphome_api_uring_send *entry = client->send_head;
+         entry && count < URING_CHAIN_MAX; entry = entry->next) {
+        struct io_uring_sqe *sqe = get_sqe(uring, &tail, count == 0);
+        if (!sqe) {
+            break;
+        }
+
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = client->fd;
+        sqe->addr = (uint64_t)(uintptr_t)entry->data;
+        sqe->len = (uint32_t)entry->len;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL | more;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = (uint64_t)(uintptr_t)entry;
+        last = sqe;
+        count++;
+    }
+
+    if (last) {
+        last->flags &= ~IOSQE_IO_LINK;
+        last->msg_flags &= ~MSG_MORE;
+        client->send_in_flight = count;
+        __atomic_add_fetch(&uring->pending, count, __ATOMIC_RELAXED);
+        submit(uring, tail);
+    }
+
+    pthread_mutex_unlock(&uring->sq_mutex);
+}
+
+/* -----------------------------------------------------------------
+ * Clients
+ * ----------------------------------------------------------------- */
+
+static void recycle_buffer(struct esphome_api_uring *uring, unsigned bid) {
+    struct io_uring_buf_ring *ring = uring->buf_ring;
+    unsigned short tail = ring->tail;
+    struct io_uring_buf *buf = &ring->bufs[tail & (URING_BUFFERS - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(uring->buffers + (size_t)bid * uring->buffer_size);
+    buf->len = (uint32_t)uring->buffer_size;
+    buf->bid = (unsigned short)bid;
+    __atomic_store_n(&ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+static void arm_recv(struct esphome_api_uring *uring, int slot) {
+    client_connection_t *client = &uring->server->clients[slot];
+    uint64_t user_data = URING_RECV | ((uint64_t)slot << 32) | client->generation;
+
+    if (submit_simple(uring, IORING_OP_RECV, client->fd, user_data) < 0) {
+        fprintf(stderr, LOG_PREFIX "io_uring queue full, dropping client %d\n", slot);
+        shutdown(client->fd, SHUT_RDWR);
+    }
+}
+
+static void arm_accept(struct esphome_api_uring *uring, int fd, uint64_t tag) {
+    if (fd >= 0 && submit_simple(uring, IORING_OP_ACCEPT, fd, tag) < 0) {
+        fprintf(stderr, LOG_PREFIX "io_uring queue full, not accepting on fd %d\n", fd);
+    }
+}
+
+void esphome_api_uring_drop_sends(client_connection_t *client) {
+    struct esphome_api_uring_send *entry = client->send_head;
+
+    /* The kernel still owns the frames in flight; they are freed on completion */
+    for (int i = 0; entry; i++) {
+        struct esphome_api_uring_send *next = entry->next;
+        if (i < client->send_in_flight) {
+            entry->orphan = true;
+        } else {
+            free(entry);
+        }
+        entry = next;
+    }
+
+    client->send_head = NULL;
+    client->send_tail = NULL;
+    client->send_queued = 0;
+    client->send_in_flight = 0;
+    client->send_scheduled = false;
+    client->generation++;
+}
+
+int esphome_api_uring_send(struct esphome_api_uring *uring, client_connection_t *client,
+                           const uint8_t *frame, size_t len, int frames, bool urgent) {
+    struct esphome_api_uring_send *entry = malloc(sizeof(*entry) + len);
+    if (!entry) {
+        return -1;
+    }
+
+    entry->next = NULL;
+    entry->slot = (int)(client - uring->server->clients);
+    entry->orphan = false;
+    entry->frames = frames;
+    entry->len = len;
+    memcpy(entry->data, frame, len);
+
+    pthread_mutex_lock(&client->send_mutex);
+
+    if (client->fd < 0 || client->send_queued >= ESPHOME_API_URING_MAX_QUEUED) {
+        if (client->fd >= 0) {
+            fprintf(stderr, LOG_PREFIX "Client %d is not reading, dropping frame\n", entry->slot);
+        }
+        pthread_mutex_unlock(&client->send_mutex);
+        free(entry);
+        return -1;
+    }
+
+    if (client->send_tail) {
+        client->send_tail->next = entry;
+    } else {
+        client->send_head = entry;
+    }
+    client->send_tail = entry;
+    client->send_queued++;
+
+    if (client->send_in_flight == 0 && current_loop != uring) {
+        submit_sends(uring, client);
+    } else if (client->send_in_flight == 0 &&
+               (urgent || uring->flush_count == ESPHOME_MAX_CLIENTS_LIMIT)) {
+        submit_sends(uring, client);
+        pthread_mutex_lock(&uring->sq_mutex);
+        enter_submit(uring);
+        pthread_mutex_unlock(&uring->sq_mutex);
+    } else if (client->send_in_flight == 0 && !client->send_scheduled) {
+        /* The chain is built once the whole batch has had its say */
+        client->send_scheduled = true;
+        uring->flush_slots[uring->flush_count++] = entry->slot;
+    }
+
+    pthread_mutex_unlock(&client->send_mutex);
+    return 0;
+}
+
+/* -----------------------------------------------------------------
+ * Workers
+ * ----------------------------------------------------------------- */
+
+int esphome_api_uring_defer(struct esphome_api_uring *uring, int client_id, uint16_t msg_type,
+                            const uint8_t *payload, size_t payload_len) {
+    client_connection_t *client = &uring->server->clients[client_id];
+
+    if (uring->worker_count == 0) {
+        return -1;
+    }
+
+    struct esphome_api_uring_job *job = malloc(sizeof(*job) + payload_len);
+    if (!job) {
+        return -1;
+    }
+
+    job->next = NULL;
+    job->slot = client_id;
+    job->generation = client->generation;
+    job->msg_type = msg_type;
+    job->len = payload_len;
+    memcpy(job->payload, payload, payload_len);
+
+    /* Counted as a receive until the client is handed back, so a handoff waits for it */
+    client->deferred = true;
+    __atomic_add_fetch(&uring->pending, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&uring->receiving, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&uring->job_mutex);
+    if (uring->job_tail) {
+        uring->job_tail->next = job;
+    } else {
+        uring->job_head = job;
+    }
+    uring->job_tail = job;
+    pthread_cond_signal(&uring->job_cond);
+    pthread_mutex_unlock(&uring->job_mutex);
+    return 0;
+}
+
+/**
+ * Worker thread: dispatch deferred requests, then resume their clients
+ */
+static void *worker_thread_func(void *arg) {
+    struct esphome_api_uring *uring = (struct esphome_api_uring *)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&uring->job_mutex);
+        while (!uring->job_head && !uring->workers_stopping) {
+            pthread_cond_wait(&uring->job_cond, &uring->job_mutex);
+        }
+        struct esphome_api_uring_job *job = uring->job_head;
+        if (!job) {
+            pthread_mutex_unlock(&uring->job_mutex);
+            break;
+        }
+        uring->job_head = job->next;
+        if (!uring->job_head) {
+            uring->job_tail = NULL;
+        }
+        pthread_mutex_unlock(&uring->job_mutex);
+
+        esphome_api_dispatch_deferred(uring->server, job->slot, job->msg_type,
+                                      job->payload, job->len);
+
+        /* The loop owns the client's receive state; it resumes parsing on the completion */
+        uint64_t user_data = URING_RESUME | ((uint64_t)job->slot << 32) | job->generation;
+        while (submit_simple(uring, IORING_OP_NOP, -1, user_data) < 0) {
+            usleep(1000);
+        }
+        free(job);
+    }
+
+    return NULL;
+}
+
+static void stop_workers(struct esphome_api_uring *uring) {
+    pthread_mutex_lock(&uring->job_mutex);
+    uring->workers_stopping = true;
+    pthread_cond_broadcast(&uring->job_cond);
+    pthread_mutex_unlock(&uring->job_mutex);
+
+    for (int i = 0; i < uring->worker_count; i++) {
+        pthread_join(uring->workers[i], NULL);
+    }
+    uring->worker_count = 0;
+
+    /* Left over only if the loop gave up draining */
+    while (uring->job_head) {
+        struct esphome_api_uring_job *job = uring->job_head;
+        uring->job_head = job->next;
+        free(job);
+    }
+    uring->job_tail = NULL;
+}
+
+/* -----------------------------------------------------------------
+ * Completions
+ * ----------------------------------------------------------------- */
+
+static void complete_accept(struct esphome_api_uring *uring, const struct io_uring_cqe *cqe) {
+    esphome_api_server_t *server = uring->server;
+    bool local = cqe->user_data == URING_ACCEPT_UNIX;
+    int listen_fd = local ? server->unix_fd : server->listen_fd;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        __atomic_sub_fetch(&uring->pending, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&uring->receiving, 1, __ATOMIC_RELAXED);
+
+        /* Multishot ends on errors such as EMFILE; keep accepting while running */
+        if (server->running && cqe->res != -EINVAL && cqe->res != -EBADF) {
+            arm_accept(uring, listen_fd, cqe->user_data);
+        }
+    }
+
+    if (cqe->res < 0) {
+        if (server->running && cqe->res != -EINVAL) {
+            fprintf(stderr, LOG_PREFIX "Accept failed: %s\n", strerror(-cqe->res));
+        }
+        return;
+    }
+
+    /* Accepted while pausing for a handoff: the new process serves it */
+    if (!server->running && !server->handoff) {
+        close(cqe->res);
+        return;
+    }
+
+    int slot = esphome_api_admit_client(server, cqe->res, local);
+    if (slot >= 0 && server->running) {
+        arm_recv(uring, slot);
+    }
+}
+
+static void complete_recv(struct esphome_api_uring *uring, const struct io_uring_cqe *cqe) {
+    esphome_api_server_t *server = uring->server;
+    int slot = (int)((cqe->user_data >> 32) & 0x7fffffff);
+    uint32_t generation = (uint32_t)cqe->user_data;
+    client_connection_t *client = &server->clients[slot];
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+    bool current = generation == client->generation && client->fd >= 0;
+    bool drop = false;
+
+    if (!more) {
+        __atomic_sub_fetch(&uring->pending, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&uring->receiving, 1, __ATOMIC_RELAXED);
+    }
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        size_t received = (size_t)cqe->res;
+
+        if (current && cqe->res > 0) {
+            const uint8_t *data = uring->buffers + (size_t)bid * uring->buffer_size;
+
+            if (client->local && server->config.unix_seqpacket && received == uring->buffer_size) {
+                /* A packet filling the buffer may have been truncated */
+                fprintf(stderr, LOG_PREFIX "Packet exceeds the receive buffer, disconnecting\n");
+                drop = true;
+            } else if (received > client->recv_buffer_size - client->recv_pos) {
+                fprintf(stderr, LOG_PREFIX "Frame exceeds the receive buffer, disconnecting\n");
+                drop = true;
+            } else {
+                memcpy(client->recv_buffer + client->recv_pos, data, received);
+                client->recv_pos += received;
+            }
+        }
+        recycle_buffer(uring, bid);
+
+        if (current && !drop) {
+            esphome_api_handle_client_data(server, client, slot);
+        }
+    }
+
+    if (!current || client->release_deferred) {
+        return;
+    }
+
+    /* Cancelled for a handoff, the connection stays open */
+    if (server->handoff && !drop && (cqe->res > 0 || cqe->res == -ECANCELED ||
+                                     cqe->res == -ENOBUFS)) {
+        return;
+    }
+
+    if (drop || (cqe->res <= 0 && cqe->res != -ENOBUFS)) {
+        if (cqe->res < 0 && cqe->res != -ECONNRESET) {
+            fprintf(stderr, LOG_PREFIX "Recv failed: %s\n", strerror(-cqe->res));
+        }
+        printf(LOG_PREFIX "Client disconnected\n");
+        if (more) {
+            /* Ends the multishot receive; its last completion is stale */
+            shutdown(client->fd, SHUT_RDWR);
+        }
+        if (client->deferred) {
+            /* The worker still uses the client */
+            client->release_deferred = true;
+            return;
+        }
+        esphome_api_release_client(server, slot);
+        return;
+    }
+
+    /* Out of buffers or the kernel ended the multishot: re-arm */
+    if (!more) {
+        arm_recv(uring, slot);
+    }
+}
+
+/**
+ * A worker returned from a deferred request: parse the client's next ones
+ */
+static void complete_resume(struct esphome_api_uring *uring, const struct io_uring_cqe *cqe) {
+    esphome_api_server_t *server = uring->server;
+    int slot = (int)((cqe->user_data >> 32) & 0x3fffffff);
+    client_connection_t *client = &server->clients[slot];
+
+    __atomic_sub_fetch(&uring->pending, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&uring->receiving, 1, __ATOMIC_RELAXED);
+
+    /* Releases wait for the worker, so the connection is still the same */
+    client->deferred = false;
+    if (client->release_deferred) {
+        client->release_deferred = false;
+        esphome_api_release_client(server, slot);
+        return;
+    }
+
+    esphome_api_handle_client_data(server, client, slot);
+}
+
+static void complete_send(struct esphome_api_uring *uring, const struct io_uring_cqe *cqe) {
+    struct esphome_api_uring_send *entry = (struct esphome_api_uring_send *)(uintptr_t)cqe->user_data;
+
+    __atomic_sub_fetch(&uring->pending, 1, __ATOMIC_RELAXED);
+
+    if (entry->orphan) {
+        free(entry);
+        return;
+    }
+
+    client_connection_t *client = &uring->server->clients[entry->slot];
+    bool failed = cqe->res < 0 || (size_t)cqe->res != entry->len;
+
+    pthread_mutex_lock(&client->send_mutex);
+
+    /* Linked sends complete in order: this is the head of the queue */
+    client->send_head = entry->next;
+    if (!client->send_head) {
+        client->send_tail = NULL;
+    }
+    client->send_queued--;
+    client->send_in_flight--;
+
+    if (failed) {
+        /* The receive side notices and releases the client */
+        if (cqe->res != -ECANCELED) {
+            fprintf(stderr, LOG_PREFIX "Send failed: %s\n",
+                    cqe->res < 0 ? strerror(-cqe->res) : "short write");
+        }
+        shutdown(client->fd, SHUT_RDWR);
+    } else {
+        __atomic_add_fetch(&uring->server->frames_sent, entry->frames, __ATOMIC_RELAXED);
+        if (!client->local) {
+            __atomic_add_fetch(&uring->server->tcp_frames_sent, entry->frames, __ATOMIC_RELAXED);
+        }
+        if (client->send_in_flight == 0 && client->send_head) {
+            submit_sends(uring, client);
+        }
+    }
+
+    pthread_mutex_unlock(&client->send_mutex);
+    free(entry);
+}
+
+static void flush_scheduled(struct esphome_api_uring *uring);
+
+/**
+ * Wait for and handle completions
+ */
+static void process_completions(struct esphome_api_uring *uring) {
+    unsigned to_submit = __atomic_load_n(uring->sq_tail, __ATOMIC_ACQUIRE) -
+                         __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+
+    /* Submit what the last batch queued and wait for the next */
+    if (to_submit > 0) {
+        __atomic_add_fetch(&uring->server->send_syscalls, 1, __ATOMIC_RELAXED);
+    }
+    if (sys_io_uring_enter(uring->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS) < 0 &&
+        errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        fprintf(stderr, LOG_PREFIX "io_uring wait failed: %s\n", strerror(errno));
+        return;
+    }
+
+    unsigned head = *uring->cq_head;
+    unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe cqe = uring->cqes[head & uring->cq_mask];
+
+        /* Hand the slot back before handling, which may take a while */
+        head++;
+        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+        if (cqe.user_data & URING_RECV) {
+            complete_recv(uring, &cqe);
+        } else if (cqe.user_data & URING_RESUME) {
+            complete_resume(uring, &cqe);
+        } else if (cqe.user_data == URING_ACCEPT_TCP || cqe.user_data == URING_ACCEPT_UNIX) {
+            complete_accept(uring, &cqe);
+        } else if (cqe.user_data > URING_TIMEOUT) {
+            complete_send(uring, &cqe);
+        }
+
+        tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    flush_scheduled(uring);
+}
+
+/**
+ * Submit one chain per client for everything the batch produced
+ */
+static void flush_scheduled(struct esphome_api_uring *uring) {
+    for (int i = 0; i < uring->flush_count; i++) {
+        client_connection_t *client = &uring->server->clients[uring->flush_slots[i]];
+
+        pthread_mutex_lock(&client->send_mutex);
+        if (client->send_scheduled && client->send_in_flight == 0 && client->send_head) {
+            submit_sends(uring, client);
+        }
+        client->send_scheduled = false;
+        pthread_mutex_unlock(&client->send_mutex);
+    }
+    uring->flush_count = 0;
+}
+
+static uint64_t get_timestamp_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Handoff: stop receiving, then keep sending until stopped
+ */
+static void serve_handoff(struct esphome_api_uring *uring) {
+    esphome_api_server_t *server = uring->server;
+
+    submit_cancel(uring, URING_ACCEPT_TCP);
+    submit_cancel(uring, URING_ACCEPT_UNIX);
+
+    pthread_mutex_lock(&server->clients_mutex);
+    for (int i = 0; i < server->max_clients; i++) {
+        client_connection_t *client = &server->clients[i];
+        if (client->fd >= 0) {
+            submit_cancel(uring, URING_RECV | ((uint64_t)i << 32) | client->generation);
+        }
+    }
+    pthread_mutex_unlock(&server->clients_mutex);
+
+    /* Data received before the cancellations is handled as usual */
+    uint64_t deadline = get_timestamp_ms() + URING_DRAIN_MS;
+    while (__atomic_load_n(&uring->receiving, __ATOMIC_RELAXED) > 0 &&
+           get_timestamp_ms() < deadline) {
+        submit_simple(uring, IORING_OP_TIMEOUT, -1, URING_TIMEOUT);
+        process_completions(uring);
+    }
+
+    pthread_mutex_lock(&uring->pause_mutex);
+    uring->paused = true;
+    pthread_cond_broadcast(&uring->pause_cond);
+    pthread_mutex_unlock(&uring->pause_mutex);
+
+    while (!__atomic_load_n(&uring->stopping, __ATOMIC_ACQUIRE)) {
+        submit_simple(uring, IORING_OP_TIMEOUT, -1, URING_TIMEOUT);
+        process_completions(uring);
+    }
+
+    deadline = get_timestamp_ms() + URING_DRAIN_MS;
+    while (__atomic_load_n(&uring->pending, __ATOMIC_RELAXED) > 0 && get_timestamp_ms() < deadline) {
+        submit_simple(uring, IORING_OP_TIMEOUT, -1, URING_TIMEOUT);
+        process_completions(uring);
+    }
+}
+
+/**
+ * Event loop thread
+ */
+static void *uring_thread_func(void *arg) {
+    struct esphome_api_uring *uring = (struct esphome_api_uring *)arg;
+    esphome_api_server_t *server = uring->server;
+
+    current_loop = uring;
+
+    /* Input adopted from the previous process goes first */
+    for (int i = 0; i < server->max_clients; i++) {
+        if (server->clients[i].fd >= 0 && server->clients[i].recv_pos > 0) {
+            esphome_api_handle_client_data(server, &server->clients[i], i);
+        }
+    }
+    flush_scheduled(uring);
+
+    while (server->running) {
+        process_completions(uring);
+    }
+
+    if (server->handoff) {
+        serve_handoff(uring);
+        return NULL;
+    }
+
+    /* The listeners hold no requests past this point... */
+    submit_cancel(uring, URING_ACCEPT_TCP);
+    submit_cancel(uring, URING_ACCEPT_UNIX);
+
+    /* ...and the clients are shut down; their receives end and release them */
+    pthread_mutex_lock(&server->clients_mutex);
+    for (int i = 0; i < server->max_clients; i++) {
+        if (server->clients[i].fd >= 0) {
+            shutdown(server->clients[i].fd, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&server->clients_mutex);
+
+    uint64_t deadline = get_timestamp_ms() + URING_DRAIN_MS;
+    while (__atomic_load_n(&uring->pending, __ATOMIC_RELAXED) > 0 && get_timestamp_ms() < deadline) {
+        submit_simple(uring, IORING_OP_TIMEOUT, -1, URING_TIMEOUT);
+        process_completions(uring);
+    }
+
+    int pending = __atomic_load_n(&uring->pending, __ATOMIC_RELAXED);
+    if (pending > 0) {
+        fprintf(stderr, LOG_PREFIX "%d io_uring request(s) still pending at stop\n", pending);
+    }
+    return NULL;
+}
+
+/* -----------------------------------------------------------------
+ * Setup
+ * ----------------------------------------------------------------- */
+
+/**
+ * Multishot recv needs Linux 6.0; older kernels reject it only at runtime
+ */
+static bool kernel_supported(void) {
+    struct utsname uts;
+    int major = 0;
+    int minor = 0;
+
+    if (uname(&uts) < 0 || sscanf(uts.release, "%d.%d", &major, &minor) != 2) {
+        return false;
+    }
+    return major > 6 || (major == 6 && minor >= 0);
+}
+
+static void unmap_rings(struct esphome_api_uring *uring) {
+    if (uring->sqes) {
+        munmap(uring->sqes, uring->sqes_size);
+    }
+    if (uring->cq_ring && uring->cq_ring != uring->sq_ring) {
+        munmap(uring->cq_ring, uring->cq_ring_size);
+    }
+    if (uring->sq_ring) {
+        munmap(uring->sq_ring, uring->sq_ring_size);
+    }
+    if (uring->buf_ring) {
+        munmap(uring->buf_ring, uring->buf_ring_size);
+    }
+    free(uring->buffers);
+}
+
+struct esphome_api_uring *esphome_api_uring_create(esphome_api_server_t *server) {
+    struct io_uring_params params;
+
+    if (!kernel_supported()) {
+        printf(LOG_PREFIX "Kernel too old for the io_uring backend (needs 6.0)\n");
+        return NULL;
+    }
+
+    struct esphome_api_uring *uring = calloc(1, sizeof(*uring));
+    if (!uring) {
+        return NULL;
+    }
+    uring->server = server;
+
+    memset(&params, 0, sizeof(params));
+    uring->ring_fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if (uring->ring_fd < 0) {
+        /* ENOSYS without io_uring, EPERM where it is disabled by sysctl or seccomp */
+        printf(LOG_PREFIX "io_uring unavailable: %s\n", strerror(errno));
+        free(uring);
+        return NULL;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        printf(LOG_PREFIX "io_uring lacks required features\n");
+        close(uring->ring_fd);
+        free(uring);
+        return NULL;
+    }
+
+    /* Rings (SQ and CQ share one mapping) */
+    uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (uring->cq_ring_size > uring->sq_ring_size) {
+        uring->sq_ring_size = uring->cq_ring_size;
+    }
+    uring->cq_ring_size = uring->sq_ring_size;
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQ_RING);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQES);
+    if (uring->sq_ring == MAP_FAILED || uring->sqes == MAP_FAILED) {
+        fprintf(stderr, LOG_PREFIX "Cannot map io_uring: %s\n", strerror(errno));
+        if (uring->sq_ring == MAP_FAILED) {
+            uring->sq_ring = NULL;
+        }
+        if (uring->sqes == MAP_FAILED) {
+            uring->sqes = NULL;
+        }
+        unmap_rings(uring);
+        close(uring->ring_fd);
+        free(uring);
+        return NULL;
+    }
+    uring->cq_ring = uring->sq_ring;
+
+    uint8_t *sq = (uint8_t *)uring->sq_ring;
+    uring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    uring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    uring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    uring->sq_entries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    uring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+    uint8_t *cq = (uint8_t *)uring->cq_ring;
+    uring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    uring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    uring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    /* Provided buffers, one per receive completion */
+    uring->buffer_size = server->clients[0].recv_buffer_size;
+    if (uring->buffer_size > URING_BUFFER_MAX) {
+        uring->buffer_size = URING_BUFFER_MAX;
+    }
+    uring->buffers = malloc(URING_BUFFERS * uring->buffer_size);
+    uring->buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+    uring->buf_ring = mmap(NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uring->buf_ring == MAP_FAILED) {
+        uring->buf_ring = NULL;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    if (uring->buf_ring && uring->buffers) {
+        reg.ring_addr = (uint64_t)(uintptr_t)uring->buf_ring;
+        reg.ring_entries = URING_BUFFERS;
+        reg.bgid = URING_BUFFER_GROUP;
+    }
+    if (!uring->buf_ring || !uring->buffers ||
+        sys_io_uring_register(uring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        printf(LOG_PREFIX "io_uring provided buffer rings unavailable: %s\n", strerror(errno));
+        unmap_rings(uring);
+        close(uring->ring_fd);
+        free(uring);
+        return NULL;
+    }
+
+    for (unsigned bid = 0; bid < URING_BUFFERS; bid++) {
+        recycle_buffer(uring, bid);
+    }
+
+    pthread_mutex_init(&uring->sq_mutex, NULL);
+    pthread_mutex_init(&uring->pause_mutex, NULL);
+    pthread_cond_init(&uring->pause_cond, NULL);
+    pthread_mutex_init(&uring->job_mutex, NULL);
+    pthread_cond_init(&uring->job_cond, NULL);
+    uring->drain_timeout.tv_nsec = 100 * 1000000;
+    return uring;
+}
+
+int esphome_api_uring_start(struct esphome_api_uring *uring) {
+    esphome_api_server_t *server = uring->server;
+
+    /* Without workers, requests that may block run on the loop */
+    for (int i = 0; i < URING_WORKERS; i++) {
+        if (esphome_thread_create(&uring->workers[i], ESPHOME_THREAD_NETWORK, "api-worker",
+                                  worker_thread_func, uring) != 0) {
+            fprintf(stderr, LOG_PREFIX "Failed to create io_uring worker thread\n");
+            break;
+        }
+        uring->worker_count++;
+    }
+
+    arm_accept(uring, server->listen_fd, URING_ACCEPT_TCP);
+    arm_accept(uring, server->unix_fd, URING_ACCEPT_UNIX);
+
+    /* Clients adopted from the previous process */
+    for (int i = 0; i < server->max_clients; i++) {
+        if (server->clients[i].fd >= 0) {
+            arm_recv(uring, i);
+        }
+    }
+
+    if (esphome_thread_create(&uring->thread, ESPHOME_THREAD_NETWORK, "api-uring",
+                              uring_thread_func, uring) != 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to create io_uring thread\n");
+        stop_workers(uring);
+        return -1;
+    }
+    uring->thread_started = true;
+    return 0;
+}
+
+int esphome_api_uring_pause(struct esphome_api_uring *uring) {
+    if (!uring->thread_started) {
+        return 0;
+    }
+
+    /* The server is no longer running: wake the loop so it cancels its receives */
+    submit_simple(uring, IORING_OP_NOP, -1, URING_WAKE);
+
+    pthread_mutex_lock(&uring->pause_mutex);
+    while (!uring->paused) {
+        pthread_cond_wait(&uring->pause_cond, &uring->pause_mutex);
+    }
+    pthread_mutex_unlock(&uring->pause_mutex);
+
+    return __atomic_load_n(&uring->receiving, __ATOMIC_RELAXED) > 0 ? -1 : 0;
+}
+
+void esphome_api_uring_stop(struct esphome_api_uring *uring) {
+    if (!uring->thread_started) {
+        return;
+    }
+
+    /* The server is no longer running: wake the loop so it drains and exits */
+    __atomic_store_n(&uring->stopping, true, __ATOMIC_RELEASE);
+    submit_simple(uring, IORING_OP_NOP, -1, URING_WAKE);
+    pthread_join(uring->thread, NULL);
+    uring->thread_started = false;
+
+    /* After the loop: it waited for the deferred requests to complete */
+    stop_workers(uring);
+}
+
+void esphome_api_uring_free(struct esphome_api_uring *uring) {
+    if (!uring) {
+        return;
+    }
+
+    /* Closing the ring cancels what is left; stop waited for in-flight sends */
+    close(uring->ring_fd);
+    unmap_rings(uring);
+    pthread_mutex_destroy(&uring->sq_mutex);
+    pthread_mutex_destroy(&uring->pause_mutex);
+    pthread_cond_destroy(&uring->pause_cond);
+    pthread_mutex_destroy(&uring->job_mutex);
+    pthread_cond_destroy(&uring->job_cond);
+    free(uring);
+}
+
+#else /* !HAVE_IO_URING_MULTISHOT */
+
+struct esphome_api_uring *esphome_api_uring_create(esphome_api_server_t *server) {
+    (void)server;
+    printf(LOG_PREFIX "Built without io_uring support\n");
+    return NULL;
+}
+
+int esphome_api_uring_start(struct esphome_api_uring *uring) {
+    (void)uring;
+    return -1;
+}
+
+int esphome_api_uring_send(struct esphome_api_uring *uring, client_connection_t *client,
+                           const uint8_t *frame, size_t len, int frames, bool urgent) {
+    (void)uring;
+    (void)client;
+    (void)frame;
+    (void)len;
+    (void)frames;
+    (void)urgent;
+    return -1;
+}
+
+int esphome_api_uring_defer(struct esphome_api_uring *uring, int client_id, uint16_t msg_type,
+                            const uint8_t *payload, size_t payload_len) {
+    (void)uring;
+    (void)client_id;
+    (void)msg_type;
+    (void)payload;
+    (void)payload_len;
+    return -1;
+}
+
+void esphome_api_uring_drop_sends(client_connection_t *client) {
+    (void)client;
+}
+
+int esphome_api_uring_pause(struct esphome_api_uring *uring) {
+    (void)uring;
+    return 0;
+}
+
+void esphome_api_uring_stop(struct esphome_api_uring *uring) {
+    (void)uring;
+}
+
+void esphome_api_uring_free(struct esphome_api_uring *uring) {
+    (void)uring;
+}
+
+#endif /* HAVE_IO_URING_MULTISHOT */
@@ -0,0 +1,363 @@
+/**
+ * @file esphome_config.c
+ * @brief Configuration file with hot reload
+ */
+
+#include "include/esphome_config.h"
+#include "include/esphome_rcu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define LOG_PREFIX "[config] "
+
+/**
+ * Key/value pair of a snapshot
+ */
+typedef struct {
+    char *key;      /* "section.key" */
+    char *value;
+} config_entry_t;
+
+/**
+ * Parsed configuration snapshot
+ */
+struct esphome_config {
+    config_entry_t *entries;
+    size_t count;
+    uint32_t generation;
+};
+
+typedef struct {
+    esphome_config_reload_fn fn;
+    void *user_data;
+} config_watcher_t;
+
+/* Current snapshot, published RCU-style */
+static esphome_config_t *current_config = NULL;
+
+/* Serializes load/reload (the single RCU publisher) */
+static pthread_mutex_t load_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *config_path = NULL;
+static uint32_t config_generation = 0;
+
+/* Held while watchers run, so unwatch waits for a running callback */
+static pthread_mutex_t watchers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static config_watcher_t watchers[ESPHOME_CONFIG_MAX_WATCHERS];
+static int watcher_count = 0;
+
+static void config_destroy(void *ptr) {
+    esphome_config_t *config = (esphome_config_t *)ptr;
+    if (!config) {
+        return;
+    }
+
+    for (size_t i = 0; i < config->count; i++) {
+        free(config->entries[i].key);
+        free(config->entries[i].value);
+    }
+    free(config->entries);
+    free(config);
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+    *end = '\0';
+
+    return s;
+}
+
+static int config_add(esphome_config_t *config, size_t *capacity,
+                      const char *section, const char *key, const char *value) {
+    if (config->count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 16;
+        config_entry_t *entries = realloc(config->entries, new_capacity * sizeof(*entries));
+        if (!entries) {
+            return -1;
+        }
+        config->entries = entries;
+        *capacity = new_capacity;
+    }
+
+    size_t key_len = strlen(section) + strlen(key) + 2;
+    char *full_key = malloc(key_len);
+    char *full_value = strdup(value);
+    if (!full_key || !full_value) {
+        free(full_key);
+        free(full_value);
+        return -1;
+    }
+
+    if (section[0] != '\0') {
+        snprintf(full_key, key_len, "%s.%s", section, key);
+    } else {
+        snprintf(full_key, key_len, "%s", key);
+    }
+
+    config->entries[config->count].key = full_key;
+    config->entries[config->count].value = full_value;
+    config->count++;
+    return 0;
+}
+
+/**
+ * Parse a configuration file into a new snapshot
+ *
+ * @return Snapshot, or NULL on error
+ */
+static esphome_config_t *config_parse(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, LOG_PREFIX "Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    esphome_config_t *config = calloc(1, sizeof(*config));
+    if (!config) {
+        fclose(fp);
+        return NULL;
+    }
+
+    char line[ESPHOME_CONFIG_LINE_MAX];
+    char section[64] = "";
+    size_t capacity = 0;
+    int line_no = 0;
+    int errors = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+
+        char *s = trim(line);
+        if (*s == '\0' || *s == '#' || *s == ';') {
+            continue;
+        }
+
+        if (*s == '[') {
+            char *end = strchr(s, ']');
+            if (!end) {
+                fprintf(stderr, LOG_PREFIX "%s:%d: unterminated section header\n", path, line_no);
+                errors++;
+                continue;
+            }
+            *end = '\0';
+            snprintf(section, sizeof(section), "%s", trim(s + 1));
+            continue;
+        }
+
+        char *eq = strchr(s, '=');
+        if (!eq) {
+            fprintf(stderr, LOG_PREFIX "%s:%d: expected 'key = value'\n", path, line_no);
+            errors++;
+            continue;
+        }
+        *eq = '\0';
+
+        char *key = trim(s);
+        char *value = trim(eq + 1);
+
+        /* Optional quotes keep leading/trailing spaces */
+        size_t value_len = strlen(value);
+        if (value_len >= 2 && value[0] == '"' && value[value_len - 1] == '"') {
+            value[value_len - 1] = '\0';
+            value++;
+        }
+
+        if (*key == '\0') {
+            fprintf(stderr, LOG_PREFIX "%s:%d: missing key\n", path, line_no);
+            errors++;
+            continue;
+        }
+
+        if (config_add(config, &capacity, section, key, value) < 0) {
+            fprintf(stderr, LOG_PREFIX "Out of memory parsing %s\n", path);
+            errors++;
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    if (errors > 0) {
+        fprintf(stderr, LOG_PREFIX "%s has %d error(s), not applied\n", path, errors);
+        config_destroy(config);
+        return NULL;
+    }
+
+    return config;
+}
+
+/**
+ * Parse config_path and publish the result
+ *
+ * Caller holds load_mutex.
+ */
+static esphome_config_t *config_load_locked(void) {
+    esphome_config_t *config = config_parse(config_path);
+    if (!config) {
+        return NULL;
+    }
+
+    config->generation = ++config_generation;
+    ESPHOME_RCU_PUBLISH(current_config, config, config_destroy);
+
+    printf(LOG_PREFIX "Loaded %s (%zu setting(s), generation %u)\n",
+           config_path, config->count, config->generation);
+    return config;
+}
+
+int esphome_config_load(const char *path) {
+    if (!path) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&load_mutex);
+    free(config_path);
+    config_path = strdup(path);
+    esphome_config_t *config = config_path ? config_load_locked() : NULL;
+    pthread_mutex_unlock(&load_mutex);
+
+    return config ? 0 : -1;
+}
+
+int esphome_config_reload(void) {
+    pthread_mutex_lock(&load_mutex);
+    if (!config_path) {
+        pthread_mutex_unlock(&load_mutex);
+        fprintf(stderr, LOG_PREFIX "No configuration file to reload\n");
+        return -1;
+    }
+
+    printf(LOG_PREFIX "Reloading %s...\n", config_path);
+    esphome_config_t *config = config_load_locked();
+
+    /* Notify watchers in reload order, still serialized against other reloads */
+    if (config) {
+        pthread_mutex_lock(&watchers_mutex);
+        for (int i = 0; i < watcher_count; i++) {
+            watchers[i].fn(config, watchers[i].user_data);
+        }
+        pthread_mutex_unlock(&watchers_mutex);
+    }
+    pthread_mutex_unlock(&load_mutex);
+
+    return config ? 0 : -1;
+}
+
+const esphome_config_t *esphome_config_get(void) {
+    return esphome_rcu_dereference(current_config);
+}
+
+const char *esphome_config_get_string(const esphome_config_t *config, const char *key,
+                                      const char *def) {
+    if (!config || !key) {
+        return def;
+    }
+
+    /* Last assignment wins */
+    for (size_t i = config->count; i > 0; i--) {
+        if (strcmp(config->entries[i - 1].key, key) == 0) {
+            return config->entries[i - 1].value;
+        }
+    }
+
+    return def;
+}
+
+long esphome_config_get_int(const esphome_config_t *config, const char *key, long def,
+                            long min, long max) {
+    const char *value = esphome_config_get_string(config, key, NULL);
+    if (!value) {
+        return def;
+    }
+
+    char *end;
+    errno = 0;
+    long result = strtol(value, &end, 0);
+    if (errno != 0 || end == value || *end != '\0') {
+        fprintf(stderr, LOG_PREFIX "%s: '%s' is not a number, using %ld\n", key, value, def);
+        return def;
+    }
+    if (result < min || result > max) {
+        fprintf(stderr, LOG_PREFIX "%s: %ld out of range [%ld, %ld], using %ld\n",
+                key, result, min, max, def);
+        return def;
+    }
+
+    return result;
+}
+
+bool esphome_config_get_bool(const esphome_config_t *config, const char *key, bool def) {
+    const char *value = esphome_config_get_string(config, key, NULL);
+    if (!value) {
+        return def;
+    }
+
+    if (strcasecmp(value, "true") == 0 || strcasecmp(value, "yes") == 0 ||
+        strcasecmp(value, "on") == 0 || strcmp(value, "1") == 0) {
+        return true;
+    }
+    if (strcasecmp(value, "false") == 0 || strcasecmp(value, "no") == 0 ||
+        strcasecmp(value, "off") == 0 || strcmp(value, "0") == 0) {
+        return false;
+    }
+
+    fprintf(stderr, LOG_PREFIX "%s: '%s' is not a boolean, using %s\n",
+            key, value, def ? "true" : "false");
+    return def;
+}
+
+uint32_t esphome_config_generation(const esphome_config_t *config) {
+    return config ? config->generation : 0;
+}
+
+int esphome_config_watch(esphome_config_reload_fn fn, void *user_data) {
+    int ret = -1;
+
+    if (!fn) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&watchers_mutex);
+    if (watcher_count < ESPHOME_CONFIG_MAX_WATCHERS) {
+        watchers[watcher_count].fn = fn;
+        watchers[watcher_count].user_data = user_data;
+        watcher_count++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&watchers_mutex);
+
+    return ret;
+}
+
+void esphome_config_unwatch(esphome_config_reload_fn fn, void *user_data) {
+    pthread_mutex_lock(&watchers_mutex);
+    for (int i = 0; i < watcher_count; i++) {
+        if (watchers[i].fn == fn && watchers[i].user_data == user_data) {
+            /* Keep registration order, watchers run in it */
+            memmove(&watchers[i], &watchers[i + 1],
+                    (size_t)(watcher_count - i - 1) * sizeof(watchers[0]));
+            watcher_count--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&watchers_mutex);
+}
+
+void esphome_config_free(void) {
+    pthread_mutex_lock(&load_mutex);
+    ESPHOME_RCU_PUBLISH(current_config, NULL, config_destroy);
+    free(config_path);
+    config_path = NULL;
+    pthread_mutex_unlock(&load_mutex);
+}
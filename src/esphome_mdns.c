@@ -0,0 +1,1154 @@
+/**
+ * @file esphome_mdns.c
+ * @brief Minimal built-in mDNS responder for _esphomelib._tcp
+ *
+ * Records are kept pre-encoded (uncompressed wire format) and rebuilt only
+ * when the name or the interface addresses change. Queries are parsed in
+ * place from the receive buffer and answered from the transmit buffer,
+ * both part of the responder, so the query path never allocates.
+ *
+ * Scope is deliberately small: queries are received over IPv4 multicast
+ * only (AAAA records are still served there), no name compression in our
+ * own packets, no response aggregation delay, and one service.
+ */
+
+#include "include/esphome_mdns.h"
+#include "include/esphome_metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define LOG_PREFIX "[mdns] "
+
+#define MDNS_GROUP "224.0.0.251"
+
+#define MDNS_RX_MAX     9000    /* Largest mDNS packet (RFC 6762 section 17) */
+#define MDNS_TX_MAX     1460    /* Our packets fit one Ethernet frame */
+#define MDNS_NAME_MAX   256     /* Wire-format name, uncompressed */
+#define MDNS_RDATA_MAX  512
+#define MDNS_MAX_ADDRS  4       /* Per address family */
+#define MDNS_MAX_RECORDS (4 + 2 * MDNS_MAX_ADDRS)
+
+/* Record TTLs (RFC 6762 section 10) */
+#define MDNS_TTL_HOST   120     /* SRV, A, AAAA */
+#define MDNS_TTL_OTHER  4500    /* PTR, TXT */
+#define MDNS_TTL_LEGACY 10      /* Answers to legacy unicast queries */
+
+/* Probing and announcing (RFC 6762 sections 8.1 and 8.3) */
+#define MDNS_PROBE_COUNT        3
+#define MDNS_PROBE_INTERVAL_MS  250
+#define MDNS_PROBE_DEFER_MS     1000    /* After losing a simultaneous probe */
+#define MDNS_ANNOUNCE_COUNT     2
+#define MDNS_ANNOUNCE_INTERVAL_MS 1000
+
+/* Interface rescans, faster while no address is configured yet */
+#define MDNS_SCAN_INTERVAL_MS   30000
+#define MDNS_SCAN_WAITING_MS    1000
+
+/* Packets handled per esphome_mdns_process() call */
+#define MDNS_RX_BURST 16
+
+#define DNS_TYPE_A      1
+#define DNS_TYPE_PTR    12
+#define DNS_TYPE_TXT    16
+#define DNS_TYPE_AAAA   28
+#define DNS_TYPE_SRV    33
+#define DNS_TYPE_ANY    255
+
+#define DNS_CLASS_IN        1
+#define DNS_CLASS_ANY       255
+#define DNS_CLASS_MASK      0x7FFF
+#define DNS_CACHE_FLUSH     0x8000  /* Record class: replaces cached records */
+#define DNS_UNICAST_RESPONSE 0x8000 /* Question class: QU bit */
+
+#define DNS_FLAG_RESPONSE   0x8000
+#define DNS_FLAG_AUTHORITATIVE 0x0400
+#define DNS_FLAG_OPCODE_RCODE 0x780F
+
+/**
+ * Names we own or answer for
+ */
+typedef enum {
+    MDNS_NAME_SERVICE = 0,      /* _esphomelib._tcp.local */
+    MDNS_NAME_META,             /* _services._dns-sd._udp.local */
+    MDNS_NAME_INSTANCE,         /* <name>._esphomelib._tcp.local */
+    MDNS_NAME_HOST,             /* <name>.local */
+    MDNS_NAME_COUNT
+} mdns_name_id_t;
+
+typedef struct {
+    uint16_t len;
+    uint8_t data[MDNS_NAME_MAX];
+} mdns_name_t;
+
+/**
+ * Resource record, pre-encoded
+ */
+typedef struct {
+    mdns_name_id_t name;
+    uint16_t type;
+    bool unique;                /* Probed, sent with the cache-flush bit */
+    uint32_t ttl;
+    uint16_t rdata_len;
+    uint8_t rdata[MDNS_RDATA_MAX];
+} mdns_record_t;
+
+typedef enum {
+    MDNS_STATE_PROBING = 0,
+    MDNS_STATE_ANNOUNCING,
+    MDNS_STATE_RUNNING,
+} mdns_state_t;
+
+static const char *const state_names[] = { "probing", "announcing", "running" };
+
+/**
+ * Packet being written
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+    bool overflow;
+} mdns_writer_t;
+
+struct esphome_mdns {
+    int fd;
+
+    /* Identity */
+    char base_name[64];
+    char name[64];              /* base_name plus conflict suffix */
+    unsigned rename_count;
+    uint16_t port;
+    bool ipv6;
+    uint16_t txt_len;
+    uint8_t txt[MDNS_RDATA_MAX];
+
+    /* Interface addresses */
+    struct in_addr addr4[MDNS_MAX_ADDRS];
+    int addr4_count;
+    struct in6_addr addr6[MDNS_MAX_ADDRS];
+    int addr6_count;
+
+    /* Published records */
+    mdns_name_t names[MDNS_NAME_COUNT];
+    mdns_record_t records[MDNS_MAX_RECORDS];
+    int record_count;
+
+    /* Probe/announce state machine */
+    mdns_state_t state;
+    int step;
+    uint64_t next_ms;
+    uint64_t next_scan_ms;
+    uint64_t started_ms;
+    bool discoverable;
+    unsigned int seed;
+
+    /* Statistics (read by the metrics thread); 32-bit so the atomics are
+     * native on 32-bit MIPS, wrap-around is fine for rates */
+    uint32_t queries;
+    uint32_t responses;
+    uint32_t suppressed;
+    uint32_t conflicts;
+    double discoverable_ms;
+    double discoverable_process_ms;
+    double discoverable_boot_ms;
+
+    uint8_t rx[MDNS_RX_MAX];
+    uint8_t tx[MDNS_TX_MAX];
+};
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void stat_inc(uint32_t *counter) {
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+/* -----------------------------------------------------------------
+ * Names
+ * ----------------------------------------------------------------- */
+
+static void name_append_label(mdns_name_t *name, const char *label) {
+    size_t len = strlen(label);
+    if (len > 63 || name->len + 1 + len + 1 > MDNS_NAME_MAX) {
+        return;
+    }
+    name->data[name->len++] = (uint8_t)len;
+    memcpy(name->data + name->len, label, len);
+    name->len += (uint16_t)len;
+}
+
+static void name_build(mdns_name_t *name, const char *l1, const char *l2, const char *l3,
+                       const char *l4) {
+    const char *labels[] = { l1, l2, l3, l4 };
+
+    name->len = 0;
+    for (size_t i = 0; i < sizeof(labels) / sizeof(labels[0]); i++) {
+        if (labels[i]) {
+            name_append_label(name, labels[i]);
+        }
+    }
+    name->data[name->len++] = 0;
+}
+
+/* Case-insensitive (label length bytes are below 'A', so they compare exactly) */
+static bool name_equal(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len) {
+    if (a_len != b_len) {
+        return false;
+    }
+    for (size_t i = 0; i < a_len; i++) {
+        if (tolower(a[i]) != tolower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Read a possibly compressed name into uncompressed wire format
+ *
+ * @param off In: name offset, out: offset after the name
+ * @return 0 on success, -1 if the name is malformed
+ */
+static int read_name(const uint8_t *pkt, size_t len, size_t *off, mdns_name_t *out) {
+    size_t pos = *off;
+    bool jumped = false;
+    int hops = 0;
+
+    out->len = 0;
+    while (pos < len) {
+        uint8_t c = pkt[pos];
+
+        if (c == 0) {
+            out->data[out->len++] = 0;
+            if (!jumped) {
+                *off = pos + 1;
+            }
+            return 0;
+        }
+
+        if ((c & 0xC0) == 0xC0) {
+            if (pos + 1 >= len || ++hops > 16) {
+                return -1;
+            }
+            if (!jumped) {
+                *off = pos + 2;
+                jumped = true;
+            }
+            pos = ((size_t)(c & 0x3F) << 8) | pkt[pos + 1];
+            continue;
+        }
+
+        if ((c & 0xC0) != 0 || pos + 1 + c > len || out->len + 1 + c + 1 > MDNS_NAME_MAX) {
+            return -1;
+        }
+        memcpy(out->data + out->len, pkt + pos, 1 + (size_t)c);
+        out->len += (uint16_t)(1 + c);
+        pos += 1 + (size_t)c;
+    }
+
+    return -1;
+}
+
+/**
+ * Copy a label, keeping only characters valid in a host name
+ */
+static void sanitize_label(char *dst, size_t size, const char *src) {
+    size_t n = 0;
+
+    for (; *src && n + 1 < size && n < 63; src++) {
+        char c = *src;
+        dst[n++] = (isalnum((unsigned char)c) || c == '-') ? c : '-';
+    }
+    dst[n] = '\0';
+
+    if (n == 0) {
+        snprintf(dst, size, "esphome-linux");
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Records
+ * ----------------------------------------------------------------- */
+
+/**
+ * Add a record with a copy of its rdata
+ *
+ * @return 0 on success, -1 if the record table is full
+ */
+static int record_add(esphome_mdns_t *mdns, mdns_name_id_t name, uint16_t type, bool unique,
+                      uint32_t ttl, const void *rdata, uint16_t rdata_len) {
+    if (mdns->record_count >= MDNS_MAX_RECORDS || rdata_len > MDNS_RDATA_MAX) {
+        return -1;
+    }
+
+    mdns_record_t *record = &mdns->records[mdns->record_count++];
+    record->name = name;
+    record->type = type;
+    record->unique = unique;
+    record->ttl = ttl;
+    memcpy(record->rdata, rdata, rdata_len);
+    record->rdata_len = rdata_len;
+    return 0;
+}
+
+static void build_records(esphome_mdns_t *mdns) {
+    const mdns_name_t *host = &mdns->names[MDNS_NAME_HOST];
+    uint8_t srv[6 + MDNS_NAME_MAX];
+    int failed = 0;
+
+    name_build(&mdns->names[MDNS_NAME_SERVICE], "_esphomelib", "_tcp", "local", NULL);
+    name_build(&mdns->names[MDNS_NAME_META], "_services", "_dns-sd", "_udp", "local");
+    name_build(&mdns->names[MDNS_NAME_INSTANCE], mdns->name, "_esphomelib", "_tcp", "local");
+    name_build(&mdns->names[MDNS_NAME_HOST], mdns->name, "local", NULL, NULL);
+
+    mdns->record_count = 0;
+
+    /* _esphomelib._tcp.local PTR <name>._esphomelib._tcp.local */
+    failed |= record_add(mdns, MDNS_NAME_SERVICE, DNS_TYPE_PTR, false, MDNS_TTL_OTHER,
+                         mdns->names[MDNS_NAME_INSTANCE].data, mdns->names[MDNS_NAME_INSTANCE].len);
+
+    /* _services._dns-sd._udp.local PTR _esphomelib._tcp.local */
+    failed |= record_add(mdns, MDNS_NAME_META, DNS_TYPE_PTR, false, MDNS_TTL_OTHER,
+                         mdns->names[MDNS_NAME_SERVICE].data, mdns->names[MDNS_NAME_SERVICE].len);
+
+    /* <name>._esphomelib._tcp.local SRV 0 0 <port> <name>.local */
+    memset(srv, 0, 4);
+    srv[4] = (uint8_t)(mdns->port >> 8);
+    srv[5] = (uint8_t)(mdns->port & 0xFF);
+    memcpy(srv + 6, host->data, host->len);
+    failed |= record_add(mdns, MDNS_NAME_INSTANCE, DNS_TYPE_SRV, true, MDNS_TTL_HOST,
+                         srv, (uint16_t)(6 + host->len));
+
+    /* <name>._esphomelib._tcp.local TXT ... */
+    failed |= record_add(mdns, MDNS_NAME_INSTANCE, DNS_TYPE_TXT, true, MDNS_TTL_OTHER,
+                         mdns->txt, mdns->txt_len);
+
+    /* <name>.local A / AAAA */
+    for (int i = 0; i < mdns->addr4_count; i++) {
+        failed |= record_add(mdns, MDNS_NAME_HOST, DNS_TYPE_A, true, MDNS_TTL_HOST,
+                             &mdns->addr4[i], sizeof(mdns->addr4[i]));
+    }
+    for (int i = 0; i < mdns->addr6_count; i++) {
+        failed |= record_add(mdns, MDNS_NAME_HOST, DNS_TYPE_AAAA, true, MDNS_TTL_HOST,
+                             &mdns->addr6[i], sizeof(mdns->addr6[i]));
+    }
+
+    if (failed) {
+        fprintf(stderr, LOG_PREFIX "Record table full, not all records are announced\n");
+    }
+}
+
+/**
+ * Compare received rdata with one of our records
+ *
+ * Names inside PTR/SRV rdata may be compressed and are expanded first.
+ */
+static bool rdata_equal(const uint8_t *pkt, size_t len, size_t off, uint16_t rdlen,
+                        const mdns_record_t *record) {
+    mdns_name_t name;
+
+    switch (record->type) {
+    case DNS_TYPE_PTR:
+        if (read_name(pkt, off + rdlen, &off, &name) < 0) {
+            return false;
+        }
+        return name_equal(name.data, name.len, record->rdata, record->rdata_len);
+
+    case DNS_TYPE_SRV:
+        if (rdlen < 7 || memcmp(pkt + off, record->rdata, 6) != 0) {
+            return false;
+        }
+        off += 6;
+        if (read_name(pkt, len, &off, &name) < 0) {
+            return false;
+        }
+        return name_equal(name.data, name.len, record->rdata + 6, (size_t)record->rdata_len - 6);
+
+    default:
+        return rdlen == record->rdata_len && memcmp(pkt + off, record->rdata, rdlen) == 0;
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Packet writing
+ * ----------------------------------------------------------------- */
+
+static void put_bytes(mdns_writer_t *w, const void *data, size_t len) {
+    if (w->overflow || w->len + len > w->cap) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+static void put_u16(mdns_writer_t *w, uint16_t value) {
+    uint8_t b[2] = { (uint8_t)(value >> 8), (uint8_t)value };
+    put_bytes(w, b, sizeof(b));
+}
+
+static void put_u32(mdns_writer_t *w, uint32_t value) {
+    uint8_t b[4] = { (uint8_t)(value >> 24), (uint8_t)(value >> 16),
+                     (uint8_t)(value >> 8), (uint8_t)value };
+    put_bytes(w, b, sizeof(b));
+}
+
+static void put_header(mdns_writer_t *w, uint16_t id, uint16_t flags, uint16_t qd,
+                       uint16_t an, uint16_t ns, uint16_t ar) {
+    w->len = 0;
+    w->overflow = false;
+    put_u16(w, id);
+    put_u16(w, flags);
+    put_u16(w, qd);
+    put_u16(w, an);
+    put_u16(w, ns);
+    put_u16(w, ar);
+}
+
+static void put_record(mdns_writer_t *w, const esphome_mdns_t *mdns, const mdns_record_t *record,
+                       uint32_t ttl, bool cache_flush) {
+    const mdns_name_t *name = &mdns->names[record->name];
+
+    put_bytes(w, name->data, name->len);
+    put_u16(w, record->type);
+    put_u16(w, (uint16_t)(DNS_CLASS_IN | (cache_flush && record->unique ? DNS_CACHE_FLUSH : 0)));
+    put_u32(w, ttl);
+    put_u16(w, record->rdata_len);
+    put_bytes(w, record->rdata, record->rdata_len);
+}
+
+static void writer_init(mdns_writer_t *w, esphome_mdns_t *mdns) {
+    w->buf = mdns->tx;
+    w->len = 0;
+    w->cap = sizeof(mdns->tx);
+    w->overflow = false;
+}
+
+/**
+ * Send to the mDNS group on every interface with an IPv4 address
+ */
+static void send_multicast(esphome_mdns_t *mdns, const mdns_writer_t *w) {
+    struct sockaddr_in group;
+
+    if (w->overflow) {
+        fprintf(stderr, LOG_PREFIX "Packet exceeds %zu bytes, not sent\n", w->cap);
+        return;
+    }
+
+    memset(&group, 0, sizeof(group));
+    group.sin_family = AF_INET;
+    group.sin_port = htons(ESPHOME_MDNS_PORT);
+    inet_pton(AF_INET, MDNS_GROUP, &group.sin_addr);
+
+    for (int i = 0; i < mdns->addr4_count; i++) {
+        setsockopt(mdns->fd, IPPROTO_IP, IP_MULTICAST_IF, &mdns->addr4[i], sizeof(mdns->addr4[i]));
+        sendto(mdns->fd, w->buf, w->len, 0, (struct sockaddr *)&group, sizeof(group));
+    }
+}
+
+static void send_unicast(esphome_mdns_t *mdns, const mdns_writer_t *w,
+                         const struct sockaddr_in *dest) {
+    if (w->overflow) {
+        fprintf(stderr, LOG_PREFIX "Packet exceeds %zu bytes, not sent\n", w->cap);
+        return;
+    }
+    sendto(mdns->fd, w->buf, w->len, 0, (const struct sockaddr *)dest, sizeof(*dest));
+}
+
+/**
+ * Probe: ANY questions for our unique names, proposed records as authority
+ */
+static void send_probe(esphome_mdns_t *mdns) {
+    mdns_writer_t w;
+    uint16_t ns = 0;
+
+    for (int i = 0; i < mdns->record_count; i++) {
+        ns += mdns->records[i].unique;
+    }
+
+    writer_init(&w, mdns);
+    put_header(&w, 0, 0, 2, 0, ns, 0);
+
+    /* The first probe asks for unicast responses (RFC 6762 section 8.1) */
+    uint16_t qclass = DNS_CLASS_IN | (mdns->step == 0 ? DNS_UNICAST_RESPONSE : 0);
+    put_bytes(&w, mdns->names[MDNS_NAME_INSTANCE].data, mdns->names[MDNS_NAME_INSTANCE].len);
+    put_u16(&w, DNS_TYPE_ANY);
+    put_u16(&w, qclass);
+    put_bytes(&w, mdns->names[MDNS_NAME_HOST].data, mdns->names[MDNS_NAME_HOST].len);
+    put_u16(&w, DNS_TYPE_ANY);
+    put_u16(&w, qclass);
+
+    for (int i = 0; i < mdns->record_count; i++) {
+        if (mdns->records[i].unique) {
+            put_record(&w, mdns, &mdns->records[i], mdns->records[i].ttl, false);
+        }
+    }
+
+    send_multicast(mdns, &w);
+}
+
+/**
+ * Unsolicited response with all records (ttl_zero: goodbye)
+ */
+static void send_announcement(esphome_mdns_t *mdns, bool ttl_zero) {
+    mdns_writer_t w;
+
+    writer_init(&w, mdns);
+    put_header(&w, 0, DNS_FLAG_RESPONSE | DNS_FLAG_AUTHORITATIVE, 0,
+               (uint16_t)mdns->record_count, 0, 0);
+    for (int i = 0; i < mdns->record_count; i++) {
+        put_record(&w, mdns, &mdns->records[i], ttl_zero ? 0 : mdns->records[i].ttl, true);
+    }
+
+    send_multicast(mdns, &w);
+}
+
+/* -----------------------------------------------------------------
+ * State machine
+ * ----------------------------------------------------------------- */
+
+static void start_probing(esphome_mdns_t *mdns, uint64_t delay_ms) {
+    mdns->state = MDNS_STATE_PROBING;
+    mdns->step = 0;
+    /* Random 0-250 ms initial delay spreads out hosts booting together */
+    mdns->next_ms = now_ms() + delay_ms + (uint64_t)(rand_r(&mdns->seed) % MDNS_PROBE_INTERVAL_MS);
+}
+
+/**
+ * Pick the next name after a conflict (<name>-2, <name>-3, ...)
+ */
+static void rename_after_conflict(esphome_mdns_t *mdns) {
+    mdns->rename_count++;
+    stat_inc(&mdns->conflicts);
+
+    char suffix[16];
+    int suffix_len = snprintf(suffix, sizeof(suffix), "-%u", mdns->rename_count + 1);
+    int base_len = (int)strlen(mdns->base_name);
+    if (base_len + suffix_len > 63) {
+        base_len = 63 - suffix_len;
+    }
+    snprintf(mdns->name, sizeof(mdns->name), "%.*s%s", base_len, mdns->base_name, suffix);
+
+    fprintf(stderr, LOG_PREFIX "Name conflict, renaming to %s\n", mdns->name);
+    build_records(mdns);
+    start_probing(mdns, 0);
+}
+
+/**
+ * Read process age and system uptime for the time-to-discoverable metric
+ */
+static void record_discoverable(esphome_mdns_t *mdns, uint64_t now) {
+    struct timespec boot;
+    double boot_ms = -1.0;
+    double process_ms = -1.0;
+
+    if (clock_gettime(CLOCK_BOOTTIME, &boot) == 0) {
+        boot_ms = (double)boot.tv_sec * 1000.0 + (double)boot.tv_nsec / 1000000.0;
+    }
+
+    /* Field 22 of /proc/self/stat is the start time in clock ticks since boot */
+    FILE *fp = fopen("/proc/self/stat", "r");
+    if (fp) {
+        char buf[512];
+        size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+        fclose(fp);
+        buf[n] = '\0';
+
+        char *p = strrchr(buf, ')');
+        for (int field = 2; p && field < 22; field++) {
+            p = strchr(p + 1, ' ');
+        }
+        long ticks_per_sec = sysconf(_SC_CLK_TCK);
+        if (p && ticks_per_sec > 0 && boot_ms >= 0.0) {
+            double start_ms = (double)strtoull(p + 1, NULL, 10) * 1000.0 / (double)ticks_per_sec;
+            process_ms = boot_ms - start_ms;
+        }
+    }
+
+    mdns->discoverable_ms = (double)(now - mdns->started_ms);
+    mdns->discoverable_process_ms = process_ms;
+    mdns->discoverable_boot_ms = boot_ms;
+    __atomic_store_n(&mdns->discoverable, true, __ATOMIC_RELEASE);
+
+    printf(LOG_PREFIX "Discoverable as %s.local: %.0f ms after responder start, "
+           "%.0f ms after process start, %.0f ms after boot\n",
+           mdns->name, mdns->discoverable_ms, process_ms, boot_ms);
+}
+
+static void run_timers(esphome_mdns_t *mdns, uint64_t now) {
+    /* Nothing to probe or announce until an interface has an address */
+    if (mdns->state == MDNS_STATE_RUNNING || mdns->addr4_count == 0 || now < mdns->next_ms) {
+        return;
+    }
+
+    if (mdns->state == MDNS_STATE_PROBING) {
+        if (mdns->step < MDNS_PROBE_COUNT) {
+            send_probe(mdns);
+            mdns->step++;
+            mdns->next_ms = now + MDNS_PROBE_INTERVAL_MS;
+            return;
+        }
+
+        /* No conflicting answer within 250 ms of the last probe */
+        mdns->state = MDNS_STATE_ANNOUNCING;
+        mdns->step = 0;
+    }
+
+    send_announcement(mdns, false);
+    if (!mdns->discoverable) {
+        record_discoverable(mdns, now);
+    }
+
+    mdns->step++;
+    if (mdns->step >= MDNS_ANNOUNCE_COUNT) {
+        mdns->state = MDNS_STATE_RUNNING;
+    } else {
+        mdns->next_ms = now + MDNS_ANNOUNCE_INTERVAL_MS;
+    }
+}
+
+/**
+ * Re-read interface addresses and join the group on new interfaces
+ *
+ * @return true if the published addresses changed
+ */
+static bool scan_interfaces(esphome_mdns_t *mdns) {
+    struct ifaddrs *ifaddr;
+    struct in_addr addr4[MDNS_MAX_ADDRS];
+    struct in6_addr addr6[MDNS_MAX_ADDRS];
+    int addr4_count = 0;
+    int addr6_count = 0;
+
+    if (getifaddrs(&ifaddr) < 0) {
+        return false;
+    }
+
+    for (struct ifaddrs *ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || !(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK) ||
+            !(ifa->ifa_flags & IFF_MULTICAST)) {
+            continue;
+        }
+
+        if (ifa->ifa_addr->sa_family == AF_INET && addr4_count < MDNS_MAX_ADDRS) {
+            addr4[addr4_count++] = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+
+            /* Joining twice fails with EADDRINUSE, which is fine */
+            struct ip_mreq mreq;
+            inet_pton(AF_INET, MDNS_GROUP, &mreq.imr_multiaddr);
+            mreq.imr_interface = addr4[addr4_count - 1];
+            setsockopt(mdns->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+        } else if (ifa->ifa_addr->sa_family == AF_INET6 && mdns->ipv6 &&
+                   addr6_count < MDNS_MAX_ADDRS) {
+            addr6[addr6_count++] = ((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr;
+        }
+    }
+
+    freeifaddrs(ifaddr);
+
+    if (addr4_count == mdns->addr4_count && addr6_count == mdns->addr6_count &&
+        memcmp(addr4, mdns->addr4, (size_t)addr4_count * sizeof(addr4[0])) == 0 &&
+        memcmp(addr6, mdns->addr6, (size_t)addr6_count * sizeof(addr6[0])) == 0) {
+        return false;
+    }
+
+    memcpy(mdns->addr4, addr4, (size_t)addr4_count * sizeof(addr4[0]));
+    mdns->addr4_count = addr4_count;
+    memcpy(mdns->addr6, addr6, (size_t)addr6_count * sizeof(addr6[0]));
+    mdns->addr6_count = addr6_count;
+    return true;
+}
+
+/* -----------------------------------------------------------------
+ * Packet handling
+ * ----------------------------------------------------------------- */
+
+/**
+ * Resource record header, parsed in place
+ */
+typedef struct {
+    mdns_name_t name;
+    uint16_t type;
+    uint16_t rclass;
+    uint32_t ttl;
+    uint16_t rdlen;
+    size_t rdata_off;
+} mdns_rr_t;
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static int read_rr(const uint8_t *pkt, size_t len, size_t *off, mdns_rr_t *rr) {
+    if (read_name(pkt, len, off, &rr->name) < 0 || *off + 10 > len) {
+        return -1;
+    }
+
+    const uint8_t *p = pkt + *off;
+    rr->type = get_u16(p);
+    rr->rclass = get_u16(p + 2);
+    rr->ttl = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+    rr->rdlen = get_u16(p + 8);
+    rr->rdata_off = *off + 10;
+
+    if (rr->rdata_off + rr->rdlen > len) {
+        return -1;
+    }
+    *off = rr->rdata_off + rr->rdlen;
+    return 0;
+}
+
+static bool rr_is_ours(const esphome_mdns_t *mdns, const mdns_rr_t *rr, const mdns_record_t *record) {
+    const mdns_name_t *name = &mdns->names[record->name];
+    return rr->type == record->type &&
+           name_equal(rr->name.data, rr->name.len, name->data, name->len);
+}
+
+/**
+ * Check a received record against our unique records
+ *
+ * @return true if it claims one of our unique names with different data
+ */
+static bool rr_conflicts(const esphome_mdns_t *mdns, const uint8_t *pkt, size_t len,
+                         const mdns_rr_t *rr) {
+    bool same_name_type = false;
+
+    for (int i = 0; i < mdns->record_count; i++) {
+        const mdns_record_t *record = &mdns->records[i];
+        if (!record->unique || !rr_is_ours(mdns, rr, record)) {
+            continue;
+        }
+        if (rdata_equal(pkt, len, rr->rdata_off, rr->rdlen, record)) {
+            return false;
+        }
+        same_name_type = true;
+    }
+
+    return same_name_type;
+}
+
+/**
+ * Responses: another host answering for one of our unique names
+ */
+static void handle_response(esphome_mdns_t *mdns, size_t len, size_t off, int count) {
+    mdns_rr_t rr;
+
+    for (int i = 0; i < count; i++) {
+        if (read_rr(mdns->rx, len, &off, &rr) < 0) {
+            return;
+        }
+        if (rr_conflicts(mdns, mdns->rx, len, &rr)) {
+            rename_after_conflict(mdns);
+            return;
+        }
+    }
+}
+
+/**
+ * Simultaneous probe tie-break (RFC 6762 section 8.2)
+ *
+ * @return true if another host probing for our names wins
+ */
+static bool lost_probe_tiebreak(esphome_mdns_t *mdns, size_t len, size_t off, int count) {
+    mdns_rr_t rr;
+
+    for (int i = 0; i < count; i++) {
+        if (read_rr(mdns->rx, len, &off, &rr) < 0) {
+            return false;
+        }
+
+        for (int j = 0; j < mdns->record_count; j++) {
+            const mdns_record_t *record = &mdns->records[j];
+            const mdns_name_t *name = &mdns->names[record->name];
+            if (!record->unique ||
+                !name_equal(rr.name.data, rr.name.len, name->data, name->len)) {
+                continue;
+            }
+
+            /* Compare class, type, then raw rdata; the larger record set wins */
+            int cmp = (int)(rr.rclass & DNS_CLASS_MASK) - DNS_CLASS_IN;
+            if (cmp == 0) {
+                cmp = (int)rr.type - (int)record->type;
+            }
+            if (cmp == 0) {
+                size_t n = rr.rdlen < record->rdata_len ? rr.rdlen : record->rdata_len;
+                cmp = memcmp(mdns->rx + rr.rdata_off, record->rdata, n);
+                if (cmp == 0) {
+                    cmp = (int)rr.rdlen - (int)record->rdata_len;
+                }
+            }
+            if (cmp != 0) {
+                return cmp > 0;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void handle_query(esphome_mdns_t *mdns, size_t len, const struct sockaddr_in *src,
+                         uint16_t id, int qd, int an, int ns) {
+    size_t off = 12;
+    uint32_t answers = 0;
+    bool unicast = false;
+    mdns_name_t qname;
+
+    stat_inc(&mdns->queries);
+
+    /* Questions */
+    for (int i = 0; i < qd; i++) {
+        if (read_name(mdns->rx, len, &off, &qname) < 0 || off + 4 > len) {
+            return;
+        }
+        uint16_t qtype = get_u16(mdns->rx + off);
+        uint16_t qclass = get_u16(mdns->rx + off + 2);
+        off += 4;
+
+        if (qclass & DNS_UNICAST_RESPONSE) {
+            unicast = true;
+        }
+        if ((qclass & DNS_CLASS_MASK) != DNS_CLASS_IN && (qclass & DNS_CLASS_MASK) != DNS_CLASS_ANY) {
+            continue;
+        }
+
+        for (int r = 0; r < mdns->record_count; r++) {
+            const mdns_record_t *record = &mdns->records[r];
+            const mdns_name_t *name = &mdns->names[record->name];
+            if ((qtype == record->type || qtype == DNS_TYPE_ANY) &&
+                name_equal(qname.data, qname.len, name->data, name->len)) {
+                answers |= 1U << r;
+            }
+        }
+    }
+    size_t questions_end = off;
+
+    /* While probing, only other probes matter */
+    if (mdns->state == MDNS_STATE_PROBING) {
+        size_t ns_off = off;
+        mdns_rr_t rr;
+        for (int i = 0; i < an; i++) {
+            if (read_rr(mdns->rx, len, &ns_off, &rr) < 0) {
+                return;
+            }
+        }
+        if (ns > 0 && lost_probe_tiebreak(mdns, len, ns_off, ns)) {
+            printf(LOG_PREFIX "Lost simultaneous probe for %s, probing again\n", mdns->name);
+            start_probing(mdns, MDNS_PROBE_DEFER_MS);
+        }
+        return;
+    }
+
+    if (answers == 0) {
+        return;
+    }
+
+    /* Known-answer suppression (RFC 6762 section 7.1) */
+    for (int i = 0; i < an; i++) {
+        mdns_rr_t rr;
+        if (read_rr(mdns->rx, len, &off, &rr) < 0) {
+            break;
+        }
+        for (int r = 0; r < mdns->record_count; r++) {
+            const mdns_record_t *record = &mdns->records[r];
+            if ((answers & (1U << r)) && rr.ttl >= record->ttl / 2 &&
+                rr_is_ours(mdns, &rr, record) &&
+                rdata_equal(mdns->rx, len, rr.rdata_off, rr.rdlen, record)) {
+                answers &= ~(1U << r);
+                stat_inc(&mdns->suppressed);
+            }
+        }
+    }
+    if (answers == 0) {
+        return;
+    }
+
+    /* Additional records: SRV/TXT/addresses for the instance, addresses for SRV */
+    uint32_t additional = 0;
+    for (int r = 0; r < mdns->record_count; r++) {
+        const mdns_record_t *record = &mdns->records[r];
+        if (!(answers & (1U << r))) {
+            continue;
+        }
+        if (record->type == DNS_TYPE_PTR && record->name == MDNS_NAME_SERVICE) {
+            for (int a = 0; a < mdns->record_count; a++) {
+                if (mdns->records[a].name == MDNS_NAME_INSTANCE ||
+                    mdns->records[a].name == MDNS_NAME_HOST) {
+                    additional |= 1U << a;
+                }
+            }
+        } else if (record->type == DNS_TYPE_SRV) {
+            for (int a = 0; a < mdns->record_count; a++) {
+                if (mdns->records[a].name == MDNS_NAME_HOST) {
+                    additional |= 1U << a;
+                }
+            }
+        }
+    }
+    additional &= ~answers;
+
+    /* Legacy unicast: source port is not 5353 (RFC 6762 section 6.7) */
+    bool legacy = ntohs(src->sin_port) != ESPHOME_MDNS_PORT;
+
+    mdns_writer_t w;
+    writer_init(&w, mdns);
+    put_header(&w, legacy ? id : 0, DNS_FLAG_RESPONSE | DNS_FLAG_AUTHORITATIVE,
+               legacy ? (uint16_t)qd : 0,
+               (uint16_t)__builtin_popcount(answers), 0,
+               (uint16_t)__builtin_popcount(additional));
+
+    if (legacy) {
+        /* Same offsets as in the query, so compression pointers stay valid */
+        put_bytes(&w, mdns->rx + 12, questions_end - 12);
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t set = pass == 0 ? answers : additional;
+        for (int r = 0; r < mdns->record_count; r++) {
+            if (set & (1U << r)) {
+                const mdns_record_t *record = &mdns->records[r];
+                uint32_t ttl = legacy && record->ttl > MDNS_TTL_LEGACY ? MDNS_TTL_LEGACY : record->ttl;
+                put_record(&w, mdns, record, ttl, !legacy);
+            }
+        }
+    }
+
+    if (legacy) {
+        send_unicast(mdns, &w, src);
+    } else if (unicast) {
+        struct sockaddr_in dest = *src;
+        dest.sin_port = htons(ESPHOME_MDNS_PORT);
+        send_unicast(mdns, &w, &dest);
+    } else {
+        send_multicast(mdns, &w);
+    }
+    stat_inc(&mdns->responses);
+}
+
+static void handle_packet(esphome_mdns_t *mdns, size_t len, const struct sockaddr_in *src) {
+    if (len < 12) {
+        return;
+    }
+
+    uint16_t id = get_u16(mdns->rx);
+    uint16_t flags = get_u16(mdns->rx + 2);
+    int qd = get_u16(mdns->rx + 4);
+    int an = get_u16(mdns->rx + 6);
+    int ns = get_u16(mdns->rx + 8);
+    int ar = get_u16(mdns->rx + 10);
+
+    /* Only standard queries/responses without errors */
+    if (flags & DNS_FLAG_OPCODE_RCODE) {
+        return;
+    }
+
+    if (flags & DNS_FLAG_RESPONSE) {
+        size_t off = 12;
+        mdns_name_t name;
+        for (int i = 0; i < qd; i++) {
+            if (read_name(mdns->rx, len, &off, &name) < 0 || off + 4 > len) {
+                return;
+            }
+            off += 4;
+        }
+        handle_response(mdns, len, off, an + ns + ar);
+    } else {
+        handle_query(mdns, len, src, id, qd, an, ns);
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Metrics
+ * ----------------------------------------------------------------- */
+
+static void mdns_metrics_dump(FILE *out, void *user_data) {
+    esphome_mdns_t *mdns = (esphome_mdns_t *)user_data;
+    mdns_state_t state = __atomic_load_n(&mdns->state, __ATOMIC_RELAXED);
+
+    fprintf(out, "mdns.state %s\n", state_names[state]);
+    fprintf(out, "mdns.queries %u\n", __atomic_load_n(&mdns->queries, __ATOMIC_RELAXED));
+    fprintf(out, "mdns.responses %u\n", __atomic_load_n(&mdns->responses, __ATOMIC_RELAXED));
+    fprintf(out, "mdns.suppressed %u\n", __atomic_load_n(&mdns->suppressed, __ATOMIC_RELAXED));
+    fprintf(out, "mdns.conflicts %u\n", __atomic_load_n(&mdns->conflicts, __ATOMIC_RELAXED));
+    if (__atomic_load_n(&mdns->discoverable, __ATOMIC_ACQUIRE)) {
+        fprintf(out, "mdns.discoverable_ms responder=%.0f process=%.0f boot=%.0f\n",
+                mdns->discoverable_ms, mdns->discoverable_process_ms, mdns->discoverable_boot_ms);
+    }
+}
+
+/* -----------------------------------------------------------------
+ * Public API
+ * ----------------------------------------------------------------- */
+
+esphome_mdns_t *esphome_mdns_init(const esphome_mdns_config_t *config) {
+    if (!config || !config->name) {
+        return NULL;
+    }
+
+    esphome_mdns_t *mdns = calloc(1, sizeof(*mdns));
+    if (!mdns) {
+        return NULL;
+    }
+
+    sanitize_label(mdns->base_name, sizeof(mdns->base_name), config->name);
+    snprintf(mdns->name, sizeof(mdns->name), "%s", mdns->base_name);
+    mdns->port = config->port;
+    mdns->ipv6 = config->ipv6;
+    mdns->started_ms = now_ms();
+    mdns->seed = (unsigned int)(mdns->started_ms ^ (uint64_t)getpid());
+
+    /* TXT rdata: length-prefixed strings, a single empty string if none */
+    for (int i = 0; i < ESPHOME_MDNS_MAX_TXT && config->txt[i]; i++) {
+        size_t n = strlen(config->txt[i]);
+        if (n > 255 || mdns->txt_len + 1 + n > sizeof(mdns->txt)) {
+            fprintf(stderr, LOG_PREFIX "TXT entry too long, dropped: %s\n", config->txt[i]);
+            continue;
+        }
+        mdns->txt[mdns->txt_len++] = (uint8_t)n;
+        memcpy(mdns->txt + mdns->txt_len, config->txt[i], n);
+        mdns->txt_len += (uint16_t)n;
+    }
+    if (mdns->txt_len == 0) {
+        mdns->txt[mdns->txt_len++] = 0;
+    }
+
+    mdns->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (mdns->fd < 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to create socket: %s\n", strerror(errno));
+        free(mdns);
+        return NULL;
+    }
+
+    /* Share port 5353 with any other responder on the host */
+    int opt = 1;
+    setsockopt(mdns->fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+#ifdef SO_REUSEPORT
+    setsockopt(mdns->fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+#endif
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(ESPHOME_MDNS_PORT);
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(mdns->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to bind port %d: %s\n", ESPHOME_MDNS_PORT, strerror(errno));
+        close(mdns->fd);
+        free(mdns);
+        return NULL;
+    }
+
+    unsigned char ttl = 255;
+    unsigned char loop = 0;
+    setsockopt(mdns->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(mdns->fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+    uint64_t now = now_ms();
+    scan_interfaces(mdns);
+    mdns->next_scan_ms = now + (mdns->addr4_count ? MDNS_SCAN_INTERVAL_MS : MDNS_SCAN_WAITING_MS);
+    build_records(mdns);
+    start_probing(mdns, 0);
+
+    esphome_metrics_register("mdns", mdns_metrics_dump, mdns);
+
+    printf(LOG_PREFIX "Responder for %s._esphomelib._tcp.local (port %u) started\n",
+           mdns->name, mdns->port);
+    if (mdns->addr4_count == 0) {
+        printf(LOG_PREFIX "No IPv4 address yet, waiting for one before probing\n");
+    }
+
+    return mdns;
+}
+
+int esphome_mdns_fd(const esphome_mdns_t *mdns) {
+    return mdns->fd;
+}
+
+int esphome_mdns_timeout_ms(const esphome_mdns_t *mdns) {
+    uint64_t now = now_ms();
+    uint64_t next = mdns->next_scan_ms;
+
+    if (mdns->state != MDNS_STATE_RUNNING && mdns->addr4_count > 0 && mdns->next_ms < next) {
+        next = mdns->next_ms;
+    }
+
+    return next > now ? (int)(next - now) : 0;
+}
+
+void esphome_mdns_process(esphome_mdns_t *mdns, bool readable) {
+    for (int i = 0; readable && i < MDNS_RX_BURST; i++) {
+        struct sockaddr_in src;
+        socklen_t src_len = sizeof(src);
+
+        ssize_t n = recvfrom(mdns->fd, mdns->rx, sizeof(mdns->rx), 0,
+                             (struct sockaddr *)&src, &src_len);
+        if (n < 0) {
+            break;
+        }
+        handle_packet(mdns, (size_t)n, &src);
+    }
+
+    uint64_t now = now_ms();
+
+    if (now >= mdns->next_scan_ms) {
+        if (scan_interfaces(mdns)) {
+            char buf[INET_ADDRSTRLEN] = "none";
+            if (mdns->addr4_count > 0) {
+                inet_ntop(AF_INET, &mdns->addr4[0], buf, sizeof(buf));
+            }
+            printf(LOG_PREFIX "Interface addresses changed (%d, first %s)\n",
+                   mdns->addr4_count, buf);
+
+            build_records(mdns);
+            /* Names are already ours once running; just tell caches */
+            if (mdns->state == MDNS_STATE_RUNNING) {
+                mdns->state = MDNS_STATE_ANNOUNCING;
+                mdns->step = 0;
+                mdns->next_ms = now;
+            }
+        }
+        mdns->next_scan_ms = now + (mdns->addr4_count ? MDNS_SCAN_INTERVAL_MS
+                                                      : MDNS_SCAN_WAITING_MS);
+    }
+
+    run_timers(mdns, now);
+}
+
+void esphome_mdns_free(esphome_mdns_t *mdns) {
+    if (!mdns) {
+        return;
+    }
+
+    esphome_metrics_unregister(mdns_metrics_dump, mdns);
+
+    /* Goodbye: caches drop our records instead of waiting for them to expire */
+    if (mdns->state != MDNS_STATE_PROBING) {
+        send_announcement(mdns, true);
+    }
+
+    close(mdns->fd);
+    free(mdns);
+}
+
+void esphome_mdns_free_silent(esphome_mdns_t *mdns) {
+    if (!mdns) {
+        return;
+    }
+
+    esphome_metrics_unregister(mdns_metrics_dump, mdns);
+    close(mdns->fd);
+    free(mdns);
+}
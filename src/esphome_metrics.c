@@ -0,0 +1,66 @@
+/**
+ * @file esphome_metrics.c
+ * @brief Runtime metrics surface
+ */
+
+#include "include/esphome_metrics.h"
+#include <pthread.h>
+#include <time.h>
+
+typedef struct {
+    const char *name;
+    esphome_metrics_dump_fn fn;
+    void *user_data;
+} metrics_provider_t;
+
+static metrics_provider_t providers[ESPHOME_METRICS_MAX_PROVIDERS];
+static int provider_count = 0;
+static pthread_mutex_t providers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int esphome_metrics_register(const char *name, esphome_metrics_dump_fn fn,
+                             void *user_data) {
+    int ret = -1;
+
+    if (!name || !fn) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&providers_mutex);
+    if (provider_count < ESPHOME_METRICS_MAX_PROVIDERS) {
+        providers[provider_count].name = name;
+        providers[provider_count].fn = fn;
+        providers[provider_count].user_data = user_data;
+        provider_count++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&providers_mutex);
+
+    return ret;
+}
+
+void esphome_metrics_unregister(esphome_metrics_dump_fn fn, void *user_data) {
+    pthread_mutex_lock(&providers_mutex);
+    for (int i = 0; i < provider_count; i++) {
+        if (providers[i].fn == fn && providers[i].user_data == user_data) {
+            providers[i] = providers[provider_count - 1];
+            provider_count--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&providers_mutex);
+}
+
+void esphome_metrics_dump(FILE *out) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    pthread_mutex_lock(&providers_mutex);
+    fprintf(out, "# metrics uptime %ld.%03ld\n",
+            (long)ts.tv_sec, ts.tv_nsec / 1000000);
+    for (int i = 0; i < provider_count; i++) {
+        fprintf(out, "[%s]\n", providers[i].name);
+        providers[i].fn(out, providers[i].user_data);
+    }
+    pthread_mutex_unlock(&providers_mutex);
+    fflush(out);
+}
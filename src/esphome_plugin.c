@@ -6,15 +6,81 @@
 #include "include/esphome_plugin.h"
 #include "include/esphome_api.h"
 #include "include/esphome_proto.h"
+#include "include/esphome_plugin_internal.h"
+#include "include/esphome_config.h"
+#include "include/esphome_rcu.h"
+#include "include/esphome_thread.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <pthread.h>
 
 #define LOG_PREFIX "[plugin-manager] "
 
+/* Lazy plugins track their clients in a 32-bit mask */
+_Static_assert(ESPHOME_MAX_CLIENTS_LIMIT <= 32, "active_clients has one bit per client");
+
+/**
+ * Shared plugin module loaded from the plugin directory
+ */
+typedef struct plugin_module {
+    struct plugin_module *next;
+    void *handle;                /* dlopen() handle */
+    esphome_plugin_t plugin;     /* Host-owned copy of the plugin descriptor */
+} plugin_module_t;
+
 /* Global plugin list (linked list) */
 static esphome_plugin_t *plugins_head = NULL;
 
+/* Loaded shared modules */
+static plugin_module_t *modules_head = NULL;
+
+/* Server and config handed to plugins, saved for lazy initialization */
+static esphome_api_server_t *plugin_server = NULL;
+static const esphome_device_config_t *plugin_config = NULL;
+
+/* Serializes plugin startup, lazy init, idle teardown and shutdown */
+static pthread_mutex_t lifecycle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond;
+static pthread_t idle_thread;
+static bool idle_thread_running = false;
+
+/* Set once shutdown begins: lazy plugins are not started any more */
+static bool plugins_stopping = false;
+
+/* Signalled when a plugin's last core callback returns (callbacks drops to 0) */
+static pthread_cond_t callbacks_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Entity listing captured from a plugin's list_entities callback
+ */
+struct esphome_entity_cache {
+    esphome_frame_buffer_t frames;
+    uint32_t generation;         /* entity_generation when captured */
+};
+
+/**
+ * Capture in progress on this thread: messages the plugin sends to the
+ * requesting client are framed into the buffer instead of sent
+ */
+typedef struct {
+    esphome_plugin_context_t *ctx;
+    int client_id;
+    esphome_frame_buffer_t *frames;
+    bool failed;                 /* Out of memory */
+} entity_capture_t;
+
+static __thread entity_capture_t *entity_capture = NULL;
+
+/* Signalled on every start_state change and when startup completes */
+static pthread_once_t startup_cond_once = PTHREAD_ONCE_INIT;
+static pthread_cond_t startup_cond;
+static bool startup_done = false;
+
 /**
  * Register a plugin (called by ESPHOME_PLUGIN_REGISTER macro via constructor)
  */
@@ -23,6 +89,11 @@ void esphome_plugin_register(esphome_plugin_t *plugin) {
         return;
     }
 
+    if (esphome_plugin_runtime_alloc(plugin) < 0) {
+        fprintf(stderr, LOG_PREFIX "Out of memory, not registering %s\n", plugin->name);
+        return;
+    }
+
     /* Add to linked list */
     plugin->next = plugins_head;
     plugins_head = plugin;
@@ -30,6 +101,174 @@ void esphome_plugin_register(esphome_plugin_t *plugin) {
     printf(LOG_PREFIX "Registered plugin: %s v%s\n", plugin->name, plugin->version);
 }
 
+/**
+ * Find a registered plugin by name
+ */
+static esphome_plugin_t *find_plugin(const char *name) {
+    for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
+        if (strcmp(plugin->name, name) == 0) {
+            return plugin;
+        }
+    }
+    return NULL;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1000.0 +
+           (double)(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/**
+ * Load one shared plugin module
+ */
+static int load_module(const char *path) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, LOG_PREFIX "Failed to load %s: %s\n", path, dlerror());
+        return -1;
+    }
+
+    const esphome_plugin_abi_t *abi =
+        (const esphome_plugin_abi_t *)dlsym(handle, ESPHOME_PLUGIN_ABI_SYMBOL);
+    if (!abi || !abi->plugin) {
+        fprintf(stderr, LOG_PREFIX "%s: missing %s symbol, not a plugin\n",
+                path, ESPHOME_PLUGIN_ABI_SYMBOL);
+        dlclose(handle);
+        return -1;
+    }
+
+    if (abi->abi_version != ESPHOME_PLUGIN_ABI_VERSION) {
+        fprintf(stderr, LOG_PREFIX "%s: ABI version %u, expected %u\n",
+                path, abi->abi_version, ESPHOME_PLUGIN_ABI_VERSION);
+        dlclose(handle);
+        return -1;
+    }
+
+    /* Older plugins may have a shorter descriptor, but never without callbacks */
+    if (abi->struct_size < offsetof(esphome_plugin_t, next)) {
+        fprintf(stderr, LOG_PREFIX "%s: descriptor too small (%u bytes)\n",
+                path, abi->struct_size);
+        dlclose(handle);
+        return -1;
+    }
+
+    if (!abi->plugin->name || find_plugin(abi->plugin->name)) {
+        fprintf(stderr, LOG_PREFIX "%s: plugin %s already registered, skipping\n",
+                path, abi->plugin->name ? abi->plugin->name : "(unnamed)");
+        dlclose(handle);
+        return -1;
+    }
+
+    plugin_module_t *module = calloc(1, sizeof(*module));
+    if (!module) {
+        dlclose(handle);
+        return -1;
+    }
+
+    size_t copy = abi->struct_size < sizeof(esphome_plugin_t) ?
+                  abi->struct_size : sizeof(esphome_plugin_t);
+    memcpy(&module->plugin, abi->plugin, copy);
+    module->plugin.next = NULL;
+    module->plugin.ctx = NULL;
+    module->handle = handle;
+
+    module->next = modules_head;
+    modules_head = module;
+
+    esphome_plugin_register(&module->plugin);
+
+    printf(LOG_PREFIX "Loaded %s from %s in %.2f ms\n",
+           module->plugin.name, path, elapsed_ms(&start));
+    return 0;
+}
+
+static int module_name_cmp(const void *a, const void *b) {
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/**
+ * Load all shared plugins from a directory
+ */
+int esphome_plugin_load_dir(const char *dir) {
+    DIR *d;
+    struct dirent *entry;
+    char *names[ESPHOME_PLUGIN_MAX_MODULES];
+    int count = 0;
+    int loaded = 0;
+
+    if (!dir || !dir[0]) {
+        return 0;
+    }
+
+    d = opendir(dir);
+    if (!d) {
+        /* The plugin directory is optional */
+        return 0;
+    }
+
+    while ((entry = readdir(d)) != NULL && count < ESPHOME_PLUGIN_MAX_MODULES) {
+        size_t len = strlen(entry->d_name);
+        if (len > 3 && strcmp(entry->d_name + len - 3, ".so") == 0) {
+            names[count] = strdup(entry->d_name);
+            if (names[count]) {
+                count++;
+            }
+        }
+    }
+    closedir(d);
+
+    /* Load in a stable order so registration order does not depend on the filesystem */
+    qsort(names, (size_t)count, sizeof(names[0]), module_name_cmp);
+
+    for (int i = 0; i < count; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        if (load_module(path) == 0) {
+            loaded++;
+        }
+        free(names[i]);
+    }
+
+    if (count > 0) {
+        printf(LOG_PREFIX "Loaded %d of %d plugin module(s) from %s\n", loaded, count, dir);
+    }
+
+    return loaded;
+}
+
+/**
+ * Unload all shared plugin modules
+ */
+void esphome_plugin_unload_all(void) {
+    while (modules_head) {
+        plugin_module_t *module = modules_head;
+        modules_head = module->next;
+
+        /* Unlink from the plugin list before the code goes away */
+        for (esphome_plugin_t **pp = &plugins_head; *pp != NULL; pp = &(*pp)->next) {
+            if (*pp == &module->plugin) {
+                *pp = module->plugin.next;
+                break;
+            }
+        }
+
+        esphome_plugin_runtime_free(&module->plugin);
+        dlclose(module->handle);
+        free(module);
+    }
+}
+
 /**
  * Get the head of the plugin list
  */
@@ -37,44 +276,484 @@ esphome_plugin_t *esphome_plugin_get_head(void) {
     return plugins_head;
 }
 
+/**
+ * Create the plugin context and run its init callback
+ *
+ * Touches no shared plugin state, so parallel startup runs it without
+ * holding lifecycle_mutex; plugin_publish() makes the result visible.
+ *
+ * @return New context, or NULL if init failed
+ */
+static esphome_plugin_context_t *plugin_create_ctx(esphome_plugin_t *plugin) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* Allocate persistent context for this plugin */
+    esphome_plugin_context_t *ctx = calloc(1, sizeof(esphome_plugin_context_t));
+    if (!ctx) {
+        fprintf(stderr, LOG_PREFIX "Failed to allocate context for plugin: %s\n", plugin->name);
+        return NULL;
+    }
+
+    ctx->server = plugin_server;
+    ctx->config = plugin_config;
+    ctx->plugin_data = NULL;
+    ctx->plugin = plugin;
+
+    if (plugin->init(ctx) < 0) {
+        fprintf(stderr, LOG_PREFIX "Failed to initialize plugin: %s\n", plugin->name);
+        free(ctx);
+        return NULL;
+    }
+
+    printf(LOG_PREFIX "Initialized %s in %.2f ms\n", plugin->name, elapsed_ms(&start));
+    return ctx;
+}
+
+static void set_start_state(esphome_plugin_t *plugin, int state) {
+    plugin->rt->start_state = state;
+    pthread_cond_broadcast(&startup_cond);
+}
+
+/**
+ * Make a started plugin visible to clients, or record that it failed
+ *
+ * A lazy plugin whose init failed goes back to STOPPED so the next client
+ * retries it. Caller holds lifecycle_mutex.
+ *
+ * @return 0 if the plugin is running, -1 otherwise
+ */
+static int plugin_publish(esphome_plugin_t *plugin, esphome_plugin_context_t *ctx) {
+    if (!ctx) {
+        set_start_state(plugin, plugin->lazy_init ? ESPHOME_PLUGIN_STOPPED : ESPHOME_PLUGIN_FAILED);
+        return -1;
+    }
+
+    /* Store the context in the plugin for later use */
+    plugin->ctx = ctx;
+    esphome_plugin_executor_attach(plugin);
+    set_start_state(plugin, ESPHOME_PLUGIN_RUNNING);
+    return 0;
+}
+
+static void entity_cache_free(esphome_plugin_t *plugin) {
+    if (plugin->rt->entity_cache) {
+        free(plugin->rt->entity_cache->frames.data);
+        free(plugin->rt->entity_cache);
+        plugin->rt->entity_cache = NULL;
+    }
+}
+
+/**
+ * Keep a running plugin up across a callback made without lifecycle_mutex
+ *
+ * Entity listing, state subscription and device info call into plugins
+ * that send to clients and may block; they pin the plugin instead of
+ * holding lifecycle_mutex across the call. Caller holds lifecycle_mutex.
+ *
+ * @return The plugin's context, to pass to the callback
+ */
+static esphome_plugin_context_t *plugin_pin(esphome_plugin_t *plugin) {
+    plugin->rt->callbacks++;
+    return plugin->ctx;
+}
+
+/**
+ * Release a pin taken by plugin_pin()
+ *
+ * Caller holds lifecycle_mutex.
+ */
+static void plugin_unpin(esphome_plugin_t *plugin) {
+    if (--plugin->rt->callbacks == 0) {
+        pthread_cond_broadcast(&callbacks_cond);
+    }
+}
+
+/**
+ * Detach the executor, run the cleanup callback and free the context
+ *
+ * Waits for pinned callbacks to return first. Caller holds lifecycle_mutex.
+ */
+static void plugin_stop(esphome_plugin_t *plugin) {
+    while (plugin->rt->callbacks > 0) {
+        pthread_cond_wait(&callbacks_cond, &lifecycle_mutex);
+    }
+
+    /* Stop delivering messages before the plugin frees its state */
+    esphome_plugin_executor_detach(plugin);
+
+    if (plugin->cleanup) {
+        printf(LOG_PREFIX "Cleaning up %s...\n", plugin->name);
+        plugin->cleanup(plugin->ctx);
+    }
+
+    /* Free the persistent context; a restarted plugin lists its entities afresh */
+    free(plugin->ctx);
+    plugin->ctx = NULL;
+    entity_cache_free(plugin);
+    for (int i = 0; i < ESPHOME_MAX_CLIENTS_LIMIT; i++) {
+        __atomic_store_n(&plugin->rt->listed_generation[i], 0, __ATOMIC_RELAXED);
+    }
+    set_start_state(plugin, ESPHOME_PLUGIN_STOPPED);
+}
+
+static bool plugin_depends_on(const esphome_plugin_t *plugin, const char *name) {
+    for (const char *const *dep = plugin->depends_on; dep && *dep; dep++) {
+        if (strcmp(*dep, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Check whether a running plugin depends on this one
+ *
+ * Caller holds lifecycle_mutex.
+ */
+static bool plugin_has_running_dependents(const esphome_plugin_t *plugin) {
+    for (esphome_plugin_t *other = plugins_head; other != NULL; other = other->next) {
+        if (other != plugin && other->ctx && plugin_depends_on(other, plugin->name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void startup_cond_init(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&startup_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**
+ * Wait (bounded) until esphome_plugin_init_all() has finished
+ *
+ * Keeps clients that connect during startup from seeing a partial entity
+ * list or losing messages to a plugin that is still initializing.
+ */
+static void wait_for_startup(void) {
+    if (__atomic_load_n(&startup_done, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    pthread_once(&startup_cond_once, startup_cond_init);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += ESPHOME_PLUGIN_STARTUP_WAIT_MS / 1000;
+    deadline.tv_nsec += (long)(ESPHOME_PLUGIN_STARTUP_WAIT_MS % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&lifecycle_mutex);
+    while (!startup_done) {
+        if (pthread_cond_timedwait(&startup_cond, &lifecycle_mutex, &deadline) != 0) {
+            fprintf(stderr, LOG_PREFIX "Plugins still starting after %d ms, continuing\n",
+                    ESPHOME_PLUGIN_STARTUP_WAIT_MS);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lifecycle_mutex);
+}
+
+static uint32_t idle_timeout_ms(const esphome_plugin_t *plugin) {
+    return plugin->idle_timeout_ms ? plugin->idle_timeout_ms : ESPHOME_PLUGIN_IDLE_TIMEOUT_MS;
+}
+
+/**
+ * Idle thread - tears down lazy plugins no client has used for their grace period
+ */
+static void *idle_thread_func(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&lifecycle_mutex);
+    while (idle_thread_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += ESPHOME_PLUGIN_IDLE_CHECK_MS / 1000;
+        pthread_cond_timedwait(&idle_cond, &lifecycle_mutex, &deadline);
+
+        if (!idle_thread_running) {
+            break;
+        }
+
+        uint64_t now = now_ms();
+        for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
+            if (!plugin->lazy_init || !plugin->ctx || plugin->rt->active_clients != 0 ||
+                plugin->rt->callbacks != 0 || plugin_has_running_dependents(plugin)) {
+                continue;
+            }
+            if (now - plugin->rt->idle_since_ms < idle_timeout_ms(plugin)) {
+                continue;
+            }
+
+            printf(LOG_PREFIX "%s idle for %u ms, shutting it down until next use\n",
+                   plugin->name, idle_timeout_ms(plugin));
+            plugin_stop(plugin);
+        }
+    }
+    pthread_mutex_unlock(&lifecycle_mutex);
+
+    return NULL;
+}
+
+/**
+ * Check declared dependencies before startup
+ *
+ * Eager plugins pull their lazy dependencies into eager startup. Plugins
+ * with a missing dependency, or in (or behind) a dependency cycle, are
+ * marked FAILED.
+ */
+static void resolve_dependencies(void) {
+    bool changed = true;
+
+    /* Promote lazy dependencies of eager plugins, transitively */
+    while (changed) {
+        changed = false;
+        for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
+            if (plugin->lazy_init) {
+                continue;
+            }
+            for (const char *const *dep = plugin->depends_on; dep && *dep; dep++) {
+                esphome_plugin_t *dep_plugin = find_plugin(*dep);
+                if (dep_plugin && dep_plugin->lazy_init) {
+                    printf(LOG_PREFIX "%s is needed by %s, initializing it at startup\n",
+                           dep_plugin->name, plugin->name);
+                    dep_plugin->lazy_init = false;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    /* Peel off plugins whose dependencies are all resolvable; what remains
+     * has a missing dependency or sits in a cycle. RUNNING marks
+     * "resolved" here and is reset below. */
+    changed = true;
+    while (changed) {
+        changed = false;
+        for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
+            if (plugin->rt->start_state == ESPHOME_PLUGIN_RUNNING) {
+                continue;
+            }
+
+            bool resolvable = true;
+            for (const char *const *dep = plugin->depends_on; dep && *dep; dep++) {
+                esphome_plugin_t *dep_plugin = find_plugin(*dep);
+                if (!dep_plugin || dep_plugin->rt->start_state != ESPHOME_PLUGIN_RUNNING) {
+                    resolvable = false;
+                    break;
+                }
+            }
+            if (resolvable) {
+                plugin->rt->start_state = ESPHOME_PLUGIN_RUNNING;
+                changed = true;
+            }
+        }
+    }
+
+    for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
+        if (plugin->rt->start_state == ESPHOME_PLUGIN_RUNNING) {
+            plugin->rt->start_state = ESPHOME_PLUGIN_STOPPED;
+            continue;
+        }
+
+        const char *missing = NULL;
+        for (const char *const *dep = plugin->depends_on; dep && *dep; dep++) {
+            if (!find_plugin(*dep)) {
+                missing = *dep;
+                break;
+            }
+        }
+        if (missing) {
+            fprintf(stderr, LOG_PREFIX "%s depends on unknown plugin %s\n", plugin->name, missing);
+        } else {
+            fprintf(stderr, LOG_PREFIX "%s has a dependency cycle or an unresolvable dependency\n",
+                    plugin->name);
+        }
+        plugin->rt->start_state = ESPHOME_PLUGIN_FAILED;
+    }
+}
+
+/**
+ * Start an eager plugin once all of its dependencies are running
+ *
+ * Runs on its own init thread during startup (or inline if that thread
+ * could not be created).
+ */
+static void *plugin_init_thread_func(void *arg) {
+    esphome_plugin_t *plugin = (esphome_plugin_t *)arg;
+    const char *failed_dep = NULL;
+
+    pthread_mutex_lock(&lifecycle_mutex);
+    for (;;) {
+        bool waiting = false;
+        for (const char *const *dep = plugin->depends_on; dep && *dep; dep++) {
+            esphome_plugin_t *dep_plugin = find_plugin(*dep);
+            if (dep_plugin->rt->start_state == ESPHOME_PLUGIN_FAILED) {
+                failed_dep = dep_plugin->name;
+                break;
+            }
+            if (dep_plugin->rt->start_state != ESPHOME_PLUGIN_RUNNING) {
+                waiting = true;
+            }
+        }
+        if (failed_dep || !waiting) {
+            break;
+        }
+        pthread_cond_wait(&startup_cond, &lifecycle_mutex);
+    }
+
+    if (failed_dep) {
+        fprintf(stderr, LOG_PREFIX "Not initializing %s: dependency %s failed\n",
+                plugin->name, failed_dep);
+        set_start_state(plugin, ESPHOME_PLUGIN_FAILED);
+        pthread_mutex_unlock(&lifecycle_mutex);
+        return NULL;
+    }
+    pthread_mutex_unlock(&lifecycle_mutex);
+
+    esphome_plugin_context_t *ctx = NULL;
+    if (plugin->init) {
+        printf(LOG_PREFIX "Initializing %s...\n", plugin->name);
+        ctx = plugin_create_ctx(plugin);
+    }
+
+    pthread_mutex_lock(&lifecycle_mutex);
+    if (plugin->init) {
+        plugin_publish(plugin, ctx);
+    } else {
+        set_start_state(plugin, ESPHOME_PLUGIN_RUNNING);
+    }
+    pthread_mutex_unlock(&lifecycle_mutex);
+
+    return NULL;
+}
+
 /**
  * Initialize all plugins
  */
 int esphome_plugin_init_all(esphome_api_server_t *server, const esphome_device_config_t *config) {
+    struct timespec start;
     int count = 0;
     int failed = 0;
+    int deferred = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_once(&startup_cond_once, startup_cond_init);
+
+    plugin_server = server;
+    plugin_config = config;
 
     printf(LOG_PREFIX "Initializing plugins...\n");
 
     for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
         count++;
-        printf(LOG_PREFIX "Initializing %s...\n", plugin->name);
 
-        if (plugin->init) {
-            /* Allocate persistent context for this plugin */
-            esphome_plugin_context_t *ctx = calloc(1, sizeof(esphome_plugin_context_t));
-            if (!ctx) {
-                fprintf(stderr, LOG_PREFIX "Failed to allocate context for plugin: %s\n", plugin->name);
-                failed++;
-                continue;
-            }
+        if (plugin->lazy_init && plugin->message_type_count == 0) {
+            fprintf(stderr, LOG_PREFIX "%s requests lazy init but owns no message types, "
+                    "initializing now\n", plugin->name);
+            plugin->lazy_init = false;
+        } else if (plugin->lazy_init && !plugin->init) {
+            /* Nothing to defer, and its lazy dependencies must start with it */
+            plugin->lazy_init = false;
+        }
+    }
+
+    /* Client threads may already run; keep them out until states are set */
+    pthread_mutex_lock(&lifecycle_mutex);
+    resolve_dependencies();
 
-            ctx->server = server;
-            ctx->config = config;
-            ctx->plugin_data = NULL;
-
-            if (plugin->init(ctx) < 0) {
-                fprintf(stderr, LOG_PREFIX "Failed to initialize plugin: %s\n", plugin->name);
-                free(ctx);
-                failed++;
-            } else {
-                /* Store the context in the plugin for later use */
-                plugin->ctx = ctx;
+    pthread_t *threads = calloc((size_t)count, sizeof(pthread_t));
+    esphome_plugin_t **pending = calloc((size_t)count, sizeof(esphome_plugin_t *));
+    int started_count = 0;
+    int pending_count = 0;
+
+    for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
+        if (plugin->rt->start_state == ESPHOME_PLUGIN_FAILED) {
+            continue;
+        }
+        if (plugin->lazy_init && plugin->init) {
+            printf(LOG_PREFIX "Deferring %s until a client uses it\n", plugin->name);
+            deferred++;
+            continue;
+        }
+        plugin->rt->start_state = ESPHOME_PLUGIN_STARTING;
+    }
+    pthread_mutex_unlock(&lifecycle_mutex);
+
+    /* Independent plugins initialize in parallel, dependents wait on startup_cond */
+    for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
+        if (plugin->rt->start_state != ESPHOME_PLUGIN_STARTING) {
+            continue;
+        }
+
+        char name[16];
+        snprintf(name, sizeof(name), "init-%s", plugin->name);
+        if (threads && esphome_thread_create(&threads[started_count], ESPHOME_THREAD_PIPELINE,
+                                             name, plugin_init_thread_func, plugin) == 0) {
+            started_count++;
+        } else if (pending) {
+            pending[pending_count++] = plugin;
+        } else {
+            plugin_init_thread_func(plugin);
+        }
+    }
+
+    /* Plugins without an init thread run inline, dependencies first, so
+     * none of them waits on a plugin that is never started */
+    while (pending_count > 0) {
+        for (int i = 0; i < pending_count; i++) {
+            bool blocked = false;
+            for (int j = 0; j < pending_count && !blocked; j++) {
+                blocked = (j != i && plugin_depends_on(pending[i], pending[j]->name));
+            }
+            if (!blocked) {
+                plugin_init_thread_func(pending[i]);
+                pending[i] = pending[--pending_count];
+                break;
             }
         }
     }
 
-    printf(LOG_PREFIX "Initialized %d plugin(s), %d failed\n", count, failed);
+    for (int i = 0; i < started_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(pending);
+
+    pthread_mutex_lock(&lifecycle_mutex);
+    for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
+        if (plugin->rt->start_state == ESPHOME_PLUGIN_FAILED) {
+            failed++;
+        }
+    }
+    __atomic_store_n(&startup_done, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&startup_cond);
+    pthread_mutex_unlock(&lifecycle_mutex);
+
+    if (deferred > 0) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&idle_cond, &attr);
+        pthread_condattr_destroy(&attr);
+
+        idle_thread_running = true;
+        if (esphome_thread_create(&idle_thread, ESPHOME_THREAD_BACKGROUND, "plugin-idle",
+                                  idle_thread_func, NULL) != 0) {
+            fprintf(stderr, LOG_PREFIX "Failed to create idle thread, lazy plugins stay loaded\n");
+            idle_thread_running = false;
+        }
+    }
+
+    printf(LOG_PREFIX "Initialized %d plugin(s), %d deferred, %d failed in %.2f ms\n",
+           count - deferred, deferred, failed, elapsed_ms(&start));
     return (failed > 0) ? -1 : 0;
 }
 
@@ -87,16 +766,120 @@ void esphome_plugin_cleanup_all(esphome_api_server_t *server, const esphome_devi
 
     printf(LOG_PREFIX "Cleaning up plugins...\n");
 
+    /* Clients are still connected: keep them from restarting what is stopped */
+    pthread_mutex_lock(&lifecycle_mutex);
+    plugins_stopping = true;
+    pthread_mutex_unlock(&lifecycle_mutex);
+
+    if (idle_thread_running) {
+        pthread_mutex_lock(&lifecycle_mutex);
+        idle_thread_running = false;
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&lifecycle_mutex);
+        pthread_join(idle_thread, NULL);
+        pthread_cond_destroy(&idle_cond);
+    }
+
+    /* Dependents go first, so a plugin never outlives what it depends on */
+    pthread_mutex_lock(&lifecycle_mutex);
+    bool stopped = true;
+    while (stopped) {
+        stopped = false;
+        for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
+            if (plugin->ctx && !plugin_has_running_dependents(plugin)) {
+                plugin_stop(plugin);
+                stopped = true;
+            }
+        }
+    }
+    pthread_mutex_unlock(&lifecycle_mutex);
+}
+
+/**
+ * Start a lazy plugin, after its stopped lazy dependencies
+ *
+ * Caller holds lifecycle_mutex. Dependency cycles were rejected at startup.
+ * Nothing is started once esphome_plugin_cleanup_all() has begun.
+ *
+ * @return 0 if the plugin is running, -1 if it or a dependency failed
+ */
+static int lazy_plugin_start(esphome_plugin_t *plugin) {
+    if (plugin->ctx) {
+        return 0;
+    }
+    if (plugin->rt->start_state == ESPHOME_PLUGIN_FAILED || plugins_stopping) {
+        return -1;
+    }
+
+    for (const char *const *dep = plugin->depends_on; dep && *dep; dep++) {
+        esphome_plugin_t *dep_plugin = find_plugin(*dep);
+        if (dep_plugin->rt->start_state == ESPHOME_PLUGIN_RUNNING) {
+            continue;
+        }
+        if (!dep_plugin->lazy_init || lazy_plugin_start(dep_plugin) < 0) {
+            fprintf(stderr, LOG_PREFIX "Not initializing %s: dependency %s is not running\n",
+                    plugin->name, dep_plugin->name);
+            return -1;
+        }
+    }
+
+    if (!plugin->init) {
+        /* Runs without a context, as at startup */
+        set_start_state(plugin, ESPHOME_PLUGIN_RUNNING);
+        return 0;
+    }
+
+    printf(LOG_PREFIX "First use of %s, initializing...\n", plugin->name);
+    set_start_state(plugin, ESPHOME_PLUGIN_STARTING);
+    return plugin_publish(plugin, plugin_create_ctx(plugin));
+}
+
+/**
+ * Start a lazy plugin on first use and mark the client as using it
+ *
+ * @return 0 if the plugin is running, -1 if its init failed
+ */
+static int lazy_plugin_acquire(esphome_plugin_t *plugin, int client_id) {
+    pthread_mutex_lock(&lifecycle_mutex);
+    int ret = lazy_plugin_start(plugin);
+    if (ret == 0) {
+        plugin->rt->idle_since_ms = now_ms();
+        if (client_id >= 0 && client_id < ESPHOME_MAX_CLIENTS_LIMIT) {
+            plugin->rt->active_clients |= 1U << client_id;
+        }
+    }
+    pthread_mutex_unlock(&lifecycle_mutex);
+
+    return ret;
+}
+
+/**
+ * Notify plugins that a client disconnected
+ */
+void esphome_plugin_client_disconnected(esphome_api_server_t *server, int client_id) {
+    (void)server;
+
+    if (client_id < 0 || client_id >= ESPHOME_MAX_CLIENTS_LIMIT) {
+        return;
+    }
+
+    pthread_mutex_lock(&lifecycle_mutex);
     for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
-        if (plugin->cleanup && plugin->ctx) {
-            printf(LOG_PREFIX "Cleaning up %s...\n", plugin->name);
-            plugin->cleanup(plugin->ctx);
+        /* The next client in this slot has not seen any listing */
+        __atomic_store_n(&plugin->rt->listed_generation[client_id], 0, __ATOMIC_RELAXED);
+
+        if (!plugin->lazy_init || !(plugin->rt->active_clients & (1U << client_id))) {
+            continue;
+        }
 
-            /* Free the persistent context */
-            free(plugin->ctx);
-            plugin->ctx = NULL;
+        plugin->rt->active_clients &= ~(1U << client_id);
+        if (plugin->rt->active_clients == 0) {
+            plugin->rt->idle_since_ms = now_ms();
+            printf(LOG_PREFIX "%s has no clients, stopping in %u ms unless used again\n",
+                   plugin->name, idle_timeout_ms(plugin));
         }
     }
+    pthread_mutex_unlock(&lifecycle_mutex);
 }
 
 /**
@@ -108,45 +891,246 @@ int esphome_plugin_configure_device_info_all(
     const esphome_device_config_t *config,
     esphome_device_info_response_t *device_info)
 {
-    (void)server;
-    (void)config;
-
     for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
-        if (plugin->configure_device_info && plugin->ctx) {
-            printf(LOG_PREFIX "Plugin %s configuring device info...\n", plugin->name);
-            if (plugin->configure_device_info(plugin->ctx, device_info) < 0) {
-                fprintf(stderr, LOG_PREFIX "Warning: Plugin %s failed to configure device info\n",
-                        plugin->name);
-            }
+        if (!plugin->configure_device_info) {
+            continue;
+        }
+
+        pthread_mutex_lock(&lifecycle_mutex);
+        if (plugin->rt->start_state == ESPHOME_PLUGIN_FAILED ||
+            (!plugin->ctx && !plugin->lazy_init && startup_done)) {
+            pthread_mutex_unlock(&lifecycle_mutex);
+            continue;
+        }
+
+        /* Device info is answered without waiting for startup: a plugin that
+         * is still initializing, or a lazy one not started yet (or being
+         * stopped), advertises its features with an idle context */
+        esphome_plugin_context_t idle_ctx = { server, config, NULL, plugin };
+        esphome_plugin_context_t *ctx = &idle_ctx;
+        bool pinned = plugin->ctx && !plugins_stopping;
+        if (pinned) {
+            ctx = plugin_pin(plugin);
+        }
+        pthread_mutex_unlock(&lifecycle_mutex);
+
+        printf(LOG_PREFIX "Plugin %s configuring device info...\n", plugin->name);
+        if (plugin->configure_device_info(ctx, device_info) < 0) {
+            fprintf(stderr, LOG_PREFIX "Warning: Plugin %s failed to configure device info\n",
+                    plugin->name);
+        }
+
+        if (pinned) {
+            pthread_mutex_lock(&lifecycle_mutex);
+            plugin_unpin(plugin);
+            pthread_mutex_unlock(&lifecycle_mutex);
+        }
+    }
+
+    return 0;
+}
+
+int esphome_frame_buffer_append(esphome_frame_buffer_t *buf, uint16_t msg_type,
+                                const uint8_t *payload, size_t payload_len) {
+    /* Preamble, two varints and the payload */
+    size_t need = buf->len + payload_len + 16;
+
+    if (need > buf->size) {
+        size_t size = buf->size ? buf->size : 1024;
+        while (size < need) {
+            size *= 2;
         }
+        uint8_t *data = realloc(buf->data, size);
+        if (!data) {
+            return -1;
+        }
+        buf->data = data;
+        buf->size = size;
     }
 
+    size_t len = esphome_frame_message(buf->data + buf->len, buf->size - buf->len,
+                                       msg_type, payload, payload_len);
+    if (len == 0) {
+        return -1;
+    }
+    buf->len += len;
+    buf->frames++;
     return 0;
 }
 
+/**
+ * Run a plugin's list_entities callback and keep what it sends
+ *
+ * Caller has pinned the plugin and does not hold lifecycle_mutex.
+ */
+static struct esphome_entity_cache *entity_cache_build(esphome_plugin_t *plugin,
+                                                       esphome_plugin_context_t *ctx,
+                                                       int client_id) {
+    struct esphome_entity_cache *cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+
+    /* Read before the callback: an invalidation during it forces a rebuild */
+    cache->generation = __atomic_load_n(&plugin->rt->entity_generation, __ATOMIC_ACQUIRE);
+
+    entity_capture_t capture = { ctx, client_id, &cache->frames, false };
+    entity_capture = &capture;
+
+    printf(LOG_PREFIX "Plugin %s listing entities...\n", plugin->name);
+    int ret = plugin->list_entities(ctx, client_id);
+
+    entity_capture = NULL;
+
+    if (ret < 0 || capture.failed) {
+        fprintf(stderr, LOG_PREFIX "Warning: Plugin %s failed to list entities\n", plugin->name);
+        free(cache->frames.data);
+        free(cache);
+        return NULL;
+    }
+
+    printf(LOG_PREFIX "Cached %d entity message(s) of %s (%zu bytes)\n",
+           cache->frames.frames, plugin->name, cache->frames.len);
+    return cache;
+}
+
+/**
+ * Generation of the current configuration snapshot
+ */
+static uint32_t current_config_generation(void) {
+    int rcu = esphome_rcu_read_lock();
+    uint32_t generation = esphome_config_generation(esphome_config_get());
+    esphome_rcu_read_unlock(rcu);
+    return generation;
+}
+
+/**
+ * Start a stopped lazy plugin so it can list its entities
+ *
+ * Home Assistant lists entities before it sends anything a lazy plugin
+ * owns, so a lazy plugin with entities must be running by then, or the
+ * client never learns the keys of the states it later sends. A plugin
+ * that listed nothing under the current configuration is left stopped, as
+ * is every plugin once shutdown has begun. Caller holds lifecycle_mutex.
+ *
+ * @return true if the plugin is running and should be listed
+ */
+static bool lazy_plugin_start_for_listing(esphome_plugin_t *plugin) {
+    if (plugin->ctx) {
+        return true;
+    }
+    if (!plugin->lazy_init || plugin->rt->start_state == ESPHOME_PLUGIN_FAILED ||
+        plugins_stopping) {
+        return false;
+    }
+    if (plugin->rt->empty_listing_config != 0 &&
+        plugin->rt->empty_listing_config == current_config_generation()) {
+        return false;
+    }
+    if (lazy_plugin_start(plugin) < 0) {
+        return false;
+    }
+
+    /* Not used by anyone yet: the idle grace period starts now */
+    plugin->rt->idle_since_ms = now_ms();
+    return true;
+}
+
+/**
+ * Account a lazy plugin's listing to the client that received it
+ *
+ * A client that was sent entities uses the plugin, which then stays up
+ * while the client is connected. Caller holds lifecycle_mutex.
+ */
+static void lazy_plugin_listed(esphome_plugin_t *plugin, int client_id,
+                               const struct esphome_entity_cache *cache) {
+    if (!cache) {
+        return;
+    }
+    if (cache->frames.frames == 0) {
+        plugin->rt->empty_listing_config = current_config_generation();
+        return;
+    }
+
+    plugin->rt->empty_listing_config = 0;
+    plugin->rt->idle_since_ms = now_ms();
+    if (client_id >= 0 && client_id < ESPHOME_MAX_CLIENTS_LIMIT) {
+        plugin->rt->active_clients |= 1U << client_id;
+    }
+}
+
 /**
  * List entities from all plugins
- * Calls each plugin's list_entities callback if present
+ * Answers from each plugin's cached listing, capturing it first if stale
  */
 int esphome_plugin_list_entities_all(
     esphome_api_server_t *server,
     const esphome_device_config_t *config,
-    int client_id)
+    int client_id,
+    esphome_frame_buffer_t *out)
 {
     (void)server;
     (void)config;
+    int result = 0;
+
+    wait_for_startup();
 
     for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
-        if (plugin->list_entities && plugin->ctx) {
-            printf(LOG_PREFIX "Plugin %s listing entities...\n", plugin->name);
-            if (plugin->list_entities(plugin->ctx, client_id) < 0) {
-                fprintf(stderr, LOG_PREFIX "Warning: Plugin %s failed to list entities\n",
-                        plugin->name);
+        if (!plugin->list_entities) {
+            continue;
+        }
+
+        pthread_mutex_lock(&lifecycle_mutex);
+        if (!lazy_plugin_start_for_listing(plugin)) {
+            pthread_mutex_unlock(&lifecycle_mutex);
+            continue;
+        }
+
+        struct esphome_entity_cache *cache = plugin->rt->entity_cache;
+        if (!cache || cache->generation != __atomic_load_n(&plugin->rt->entity_generation,
+                                                            __ATOMIC_ACQUIRE)) {
+            /* The callback sends to the client: run it without the lock */
+            esphome_plugin_context_t *ctx = plugin_pin(plugin);
+            pthread_mutex_unlock(&lifecycle_mutex);
+            cache = entity_cache_build(plugin, ctx, client_id);
+            pthread_mutex_lock(&lifecycle_mutex);
+            plugin_unpin(plugin);
+
+            /* A concurrent listing may have stored one meanwhile; ours is as new */
+            entity_cache_free(plugin);
+            plugin->rt->entity_cache = cache;
+        }
+        if (plugin->lazy_init) {
+            lazy_plugin_listed(plugin, client_id, cache);
+        }
+        if (cache && client_id >= 0 && client_id < ESPHOME_MAX_CLIENTS_LIMIT) {
+            __atomic_store_n(&plugin->rt->listed_generation[client_id], cache->generation + 1,
+                             __ATOMIC_RELEASE);
+        }
+        if (!cache || cache->frames.len == 0) {
+            pthread_mutex_unlock(&lifecycle_mutex);
+            continue;
+        }
+
+        /* Whole frames only, so the buffer can be grown by hand */
+        size_t need = out->len + cache->frames.len;
+        if (need > out->size) {
+            uint8_t *data = realloc(out->data, need);
+            if (!data) {
+                pthread_mutex_unlock(&lifecycle_mutex);
+                result = -1;
+                break;
             }
+            out->data = data;
+            out->size = need;
         }
+        memcpy(out->data + out->len, cache->frames.data, cache->frames.len);
+        out->len += cache->frames.len;
+        out->frames += cache->frames.frames;
+        pthread_mutex_unlock(&lifecycle_mutex);
     }
 
-    return 0;
+    return result;
 }
 
 /**
@@ -161,14 +1145,34 @@ int esphome_plugin_subscribe_states_all(
     (void)server;
     (void)config;
 
+    wait_for_startup();
+
     for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
-        if (plugin->subscribe_states && plugin->ctx) {
-            printf(LOG_PREFIX "Plugin %s subscribe states...\n", plugin->name);
-            if (plugin->subscribe_states(plugin->ctx, client_id) < 0) {
-                fprintf(stderr, LOG_PREFIX "Warning: Plugin %s failed to subscribe states\n",
-                        plugin->name);
-            }
+        if (!plugin->subscribe_states) {
+            continue;
         }
+
+        /* Initial states are sent from the callback: run it without the lock */
+        pthread_mutex_lock(&lifecycle_mutex);
+        esphome_plugin_context_t *ctx = NULL;
+        if (plugin->ctx && !plugins_stopping) {
+            ctx = plugin_pin(plugin);
+        }
+        pthread_mutex_unlock(&lifecycle_mutex);
+
+        if (!ctx) {
+            continue;
+        }
+
+        printf(LOG_PREFIX "Plugin %s subscribe states...\n", plugin->name);
+        if (plugin->subscribe_states(ctx, client_id) < 0) {
+            fprintf(stderr, LOG_PREFIX "Warning: Plugin %s failed to subscribe states\n",
+                    plugin->name);
+        }
+
+        pthread_mutex_lock(&lifecycle_mutex);
+        plugin_unpin(plugin);
+        pthread_mutex_unlock(&lifecycle_mutex);
     }
 
     return 0;
@@ -189,9 +1193,29 @@ int esphome_plugin_handle_message(
     (void)server;
     (void)config;
 
+    wait_for_startup();
+
     for (esphome_plugin_t *plugin = plugins_head; plugin != NULL; plugin = plugin->next) {
-        if (plugin->handle_message && plugin->ctx) {
-            int result = plugin->handle_message(plugin->ctx, client_id, msg_type, data, len);
+        if (!plugin->handle_message || (!plugin->ctx && !plugin->lazy_init)) {
+            continue;
+        }
+
+        if (esphome_plugin_owns_message(plugin, msg_type)) {
+            if (plugin->lazy_init && lazy_plugin_acquire(plugin, client_id) < 0) {
+                return -1;
+            }
+
+            /* Declared owner: hand off to its executor */
+            return esphome_plugin_executor_dispatch(plugin, client_id, msg_type, data, len);
+        }
+
+        if (!plugin->ctx) {
+            continue;
+        }
+
+        if (plugin->message_type_count == 0) {
+            /* Undeclared ownership: probe the handler inline */
+            int result = esphome_plugin_executor_dispatch(plugin, client_id, msg_type, data, len);
             if (result == 0) {
                 /* Message was handled by this plugin */
                 return 0;
@@ -234,9 +1258,104 @@ int esphome_plugin_send_message_to_client(
         return -1;
     }
 
+    /* Inside list_entities: part of the listing being cached */
+    entity_capture_t *capture = entity_capture;
+    if (capture && capture->ctx == ctx && capture->client_id == client_id) {
+        if (esphome_frame_buffer_append(capture->frames, (uint16_t)msg_type, data, len) < 0) {
+            capture->failed = true;
+            return -1;
+        }
+        return 0;
+    }
+
     return esphome_api_send_to_client(ctx->server, client_id, (uint16_t)msg_type, data, len);
 }
 
+/**
+ * Coalesce the messages this thread sends
+ */
+void esphome_plugin_cork(esphome_plugin_context_t *ctx) {
+    if (ctx && ctx->server) {
+        esphome_api_cork(ctx->server);
+    }
+}
+
+/**
+ * Write the messages held back since esphome_plugin_cork()
+ */
+void esphome_plugin_uncork(esphome_plugin_context_t *ctx) {
+    if (ctx && ctx->server) {
+        esphome_api_uncork(ctx->server);
+    }
+}
+
+/**
+ * Drop a plugin's cached entity listing
+ */
+void esphome_plugin_invalidate_entities(esphome_plugin_context_t *ctx) {
+    if (!ctx || !ctx->plugin) {
+        return;
+    }
+
+    __atomic_add_fetch(&ctx->plugin->rt->entity_generation, 1, __ATOMIC_RELEASE);
+}
+
+uint32_t esphome_plugin_entity_generation(esphome_plugin_context_t *ctx) {
+    if (!ctx || !ctx->plugin) {
+        return 0;
+    }
+
+    return __atomic_load_n(&ctx->plugin->rt->entity_generation, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Check one client's listing record against a generation
+ */
+static bool client_listed(const esphome_plugin_t *plugin, int client_id, uint32_t generation) {
+    uint32_t listed = __atomic_load_n(&plugin->rt->listed_generation[client_id], __ATOMIC_ACQUIRE);
+
+    /* Wrap-safe: listed - 1 is the generation of the client's listing */
+    return listed != 0 && (int32_t)(listed - 1 - generation) >= 0;
+}
+
+bool esphome_plugin_client_listed(esphome_plugin_context_t *ctx, int client_id,
+                                  uint32_t generation) {
+    if (!ctx || !ctx->plugin || client_id >= ESPHOME_MAX_CLIENTS_LIMIT) {
+        return false;
+    }
+
+    if (client_id >= 0) {
+        return client_listed(ctx->plugin, client_id, generation);
+    }
+
+    uint32_t clients = esphome_api_connected_clients(ctx->server);
+    for (int i = 0; i < ESPHOME_MAX_CLIENTS_LIMIT; i++) {
+        if ((clients & (1U << i)) && !client_listed(ctx->plugin, i, generation)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int esphome_plugin_send_entity_state(esphome_plugin_context_t *ctx,
+                                     uint32_t generation,
+                                     uint32_t msg_type,
+                                     const uint8_t *data,
+                                     size_t len) {
+    if (!ctx || !ctx->plugin || !ctx->server) {
+        return 0;
+    }
+
+    int sent = 0;
+    for (int i = 0; i < ESPHOME_MAX_CLIENTS_LIMIT; i++) {
+        if (client_listed(ctx->plugin, i, generation) &&
+            esphome_api_send_to_client(ctx->server, i, (uint16_t)msg_type, data, len) == 0) {
+            sent++;
+        }
+    }
+    return sent;
+}
+
 /**
  * Get the hostname/IP address of a connected client
  */
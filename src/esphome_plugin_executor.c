@@ -0,0 +1,462 @@
+/**
+ * @file esphome_plugin_executor.c
+ * @brief Per-plugin message executors
+ *
+ * Hands plugin messages off the client receive threads so that a plugin
+ * doing I/O in its handler cannot stall a client's stream (including
+ * pings). Each plugin owns a bounded FIFO of pending messages; an executor
+ * (one dedicated thread, or the shared pool) drains plugins that have work,
+ * one message at a time per plugin.
+ */
+
+#include "include/esphome_plugin_internal.h"
+#include "include/esphome_thread.h"
+#include "include/esphome_metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define LOG_PREFIX "[plugin-executor] "
+
+/**
+ * Queued plugin message
+ */
+typedef struct plugin_job {
+    struct plugin_job *next;
+    int client_id;
+    uint32_t msg_type;
+    uint64_t enqueued_ns;
+    size_t len;
+    uint8_t data[];
+} plugin_job_t;
+
+/**
+ * Executor: worker threads draining a list of plugins with pending work
+ */
+typedef struct plugin_executor {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    esphome_plugin_runtime_t *ready_head;
+    esphome_plugin_runtime_t *ready_tail;
+    pthread_t threads[ESPHOME_PLUGIN_POOL_THREADS];
+    int thread_count;
+    bool stopping;
+} plugin_executor_t;
+
+static plugin_executor_t *shared_pool = NULL;
+static int shared_pool_users = 0;
+static pthread_mutex_t shared_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* -----------------------------------------------------------------
+ * Utility functions
+ * ----------------------------------------------------------------- */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Run the plugin handler and account for it
+ */
+static int run_handler(esphome_plugin_runtime_t *rt, int client_id, uint32_t msg_type,
+                       const uint8_t *data, size_t len, uint64_t queue_ns, bool inline_run) {
+    esphome_plugin_t *plugin = rt->plugin;
+    uint64_t start = now_ns();
+
+    /* The replies of one message leave together, as on the client thread */
+    esphome_plugin_cork(plugin->ctx);
+    int result = plugin->handle_message(plugin->ctx, client_id, msg_type, data, len);
+    esphome_plugin_uncork(plugin->ctx);
+
+    uint64_t run_ns = now_ns() - start;
+    bool slow = run_ns >= (uint64_t)ESPHOME_PLUGIN_SLOW_HANDLER_MS * 1000000ULL;
+
+    pthread_mutex_lock(&rt->lock);
+    if (result == 0) {
+        rt->handled++;
+    }
+    rt->queue_ns_total += queue_ns;
+    if (queue_ns > rt->queue_ns_max) {
+        rt->queue_ns_max = queue_ns;
+    }
+    rt->run_ns_total += run_ns;
+    if (run_ns > rt->run_ns_max) {
+        rt->run_ns_max = run_ns;
+    }
+    if (slow) {
+        rt->slow++;
+    }
+    pthread_mutex_unlock(&rt->lock);
+
+    if (slow) {
+        fprintf(stderr, LOG_PREFIX "Warning: %s took %llu ms to handle message type %u%s\n",
+                plugin->name, (unsigned long long)(run_ns / 1000000ULL), msg_type,
+                inline_run ? " on the client thread" : "");
+    }
+
+    return result;
+}
+
+/* -----------------------------------------------------------------
+ * Executors
+ * ----------------------------------------------------------------- */
+
+/* Caller holds ex->lock */
+static void ready_push(plugin_executor_t *ex, esphome_plugin_runtime_t *rt) {
+    rt->ready_next = NULL;
+    if (ex->ready_tail) {
+        ex->ready_tail->ready_next = rt;
+    } else {
+        ex->ready_head = rt;
+    }
+    ex->ready_tail = rt;
+    pthread_cond_signal(&ex->cond);
+}
+
+static void *executor_thread_func(void *arg) {
+    plugin_executor_t *ex = (plugin_executor_t *)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&ex->lock);
+        while (!ex->stopping && !ex->ready_head) {
+            pthread_cond_wait(&ex->cond, &ex->lock);
+        }
+        if (ex->stopping) {
+            pthread_mutex_unlock(&ex->lock);
+            break;
+        }
+        esphome_plugin_runtime_t *rt = ex->ready_head;
+        ex->ready_head = rt->ready_next;
+        if (!ex->ready_head) {
+            ex->ready_tail = NULL;
+        }
+        pthread_mutex_unlock(&ex->lock);
+
+        /* One message per turn, so a busy plugin cannot starve the others in the pool */
+        pthread_mutex_lock(&rt->lock);
+        plugin_job_t *job = rt->head;
+        if (job) {
+            rt->head = job->next;
+            if (!rt->head) {
+                rt->tail = NULL;
+            }
+            rt->queued--;
+        }
+        pthread_mutex_unlock(&rt->lock);
+
+        if (job) {
+            run_handler(rt, job->client_id, job->msg_type, job->data, job->len,
+                        now_ns() - job->enqueued_ns, false);
+            free(job);
+        }
+
+        pthread_mutex_lock(&rt->lock);
+        bool more = rt->head != NULL;
+        if (!more) {
+            rt->scheduled = false;
+            pthread_cond_broadcast(&rt->idle_cond);
+        }
+        pthread_mutex_unlock(&rt->lock);
+
+        if (more) {
+            pthread_mutex_lock(&ex->lock);
+            ready_push(ex, rt);
+            pthread_mutex_unlock(&ex->lock);
+        }
+    }
+
+    return NULL;
+}
+
+static plugin_executor_t *executor_create(int threads, const char *name) {
+    plugin_executor_t *ex = calloc(1, sizeof(*ex));
+    if (!ex) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&ex->lock, NULL);
+    pthread_cond_init(&ex->cond, NULL);
+
+    for (int i = 0; i < threads && i < ESPHOME_PLUGIN_POOL_THREADS; i++) {
+        if (esphome_thread_create(&ex->threads[i], ESPHOME_THREAD_PIPELINE, name,
+                                  executor_thread_func, ex) != 0) {
+            fprintf(stderr, LOG_PREFIX "Failed to create executor thread %s\n", name);
+            break;
+        }
+        ex->thread_count++;
+    }
+
+    if (ex->thread_count == 0) {
+        pthread_cond_destroy(&ex->cond);
+        pthread_mutex_destroy(&ex->lock);
+        free(ex);
+        return NULL;
+    }
+
+    return ex;
+}
+
+static void executor_destroy(plugin_executor_t *ex) {
+    pthread_mutex_lock(&ex->lock);
+    ex->stopping = true;
+    pthread_cond_broadcast(&ex->cond);
+    pthread_mutex_unlock(&ex->lock);
+
+    for (int i = 0; i < ex->thread_count; i++) {
+        pthread_join(ex->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&ex->cond);
+    pthread_mutex_destroy(&ex->lock);
+    free(ex);
+}
+
+/* -----------------------------------------------------------------
+ * Metrics
+ * ----------------------------------------------------------------- */
+
+static void executor_metrics_dump(FILE *out, void *user_data) {
+    (void)user_data;
+
+    for (esphome_plugin_t *plugin = esphome_plugin_get_head(); plugin; plugin = plugin->next) {
+        esphome_plugin_runtime_t *rt = plugin->rt;
+        if (!rt) {
+            continue;
+        }
+
+        pthread_mutex_lock(&rt->lock);
+        uint64_t runs = rt->handled ? rt->handled : 1;
+        fprintf(out, "plugin.%s.handled %llu\n", plugin->name, (unsigned long long)rt->handled);
+        fprintf(out, "plugin.%s.dropped %llu\n", plugin->name, (unsigned long long)rt->dropped);
+        fprintf(out, "plugin.%s.slow %llu\n", plugin->name, (unsigned long long)rt->slow);
+        fprintf(out, "plugin.%s.queued %u/%u\n", plugin->name, rt->queued, rt->depth);
+        fprintf(out, "plugin.%s.queue_us avg=%llu max=%llu\n", plugin->name,
+                (unsigned long long)(rt->queue_ns_total / runs / 1000ULL),
+                (unsigned long long)(rt->queue_ns_max / 1000ULL));
+        fprintf(out, "plugin.%s.run_us avg=%llu max=%llu\n", plugin->name,
+                (unsigned long long)(rt->run_ns_total / runs / 1000ULL),
+                (unsigned long long)(rt->run_ns_max / 1000ULL));
+        pthread_mutex_unlock(&rt->lock);
+    }
+}
+
+static void register_metrics(void) {
+    esphome_metrics_register("plugins", executor_metrics_dump, NULL);
+}
+
+/* -----------------------------------------------------------------
+ * Internal API
+ * ----------------------------------------------------------------- */
+
+bool esphome_plugin_owns_message(const esphome_plugin_t *plugin, uint32_t msg_type) {
+    for (size_t i = 0; i < plugin->message_type_count; i++) {
+        if (plugin->message_types[i] == msg_type) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int esphome_plugin_executor_attach(esphome_plugin_t *plugin) {
+    static pthread_once_t metrics_once = PTHREAD_ONCE_INIT;
+    esphome_plugin_executor_t kind = plugin->executor;
+    esphome_plugin_runtime_t *rt = plugin->rt;
+    plugin_executor_t *ex = NULL;
+
+    if (!rt) {
+        return -1;
+    }
+    if (!rt->closed) {
+        return 0;  /* Already attached */
+    }
+
+    if (kind != ESPHOME_PLUGIN_EXECUTOR_INLINE &&
+        (plugin->message_type_count == 0 || !plugin->message_types)) {
+        fprintf(stderr, LOG_PREFIX "%s declares no message types, running its handler inline\n",
+                plugin->name);
+        kind = ESPHOME_PLUGIN_EXECUTOR_INLINE;
+    }
+
+    if (kind == ESPHOME_PLUGIN_EXECUTOR_DEDICATED) {
+        char name[16];
+        snprintf(name, sizeof(name), "plg-%s", plugin->name);
+        ex = executor_create(1, name);
+    } else if (kind == ESPHOME_PLUGIN_EXECUTOR_SHARED) {
+        pthread_mutex_lock(&shared_pool_mutex);
+        if (!shared_pool) {
+            shared_pool = executor_create(ESPHOME_PLUGIN_POOL_THREADS, "plg-pool");
+        }
+        if (shared_pool) {
+            shared_pool_users++;
+        }
+        ex = shared_pool;
+        pthread_mutex_unlock(&shared_pool_mutex);
+    }
+
+    if (kind != ESPHOME_PLUGIN_EXECUTOR_INLINE && !ex) {
+        fprintf(stderr, LOG_PREFIX "No executor for %s, running its handler inline\n",
+                plugin->name);
+    }
+
+    pthread_mutex_lock(&rt->lock);
+    rt->executor = ex;
+    rt->dedicated = (ex && kind == ESPHOME_PLUGIN_EXECUTOR_DEDICATED);
+    rt->depth = plugin->queue_depth ? plugin->queue_depth : ESPHOME_PLUGIN_QUEUE_DEPTH;
+    rt->closed = false;
+    pthread_mutex_unlock(&rt->lock);
+
+    pthread_once(&metrics_once, register_metrics);
+    return 0;
+}
+
+void esphome_plugin_executor_detach(esphome_plugin_t *plugin) {
+    esphome_plugin_runtime_t *rt = plugin->rt;
+    plugin_job_t *pending;
+    plugin_executor_t *ex;
+    bool dedicated;
+
+    if (!rt) {
+        return;
+    }
+
+    /* Reject new messages and discard the backlog, then let the current one finish */
+    pthread_mutex_lock(&rt->lock);
+    rt->closed = true;
+    pending = rt->head;
+    rt->head = NULL;
+    rt->tail = NULL;
+    if (rt->queued > 0) {
+        printf(LOG_PREFIX "Discarding %u pending message(s) for %s\n", rt->queued, plugin->name);
+    }
+    rt->queued = 0;
+    while (rt->scheduled) {
+        pthread_cond_wait(&rt->idle_cond, &rt->lock);
+    }
+    ex = rt->executor;
+    dedicated = rt->dedicated;
+    rt->executor = NULL;
+    rt->dedicated = false;
+    pthread_mutex_unlock(&rt->lock);
+
+    while (pending) {
+        plugin_job_t *next = pending->next;
+        free(pending);
+        pending = next;
+    }
+
+    if (dedicated) {
+        executor_destroy(ex);
+    } else if (ex) {
+        pthread_mutex_lock(&shared_pool_mutex);
+        if (--shared_pool_users == 0) {
+            executor_destroy(shared_pool);
+            shared_pool = NULL;
+        }
+        pthread_mutex_unlock(&shared_pool_mutex);
+    }
+}
+
+int esphome_plugin_runtime_alloc(esphome_plugin_t *plugin) {
+    /* Runtime state (and statistics) outlive detach, so a plugin can be re-attached */
+    esphome_plugin_runtime_t *rt = calloc(1, sizeof(*rt));
+    if (!rt) {
+        return -1;
+    }
+    rt->plugin = plugin;
+    rt->closed = true;
+    pthread_mutex_init(&rt->lock, NULL);
+    pthread_cond_init(&rt->idle_cond, NULL);
+
+    plugin->rt = rt;
+    return 0;
+}
+
+void esphome_plugin_runtime_free(esphome_plugin_t *plugin) {
+    esphome_plugin_runtime_t *rt = plugin->rt;
+
+    if (!rt) {
+        return;
+    }
+
+    esphome_plugin_executor_detach(plugin);
+    plugin->rt = NULL;
+    pthread_cond_destroy(&rt->idle_cond);
+    pthread_mutex_destroy(&rt->lock);
+    free(rt);
+}
+
+int esphome_plugin_executor_dispatch(esphome_plugin_t *plugin, int client_id,
+                                     uint32_t msg_type, const uint8_t *data, size_t len) {
+    esphome_plugin_runtime_t *rt = plugin->rt;
+
+    if (!rt) {
+        return plugin->handle_message(plugin->ctx, client_id, msg_type, data, len);
+    }
+
+    pthread_mutex_lock(&rt->lock);
+    bool closed = rt->closed;
+    bool inline_run = (rt->executor == NULL);
+    pthread_mutex_unlock(&rt->lock);
+
+    if (closed) {
+        return -1;
+    }
+
+    if (inline_run) {
+        return run_handler(rt, client_id, msg_type, data, len, 0, true);
+    }
+
+    /* Payload must outlive the client's receive buffer */
+    plugin_job_t *job = malloc(sizeof(*job) + len);
+    if (!job) {
+        return -1;
+    }
+    job->next = NULL;
+    job->client_id = client_id;
+    job->msg_type = msg_type;
+    job->len = len;
+    if (len > 0) {
+        memcpy(job->data, data, len);
+    }
+    job->enqueued_ns = now_ns();
+
+    pthread_mutex_lock(&rt->lock);
+    if (rt->closed || !rt->executor || rt->queued >= rt->depth) {
+        uint64_t dropped = ++rt->dropped;
+        pthread_mutex_unlock(&rt->lock);
+        free(job);
+        /* Rate-limit: a stuck plugin would otherwise flood the log */
+        if ((dropped & (dropped - 1)) == 0) {
+            fprintf(stderr, LOG_PREFIX "Warning: %s queue full, dropped message type %u (%llu total)\n",
+                    plugin->name, msg_type, (unsigned long long)dropped);
+        }
+        /* The message is owned by this plugin, so it still counts as handled */
+        return 0;
+    }
+
+    if (rt->tail) {
+        rt->tail->next = job;
+    } else {
+        rt->head = job;
+    }
+    rt->tail = job;
+    rt->queued++;
+
+    /* Detach waits for scheduled to clear, so the executor stays valid below */
+    plugin_executor_t *ex = rt->executor;
+    bool schedule = !rt->scheduled;
+    rt->scheduled = true;
+    pthread_mutex_unlock(&rt->lock);
+
+    if (schedule) {
+        pthread_mutex_lock(&ex->lock);
+        ready_push(ex, rt);
+        pthread_mutex_unlock(&ex->lock);
+    }
+
+    return 0;
+}
@@ -142,6 +142,30 @@ bool pb_encode_fixed64(pb_buffer_t *buf, uint32_t field_num, uint64_t value) {
     return true;
 }
 
+bool pb_encode_fixed32(pb_buffer_t *buf, uint32_t field_num, uint32_t value) {
+    if (!pb_encode_varint(buf, PB_FIELD_TAG(field_num, PB_WIRE_TYPE_32BIT))) {
+        return false;
+    }
+
+    if (buf->pos + 4 > buf->size) {
+        buf->error = true;
+        return false;
+    }
+
+    /* Little-endian encoding */
+    buf->data[buf->pos++] = (uint8_t)(value);
+    buf->data[buf->pos++] = (uint8_t)(value >> 8);
+    buf->data[buf->pos++] = (uint8_t)(value >> 16);
+    buf->data[buf->pos++] = (uint8_t)(value >> 24);
+    return true;
+}
+
+bool pb_encode_float(pb_buffer_t *buf, uint32_t field_num, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return pb_encode_fixed32(buf, field_num, bits);
+}
+
 bool pb_encode_uint64(pb_buffer_t *buf, uint32_t field_num, uint64_t value) {
     if (!pb_encode_varint(buf, PB_FIELD_TAG(field_num, PB_WIRE_TYPE_VARINT))) {
         return false;
@@ -149,6 +173,14 @@ bool pb_encode_uint64(pb_buffer_t *buf, uint32_t field_num, uint64_t value) {
     return pb_encode_varint(buf, value);
 }
 
+bool pb_encode_int32(pb_buffer_t *buf, uint32_t field_num, int32_t value) {
+    /* Negative values are sign-extended to 64 bits, as protobuf requires */
+    if (!pb_encode_varint(buf, PB_FIELD_TAG(field_num, PB_WIRE_TYPE_VARINT))) {
+        return false;
+    }
+    return pb_encode_varint(buf, (uint64_t)(int64_t)value);
+}
+
 bool pb_encode_sint32(pb_buffer_t *buf, uint32_t field_num, int32_t value) {
     /* ZigZag encoding */
     uint32_t zigzag = (uint32_t)((value << 1) ^ (value >> 31));
@@ -354,6 +386,47 @@ size_t esphome_encode_list_entities_done(uint8_t *buf, size_t size) {
     return 0; /* Empty message */
 }
 
+size_t esphome_encode_list_entities_sensor(uint8_t *buf, size_t size,
+                                           const esphome_list_entities_sensor_response_t *msg) {
+    pb_buffer_t pb;
+    pb_buffer_init_write(&pb, buf, size);
+
+    pb_encode_string(&pb, 1, msg->object_id);
+    pb_encode_fixed32(&pb, 2, msg->key);
+    pb_encode_string(&pb, 3, msg->name);
+    pb_encode_string(&pb, 5, msg->icon);
+    pb_encode_string(&pb, 6, msg->unit_of_measurement);
+    if (msg->accuracy_decimals != 0) {
+        pb_encode_int32(&pb, 7, msg->accuracy_decimals);
+    }
+    if (msg->force_update) {
+        pb_encode_bool(&pb, 8, true);
+    }
+    pb_encode_string(&pb, 9, msg->device_class);
+    if (msg->state_class != SENSOR_STATE_CLASS_NONE) {
+        pb_encode_uint32(&pb, 10, msg->state_class);
+    }
+    if (msg->disabled_by_default) {
+        pb_encode_bool(&pb, 12, true);
+    }
+
+    return pb.error ? 0 : pb.pos;
+}
+
+size_t esphome_encode_sensor_state(uint8_t *buf, size_t size,
+                                   const esphome_sensor_state_response_t *msg) {
+    pb_buffer_t pb;
+    pb_buffer_init_write(&pb, buf, size);
+
+    pb_encode_fixed32(&pb, 1, msg->key);
+    pb_encode_float(&pb, 2, msg->state);
+    if (msg->missing_state) {
+        pb_encode_bool(&pb, 3, true);
+    }
+
+    return pb.error ? 0 : pb.pos;
+}
+
 size_t esphome_encode_ble_advertisements(uint8_t *buf, size_t size,
                                           const esphome_ble_advertisements_response_t *msg) {
     pb_buffer_t pb;
@@ -427,6 +500,38 @@ size_t esphome_encode_ble_advertisements(uint8_t *buf, size_t size,
     return pb.error ? 0 : pb.pos;
 }
 
+size_t esphome_encode_hello_request(uint8_t *buf, size_t size,
+                                    const esphome_hello_request_t *msg) {
+    pb_buffer_t pb;
+    pb_buffer_init_write(&pb, buf, size);
+
+    pb_encode_string(&pb, 1, msg->client);
+    pb_encode_uint32(&pb, 2, msg->api_version_major);
+    pb_encode_uint32(&pb, 3, msg->api_version_minor);
+
+    return pb.error ? 0 : pb.pos;
+}
+
+size_t esphome_encode_connect_request(uint8_t *buf, size_t size,
+                                      const esphome_connect_request_t *msg) {
+    pb_buffer_t pb;
+    pb_buffer_init_write(&pb, buf, size);
+
+    pb_encode_string(&pb, 1, msg->password);
+
+    return pb.error ? 0 : pb.pos;
+}
+
+size_t esphome_encode_subscribe_ble_advertisements(uint8_t *buf, size_t size,
+                                                   const esphome_subscribe_ble_advertisements_t *msg) {
+    pb_buffer_t pb;
+    pb_buffer_init_write(&pb, buf, size);
+
+    pb_encode_uint32(&pb, 1, msg->flags);
+
+    return pb.error ? 0 : pb.pos;
+}
+
 /* -----------------------------------------------------------------
  * ESPHome message decoding
  * ----------------------------------------------------------------- */
@@ -449,6 +554,10 @@ bool esphome_decode_hello_request(const uint8_t *buf, size_t size,
 
         if (field_num == 1 && wire_type == PB_WIRE_TYPE_LENGTH) {
             pb_decode_string(&pb, msg->client, sizeof(msg->client));
+        } else if (field_num == 2 && wire_type == PB_WIRE_TYPE_VARINT) {
+            pb_decode_uint32(&pb, &msg->api_version_major);
+        } else if (field_num == 3 && wire_type == PB_WIRE_TYPE_VARINT) {
+            pb_decode_uint32(&pb, &msg->api_version_minor);
         } else {
             pb_skip_field(&pb, wire_type);
         }
@@ -509,6 +618,115 @@ bool esphome_decode_subscribe_ble_advertisements(const uint8_t *buf, size_t size
     return !pb.error;
 }
 
+bool esphome_decode_connect_response(const uint8_t *buf, size_t size,
+                                     esphome_connect_response_t *msg) {
+    pb_buffer_t pb;
+    pb_buffer_init_read(&pb, buf, size);
+
+    memset(msg, 0, sizeof(*msg));
+
+    while (pb.pos < pb.size && !pb.error) {
+        uint64_t tag;
+        if (!pb_decode_varint(&pb, &tag)) {
+            break;
+        }
+
+        uint32_t field_num = tag >> 3;
+        uint8_t wire_type = tag & 0x7;
+
+        if (field_num == 1 && wire_type == PB_WIRE_TYPE_VARINT) {
+            uint64_t value;
+            if (pb_decode_varint(&pb, &value)) {
+                msg->invalid_password = value != 0;
+            }
+        } else {
+            pb_skip_field(&pb, wire_type);
+        }
+    }
+
+    return !pb.error;
+}
+
+/**
+ * Decode one BluetoothLERawAdvertisement
+ */
+static bool decode_ble_advertisement(const uint8_t *buf, size_t size,
+                                     esphome_ble_advertisement_t *adv) {
+    pb_buffer_t pb;
+    pb_buffer_init_read(&pb, buf, size);
+
+    memset(adv, 0, sizeof(*adv));
+
+    while (pb.pos < pb.size && !pb.error) {
+        uint64_t tag;
+        if (!pb_decode_varint(&pb, &tag)) {
+            break;
+        }
+
+        uint32_t field_num = tag >> 3;
+        uint8_t wire_type = tag & 0x7;
+        uint64_t value;
+
+        if (field_num == 1 && wire_type == PB_WIRE_TYPE_VARINT) {
+            pb_decode_varint(&pb, &adv->address);
+        } else if (field_num == 2 && wire_type == PB_WIRE_TYPE_VARINT) {
+            /* sint32 (ZigZag) */
+            if (pb_decode_varint(&pb, &value)) {
+                uint32_t zigzag = (uint32_t)value;
+                adv->rssi = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+            }
+        } else if (field_num == 3 && wire_type == PB_WIRE_TYPE_VARINT) {
+            pb_decode_uint32(&pb, &adv->address_type);
+        } else if (field_num == 4 && wire_type == PB_WIRE_TYPE_LENGTH) {
+            if (!pb_decode_varint(&pb, &value) || pb.pos + value > pb.size) {
+                return false;
+            }
+            adv->data_len = value < sizeof(adv->data) ? (size_t)value : sizeof(adv->data);
+            memcpy(adv->data, pb.data + pb.pos, adv->data_len);
+            pb.pos += value;
+        } else {
+            pb_skip_field(&pb, wire_type);
+        }
+    }
+
+    return !pb.error;
+}
+
+bool esphome_decode_ble_advertisements(const uint8_t *buf, size_t size,
+                                       esphome_ble_advertisements_response_t *msg) {
+    pb_buffer_t pb;
+    pb_buffer_init_read(&pb, buf, size);
+
+    msg->count = 0;
+
+    while (pb.pos < pb.size && !pb.error) {
+        uint64_t tag;
+        if (!pb_decode_varint(&pb, &tag)) {
+            break;
+        }
+
+        uint32_t field_num = tag >> 3;
+        uint8_t wire_type = tag & 0x7;
+
+        if (field_num == 1 && wire_type == PB_WIRE_TYPE_LENGTH) {
+            uint64_t len;
+            if (!pb_decode_varint(&pb, &len) || pb.pos + len > pb.size) {
+                return false;
+            }
+            if (msg->count < ESPHOME_MAX_ADV_BATCH &&
+                decode_ble_advertisement(pb.data + pb.pos, (size_t)len,
+                                         &msg->advertisements[msg->count])) {
+                msg->count++;
+            }
+            pb.pos += len;
+        } else {
+            pb_skip_field(&pb, wire_type);
+        }
+    }
+
+    return !pb.error;
+}
+
 /* -----------------------------------------------------------------
  * ESPHome message framing
  * ----------------------------------------------------------------- */
@@ -0,0 +1,163 @@
+/**
+ * @file esphome_rcu.c
+ * @brief RCU-style publication of read-mostly data
+ *
+ * Grace periods are tracked with epochs. Every publish advances rcu_epoch
+ * and tags the object it retires with the new value; every open read
+ * section holds a reader slot with the epoch it started in. An object
+ * retired at epoch E is freed once no slot holds an epoch older than E:
+ * sections that started later loaded their pointers after the publish.
+ *
+ * A section whose slot the publisher does not see yet is covered by the
+ * fences on both sides: either the publisher sees the slot, or the reader
+ * sees the new pointer.
+ */
+
+#include "include/esphome_rcu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define LOG_PREFIX "[rcu] "
+
+/**
+ * Object waiting for the read sections that may still see it
+ */
+typedef struct rcu_retired {
+    struct rcu_retired *next;
+    void *ptr;
+    esphome_rcu_free_fn free_fn;
+    uint32_t epoch;                /* rcu_epoch after the publish that retired it */
+} rcu_retired_t;
+
+static rcu_retired_t *retired_head = NULL;
+static uint32_t retired_count = 0;     /* Written under retired_mutex, read lock-free */
+static pthread_mutex_t retired_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Advanced by every publish (under retired_mutex), never 0 */
+static uint32_t rcu_epoch = 1;
+
+/* Epoch each open read section started in, 0 = slot free */
+static uint32_t reader_epoch[ESPHOME_RCU_MAX_READERS];
+
+/* First slot a thread tries, spreads threads over the slots */
+static __thread int reader_hint = -1;
+
+static void rcu_free(rcu_retired_t *entry) {
+    if (entry->free_fn) {
+        entry->free_fn(entry->ptr);
+    } else {
+        free(entry->ptr);
+    }
+    free(entry);
+}
+
+/**
+ * Free retired objects no open read section can see
+ *
+ * Caller holds retired_mutex.
+ */
+static void reclaim_quiescent(void) {
+    uint32_t oldest = __atomic_load_n(&rcu_epoch, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < ESPHOME_RCU_MAX_READERS; i++) {
+        uint32_t epoch = __atomic_load_n(&reader_epoch[i], __ATOMIC_ACQUIRE);
+        if (epoch != 0 && (int32_t)(epoch - oldest) < 0) {
+            oldest = epoch;
+        }
+    }
+
+    rcu_retired_t **pp = &retired_head;
+    while (*pp) {
+        rcu_retired_t *entry = *pp;
+        if ((int32_t)(oldest - entry->epoch) >= 0) {
+            *pp = entry->next;
+            rcu_free(entry);
+            __atomic_store_n(&retired_count, retired_count - 1, __ATOMIC_RELAXED);
+        } else {
+            pp = &entry->next;
+        }
+    }
+}
+
+int esphome_rcu_read_lock(void) {
+    if (reader_hint < 0) {
+        static uint32_t next_hint;
+        reader_hint = (int)(__atomic_fetch_add(&next_hint, 1, __ATOMIC_RELAXED) %
+                            ESPHOME_RCU_MAX_READERS);
+    }
+
+    for (;;) {
+        uint32_t epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_ACQUIRE);
+
+        for (int n = 0; n < ESPHOME_RCU_MAX_READERS; n++) {
+            int i = (reader_hint + n) % ESPHOME_RCU_MAX_READERS;
+            uint32_t expected = 0;
+
+            if (__atomic_load_n(&reader_epoch[i], __ATOMIC_RELAXED) == 0 &&
+                __atomic_compare_exchange_n(&reader_epoch[i], &expected, epoch, false,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                /* Slot visible before the pointer loads; pairs with the publish */
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                return i;
+            }
+        }
+
+        /* All slots taken: wait for a section to end */
+        sched_yield();
+    }
+}
+
+void esphome_rcu_read_unlock(int token) {
+    __atomic_store_n(&reader_epoch[token], 0, __ATOMIC_RELEASE);
+
+    /* This section may have been the last one holding objects back */
+    if (__atomic_load_n(&retired_count, __ATOMIC_RELAXED) != 0 &&
+        pthread_mutex_trylock(&retired_mutex) == 0) {
+        reclaim_quiescent();
+        pthread_mutex_unlock(&retired_mutex);
+    }
+}
+
+void esphome_rcu_publish(void **slot, void *value, esphome_rcu_free_fn free_fn) {
+    void *old = __atomic_exchange_n(slot, value, __ATOMIC_ACQ_REL);
+
+    pthread_mutex_lock(&retired_mutex);
+
+    uint32_t epoch = rcu_epoch + 1 ? rcu_epoch + 1 : 1;
+    __atomic_store_n(&rcu_epoch, epoch, __ATOMIC_SEQ_CST);
+    /* New pointer visible before the reader slots are scanned */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (old) {
+        rcu_retired_t *entry = malloc(sizeof(*entry));
+        if (entry) {
+            entry->ptr = old;
+            entry->free_fn = free_fn;
+            entry->epoch = epoch;
+            entry->next = retired_head;
+            retired_head = entry;
+            __atomic_store_n(&retired_count, retired_count + 1, __ATOMIC_RELAXED);
+        } else {
+            /* Leaking is safe, freeing under a reader is not */
+            fprintf(stderr, LOG_PREFIX "Out of memory, leaking replaced object\n");
+        }
+    }
+    reclaim_quiescent();
+
+    pthread_mutex_unlock(&retired_mutex);
+}
+
+void esphome_rcu_barrier(void) {
+    pthread_mutex_lock(&retired_mutex);
+    while (retired_head) {
+        rcu_retired_t *entry = retired_head;
+        retired_head = entry->next;
+        rcu_free(entry);
+    }
+    __atomic_store_n(&retired_count, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&retired_mutex);
+}
@@ -0,0 +1,445 @@
+/**
+ * @file esphome_thread.c
+ * @brief Thread roles and scheduling policy
+ */
+
+#include "include/esphome_thread.h"
+#include "include/esphome_metrics.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define LOG_PREFIX "[esphome-thread] "
+#define THREAD_NAME_MAX 16
+
+/**
+ * Scheduling policy of a role
+ */
+typedef struct {
+    int sched;          /* SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO, SCHED_RR */
+    int prio;           /* Real-time priority (fifo/rr only) */
+    int nice;           /* Nice value (other/batch, and fallback for fifo/rr) */
+    uint64_t cpus;      /* Affinity mask, 0 = all CPUs */
+} thread_policy_t;
+
+/**
+ * Live thread record, used to sample CPU time of running threads
+ */
+typedef struct thread_record {
+    struct thread_record *next;
+    esphome_thread_role_t role;
+    clockid_t clock;
+    char name[THREAD_NAME_MAX];
+} thread_record_t;
+
+typedef struct {
+    const char *name;
+    const char *env;
+    thread_policy_t policy;
+    uint32_t threads_live;
+    uint32_t threads_started;
+    uint64_t retired_ns;    /* CPU time of exited threads */
+    bool warned;
+} thread_role_t;
+
+typedef struct {
+    esphome_thread_role_t role;
+    char name[THREAD_NAME_MAX];
+    void *(*start_routine)(void *);
+    void *arg;
+} thread_start_t;
+
+/*
+ * Defaults favour BLE reception: on a single-core SoC shared with a video
+ * encoder the stack's receive buffers overflow long before the API
+ * clients notice any delay. The HCI reader itself is a NimBLE task that
+ * gets its real-time priority from the NPL port; the scan role drains the
+ * advertisements it hands over, just below it.
+ */
+static thread_role_t roles[ESPHOME_THREAD_ROLE_COUNT] = {
+    [ESPHOME_THREAD_SCAN]       = { "scan",       "ESPHOME_THREAD_POLICY_SCAN",
+                                    { SCHED_FIFO,  10, -10, 0 }, 0, 0, 0, false },
+    [ESPHOME_THREAD_PIPELINE]   = { "pipeline",   "ESPHOME_THREAD_POLICY_PIPELINE",
+                                    { SCHED_OTHER,  0,  -5, 0 }, 0, 0, 0, false },
+    [ESPHOME_THREAD_NETWORK]    = { "network",    "ESPHOME_THREAD_POLICY_NETWORK",
+                                    { SCHED_OTHER,  0,   0, 0 }, 0, 0, 0, false },
+    [ESPHOME_THREAD_BACKGROUND] = { "background", "ESPHOME_THREAD_POLICY_BACKGROUND",
+                                    { SCHED_OTHER,  0,  10, 0 }, 0, 0, 0, false },
+};
+
+static thread_record_t *live_threads = NULL;
+static pthread_mutex_t roles_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t roles_once = PTHREAD_ONCE_INIT;
+
+/* -----------------------------------------------------------------
+ * Policy parsing
+ * ----------------------------------------------------------------- */
+
+static const char *sched_name(int sched) {
+    switch (sched) {
+    case SCHED_FIFO:  return "fifo";
+    case SCHED_RR:    return "rr";
+    case SCHED_BATCH: return "batch";
+    case SCHED_IDLE:  return "idle";
+    default:          return "other";
+    }
+}
+
+static int parse_cpus(const char *str, uint64_t *mask) {
+    uint64_t m = 0;
+
+    if (strcasecmp(str, "all") == 0) {
+        *mask = 0;
+        return 0;
+    }
+
+    while (*str) {
+        char *end;
+        long first = strtol(str, &end, 10);
+        long last = first;
+
+        if (end == str || first < 0 || first > 63) {
+            return -1;
+        }
+        if (*end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if (end == str || last < first || last > 63) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            m |= 1ULL << cpu;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        str = end;
+    }
+
+    *mask = m;
+    return 0;
+}
+
+static int parse_policy(const char *spec, thread_policy_t *policy) {
+    char buf[256];
+    char *save = NULL;
+
+    snprintf(buf, sizeof(buf), "%s", spec);
+
+    for (char *tok = strtok_r(buf, " \t;", &save); tok; tok = strtok_r(NULL, " \t;", &save)) {
+        char *value = strchr(tok, '=');
+        char *end;
+
+        if (!value) {
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (strcmp(tok, "sched") == 0) {
+            if (strcasecmp(value, "other") == 0) {
+                policy->sched = SCHED_OTHER;
+            } else if (strcasecmp(value, "batch") == 0) {
+                policy->sched = SCHED_BATCH;
+            } else if (strcasecmp(value, "idle") == 0) {
+                policy->sched = SCHED_IDLE;
+            } else if (strcasecmp(value, "fifo") == 0) {
+                policy->sched = SCHED_FIFO;
+            } else if (strcasecmp(value, "rr") == 0) {
+                policy->sched = SCHED_RR;
+            } else {
+                return -1;
+            }
+        } else if (strcmp(tok, "prio") == 0) {
+            long prio = strtol(value, &end, 10);
+            if (*end != '\0' || prio < 1 || prio > 99) {
+                return -1;
+            }
+            policy->prio = (int)prio;
+        } else if (strcmp(tok, "nice") == 0) {
+            long nice = strtol(value, &end, 10);
+            if (*end != '\0' || nice < -20 || nice > 19) {
+                return -1;
+            }
+            policy->nice = (int)nice;
+        } else if (strcmp(tok, "cpus") == 0) {
+            if (parse_cpus(value, &policy->cpus) < 0) {
+                return -1;
+            }
+        } else {
+            return -1;
+        }
+    }
+
+    if ((policy->sched == SCHED_FIFO || policy->sched == SCHED_RR) && policy->prio == 0) {
+        policy->prio = 1;
+    }
+
+    return 0;
+}
+
+/* -----------------------------------------------------------------
+ * Metrics
+ * ----------------------------------------------------------------- */
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Caller holds roles_mutex */
+static uint64_t role_cpu_ns(esphome_thread_role_t role) {
+    uint64_t ns = roles[role].retired_ns;
+
+    for (thread_record_t *rec = live_threads; rec; rec = rec->next) {
+        if (rec->role == role) {
+            ns += clock_ns(rec->clock);
+        }
+    }
+
+    return ns;
+}
+
+static void thread_metrics_dump(FILE *out, void *user_data) {
+    (void)user_data;
+
+    pthread_mutex_lock(&roles_mutex);
+    for (int i = 0; i < ESPHOME_THREAD_ROLE_COUNT; i++) {
+        thread_role_t *r = &roles[i];
+        fprintf(out, "thread.%s.cpu_ms %llu\n", r->name,
+                (unsigned long long)(role_cpu_ns((esphome_thread_role_t)i) / 1000000ULL));
+        fprintf(out, "thread.%s.live %u\n", r->name, r->threads_live);
+        fprintf(out, "thread.%s.started %u\n", r->name, r->threads_started);
+        fprintf(out, "thread.%s.policy %s prio=%d nice=%d cpus=0x%llx\n", r->name,
+                sched_name(r->policy.sched), r->policy.prio, r->policy.nice,
+                (unsigned long long)r->policy.cpus);
+    }
+    for (thread_record_t *rec = live_threads; rec; rec = rec->next) {
+        fprintf(out, "thread.%s.%s.cpu_ms %llu\n", roles[rec->role].name, rec->name,
+                (unsigned long long)(clock_ns(rec->clock) / 1000000ULL));
+    }
+    pthread_mutex_unlock(&roles_mutex);
+}
+
+static void roles_setup(void) {
+    for (int i = 0; i < ESPHOME_THREAD_ROLE_COUNT; i++) {
+        const char *spec = getenv(roles[i].env);
+        if (!spec) {
+            continue;
+        }
+
+        thread_policy_t policy = roles[i].policy;
+        if (parse_policy(spec, &policy) < 0) {
+            fprintf(stderr, LOG_PREFIX "Ignoring invalid %s='%s'\n", roles[i].env, spec);
+            continue;
+        }
+        roles[i].policy = policy;
+    }
+
+    esphome_metrics_register("threads", thread_metrics_dump, NULL);
+}
+
+/* -----------------------------------------------------------------
+ * Thread start
+ * ----------------------------------------------------------------- */
+
+static void warn_once(thread_role_t *r, const char *what, int err) {
+    bool warned;
+
+    pthread_mutex_lock(&roles_mutex);
+    warned = r->warned;
+    r->warned = true;
+    pthread_mutex_unlock(&roles_mutex);
+
+    if (!warned) {
+        fprintf(stderr, LOG_PREFIX "Cannot apply %s for role %s: %s\n",
+                what, r->name, strerror(err));
+    }
+}
+
+/**
+ * Apply the role policy to the calling thread
+ */
+static void apply_policy(thread_role_t *r, const thread_policy_t *policy) {
+    struct sched_param param;
+    bool use_nice = true;
+    int err;
+
+    if (policy->cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < 64; cpu++) {
+            if (policy->cpus & (1ULL << cpu)) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            warn_once(r, "CPU affinity", err);
+        }
+    }
+
+    memset(&param, 0, sizeof(param));
+    if (policy->sched == SCHED_FIFO || policy->sched == SCHED_RR) {
+        param.sched_priority = policy->prio;
+        err = pthread_setschedparam(pthread_self(), policy->sched, &param);
+        if (err == 0) {
+            use_nice = false;
+        } else {
+            /* Typically EPERM without CAP_SYS_NICE: degrade to nice value */
+            warn_once(r, "real-time scheduling", err);
+        }
+    } else if (policy->sched != SCHED_OTHER) {
+        err = pthread_setschedparam(pthread_self(), policy->sched, &param);
+        if (err != 0) {
+            warn_once(r, "scheduling class", err);
+        }
+    }
+
+    /* Nice values are per thread on Linux when addressed by TID */
+    if (use_nice && policy->nice != 0) {
+        if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), policy->nice) != 0) {
+            warn_once(r, "nice value", errno);
+        }
+    }
+}
+
+static void thread_exit_handler(void *arg) {
+    thread_record_t *rec = (thread_record_t *)arg;
+    uint64_t ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    pthread_mutex_lock(&roles_mutex);
+    for (thread_record_t **pp = &live_threads; *pp; pp = &(*pp)->next) {
+        if (*pp == rec) {
+            *pp = rec->next;
+            break;
+        }
+    }
+    roles[rec->role].retired_ns += ns;
+    roles[rec->role].threads_live--;
+    pthread_mutex_unlock(&roles_mutex);
+}
+
+static void *thread_trampoline(void *arg) {
+    thread_start_t start = *(thread_start_t *)arg;
+    thread_role_t *r = &roles[start.role];
+    thread_record_t rec;
+    thread_policy_t policy;
+    void *ret;
+
+    free(arg);
+
+    pthread_setname_np(pthread_self(), start.name);
+
+    memset(&rec, 0, sizeof(rec));
+    rec.role = start.role;
+    memcpy(rec.name, start.name, sizeof(rec.name));
+    if (pthread_getcpuclockid(pthread_self(), &rec.clock) != 0) {
+        rec.clock = CLOCK_THREAD_CPUTIME_ID;
+    }
+
+    pthread_mutex_lock(&roles_mutex);
+    policy = r->policy;
+    rec.next = live_threads;
+    live_threads = &rec;
+    r->threads_live++;
+    pthread_mutex_unlock(&roles_mutex);
+
+    apply_policy(r, &policy);
+
+    pthread_cleanup_push(thread_exit_handler, &rec);
+    ret = start.start_routine(start.arg);
+    pthread_cleanup_pop(1);
+
+    return ret;
+}
+
+/* -----------------------------------------------------------------
+ * Public API
+ * ----------------------------------------------------------------- */
+
+int esphome_thread_create(pthread_t *thread,
+                          esphome_thread_role_t role,
+                          const char *name,
+                          void *(*start_routine)(void *),
+                          void *arg) {
+    if (!thread || !start_routine || role < 0 || role >= ESPHOME_THREAD_ROLE_COUNT) {
+        return EINVAL;
+    }
+
+    pthread_once(&roles_once, roles_setup);
+
+    thread_start_t *start = malloc(sizeof(*start));
+    if (!start) {
+        return ENOMEM;
+    }
+    start->role = role;
+    start->start_routine = start_routine;
+    start->arg = arg;
+    snprintf(start->name, sizeof(start->name), "%s", name ? name : roles[role].name);
+
+    int err = pthread_create(thread, NULL, thread_trampoline, start);
+    if (err != 0) {
+        free(start);
+        return err;
+    }
+
+    pthread_mutex_lock(&roles_mutex);
+    roles[role].threads_started++;
+    pthread_mutex_unlock(&roles_mutex);
+
+    return 0;
+}
+
+int esphome_thread_set_policy(esphome_thread_role_t role, const char *spec) {
+    if (role < 0 || role >= ESPHOME_THREAD_ROLE_COUNT || !spec) {
+        return -1;
+    }
+
+    pthread_once(&roles_once, roles_setup);
+
+    pthread_mutex_lock(&roles_mutex);
+    thread_policy_t policy = roles[role].policy;
+    int ret = parse_policy(spec, &policy);
+    if (ret == 0) {
+        roles[role].policy = policy;
+    }
+    pthread_mutex_unlock(&roles_mutex);
+
+    return ret;
+}
+
+int esphome_thread_get_stats(esphome_thread_role_t role, esphome_thread_stats_t *stats) {
+    if (role < 0 || role >= ESPHOME_THREAD_ROLE_COUNT || !stats) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&roles_mutex);
+    stats->threads_live = roles[role].threads_live;
+    stats->threads_started = roles[role].threads_started;
+    stats->cpu_ns = role_cpu_ns(role);
+    pthread_mutex_unlock(&roles_mutex);
+
+    return 0;
+}
+
+const char *esphome_thread_role_name(esphome_thread_role_t role) {
+    if (role < 0 || role >= ESPHOME_THREAD_ROLE_COUNT) {
+        return "unknown";
+    }
+    return roles[role].name;
+}
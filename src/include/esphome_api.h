@@ -13,9 +13,26 @@
 #include <stdbool.h>
 #include <pthread.h>
 
-/* Server configuration */
+/* Server configuration defaults (overridable from the configuration file) */
 #define ESPHOME_API_PORT 6053
 #define ESPHOME_MAX_CLIENTS 2
+#define ESPHOME_API_RECV_BUFFER_SIZE 4096
+
+/* Upper bound for max_clients (plugins track clients in a 32-bit mask) */
+#define ESPHOME_MAX_CLIENTS_LIMIT 32
+
+/* Unix domain socket defaults; its clients share ESPHOME_MAX_CLIENTS_LIMIT */
+#define ESPHOME_UNIX_MAX_CLIENTS 4
+#define ESPHOME_UNIX_ALLOWED_UIDS_MAX 8
+
+/**
+ * Connection handling
+ */
+typedef enum {
+    ESPHOME_API_BACKEND_THREADS = 0, /* A blocking thread per client (default) */
+    ESPHOME_API_BACKEND_AUTO,        /* io_uring where the kernel supports it, else threads */
+    ESPHOME_API_BACKEND_IO_URING,    /* One event loop (Linux 6.0+), falls back to threads */
+} esphome_api_backend_t;
 
 /**
  * Device configuration
@@ -28,6 +45,21 @@ typedef struct esphome_device_config {
     char manufacturer[128];
     char friendly_name[128];
     char suggested_area[64];
+
+    /* Server settings, read once by esphome_api_init() (0 = default) */
+    uint16_t api_port;            /* TCP port */
+    uint32_t max_clients;         /* Concurrent clients (<= ESPHOME_MAX_CLIENTS_LIMIT) */
+    uint32_t recv_buffer_size;    /* Per-client receive buffer, bounds the frame size */
+    bool disable_mdns;            /* Leave discovery to an external mDNS responder */
+    esphome_api_backend_t backend; /* Connection handling */
+
+    /* Unix domain socket for local clients, authenticated by peer credentials */
+    char unix_socket[108];        /* Socket path ("" = TCP only) */
+    bool unix_seqpacket;          /* SOCK_SEQPACKET (one frame per packet) instead of a stream */
+    uint32_t unix_max_clients;    /* Local client slots, in addition to max_clients */
+    uint32_t unix_allowed_uids[ESPHOME_UNIX_ALLOWED_UIDS_MAX]; /* Besides root and our own uid */
+    uint32_t unix_allowed_uid_count;
+    int64_t unix_allowed_gid;     /* Members of this group may connect (-1 = none) */
 } esphome_device_config_t;
 
 /**
@@ -46,7 +78,11 @@ esphome_api_server_t *esphome_api_init(const esphome_device_config_t *config);
 /**
  * Start the API server (non-blocking)
  *
- * Starts a background thread to handle TCP connections.
+ * Starts a background thread to handle TCP connections (an io_uring
+ * event loop, or a listener with a thread per client), and on the Unix
+ * domain socket when one is configured. Local clients use the same framing
+ * and have their own slots; a peer whose credentials (SO_PEERCRED) are not
+ * allowed is disconnected before it can send anything.
  *
  * @param server Server instance
  * @return 0 on success, -1 on error
@@ -67,6 +103,59 @@ void esphome_api_stop(esphome_api_server_t *server);
  */
 void esphome_api_free(esphome_api_server_t *server);
 
+/**
+ * Wait for a new process to report that it is ready to take over
+ *
+ * First step of an upgrade: the new binary, started with one end of a
+ * SOCK_SEQPACKET socket pair, calls esphome_api_adopt() on it.
+ *
+ * @param channel This process's end of the socket pair
+ * @param timeout_ms How long to wait
+ * @return 0 if the new process is ready and speaks the same handoff
+ *         protocol, -1 otherwise (keep serving)
+ */
+int esphome_api_handoff_wait_ready(int channel, int timeout_ms);
+
+/**
+ * Stop accepting and reading for a handoff
+ *
+ * Waits until no thread reads from a client any more; the data already
+ * received is handled first. Connections stay open and frames (from
+ * plugins being cleaned up, for instance) still go out. The mDNS responder
+ * stops without a goodbye, the new process announces the same name.
+ *
+ * @param server Server instance
+ */
+void esphome_api_pause(esphome_api_server_t *server);
+
+/**
+ * Hand the listeners and the clients over to the new process
+ *
+ * Sends the listening sockets and, per client, its socket with
+ * SCM_RIGHTS, its authentication state, the subscription requests it made
+ * and its unparsed input. The connections are closed in this process only;
+ * esphome_api_stop() then finds nothing left to shut down.
+ *
+ * @param server Server instance, paused
+ * @param channel This process's end of the socket pair
+ * @return Number of clients handed over, or -1 if the new process is gone
+ */
+int esphome_api_handoff(esphome_api_server_t *server, int channel);
+
+/**
+ * Take over from the previous process (before esphome_api_start())
+ *
+ * Reports ready, then receives what esphome_api_handoff() sends. The
+ * adopted listeners replace binding new ones, unless the port or the Unix
+ * socket settings changed. Each client resumes with its subscription
+ * requests replayed ahead of its unparsed input.
+ *
+ * @param server Server instance
+ * @param channel This process's end of the socket pair
+ * @return Number of clients adopted, or -1 if the previous process aborted
+ */
+int esphome_api_adopt(esphome_api_server_t *server, int channel);
+
 /**
  * Send a message to a specific client (for plugin use)
  *
@@ -97,9 +186,39 @@ int esphome_api_broadcast(esphome_api_server_t *server,
                           const uint8_t *payload,
                           size_t payload_len);
 
+/**
+ * Coalesce the messages the calling thread sends until esphome_api_uncork()
+ *
+ * Frames for each client collect in its send buffer, as the replies of a
+ * receive iteration do, and leave in one write per client at the
+ * outermost esphome_api_uncork(). Urgent frames and frames that do not
+ * fit flush the buffer early. Calls nest. No effect on the io_uring
+ * backend, which chains queued frames itself.
+ *
+ * @param server API server instance
+ */
+void esphome_api_cork(esphome_api_server_t *server);
+
+/**
+ * End a esphome_api_cork() section, writing the frames it held back
+ *
+ * @param server API server instance
+ */
+void esphome_api_uncork(esphome_api_server_t *server);
+
+/**
+ * Get the clients currently connected
+ *
+ * @param server API server instance
+ * @return Bit per connected client index
+ */
+uint32_t esphome_api_connected_clients(esphome_api_server_t *server);
+
 /**
  * Get the hostname/IP address of a connected client
  *
+ * Clients on the Unix domain socket report "localhost".
+ *
  * @param server API server instance
  * @param client_id Client index (0-based)
  * @param host_buf Buffer to store the hostname/IP string
@@ -0,0 +1,244 @@
+/**
+ * @file esphome_api_internal.h
+ * @brief Internal API server state shared by the connection backends
+ *
+ * The server handles connections either with a thread per client
+ * (esphome_api.c) or with an io_uring event loop (esphome_api_uring.c).
+ * Both share the client table, the framing and the message dispatch.
+ * Plugins should NOT include this header.
+ */
+
+#ifndef ESPHOME_API_INTERNAL_H
+#define ESPHOME_API_INTERNAL_H
+
+#include "esphome_api.h"
+#include "esphome_mdns.h"
+#include <stddef.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* Frames queued per client on the io_uring backend before it is dropped */
+#define ESPHOME_API_URING_MAX_QUEUED 256
+
+/* Bytes of frames coalesced into one write on the thread backend */
+#define ESPHOME_API_SEND_BATCH_SIZE 8192
+
+/* Bytes of subscription requests kept per client for an upgrade handoff */
+#define ESPHOME_API_REPLAY_SIZE 256
+
+struct esphome_api_uring;
+struct esphome_api_uring_send;
+
+/**
+ * Client connection state
+ */
+typedef struct {
+    int fd;
+    bool authenticated;
+    uint8_t *recv_buffer;
+    size_t recv_buffer_size;
+    size_t recv_pos;
+    pthread_mutex_t send_mutex;
+    pthread_t thread;
+    bool thread_running;
+    struct esphome_api_server *server;
+    struct sockaddr_in addr;  /* Client's IP address */
+    bool local;               /* Connected over the Unix domain socket */
+    struct ucred peer;        /* Local client's credentials */
+
+    /* Write coalescing on the thread backend, guarded by send_mutex */
+    bool corked;              /* Receive iteration in progress, frames wait for its end */
+    uint8_t *out_buffer;      /* Frames produced during the iteration */
+    size_t out_len;
+    int out_frames;
+
+    /* Subscription requests, replayed by the process taking over on an upgrade */
+    uint8_t replay[ESPHOME_API_REPLAY_SIZE];
+    size_t replay_len;
+    bool replay_overflow;     /* Too many to keep, the client is not handed over */
+
+    /* io_uring backend, guarded by send_mutex */
+    uint32_t generation;      /* Bumped on close, completions of older connections are ignored */
+    struct esphome_api_uring_send *send_head;  /* Queued frames, the first send_in_flight submitted */
+    struct esphome_api_uring_send *send_tail;
+    int send_queued;
+    int send_in_flight;
+    bool send_scheduled;      /* Listed for submission at the end of the completion batch */
+
+    /* io_uring backend, event loop thread only */
+    bool deferred;            /* A request runs on the worker, the following ones wait */
+    bool release_deferred;    /* Disconnected meanwhile, released once the request returns */
+} client_connection_t;
+
+/**
+ * API server instance
+ */
+struct esphome_api_server {
+    esphome_device_config_t config;
+    int listen_fd;
+    int unix_fd;              /* Unix domain socket listener, -1 if none */
+    bool running;
+    bool handoff;             /* Paused for a handoff to a new process */
+    pthread_t listen_thread;
+
+    /* Client connections */
+    client_connection_t *clients;
+    int max_clients;          /* Slots: TCP first, then Unix domain socket */
+    int tcp_clients;
+    uint16_t port;
+    pthread_mutex_t clients_mutex;
+
+    /* Built-in mDNS responder, driven by the listen thread */
+    esphome_mdns_t *mdns;
+
+    /* io_uring event loop, NULL on the thread-per-client backend */
+    struct esphome_api_uring *uring;
+
+    /* Outbound statistics (atomic, 32-bit: no 64-bit atomics on 32-bit MIPS) */
+    uint32_t frames_sent;
+    uint32_t send_syscalls;   /* send()/sendmsg(), or io_uring_enter() with submissions */
+    uint32_t tcp_frames_sent;
+    uint32_t tcp_segments_closed;  /* Data segments of TCP connections already closed */
+};
+
+/**
+ * Parse and dispatch the complete frames in a client's receive buffer
+ *
+ * @param server Server
+ * @param client Client
+ * @param client_id Client index
+ */
+void esphome_api_handle_client_data(esphome_api_server_t *server,
+                                    client_connection_t *client, int client_id);
+
+/**
+ * Dispatch a request taken out of a client's receive buffer
+ *
+ * Used by the io_uring worker for requests deferred by
+ * esphome_api_uring_defer(); the client stays open until it returns.
+ *
+ * @param server Server
+ * @param client_id Client index
+ * @param msg_type ESPHome Native API message type
+ * @param payload Message payload
+ * @param payload_len Length of payload
+ */
+void esphome_api_dispatch_deferred(esphome_api_server_t *server, int client_id, uint16_t msg_type,
+                                   const uint8_t *payload, size_t payload_len);
+
+/**
+ * Admit an accepted connection into a free client slot
+ *
+ * Checks the peer credentials of local clients and sets TCP_NODELAY on
+ * network ones. Closes the connection if it is refused.
+ *
+ * @param server Server
+ * @param fd Accepted connection
+ * @param local Accepted on the Unix domain socket
+ * @return Client index, or -1 if refused
+ */
+int esphome_api_admit_client(esphome_api_server_t *server, int fd, bool local);
+
+/**
+ * Notify plugins of a disconnect and close the client's socket
+ *
+ * @param server Server
+ * @param client_id Client index
+ */
+void esphome_api_release_client(esphome_api_server_t *server, int client_id);
+
+/**
+ * Set up an io_uring event loop for the server's listeners
+ *
+ * Needs multishot accept and recv and provided buffer rings (Linux 6.0).
+ *
+ * @param server Server
+ * @return Event loop, or NULL if io_uring is unavailable (use threads)
+ */
+struct esphome_api_uring *esphome_api_uring_create(esphome_api_server_t *server);
+
+/**
+ * Start accepting and serving clients on the event loop thread
+ *
+ * @param uring Event loop
+ * @return 0 on success, -1 on error
+ */
+int esphome_api_uring_start(struct esphome_api_uring *uring);
+
+/**
+ * Queue a framed message for sending to a client
+ *
+ * Frames to one client go out in order; frames queued together are sent
+ * as one chain of linked SQEs, corked with MSG_MORE on TCP. On the event
+ * loop thread, submission waits for the end of the completion batch
+ * unless the frame is urgent.
+ *
+ * @param uring Event loop
+ * @param client Client (caller does not hold its send_mutex)
+ * @param frame Framed message, or several back to back (copied)
+ * @param len Length
+ * @param frames Number of messages, for the statistics
+ * @param urgent Submit right away
+ * @return 0 if queued, -1 if the client's queue is full or it is gone
+ */
+int esphome_api_uring_send(struct esphome_api_uring *uring, client_connection_t *client,
+                           const uint8_t *frame, size_t len, int frames, bool urgent);
+
+/**
+ * Hand a request that may block to the event loop's worker
+ *
+ * Called on the event loop thread. The payload is copied and the client
+ * is marked deferred: its later requests stay in the receive buffer until
+ * the worker has dispatched this one and handed the client back through
+ * the ring, and a disconnect meanwhile releases it only then.
+ *
+ * @param uring Event loop
+ * @param client_id Client index
+ * @param msg_type ESPHome Native API message type
+ * @param payload Message payload
+ * @param payload_len Length of payload
+ * @return 0 if deferred, -1 to dispatch it on the calling thread instead
+ */
+int esphome_api_uring_defer(struct esphome_api_uring *uring, int client_id, uint16_t msg_type,
+                            const uint8_t *payload, size_t payload_len);
+
+/**
+ * Discard a closing client's queued frames
+ *
+ * Frames the kernel still holds are freed when their sends complete.
+ * Caller holds the client's send_mutex.
+ *
+ * @param client Client
+ */
+void esphome_api_uring_drop_sends(client_connection_t *client);
+
+/**
+ * Stop accepting and receiving for a handoff
+ *
+ * Cancels the multishot accepts and receives and handles the data that
+ * was already received; frames keep going out. Called with server->running
+ * cleared and server->handoff set.
+ *
+ * @param uring Event loop
+ * @return 0 once nothing is received any more, -1 on timeout
+ */
+int esphome_api_uring_pause(struct esphome_api_uring *uring);
+
+/**
+ * Stop the event loop thread and release all clients it served
+ *
+ * After esphome_api_uring_pause(), waits for the queued frames to go out
+ * instead and leaves the clients connected.
+ *
+ * @param uring Event loop
+ */
+void esphome_api_uring_stop(struct esphome_api_uring *uring);
+
+/**
+ * Free the event loop
+ *
+ * @param uring Event loop (NULL is ignored)
+ */
+void esphome_api_uring_free(struct esphome_api_uring *uring);
+
+#endif /* ESPHOME_API_INTERNAL_H */
@@ -0,0 +1,147 @@
+/**
+ * @file esphome_config.h
+ * @brief Configuration file with hot reload
+ *
+ * The configuration file is a small INI file:
+ *
+ *     # comment
+ *     [device]
+ *     name = living-room-proxy
+ *
+ *     [bluetooth_proxy]
+ *     report_interval_ms = 5000
+ *
+ * Keys are looked up as "section.key" ("device.name"). The file is parsed
+ * at startup and again on SIGHUP; each parse produces an immutable
+ * snapshot that is published RCU-style, so readers never lock. Watchers
+ * registered with esphome_config_watch() are told about every new
+ * snapshot and republish whatever parameters they derive from it.
+ */
+
+#ifndef ESPHOME_CONFIG_H
+#define ESPHOME_CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of registered reload watchers */
+#define ESPHOME_CONFIG_MAX_WATCHERS 16
+
+/* Maximum length of a configuration line */
+#define ESPHOME_CONFIG_LINE_MAX 512
+
+/* Parsed configuration snapshot (immutable, opaque) */
+typedef struct esphome_config esphome_config_t;
+
+/**
+ * Reload callback
+ *
+ * Runs on the thread that reloaded the configuration (the main thread
+ * for SIGHUP), after the new snapshot is published.
+ *
+ * @param config New snapshot
+ * @param user_data Pointer passed to esphome_config_watch()
+ */
+typedef void (*esphome_config_reload_fn)(const esphome_config_t *config, void *user_data);
+
+/**
+ * Parse a configuration file and publish it
+ *
+ * The path is remembered for esphome_config_reload(), even if this first
+ * parse fails.
+ *
+ * @param path Configuration file
+ * @return 0 on success, -1 if the file cannot be read or has syntax errors
+ *         (the previous snapshot, if any, stays current)
+ */
+int esphome_config_load(const char *path);
+
+/**
+ * Re-read the configuration file and notify watchers
+ *
+ * @return 0 on success, -1 on error (the previous snapshot stays current)
+ */
+int esphome_config_reload(void);
+
+/**
+ * Get the current snapshot (lock-free)
+ *
+ * Call inside an RCU read section (esphome_rcu_read_lock()) and use the
+ * snapshot only until esphome_rcu_read_unlock(). The thread that loads
+ * and reloads the configuration may call it without one.
+ *
+ * @return Current snapshot, or NULL if no configuration was loaded
+ */
+const esphome_config_t *esphome_config_get(void);
+
+/**
+ * Look up a string value
+ *
+ * @param config Snapshot (NULL returns def)
+ * @param key "section.key"
+ * @param def Returned if the key is not set
+ * @return Value (owned by the snapshot) or def
+ */
+const char *esphome_config_get_string(const esphome_config_t *config, const char *key,
+                                      const char *def);
+
+/**
+ * Look up an integer value
+ *
+ * Values that do not parse or fall outside [min, max] are logged and
+ * replaced by def.
+ *
+ * @return Value or def
+ */
+long esphome_config_get_int(const esphome_config_t *config, const char *key, long def,
+                            long min, long max);
+
+/**
+ * Look up a boolean value (true/false, yes/no, on/off, 1/0)
+ *
+ * @return Value or def
+ */
+bool esphome_config_get_bool(const esphome_config_t *config, const char *key, bool def);
+
+/**
+ * Get the snapshot generation (1 for the first load, +1 per reload)
+ *
+ * @return Generation, 0 for NULL
+ */
+uint32_t esphome_config_generation(const esphome_config_t *config);
+
+/**
+ * Register a reload watcher
+ *
+ * @param fn Callback
+ * @param user_data Passed to fn
+ * @return 0 on success, -1 if the watcher table is full
+ */
+int esphome_config_watch(esphome_config_reload_fn fn, void *user_data);
+
+/**
+ * Unregister a reload watcher
+ *
+ * When this returns the callback is not running and will not run again.
+ *
+ * @param fn Callback previously registered
+ * @param user_data Pointer previously registered with fn
+ */
+void esphome_config_unwatch(esphome_config_reload_fn fn, void *user_data);
+
+/**
+ * Free the current snapshot
+ *
+ * Called at shutdown, after all readers stopped.
+ */
+void esphome_config_free(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESPHOME_CONFIG_H */
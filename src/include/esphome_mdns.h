@@ -0,0 +1,99 @@
+/**
+ * @file esphome_mdns.h
+ * @brief Minimal built-in mDNS responder for _esphomelib._tcp
+ *
+ * Advertises the API server so Home Assistant discovers it without an
+ * external mdnsd/avahi. The responder publishes PTR, SRV, TXT, A and AAAA
+ * records for one service instance, probes its names before using them
+ * (RFC 6762 section 8), announces them, answers queries with known-answer
+ * suppression and says goodbye on shutdown.
+ *
+ * It owns no thread: the owner polls esphome_mdns_fd() in its own event
+ * loop and calls esphome_mdns_process() when the socket is readable or
+ * esphome_mdns_timeout_ms() expires. All buffers are allocated once in
+ * esphome_mdns_init(), so answering a query does not touch the heap.
+ */
+
+#ifndef ESPHOME_MDNS_H
+#define ESPHOME_MDNS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESPHOME_MDNS_PORT 5353
+
+/* Maximum number of TXT entries */
+#define ESPHOME_MDNS_MAX_TXT 8
+
+/* Responder instance (opaque) */
+typedef struct esphome_mdns esphome_mdns_t;
+
+/**
+ * Responder configuration
+ */
+typedef struct {
+    const char *name;                       /* Instance and host name (<name>.local) */
+    uint16_t port;                          /* Advertised API port */
+    bool ipv6;                              /* Publish AAAA records (service reachable over IPv6) */
+    const char *txt[ESPHOME_MDNS_MAX_TXT];  /* "key=value" entries, NULL-terminated */
+} esphome_mdns_config_t;
+
+/**
+ * Create a responder and start probing
+ *
+ * The configuration is copied.
+ *
+ * @param config Responder configuration
+ * @return Responder, or NULL if the socket cannot be set up
+ */
+esphome_mdns_t *esphome_mdns_init(const esphome_mdns_config_t *config);
+
+/**
+ * Get the socket to poll for input
+ *
+ * @param mdns Responder
+ * @return File descriptor
+ */
+int esphome_mdns_fd(const esphome_mdns_t *mdns);
+
+/**
+ * Get the time until the next probe, announcement or interface scan
+ *
+ * @param mdns Responder
+ * @return Milliseconds, 0 if a timer is due
+ */
+int esphome_mdns_timeout_ms(const esphome_mdns_t *mdns);
+
+/**
+ * Handle pending input and due timers
+ *
+ * @param mdns Responder
+ * @param readable true if the socket polled readable
+ */
+void esphome_mdns_process(esphome_mdns_t *mdns, bool readable);
+
+/**
+ * Send goodbye packets and free the responder
+ *
+ * @param mdns Responder (NULL is ignored)
+ */
+void esphome_mdns_free(esphome_mdns_t *mdns);
+
+/**
+ * Free the responder without goodbye packets
+ *
+ * For a handoff to a process that goes on announcing the same records.
+ *
+ * @param mdns Responder (NULL is ignored)
+ */
+void esphome_mdns_free_silent(esphome_mdns_t *mdns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESPHOME_MDNS_H */
@@ -0,0 +1,60 @@
+/**
+ * @file esphome_metrics.h
+ * @brief Runtime metrics surface
+ *
+ * Subsystems register a dump callback; all callbacks are run when the
+ * service receives SIGUSR1 (kill -USR1 $(pidof esphome-linux)), writing
+ * plain "section key value" lines to stdout.
+ */
+
+#ifndef ESPHOME_METRICS_H
+#define ESPHOME_METRICS_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of registered metric providers */
+#define ESPHOME_METRICS_MAX_PROVIDERS 16
+
+/**
+ * Metrics dump callback
+ *
+ * @param out Stream to write metric lines to
+ * @param user_data Pointer passed to esphome_metrics_register()
+ */
+typedef void (*esphome_metrics_dump_fn)(FILE *out, void *user_data);
+
+/**
+ * Register a metrics provider
+ *
+ * @param name Section name printed before the provider output
+ * @param fn Dump callback
+ * @param user_data Passed to fn
+ * @return 0 on success, -1 if the provider table is full
+ */
+int esphome_metrics_register(const char *name, esphome_metrics_dump_fn fn,
+                             void *user_data);
+
+/**
+ * Unregister a metrics provider
+ *
+ * @param fn Dump callback previously registered
+ * @param user_data Pointer previously registered with fn
+ */
+void esphome_metrics_unregister(esphome_metrics_dump_fn fn, void *user_data);
+
+/**
+ * Run all registered providers
+ *
+ * @param out Stream to write to
+ */
+void esphome_metrics_dump(FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESPHOME_METRICS_H */
@@ -66,6 +66,7 @@ struct esphome_plugin_context {
     esphome_api_server_t *server;           /* API server instance */
     const esphome_device_config_t *config;  /* Device configuration */
     void *plugin_data;                       /* Plugin-specific data */
+    esphome_plugin_t *plugin;                /* Owning plugin (internal use) */
 };
 
 /**
@@ -143,9 +144,13 @@ typedef int (*esphome_plugin_configure_device_info_fn)(
  * Plugins should use esphome_plugin_send_message_to_client() to send
  * entity responses (e.g., BinarySensorInfo, SwitchInfo, etc.).
  *
+ * The core captures what is sent to client_id and answers later requests
+ * from that copy without calling back, until the plugin calls
+ * esphome_plugin_invalidate_entities().
+ *
  * @param ctx Plugin context
  * @param client_id Client requesting entity list
- * @return 0 on success, -1 on error
+ * @return 0 on success, -1 on error (the listing is then not cached)
  */
 typedef int (*esphome_plugin_list_entities_fn)(
     esphome_plugin_context_t *ctx,
@@ -168,7 +173,25 @@ typedef int (*esphome_plugin_subscribe_states_fn)(
     esphome_plugin_context_t *ctx,
     int client_id);
 
-    /**
+/**
+ * Plugin executor - where handle_message runs
+ *
+ * Only messages listed in the plugin's message_types can be handed off to a
+ * worker, because the core must know the message is handled without
+ * waiting for the handler's return value. Worker executors deliver a
+ * plugin's messages in arrival order, one at a time, through a bounded
+ * queue; messages arriving while the queue is full are dropped and counted.
+ */
+typedef enum {
+    ESPHOME_PLUGIN_EXECUTOR_INLINE = 0,  /* On the client's receive thread (default) */
+    ESPHOME_PLUGIN_EXECUTOR_DEDICATED,   /* On a worker thread owned by the plugin */
+    ESPHOME_PLUGIN_EXECUTOR_SHARED,      /* On the core's shared worker pool */
+} esphome_plugin_executor_t;
+
+/* Core state attached to each plugin (opaque to plugins) */
+typedef struct esphome_plugin_runtime esphome_plugin_runtime_t;
+
+/**
  * Plugin descriptor
  */
 struct esphome_plugin {
@@ -182,8 +205,40 @@ struct esphome_plugin {
     esphome_plugin_subscribe_states_fn subscribe_states; /* Entity Initial state (optional) */
     esphome_plugin_t *next;                  /* Linked list (internal use) */
     esphome_plugin_context_t *ctx;           /* Persistent context (internal use) */
+
+    /* Optional fields, zero-filled for modules built against an older descriptor */
+    const uint32_t *message_types;           /* Message types this plugin owns */
+    size_t message_type_count;               /* Number of entries in message_types */
+    esphome_plugin_executor_t executor;      /* Where handle_message runs */
+    uint32_t queue_depth;                    /* Executor queue bound (0 = default) */
+    esphome_plugin_runtime_t *rt;            /* Executor, lifecycle and statistics (internal use) */
+    bool lazy_init;                          /* Defer init until a client sends an owned message */
+    uint32_t idle_timeout_ms;                /* Lazy plugins: teardown grace period (0 = default) */
+    const char *const *depends_on;           /* NULL-terminated names of plugins to init first */
 };
 
+/**
+ * Plugin ABI version
+ *
+ * Bumped whenever esphome_plugin_t or a core function used by plugins
+ * changes incompatibly. Appending fields to esphome_plugin_t does not
+ * require a bump: the loader copies struct_size bytes and zero-fills the
+ * rest.
+ */
+#define ESPHOME_PLUGIN_ABI_VERSION 1
+
+/* Name of the ABI descriptor symbol exported by shared plugins */
+#define ESPHOME_PLUGIN_ABI_SYMBOL "esphome_plugin_abi"
+
+/**
+ * ABI descriptor exported by runtime-loadable (.so) plugins
+ */
+typedef struct esphome_plugin_abi {
+    uint32_t abi_version;        /* ESPHOME_PLUGIN_ABI_VERSION at build time */
+    uint32_t struct_size;        /* sizeof(esphome_plugin_t) at build time */
+    const esphome_plugin_t *plugin;
+} esphome_plugin_abi_t;
+
 /**
  * Register a plugin (used via ESPHOME_PLUGIN_REGISTER macro)
  *
@@ -223,6 +278,79 @@ int esphome_plugin_send_message_to_client(esphome_plugin_context_t *ctx,
                                            const uint8_t *data,
                                            size_t len);
 
+/**
+ * Coalesce the messages this thread sends until esphome_plugin_uncork()
+ *
+ * Use it around bursts sent from the plugin's own threads, such as a pass
+ * over all devices: each client then gets one write instead of one per
+ * message. Calls nest. Message handlers run in such a section already.
+ *
+ * @param ctx Plugin context
+ */
+void esphome_plugin_cork(esphome_plugin_context_t *ctx);
+
+/**
+ * End a esphome_plugin_cork() section, writing the messages it held back
+ *
+ * @param ctx Plugin context
+ */
+void esphome_plugin_uncork(esphome_plugin_context_t *ctx);
+
+/**
+ * Drop the plugin's cached entity listing
+ *
+ * Call whenever the plugin's entities are added, removed or redefined;
+ * the next LIST_ENTITIES_REQUEST calls list_entities again. Lock-free, so
+ * it may be called from any thread, with the plugin's own locks held.
+ *
+ * @param ctx Plugin context
+ */
+void esphome_plugin_invalidate_entities(esphome_plugin_context_t *ctx);
+
+/**
+ * Get the plugin's entity generation
+ *
+ * Starts at 0 and is bumped by esphome_plugin_invalidate_entities(). Read
+ * it in list_entities to remember which listing first carried an entity.
+ *
+ * @param ctx Plugin context
+ * @return Current generation
+ */
+uint32_t esphome_plugin_entity_generation(esphome_plugin_context_t *ctx);
+
+/**
+ * Check whether clients know the plugin's entities
+ *
+ * Listings are cached and answered without calling list_entities, so a
+ * plugin cannot tell on its own which clients were sent which entities.
+ * Only send entity states to clients for which this returns true.
+ * Forgotten when the client disconnects or the plugin is stopped.
+ *
+ * @param ctx Plugin context
+ * @param client_id Client ID, or -1 for every connected client
+ * @param generation Oldest listing that carries the entity (see
+ *                   esphome_plugin_entity_generation(); 0 = any listing)
+ * @return true if the client(s) were sent such a listing since the plugin started
+ */
+bool esphome_plugin_client_listed(esphome_plugin_context_t *ctx, int client_id,
+                                  uint32_t generation);
+
+/**
+ * Send an entity state to every client that knows the entity
+ *
+ * @param ctx Plugin context
+ * @param generation Oldest listing that carries the entity (0 = any listing)
+ * @param msg_type ESPHome Native API message type
+ * @param data Message payload
+ * @param len Length of payload
+ * @return Number of clients the message was sent to
+ */
+int esphome_plugin_send_entity_state(esphome_plugin_context_t *ctx,
+                                     uint32_t generation,
+                                     uint32_t msg_type,
+                                     const uint8_t *data,
+                                     size_t len);
+
 /**
  * Get the hostname/IP address of a connected client
  *
@@ -268,7 +396,7 @@ void esphome_plugin_log(esphome_plugin_context_t *ctx,
 #define ESPHOME_PLUGIN_REGISTER(var_name, plugin_name, plugin_version, \
                                  init_fn, cleanup_fn, handle_msg_fn, \
                                  config_device_info_fn, list_entities_fn, subscribe_states_fn) \
-    static esphome_plugin_t var_name = { \
+    ESPHOME_PLUGIN_REGISTER_EX(var_name, \
         .name = plugin_name, \
         .version = plugin_version, \
         .init = init_fn, \
@@ -276,12 +404,48 @@ void esphome_plugin_log(esphome_plugin_context_t *ctx,
         .handle_message = handle_msg_fn, \
         .configure_device_info = config_device_info_fn, \
         .list_entities = list_entities_fn, \
-        .subscribe_states = subscribe_states_fn, \
-        .next = NULL \
-    }; \
+        .subscribe_states = subscribe_states_fn)
+
+/**
+ * Plugin registration macro with designated initializers
+ *
+ * Allows setting any esphome_plugin_t field, including the optional
+ * fields that ESPHOME_PLUGIN_REGISTER leaves at their defaults:
+ * @code
+ * static const uint32_t my_messages[] = { ESPHOME_MSG_BLUETOOTH_DEVICE_REQUEST };
+ *
+ * ESPHOME_PLUGIN_REGISTER_EX(my_plugin,
+ *     .name = "MyPlugin",
+ *     .version = "1.0.0",
+ *     .init = my_plugin_init,
+ *     .handle_message = my_plugin_handle_message,
+ *     .message_types = my_messages,
+ *     .message_type_count = 1,
+ *     .executor = ESPHOME_PLUGIN_EXECUTOR_DEDICATED
+ * );
+ * @endcode
+ *
+ * When the plugin is built as a shared module (ESPHOME_PLUGIN_SHARED
+ * defined), the macro exports an esphome_plugin_abi_t descriptor instead of
+ * registering from a constructor; the core loads it with dlopen. Only one
+ * plugin may be registered per shared module.
+ */
+#ifdef ESPHOME_PLUGIN_SHARED
+#define ESPHOME_PLUGIN_REGISTER_EX(var_name, ...) \
+    static const esphome_plugin_t var_name = { __VA_ARGS__ }; \
+    __attribute__((visibility("default"))) \
+    const esphome_plugin_abi_t esphome_plugin_abi = { \
+        .abi_version = ESPHOME_PLUGIN_ABI_VERSION, \
+        .struct_size = sizeof(esphome_plugin_t), \
+        .plugin = &var_name \
+    }
+#else
+#define ESPHOME_PLUGIN_REGISTER_EX(var_name, ...) \
+    static esphome_plugin_t var_name = { __VA_ARGS__ }; \
     __attribute__((constructor)) static void __register_##var_name(void) { \
         esphome_plugin_register(&var_name); \
     }
+#endif
 
 #ifdef __cplusplus
 }
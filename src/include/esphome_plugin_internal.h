@@ -12,6 +12,162 @@
 #include "esphome_plugin.h"
 #include "esphome_api.h"
 #include "esphome_proto.h"
+#include <pthread.h>
+
+/* Maximum number of shared plugin modules loaded from the plugin directory */
+#define ESPHOME_PLUGIN_MAX_MODULES 32
+
+/* Default bound of a plugin executor queue (esphome_plugin_t.queue_depth) */
+#define ESPHOME_PLUGIN_QUEUE_DEPTH 16
+
+/* Worker threads in the shared plugin executor pool */
+#define ESPHOME_PLUGIN_POOL_THREADS 2
+
+/* Handlers running longer than this are logged as slow */
+#define ESPHOME_PLUGIN_SLOW_HANDLER_MS 100
+
+/* Default grace period before an unused lazy plugin is torn down */
+#define ESPHOME_PLUGIN_IDLE_TIMEOUT_MS 300000
+
+/* How often the idle thread looks for lazy plugins to tear down */
+#define ESPHOME_PLUGIN_IDLE_CHECK_MS 1000
+
+/* How long entity listing and plugin messages wait for plugin startup */
+#define ESPHOME_PLUGIN_STARTUP_WAIT_MS 5000
+
+/* Plugin startup states (esphome_plugin_runtime_t.start_state) */
+enum {
+    ESPHOME_PLUGIN_STOPPED = 0,   /* Not initialized (or lazy and idle) */
+    ESPHOME_PLUGIN_STARTING,      /* init() is running */
+    ESPHOME_PLUGIN_RUNNING,       /* Initialized */
+    ESPHOME_PLUGIN_FAILED,        /* init() or a dependency failed */
+};
+
+/**
+ * Core state of a plugin (esphome_plugin_t.rt)
+ *
+ * Lives from registration until the plugin's module is unloaded, so it is
+ * not part of the descriptor that plugins build against. The executor
+ * part is guarded by `lock`, the lifecycle part by the plugin manager's
+ * lifecycle mutex unless a field is marked atomic.
+ */
+struct esphome_plugin_runtime {
+    esphome_plugin_t *plugin;
+
+    /* Executor (esphome_plugin_executor.c) */
+    struct plugin_executor *executor; /* NULL when running inline */
+    bool dedicated;                   /* executor is owned by this plugin */
+    pthread_mutex_t lock;             /* Protects the executor part and statistics */
+    pthread_cond_t idle_cond;         /* Signalled when scheduled drops to false */
+    struct plugin_job *head;
+    struct plugin_job *tail;
+    uint32_t queued;
+    uint32_t depth;
+    bool scheduled;                   /* On the ready list or being run */
+    bool closed;                      /* Not attached, reject new messages */
+    esphome_plugin_runtime_t *ready_next;
+
+    /* Statistics */
+    uint64_t handled;
+    uint64_t dropped;
+    uint64_t slow;
+    uint64_t queue_ns_total;
+    uint64_t queue_ns_max;
+    uint64_t run_ns_total;
+    uint64_t run_ns_max;
+
+    /* Lifecycle (esphome_plugin.c) */
+    int start_state;                  /* ESPHOME_PLUGIN_STOPPED, ... */
+    uint32_t active_clients;          /* Clients using a lazy plugin, one bit per client */
+    uint64_t idle_since_ms;           /* When active_clients dropped to 0 */
+    uint32_t callbacks;               /* Core callbacks running without the lifecycle mutex */
+    uint32_t entity_generation;       /* Atomic, bumped to invalidate entity_cache */
+    struct esphome_entity_cache *entity_cache; /* Encoded entity listing */
+    uint32_t empty_listing_config;    /* Config generation a lazy plugin listed nothing under */
+    uint32_t listed_generation[ESPHOME_MAX_CLIENTS_LIMIT]; /* Atomic, per client:
+                                         entity_generation + 1 of its listing, 0 = none */
+};
+
+/**
+ * Allocate a plugin's runtime state (plugin->rt)
+ *
+ * Called when the plugin registers. The executor starts detached.
+ *
+ * @param plugin Plugin descriptor
+ * @return 0 on success, -1 on allocation failure
+ */
+int esphome_plugin_runtime_alloc(esphome_plugin_t *plugin);
+
+/**
+ * Detach a plugin's executor and free its runtime state and statistics
+ *
+ * @param plugin Plugin descriptor
+ */
+void esphome_plugin_runtime_free(esphome_plugin_t *plugin);
+
+/**
+ * Load shared plugin modules (*.so) from a directory
+ *
+ * Each module must export an esphome_plugin_abi_t descriptor (see
+ * ESPHOME_PLUGIN_REGISTER with ESPHOME_PLUGIN_SHARED). Modules with a
+ * mismatching ABI version, or whose plugin name is already registered,
+ * are skipped. A missing directory is not an error. Must be called
+ * before esphome_plugin_init_all().
+ *
+ * @param dir Plugin directory
+ * @return Number of plugins loaded
+ */
+int esphome_plugin_load_dir(const char *dir);
+
+/**
+ * Unload all shared plugin modules
+ *
+ * Must be called after esphome_plugin_cleanup_all().
+ */
+void esphome_plugin_unload_all(void);
+
+/**
+ * Check whether a plugin declared ownership of a message type
+ *
+ * @param plugin Plugin descriptor
+ * @param msg_type ESPHome Native API message type
+ * @return true if msg_type is listed in plugin->message_types
+ */
+bool esphome_plugin_owns_message(const esphome_plugin_t *plugin, uint32_t msg_type);
+
+/**
+ * Attach the executor declared by a plugin
+ *
+ * Called after the plugin initialized successfully. Plugins asking for a
+ * worker executor without declaring message_types run inline.
+ *
+ * @param plugin Plugin descriptor
+ * @return 0 on success, -1 if the plugin has no runtime state
+ */
+int esphome_plugin_executor_attach(esphome_plugin_t *plugin);
+
+/**
+ * Detach a plugin's executor
+ *
+ * Discards pending messages, waits for a running handler to return and
+ * stops the plugin's dedicated thread (or releases the shared pool).
+ * Must be called before the plugin's cleanup callback.
+ *
+ * @param plugin Plugin descriptor
+ */
+void esphome_plugin_executor_detach(esphome_plugin_t *plugin);
+
+/**
+ * Deliver a message to a plugin through its executor
+ *
+ * Inline plugins run on the calling thread and their result is returned.
+ * Otherwise the message is copied into the plugin's queue and 0 is
+ * returned; a full queue drops the message with a warning.
+ *
+ * @return Handler result (inline), 0 when queued or dropped, -1 on error
+ */
+int esphome_plugin_executor_dispatch(esphome_plugin_t *plugin, int client_id,
+                                     uint32_t msg_type, const uint8_t *data, size_t len);
 
 /**
  * Get the head of the plugin list
@@ -23,7 +179,12 @@ esphome_plugin_t *esphome_plugin_get_head(void);
 /**
  * Initialize all registered plugins
  *
- * Called during server startup to initialize all plugins.
+ * Called during server startup to initialize all plugins. Independent
+ * plugins initialize in parallel; a plugin listing depends_on starts once
+ * all of its dependencies are running and fails if any of them failed,
+ * is missing or is part of a dependency cycle. The API server may already
+ * serve clients: device info is answered right away, while entity
+ * listing and plugin messages wait (bounded) for startup to finish.
  *
  * @param server API server instance
  * @param config Device configuration
@@ -43,6 +204,17 @@ int esphome_plugin_init_all(esphome_api_server_t *server,
 void esphome_plugin_cleanup_all(esphome_api_server_t *server,
                                 const esphome_device_config_t *config);
 
+/**
+ * Notify the plugin system that a client disconnected
+ *
+ * Lazy plugins that no connected client uses any more start their idle
+ * grace period; they are torn down when it expires.
+ *
+ * @param server API server instance
+ * @param client_id Client that disconnected
+ */
+void esphome_plugin_client_disconnected(esphome_api_server_t *server, int client_id);
+
 /**
  * Allow all plugins to configure device info
  *
@@ -60,20 +232,45 @@ int esphome_plugin_configure_device_info_all(
     esphome_device_info_response_t *device_info);
 
 /**
- * Allow all plugins to list their entities
+ * Growable buffer of framed messages
+ */
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t size;
+    int frames;
+} esphome_frame_buffer_t;
+
+/**
+ * Frame a message onto the end of a buffer
  *
- * Called during the list entities phase. Each plugin can send entity
- * responses for any entities it exposes.
+ * @param buf Buffer (zero-initialized before first use)
+ * @param msg_type ESPHome Native API message type
+ * @param payload Message payload
+ * @param payload_len Length of payload
+ * @return 0 on success, -1 on allocation failure
+ */
+int esphome_frame_buffer_append(esphome_frame_buffer_t *buf, uint16_t msg_type,
+                                const uint8_t *payload, size_t payload_len);
+
+/**
+ * Collect the entity listings of all plugins
+ *
+ * Each plugin's listing is captured from its list_entities callback once
+ * and reused until the plugin invalidates it, so a request costs a copy
+ * per plugin instead of a callback and a send per entity.
  *
  * @param server API server instance
  * @param config Device configuration
  * @param client_id Client requesting entity list
+ * @param out Receives the framed LIST_ENTITIES_* messages (caller frees out->data)
  * @return 0 on success, -1 on error
  */
 int esphome_plugin_list_entities_all(
     esphome_api_server_t *server,
     const esphome_device_config_t *config,
-    int client_id);
+    int client_id,
+    esphome_frame_buffer_t *out);
 
 /**
  * Allow all plugins to send initial states of their entities
@@ -234,6 +234,8 @@ typedef struct {
 
 typedef struct {
     char client[ESPHOME_MAX_STRING_LEN];
+    uint32_t api_version_major;      /* Field 2 - uint32 */
+    uint32_t api_version_minor;      /* Field 3 - uint32 */
 } esphome_hello_request_t;
 
 typedef struct {
@@ -315,6 +317,9 @@ typedef struct {
     /* Empty */
 } esphome_list_entities_done_t;
 
+/* SubscribeBluetoothLEAdvertisementsRequest flags */
+#define BLE_SUBSCRIPTION_FLAG_RAW_ADVERTISEMENTS (1 << 0)
+
 typedef struct {
     uint32_t flags;
 } esphome_subscribe_ble_advertisements_t;
@@ -332,6 +337,31 @@ typedef struct {
     size_t count;
 } esphome_ble_advertisements_response_t;
 
+/* Sensor state classes (api.proto SensorStateClass) */
+#define SENSOR_STATE_CLASS_NONE             0
+#define SENSOR_STATE_CLASS_MEASUREMENT      1
+#define SENSOR_STATE_CLASS_TOTAL_INCREASING 2
+#define SENSOR_STATE_CLASS_TOTAL            3
+
+typedef struct {
+    char object_id[64];                      /* Field 1 */
+    uint32_t key;                            /* Field 2 - fixed32, unique per device */
+    char name[ESPHOME_MAX_STRING_LEN];       /* Field 3 */
+    char icon[32];                           /* Field 5 */
+    char unit_of_measurement[16];            /* Field 6 */
+    int32_t accuracy_decimals;               /* Field 7 */
+    bool force_update;                       /* Field 8 */
+    char device_class[32];                   /* Field 9 */
+    uint32_t state_class;                    /* Field 10 - SENSOR_STATE_CLASS_* */
+    bool disabled_by_default;                /* Field 12 */
+} esphome_list_entities_sensor_response_t;
+
+typedef struct {
+    uint32_t key;                            /* Field 1 - fixed32 */
+    float state;                             /* Field 2 */
+    bool missing_state;                      /* Field 3 */
+} esphome_sensor_state_response_t;
+
 /**
  * Protobuf encoding functions
  */
@@ -354,6 +384,15 @@ bool pb_encode_bool(pb_buffer_t *buf, uint32_t field_num, bool value);
 /* Encode fixed64 */
 bool pb_encode_fixed64(pb_buffer_t *buf, uint32_t field_num, uint64_t value);
 
+/* Encode fixed32 */
+bool pb_encode_fixed32(pb_buffer_t *buf, uint32_t field_num, uint32_t value);
+
+/* Encode float (fixed32 wire type) */
+bool pb_encode_float(pb_buffer_t *buf, uint32_t field_num, float value);
+
+/* Encode int32 (varint, negative values take 10 bytes) */
+bool pb_encode_int32(pb_buffer_t *buf, uint32_t field_num, int32_t value);
+
 /* Encode uint64 (varint) */
 bool pb_encode_uint64(pb_buffer_t *buf, uint32_t field_num, uint64_t value);
 
@@ -396,6 +435,22 @@ size_t esphome_encode_list_entities_done(uint8_t *buf, size_t size);
 size_t esphome_encode_ble_advertisements(uint8_t *buf, size_t size,
                                           const esphome_ble_advertisements_response_t *msg);
 
+size_t esphome_encode_list_entities_sensor(uint8_t *buf, size_t size,
+                                           const esphome_list_entities_sensor_response_t *msg);
+
+size_t esphome_encode_sensor_state(uint8_t *buf, size_t size,
+                                   const esphome_sensor_state_response_t *msg);
+
+/* Client side, used to connect to other proxies */
+size_t esphome_encode_hello_request(uint8_t *buf, size_t size,
+                                    const esphome_hello_request_t *msg);
+
+size_t esphome_encode_connect_request(uint8_t *buf, size_t size,
+                                      const esphome_connect_request_t *msg);
+
+size_t esphome_encode_subscribe_ble_advertisements(uint8_t *buf, size_t size,
+                                                   const esphome_subscribe_ble_advertisements_t *msg);
+
 /**
  * ESPHome message decoding
  */
@@ -409,6 +464,14 @@ bool esphome_decode_connect_request(const uint8_t *buf, size_t size,
 bool esphome_decode_subscribe_ble_advertisements(const uint8_t *buf, size_t size,
                                                   esphome_subscribe_ble_advertisements_t *msg);
 
+/* Client side, used to connect to other proxies */
+bool esphome_decode_connect_response(const uint8_t *buf, size_t size,
+                                     esphome_connect_response_t *msg);
+
+/* Advertisements beyond ESPHOME_MAX_ADV_BATCH are dropped */
+bool esphome_decode_ble_advertisements(const uint8_t *buf, size_t size,
+                                       esphome_ble_advertisements_response_t *msg);
+
 /**
  * ESPHome message framing
  */
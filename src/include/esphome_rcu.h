@@ -0,0 +1,79 @@
+/**
+ * @file esphome_rcu.h
+ * @brief RCU-style publication of read-mostly data
+ *
+ * Hot-path readers enter a read section with esphome_rcu_read_lock(),
+ * load a pointer with esphome_rcu_dereference() and use the object it
+ * points to without taking a lock. Writers build a new object and publish
+ * it with ESPHOME_RCU_PUBLISH(); the old object is freed once every read
+ * section that was open at the publish has ended (or by
+ * esphome_rcu_barrier() at shutdown).
+ *
+ * A pointer is only valid inside the read section it was loaded in. The
+ * thread that publishes to a slot may read that slot without one. Read
+ * sections may block and nest; an open section only delays reclaiming.
+ */
+
+#ifndef ESPHOME_RCU_H
+#define ESPHOME_RCU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Read sections that can be open at the same time; more wait for a slot */
+#define ESPHOME_RCU_MAX_READERS 64
+
+/**
+ * Destructor for a retired object
+ *
+ * @param ptr Object that was replaced
+ */
+typedef void (*esphome_rcu_free_fn)(void *ptr);
+
+/* Load an RCU-published pointer (lock-free, pairs with the publish) */
+#define esphome_rcu_dereference(ptr) __atomic_load_n(&(ptr), __ATOMIC_ACQUIRE)
+
+/* Publish a new object in place of the current one */
+#define ESPHOME_RCU_PUBLISH(ptr, value, free_fn) \
+    esphome_rcu_publish((void **)&(ptr), (void *)(value), (free_fn))
+
+/**
+ * Enter a read section
+ *
+ * @return Token for esphome_rcu_read_unlock()
+ */
+int esphome_rcu_read_lock(void);
+
+/**
+ * Leave a read section; pointers loaded in it must not be used any more
+ *
+ * @param token Value returned by esphome_rcu_read_lock()
+ */
+void esphome_rcu_read_unlock(int token);
+
+/**
+ * Publish a new object and retire the one it replaces
+ *
+ * Concurrent publishers to the same slot must be serialized by the
+ * caller. Retired objects no read section can still see are freed.
+ *
+ * @param slot Published pointer
+ * @param value New object (fully initialized), or NULL
+ * @param free_fn Destructor for the replaced object (NULL = free())
+ */
+void esphome_rcu_publish(void **slot, void *value, esphome_rcu_free_fn free_fn);
+
+/**
+ * Free all retired objects now
+ *
+ * Only call once no reader can still hold a replaced pointer, e.g. after
+ * all reader threads were joined.
+ */
+void esphome_rcu_barrier(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESPHOME_RCU_H */
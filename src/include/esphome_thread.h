@@ -0,0 +1,101 @@
+/**
+ * @file esphome_thread.h
+ * @brief Thread roles and scheduling policy
+ *
+ * Every long-lived thread in the service is created through
+ * esphome_thread_create() with one of a few roles. Each role carries a
+ * scheduling policy (SCHED class, RT priority or nice value, CPU affinity)
+ * that is applied by the new thread before it runs any user code, and
+ * accumulates the CPU time of its threads for the metrics surface.
+ *
+ * Policies can be overridden per role through the environment, e.g.:
+ * @code
+ * ESPHOME_THREAD_POLICY_SCAN="sched=rr prio=15 cpus=0"
+ * ESPHOME_THREAD_POLICY_BACKGROUND="sched=idle"
+ * ESPHOME_THREAD_POLICY_NETWORK="nice=5;cpus=1-3"
+ * @endcode
+ * Keys: sched=other|batch|idle|fifo|rr, prio=1..99 (fifo/rr), nice=-20..19,
+ * cpus=list of CPUs ("0", "0,2", "1-3") or "all".
+ */
+
+#ifndef ESPHOME_THREAD_H
+#define ESPHOME_THREAD_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Thread roles, in decreasing order of latency sensitivity
+ */
+typedef enum {
+    ESPHOME_THREAD_SCAN = 0,     /* Takes advertisements from the BLE stack */
+    ESPHOME_THREAD_PIPELINE,     /* Batches and forwards advertisements */
+    ESPHOME_THREAD_NETWORK,      /* API listener and client connections */
+    ESPHOME_THREAD_BACKGROUND,   /* Periodic reports and housekeeping */
+    ESPHOME_THREAD_ROLE_COUNT
+} esphome_thread_role_t;
+
+/**
+ * Per-role statistics
+ */
+typedef struct {
+    uint32_t threads_live;       /* Threads of this role currently running */
+    uint32_t threads_started;    /* Threads of this role created so far */
+    uint64_t cpu_ns;             /* CPU time of live and exited threads */
+} esphome_thread_stats_t;
+
+/**
+ * Create a thread with the scheduling policy of a role
+ *
+ * Drop-in replacement for pthread_create() with default attributes.
+ * Failure to apply the policy (e.g. missing CAP_SYS_NICE for real-time
+ * classes) is logged once per role and the thread runs with the default
+ * policy.
+ *
+ * @param thread Receives the thread handle
+ * @param role Thread role
+ * @param name Thread name (truncated to 15 characters)
+ * @param start_routine Thread function
+ * @param arg Argument passed to start_routine
+ * @return 0 on success, error number on failure (as pthread_create)
+ */
+int esphome_thread_create(pthread_t *thread,
+                          esphome_thread_role_t role,
+                          const char *name,
+                          void *(*start_routine)(void *),
+                          void *arg);
+
+/**
+ * Override the policy of a role
+ *
+ * Applies to threads created afterwards.
+ *
+ * @param role Thread role
+ * @param spec Policy specification (see file documentation)
+ * @return 0 on success, -1 if spec could not be parsed
+ */
+int esphome_thread_set_policy(esphome_thread_role_t role, const char *spec);
+
+/**
+ * Get the statistics of a role
+ *
+ * @param role Thread role
+ * @param stats Receives the statistics
+ * @return 0 on success, -1 on invalid role
+ */
+int esphome_thread_get_stats(esphome_thread_role_t role, esphome_thread_stats_t *stats);
+
+/**
+ * Get the name of a role ("scan", "pipeline", "network", "background")
+ */
+const char *esphome_thread_role_name(esphome_thread_role_t role);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESPHOME_THREAD_H */
@@ -11,22 +11,105 @@
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <time.h>
+#include <grp.h>
+#include <pwd.h>
 #include "include/esphome_api.h"
 #include "include/esphome_plugin_internal.h"
+#include "include/esphome_metrics.h"
+#include "include/esphome_config.h"
+#include "include/esphome_rcu.h"
 
 #define PROGRAM_NAME "esphome-linux"
+
+/* Default directory for runtime-loadable plugins (set by the build) */
+#ifndef ESPHOME_PLUGIN_DIR
+#define ESPHOME_PLUGIN_DIR "/usr/lib/esphome-linux/plugins"
+#endif
+
+/* Default configuration file (set by the build) */
+#ifndef ESPHOME_CONFIG_FILE
+#define ESPHOME_CONFIG_FILE "/etc/esphome-linux.conf"
+#endif
 #define VERSION "1.0.0"
 
+/* Upgrades: the new binary finds its end of the handoff channel here */
+#define UPGRADE_FD_ENV "ESPHOME_UPGRADE_FD"
+#define UPGRADE_FD 3
+#define UPGRADE_READY_MS 10000
+
+extern char **environ;
+
 static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t dump_metrics = 0;
+static volatile sig_atomic_t reload_config = 0;
+static volatile sig_atomic_t upgrade_requested = 0;
 static esphome_api_server_t *api_server = NULL;
 
+/* Binary and arguments to start on an upgrade, recorded before it is replaced */
+static char exe_path[PATH_MAX];
+static char **saved_argv;
+
+/* Detected identity, the defaults for the [device] section */
+static char detected_hostname[128] = "thingino-proxy";
+static char detected_mac[24] = "00:00:00:00:00:00";
+
+/* Startup phases, timed from entering main() */
+#define STARTUP_PHASES_MAX 8
+
+static struct timespec startup_begin;
+static int startup_phase_count = 0;
+static struct {
+    const char *name;
+    double at_ms;      /* Since startup_begin */
+    double took_ms;    /* Since the previous phase */
+} startup_phases[STARTUP_PHASES_MAX];
+
+/**
+ * Record the end of a startup phase
+ */
+static void startup_phase_done(const char *name) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double at_ms = (double)(now.tv_sec - startup_begin.tv_sec) * 1000.0 +
+                   (double)(now.tv_nsec - startup_begin.tv_nsec) / 1000000.0;
+    double prev_ms = startup_phase_count > 0 ? startup_phases[startup_phase_count - 1].at_ms : 0.0;
+
+    printf("[main] Startup phase %s: %.2f ms (%.2f ms since start)\n",
+           name, at_ms - prev_ms, at_ms);
+
+    if (startup_phase_count < STARTUP_PHASES_MAX) {
+        startup_phases[startup_phase_count].name = name;
+        startup_phases[startup_phase_count].at_ms = at_ms;
+        startup_phases[startup_phase_count].took_ms = at_ms - prev_ms;
+        startup_phase_count++;
+    }
+}
+
+/**
+ * Metrics provider for startup phase timings
+ */
+static void startup_metrics_dump(FILE *out, void *user_data) {
+    (void)user_data;
+
+    for (int i = 0; i < startup_phase_count; i++) {
+        fprintf(out, "phase %-16s took_ms=%.2f at_ms=%.2f\n", startup_phases[i].name,
+                startup_phases[i].took_ms, startup_phases[i].at_ms);
+    }
+}
+
 /**
  * Signal handler for graceful shutdown
  */
@@ -38,6 +121,139 @@ static void signal_handler(int sig) {
     write(STDERR_FILENO, msg, sizeof(msg) - 1);
 }
 
+/**
+ * Signal handler for metrics dump requests (SIGUSR1)
+ */
+static void metrics_signal_handler(int sig) {
+    (void)sig;
+    dump_metrics = 1;
+}
+
+/**
+ * Signal handler for configuration reload requests (SIGHUP)
+ */
+static void reload_signal_handler(int sig) {
+    (void)sig;
+    reload_config = 1;
+}
+
+/**
+ * Signal handler for upgrade requests (SIGUSR2)
+ */
+static void upgrade_signal_handler(int sig) {
+    (void)sig;
+    upgrade_requested = 1;
+}
+
+/**
+ * Start the binary at exe_path with one end of a handoff channel
+ *
+ * @param channel Set to this process's end of the channel
+ * @return PID of the new process, or -1 on error
+ */
+static pid_t spawn_successor(int *channel) {
+    static char upgrade_env[] = UPGRADE_FD_ENV "=3";  /* UPGRADE_FD */
+    int pair[2];
+
+    if (exe_path[0] == '\0') {
+        fprintf(stderr, "[main] Executable path unknown, cannot upgrade\n");
+        return -1;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0) {
+        perror("[main] socketpair");
+        return -1;
+    }
+
+    /* Only async-signal-safe calls after fork(): prepare the environment now */
+    size_t count = 0;
+    while (environ[count]) {
+        count++;
+    }
+    char **env = calloc(count + 2, sizeof(char *));
+    if (!env) {
+        close(pair[0]);
+        close(pair[1]);
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (strncmp(environ[i], UPGRADE_FD_ENV "=", sizeof(UPGRADE_FD_ENV)) != 0) {
+            env[n++] = environ[i];
+        }
+    }
+    env[n] = upgrade_env;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* The new binary gets stdio and the channel, nothing else */
+        dup2(pair[1], UPGRADE_FD);
+        fcntl(UPGRADE_FD, F_SETFD, 0);
+#ifdef SYS_close_range
+        if (syscall(SYS_close_range, UPGRADE_FD + 1, ~0U, 0) < 0)
+#endif
+        {
+            for (long fd = UPGRADE_FD + 1; fd < sysconf(_SC_OPEN_MAX); fd++) {
+                close((int)fd);
+            }
+        }
+        execve(exe_path, saved_argv, env);
+        _exit(127);
+    }
+
+    free(env);
+    close(pair[1]);
+
+    if (pid < 0) {
+        perror("[main] fork");
+        close(pair[0]);
+        return -1;
+    }
+
+    *channel = pair[0];
+    return pid;
+}
+
+/**
+ * Hand over to a newly started copy of the binary
+ *
+ * Keeps serving if the new process does not come up. Once it is ready,
+ * the server pauses, the plugins stop (releasing the hardware, saving the
+ * device cache) and the listeners and clients move to the new process.
+ *
+ * @return 0 if this process should exit, -1 to keep serving
+ */
+static int upgrade(const esphome_device_config_t *config) {
+    int channel;
+
+    pid_t pid = spawn_successor(&channel);
+    if (pid < 0) {
+        return -1;
+    }
+    printf("[main] Upgrade: started %s as PID %d\n", exe_path, (int)pid);
+
+    if (esphome_api_handoff_wait_ready(channel, UPGRADE_READY_MS) < 0) {
+        fprintf(stderr, "[main] Upgrade failed, keeping on serving\n");
+        close(channel);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    esphome_api_pause(api_server);
+    esphome_plugin_cleanup_all(api_server, config);
+
+    /* Past the pause there is no way back: clients not handed over reconnect */
+    int handed = esphome_api_handoff(api_server, channel);
+    if (handed < 0) {
+        fprintf(stderr, "[main] Handoff to PID %d failed, clients will reconnect\n", (int)pid);
+    }
+    close(channel);
+
+    printf("[main] PID %d took over\n", (int)pid);
+    return 0;
+}
+
 /**
  * Get the MAC address of the primary network interface
  */
@@ -79,24 +295,178 @@ static int get_hostname(char *hostname, size_t size) {
     return -1;
 }
 
+/**
+ * Parse the users allowed on the Unix domain socket ("name-or-uid, ...")
+ */
+static void parse_allowed_uids(const char *list, esphome_device_config_t *config) {
+    char copy[256];
+    char *saveptr = NULL;
+
+    snprintf(copy, sizeof(copy), "%s", list);
+    for (char *item = strtok_r(copy, ", ", &saveptr); item; item = strtok_r(NULL, ", ", &saveptr)) {
+        char *end;
+        unsigned long uid = strtoul(item, &end, 10);
+
+        if (*end != '\0') {
+            struct passwd *pw = getpwnam(item);
+            if (!pw) {
+                fprintf(stderr, "[main] Unknown user in api.unix_allow_users: %s\n", item);
+                continue;
+            }
+            uid = pw->pw_uid;
+        }
+
+        if (config->unix_allowed_uid_count == ESPHOME_UNIX_ALLOWED_UIDS_MAX) {
+            fprintf(stderr, "[main] api.unix_allow_users: more than %d users, ignoring %s\n",
+                    ESPHOME_UNIX_ALLOWED_UIDS_MAX, item);
+            break;
+        }
+        config->unix_allowed_uids[config->unix_allowed_uid_count++] = (uint32_t)uid;
+    }
+}
+
+/**
+ * Resolve the group allowed on the Unix domain socket (name or gid, "" = none)
+ */
+static int64_t parse_allowed_gid(const char *group) {
+    char *end;
+
+    if (group[0] == '\0') {
+        return -1;
+    }
+
+    unsigned long gid = strtoul(group, &end, 10);
+    if (*end == '\0') {
+        return (int64_t)gid;
+    }
+
+    struct group *gr = getgrnam(group);
+    if (!gr) {
+        fprintf(stderr, "[main] Unknown group in api.unix_allow_group: %s\n", group);
+        return -1;
+    }
+    return (int64_t)gr->gr_gid;
+}
+
+/**
+ * Build the device configuration from detected values and the config file
+ */
+static void build_device_config(const esphome_config_t *cfg, esphome_device_config_t *config) {
+    memset(config, 0, sizeof(*config));
+
+    snprintf(config->device_name, sizeof(config->device_name), "%s",
+             esphome_config_get_string(cfg, "device.name", detected_hostname));
+    snprintf(config->mac_address, sizeof(config->mac_address), "%s",
+             esphome_config_get_string(cfg, "device.mac_address", detected_mac));
+    snprintf(config->esphome_version, sizeof(config->esphome_version), "2025.12.0");
+    snprintf(config->model, sizeof(config->model), "%s",
+             esphome_config_get_string(cfg, "device.model", "ESPHome Linux"));
+    snprintf(config->manufacturer, sizeof(config->manufacturer), "%s",
+             esphome_config_get_string(cfg, "device.manufacturer", "Thingino"));
+    snprintf(config->friendly_name, sizeof(config->friendly_name), "%s",
+             esphome_config_get_string(cfg, "device.friendly_name", config->device_name));
+    snprintf(config->suggested_area, sizeof(config->suggested_area), "%s",
+             esphome_config_get_string(cfg, "device.suggested_area", ""));
+
+    config->api_port = (uint16_t)esphome_config_get_int(cfg, "api.port", ESPHOME_API_PORT,
+                                                        1, 65535);
+    config->max_clients = (uint32_t)esphome_config_get_int(cfg, "api.max_clients",
+                                                           ESPHOME_MAX_CLIENTS, 1,
+                                                           ESPHOME_MAX_CLIENTS_LIMIT);
+    config->recv_buffer_size = (uint32_t)esphome_config_get_int(cfg, "api.recv_buffer_size",
+                                                                ESPHOME_API_RECV_BUFFER_SIZE,
+                                                                512, 1024 * 1024);
+    config->disable_mdns = !esphome_config_get_bool(cfg, "mdns.enabled", true);
+
+    /* io_uring is opt-in: core handlers that block (entity listing during
+     * startup, lazy plugin starts) would stall every client on its loop */
+    const char *backend = esphome_config_get_string(cfg, "api.backend", "threads");
+    if (strcmp(backend, "auto") == 0) {
+        config->backend = ESPHOME_API_BACKEND_AUTO;
+    } else if (strcmp(backend, "io_uring") == 0) {
+        config->backend = ESPHOME_API_BACKEND_IO_URING;
+    } else {
+        if (strcmp(backend, "threads") != 0) {
+            fprintf(stderr, "[main] Unknown api.backend '%s', using threads\n", backend);
+        }
+        config->backend = ESPHOME_API_BACKEND_THREADS;
+    }
+
+    snprintf(config->unix_socket, sizeof(config->unix_socket), "%s",
+             esphome_config_get_string(cfg, "api.unix_socket", ""));
+    config->unix_seqpacket = strcmp(esphome_config_get_string(cfg, "api.unix_socket_type",
+                                                              "stream"), "seqpacket") == 0;
+    config->unix_max_clients = (uint32_t)esphome_config_get_int(cfg, "api.unix_max_clients",
+                                                                ESPHOME_UNIX_MAX_CLIENTS, 1,
+                                                                ESPHOME_MAX_CLIENTS_LIMIT - 1);
+    parse_allowed_uids(esphome_config_get_string(cfg, "api.unix_allow_users", ""), config);
+    config->unix_allowed_gid = parse_allowed_gid(
+        esphome_config_get_string(cfg, "api.unix_allow_group", ""));
+}
+
+/**
+ * Reload watcher - device identity and server settings are fixed at startup
+ */
+static void on_config_reload(const esphome_config_t *cfg, void *user_data) {
+    const esphome_device_config_t *active = (const esphome_device_config_t *)user_data;
+    esphome_device_config_t updated;
+
+    build_device_config(cfg, &updated);
+    if (memcmp(&updated, active, sizeof(updated)) != 0) {
+        printf("[main] [device]/[api] settings changed, restart to apply them\n");
+    }
+}
+
 /**
  * Main entry point
  */
 int main(int argc, char *argv[]) {
-    (void)argc;
-    (void)argv;
+    clock_gettime(CLOCK_MONOTONIC, &startup_begin);
+
+    /* Configuration file: -c <file>, $ESPHOME_CONFIG or the build default */
+    const char *config_file = getenv("ESPHOME_CONFIG");
+    bool config_file_required = (config_file != NULL);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:")) != -1) {
+        if (opt == 'c') {
+            config_file = optarg;
+            config_file_required = true;
+        } else {
+            fprintf(stderr, "Usage: %s [-c config-file]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!config_file) {
+        config_file = ESPHOME_CONFIG_FILE;
+    }
+
+    /* Started by a previous process for an upgrade (see upgrade()) */
+    int upgrade_fd = -1;
+    const char *upgrade_env = getenv(UPGRADE_FD_ENV);
+    if (upgrade_env) {
+        upgrade_fd = atoi(upgrade_env);
+        unsetenv(UPGRADE_FD_ENV);
+    }
+
+    saved_argv = argv;
+    ssize_t exe_len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+    exe_path[exe_len > 0 ? exe_len : 0] = '\0';
 
     printf("%s v%s - ESPHome Native API for Linux\n",
            PROGRAM_NAME, VERSION);
     printf("Copyright (c) 2025 Thingino Project\n\n");
 
-    /* Block SIGINT and SIGTERM before creating any threads.
+    /* Block SIGINT, SIGTERM, SIGUSR1, SIGUSR2 and SIGHUP before creating any threads.
      * Child threads will inherit the blocked signal mask.
      * We'll unblock these signals only in the main thread later. */
     sigset_t block_mask, old_mask;
     sigemptyset(&block_mask);
     sigaddset(&block_mask, SIGINT);
     sigaddset(&block_mask, SIGTERM);
+    sigaddset(&block_mask, SIGUSR1);
+    sigaddset(&block_mask, SIGUSR2);
+    sigaddset(&block_mask, SIGHUP);
     pthread_sigmask(SIG_BLOCK, &block_mask, &old_mask);
 
     /* Setup signal handlers using sigaction for reliability */
@@ -109,31 +479,43 @@ int main(int argc, char *argv[]) {
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
 
+    /* SIGUSR1 dumps runtime metrics to stdout */
+    sa.sa_handler = metrics_signal_handler;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    /* SIGHUP re-reads the configuration file */
+    sa.sa_handler = reload_signal_handler;
+    sigaction(SIGHUP, &sa, NULL);
+
+    /* SIGUSR2 hands the server over to a fresh start of the binary */
+    sa.sa_handler = upgrade_signal_handler;
+    sigaction(SIGUSR2, &sa, NULL);
+
     /* Ignore SIGPIPE */
     sa.sa_handler = SIG_IGN;
     sigaction(SIGPIPE, &sa, NULL);
 
-    /* Get device information */
-    char hostname[128] = "thingino-proxy";
-    char mac_address[24] = "00:00:00:00:00:00";
-
-    get_hostname(hostname, sizeof(hostname));
-    get_mac_address(mac_address, sizeof(mac_address));
+    /* Load the configuration file; a missing default file means defaults */
+    if (esphome_config_load(config_file) < 0) {
+        if (config_file_required || access(config_file, F_OK) == 0) {
+            fprintf(stderr, "Failed to load configuration file %s\n", config_file);
+            return EXIT_FAILURE;
+        }
+        printf("No configuration file at %s, using defaults\n", config_file);
+    }
 
-    printf("Device: %s\n", hostname);
-    printf("MAC: %s\n\n", mac_address);
+    /* Get device information */
+    get_hostname(detected_hostname, sizeof(detected_hostname));
+    get_mac_address(detected_mac, sizeof(detected_mac));
 
     /* Configure device */
     esphome_device_config_t config;
-    memset(&config, 0, sizeof(config));
+    build_device_config(esphome_config_get(), &config);
+
+    printf("Device: %s\n", config.device_name);
+    printf("MAC: %s\n\n", config.mac_address);
 
-    snprintf(config.device_name, sizeof(config.device_name), "%s", hostname);
-    snprintf(config.mac_address, sizeof(config.mac_address), "%s", mac_address);
-    snprintf(config.esphome_version, sizeof(config.esphome_version), "2025.12.0");
-    snprintf(config.model, sizeof(config.model), "ESPHome Linux");
-    snprintf(config.manufacturer, sizeof(config.manufacturer), "Thingino");
-    snprintf(config.friendly_name, sizeof(config.friendly_name), "%s", hostname);
-    snprintf(config.suggested_area, sizeof(config.suggested_area), "");
+    esphome_config_watch(on_config_reload, &config);
 
     /* Initialize API server */
     api_server = esphome_api_init(&config);
@@ -141,22 +523,46 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Failed to initialize API server\n");
         return EXIT_FAILURE;
     }
+    startup_phase_done("api-init");
+
+    /* Load shared plugin modules before any client can walk the plugin list */
+    const char *plugin_dir = getenv("ESPHOME_PLUGIN_DIR");
+    esphome_plugin_load_dir(plugin_dir ? plugin_dir : ESPHOME_PLUGIN_DIR);
+    startup_phase_done("plugins-loaded");
+
+    /* Take over the listeners and clients before binding anything */
+    if (upgrade_fd >= 0) {
+        int adopted = esphome_api_adopt(api_server, upgrade_fd);
+        close(upgrade_fd);
+        if (adopted < 0) {
+            fprintf(stderr, "Previous process aborted the upgrade\n");
+            esphome_api_free(api_server);
+            esphome_plugin_unload_all();
+            return EXIT_FAILURE;
+        }
+        startup_phase_done("adopted");
+    }
 
-    /* Start API server */
+    /* Start API server: clients get hello and device info right away,
+     * while entity listing waits for plugin startup below */
     if (esphome_api_start(api_server) < 0) {
         fprintf(stderr, "Failed to start API server\n");
         esphome_api_free(api_server);
+        esphome_plugin_unload_all();
         return EXIT_FAILURE;
     }
+    startup_phase_done("api-listening");
 
     printf("ESPHome API server started successfully\n");
-    printf("Listening on port 6053\n");
+    printf("Listening on port %u\n", config.api_port);
 
-    /* Initialize all registered plugins */
+    /* Initialize all registered plugins (in parallel, honoring dependencies) */
     if (esphome_plugin_init_all(api_server, &config) < 0) {
         fprintf(stderr, "Warning: Some plugins failed to initialize\n");
     }
+    startup_phase_done("plugins-ready");
 
+    esphome_metrics_register("startup", startup_metrics_dump, NULL);
     printf("Plugins loaded and ready\n");
 
     /* Now that all threads are created, unblock signals only in the main thread.
@@ -171,17 +577,42 @@ int main(int argc, char *argv[]) {
 
     while (running) {
         sigsuspend(&wait_mask);  /* Atomically unblock and wait for signals */
+
+        if (dump_metrics) {
+            dump_metrics = 0;
+            esphome_metrics_dump(stdout);
+        }
+
+        if (reload_config) {
+            reload_config = 0;
+            esphome_config_reload();
+        }
+
+        if (upgrade_requested) {
+            upgrade_requested = 0;
+            if (upgrade(&config) == 0) {
+                running = 0;
+            }
+        }
     }
 
     /* Cleanup */
     printf("\nShutting down...\n");
 
-    /* Cleanup all plugins */
+    /* Cleanup all plugins (already done after an upgrade) */
     esphome_plugin_cleanup_all(api_server, &config);
 
     esphome_api_stop(api_server);
     esphome_api_free(api_server);
 
+    /* No client thread can reach plugin code any more */
+    esphome_plugin_unload_all();
+
+    /* No reader is left, release configuration snapshots */
+    esphome_config_unwatch(on_config_reload, &config);
+    esphome_config_free();
+    esphome_rcu_barrier();
+
     printf("Goodbye!\n");
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,339 @@
+/**
+ * @file api_loadgen.c
+ * @brief Loopback load generator for the native API server
+ *
+ * Opens a number of clients, completes the HELLO/CONNECT handshake, then
+ * keeps a window of PING requests in flight on each and measures how many
+ * responses the server turns around per second and how long they take.
+ * Run it against the same server with api.backend set to "threads" and to
+ * "io_uring" to compare the two; with -P it also reports the server's CPU
+ * time per response from /proc. With -l, every Nth request is a
+ * LIST_ENTITIES request instead, whose handler runs plugin code; its
+ * response counts when LIST_ENTITIES_DONE arrives.
+ *
+ * Usage: esphome-api-loadgen [-H host] [-p port] [-u socket] [-c clients]
+ *                            [-w window] [-d seconds] [-l every] [-P server-pid]
+ */
+
+#include "esphome_proto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define LOADGEN_MAX_CLIENTS 1024
+#define LOADGEN_MAX_WINDOW  256
+#define LOADGEN_MAX_SAMPLES (4 * 1024 * 1024)
+
+typedef struct {
+    int fd;
+    bool ready;                    /* Handshake done, pinging */
+    uint8_t buf[16384];
+    size_t pos;
+    uint64_t sent_ns[LOADGEN_MAX_WINDOW];  /* Responses come back in order */
+    unsigned head;
+    unsigned tail;
+    unsigned list_every;           /* Every Nth request lists entities, 0 = pings only */
+} loadgen_client_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int connect_client(const char *host, uint16_t port, const char *unix_path) {
+    int fd;
+
+    if (unix_path) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, unix_path, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static int send_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int send_handshake(int fd) {
+    uint8_t payload[256];
+    uint8_t frames[512];
+    size_t len = 0;
+
+    esphome_hello_request_t hello;
+    memset(&hello, 0, sizeof(hello));
+    snprintf(hello.client, sizeof(hello.client), "esphome-api-loadgen");
+    hello.api_version_major = 1;
+    hello.api_version_minor = 10;
+    size_t payload_len = esphome_encode_hello_request(payload, sizeof(payload), &hello);
+    len += esphome_frame_message(frames, sizeof(frames), ESPHOME_MSG_HELLO_REQUEST,
+                                 payload, payload_len);
+
+    esphome_connect_request_t connect_req;
+    memset(&connect_req, 0, sizeof(connect_req));
+    payload_len = esphome_encode_connect_request(payload, sizeof(payload), &connect_req);
+    len += esphome_frame_message(frames + len, sizeof(frames) - len, ESPHOME_MSG_CONNECT_REQUEST,
+                                 payload, payload_len);
+
+    return send_all(fd, frames, len);
+}
+
+/**
+ * Queue requests until the client's window is full, in one send
+ */
+static int fill_window(loadgen_client_t *client, unsigned window, uint64_t ts) {
+    uint8_t frames[LOADGEN_MAX_WINDOW * 3];
+    size_t len = 0;
+
+    while (client->tail - client->head < window) {
+        bool list = client->list_every > 0 && client->tail % client->list_every == 0;
+        len += esphome_frame_message(frames + len, sizeof(frames) - len,
+                                     list ? ESPHOME_MSG_LIST_ENTITIES_REQUEST :
+                                            ESPHOME_MSG_PING_REQUEST, NULL, 0);
+        client->sent_ns[client->tail % LOADGEN_MAX_WINDOW] = ts;
+        client->tail++;
+    }
+    return len > 0 ? send_all(client->fd, frames, len) : 0;
+}
+
+/**
+ * Server CPU time (user + system) in clock ticks, or -1
+ */
+static long long read_cpu_ticks(int pid) {
+    char path[64];
+    char line[1024];
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    char *ok = fgets(line, sizeof(line), f);
+    fclose(f);
+    if (!ok) {
+        return -1;
+    }
+
+    /* Fields after the parenthesised command name; utime and stime are 14 and 15 */
+    char *p = strrchr(line, ')');
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                     &utime, &stime) != 2) {
+        return -1;
+    }
+    return (long long)(utime + stime);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-H host] [-p port] [-u socket] [-c clients] [-w window]\n"
+            "          [-d seconds] [-l every] [-P server-pid]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    const char *unix_path = NULL;
+    uint16_t port = 6053;
+    int client_count = 16;
+    unsigned window = 8;
+    int duration = 10;
+    int server_pid = 0;
+    int list_every = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:u:c:w:d:l:P:")) != -1) {
+        switch (opt) {
+            case 'H': host = optarg; break;
+            case 'p': port = (uint16_t)atoi(optarg); break;
+            case 'u': unix_path = optarg; break;
+            case 'c': client_count = atoi(optarg); break;
+            case 'w': window = (unsigned)atoi(optarg); break;
+            case 'd': duration = atoi(optarg); break;
+            case 'l': list_every = atoi(optarg); break;
+            case 'P': server_pid = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (client_count < 1 || client_count > LOADGEN_MAX_CLIENTS ||
+        window < 1 || window > LOADGEN_MAX_WINDOW || duration < 1 || list_every < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    loadgen_client_t *clients = calloc((size_t)client_count, sizeof(*clients));
+    struct pollfd *fds = calloc((size_t)client_count, sizeof(*fds));
+    uint32_t *samples = malloc(LOADGEN_MAX_SAMPLES * sizeof(*samples));
+    if (!clients || !fds || !samples) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (int i = 0; i < client_count; i++) {
+        clients[i].fd = connect_client(host, port, unix_path);
+        if (clients[i].fd < 0 || send_handshake(clients[i].fd) < 0) {
+            fprintf(stderr, "Client %d: cannot connect: %s\n", i, strerror(errno));
+            return 1;
+        }
+        clients[i].list_every = (unsigned)list_every;
+        fds[i].fd = clients[i].fd;
+        fds[i].events = POLLIN;
+    }
+
+    long long cpu_start = server_pid > 0 ? read_cpu_ticks(server_pid) : -1;
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)duration * 1000000000ull;
+    uint64_t responses = 0;
+    uint64_t listings = 0;
+    size_t sample_count = 0;
+    int ready = 0;
+
+    for (;;) {
+        uint64_t ts = now_ns();
+        if (ts >= end) {
+            break;
+        }
+
+        int n = poll(fds, (nfds_t)client_count, 100);
+        if (n < 0 && errno != EINTR) {
+            perror("poll");
+            return 1;
+        }
+
+        ts = now_ns();
+        for (int i = 0; i < client_count && n > 0; i++) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            n--;
+
+            loadgen_client_t *client = &clients[i];
+            ssize_t r = recv(client->fd, client->buf + client->pos,
+                             sizeof(client->buf) - client->pos, 0);
+            if (r <= 0) {
+                fprintf(stderr, "Client %d: connection lost\n", i);
+                return 1;
+            }
+            client->pos += (size_t)r;
+
+            /* Consume complete frames */
+            size_t offset = 0;
+            for (;;) {
+                uint32_t msg_len = 0;
+                uint16_t msg_type = 0;
+                size_t header = esphome_decode_frame_header(client->buf + offset,
+                                                            client->pos - offset,
+                                                            &msg_len, &msg_type);
+                if (header == 0 || client->pos - offset < header + msg_len) {
+                    break;
+                }
+                offset += header + msg_len;
+
+                if (msg_type == ESPHOME_MSG_CONNECT_RESPONSE && !client->ready) {
+                    client->ready = true;
+                    ready++;
+                } else if ((msg_type == ESPHOME_MSG_PING_RESPONSE ||
+                            msg_type == ESPHOME_MSG_LIST_ENTITIES_DONE_RESPONSE) &&
+                           client->head != client->tail) {
+                    if (msg_type == ESPHOME_MSG_LIST_ENTITIES_DONE_RESPONSE) {
+                        listings++;
+                    }
+                    uint64_t sent = client->sent_ns[client->head % LOADGEN_MAX_WINDOW];
+                    client->head++;
+                    responses++;
+                    if (sample_count < LOADGEN_MAX_SAMPLES) {
+                        samples[sample_count++] = (uint32_t)((ts - sent) / 1000);
+                    }
+                }
+            }
+            memmove(client->buf, client->buf + offset, client->pos - offset);
+            client->pos -= offset;
+
+            if (client->ready && fill_window(client, window, ts) < 0) {
+                fprintf(stderr, "Client %d: send failed: %s\n", i, strerror(errno));
+                return 1;
+            }
+        }
+    }
+
+    double elapsed = (double)(now_ns() - start) / 1e9;
+    long long cpu_end = server_pid > 0 ? read_cpu_ticks(server_pid) : -1;
+
+    printf("clients=%d window=%u ready=%d duration=%.1fs\n", client_count, window, ready, elapsed);
+    printf("responses: %llu (%.0f/s)\n", (unsigned long long)responses, (double)responses / elapsed);
+    if (list_every > 0) {
+        printf("entity listings: %llu (%.0f/s)\n", (unsigned long long)listings,
+               (double)listings / elapsed);
+    }
+
+    if (sample_count > 0) {
+        qsort(samples, sample_count, sizeof(*samples), compare_u32);
+        printf("latency: p50=%uus p99=%uus max=%uus\n",
+               samples[sample_count / 2], samples[sample_count * 99 / 100],
+               samples[sample_count - 1]);
+    }
+
+    if (cpu_start >= 0 && cpu_end >= 0) {
+        double cpu = (double)(cpu_end - cpu_start) / (double)sysconf(_SC_CLK_TCK);
+        printf("server cpu: %.2fs (%.0f%%, %.2fus per response)\n", cpu, 100.0 * cpu / elapsed,
+               responses ? cpu * 1e6 / (double)responses : 0.0);
+    }
+
+    for (int i = 0; i < client_count; i++) {
+        close(clients[i].fd);
+    }
+    free(samples);
+    free(fds);
+    free(clients);
+    return 0;
+}
@@ -0,0 +1,281 @@
+/**
+ * @file ble_ad_replay.c
+ * @brief Replay recorded advertisements through the AD scanner
+ *
+ * Feeds every advertisement of one or more trace files to ble_ad_scan()
+ * and to its scalar reference ble_ad_scan_scalar(), checks that both
+ * build the same index (fields, class masks and hash), then times both
+ * over the whole trace. Every prefix of each advertisement is checked as
+ * well, so truncated and malformed length chains are covered.
+ *
+ * A trace has one advertisement per line, the AD data in hex as the last
+ * word; other words and lines starting with '#' are ignored. Record one
+ * on the target with:
+ *
+ *   ble-feed-reader -x [name] > trace.txt
+ *
+ * Usage: ble-ad-replay [-r rounds] trace...
+ * Exit status is 0 when both implementations agree on every input.
+ */
+
+#include "ble_ad.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+
+#define REPLAY_LINE_MAX 1024
+#define REPLAY_DATA_MAX 255        /* ble_ad_scan() limit */
+
+typedef struct {
+    uint8_t data[REPLAY_DATA_MAX];
+    uint8_t len;
+} replay_adv_t;
+
+typedef struct {
+    replay_adv_t *advs;
+    size_t count;
+    size_t size;
+} replay_trace_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int hex_nibble(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = (char)tolower((unsigned char)c);
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/**
+ * Parse the last word of a trace line
+ *
+ * @return 0 on success, -1 if it is not AD data in hex
+ */
+static int parse_line(const char *line, replay_adv_t *adv) {
+    size_t end = strlen(line);
+    while (end > 0 && isspace((unsigned char)line[end - 1])) {
+        end--;
+    }
+    size_t start = end;
+    while (start > 0 && !isspace((unsigned char)line[start - 1])) {
+        start--;
+    }
+
+    size_t digits = end - start;
+    if (digits == 0 || digits % 2 != 0 || digits / 2 > REPLAY_DATA_MAX) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < digits / 2; i++) {
+        int hi = hex_nibble(line[start + 2 * i]);
+        int lo = hex_nibble(line[start + 2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return -1;
+        }
+        adv->data[i] = (uint8_t)(hi << 4 | lo);
+    }
+    adv->len = (uint8_t)(digits / 2);
+    return 0;
+}
+
+/**
+ * Append the advertisements of a trace file
+ *
+ * @return Number of lines skipped, or -1 on error
+ */
+static int load_trace(const char *path, replay_trace_t *trace) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    char line[REPLAY_LINE_MAX];
+    int skipped = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+
+        if (trace->count == trace->size) {
+            size_t size = trace->size ? trace->size * 2 : 1024;
+            replay_adv_t *advs = realloc(trace->advs, size * sizeof(*advs));
+            if (!advs) {
+                fprintf(stderr, "Out of memory\n");
+                fclose(f);
+                return -1;
+            }
+            trace->advs = advs;
+            trace->size = size;
+        }
+
+        if (parse_line(line, &trace->advs[trace->count]) < 0) {
+            skipped++;
+            continue;
+        }
+        trace->count++;
+    }
+
+    fclose(f);
+    return skipped;
+}
+
+/**
+ * Compare two indexes of the same data
+ *
+ * Only the fields up to count are defined.
+ */
+static bool index_equal(const ble_ad_index_t *a, const ble_ad_index_t *b) {
+    if (a->count != b->count || a->service_uuids != b->service_uuids ||
+        a->service_data != b->service_data || a->manufacturer != b->manufacturer ||
+        a->names != b->names || a->hash != b->hash) {
+        return false;
+    }
+
+    for (int i = 0; i < a->count; i++) {
+        if (a->fields[i].type != b->fields[i].type || a->fields[i].len != b->fields[i].len ||
+            a->fields[i].offset != b->fields[i].offset) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void print_mismatch(const uint8_t *data, size_t len,
+                           const ble_ad_index_t *simd, const ble_ad_index_t *scalar) {
+    fprintf(stderr, "MISMATCH on ");
+    for (size_t i = 0; i < len; i++) {
+        fprintf(stderr, "%02X", data[i]);
+    }
+    fprintf(stderr, "\n  scan:   %u fields, uuids %04x sdata %04x mfr %04x names %04x hash %08x\n",
+            simd->count, simd->service_uuids, simd->service_data, simd->manufacturer,
+            simd->names, simd->hash);
+    fprintf(stderr, "  scalar: %u fields, uuids %04x sdata %04x mfr %04x names %04x hash %08x\n",
+            scalar->count, scalar->service_uuids, scalar->service_data, scalar->manufacturer,
+            scalar->names, scalar->hash);
+}
+
+/**
+ * Check both implementations on every advertisement and its prefixes
+ *
+ * @return Number of mismatches
+ */
+static uint64_t verify(const replay_trace_t *trace, uint64_t *checked) {
+    uint64_t mismatches = 0;
+
+    for (size_t n = 0; n < trace->count; n++) {
+        const replay_adv_t *adv = &trace->advs[n];
+
+        for (size_t len = 0; len <= adv->len; len++) {
+            ble_ad_index_t simd;
+            ble_ad_index_t scalar;
+
+            ble_ad_scan(adv->data, len, &simd);
+            ble_ad_scan_scalar(adv->data, len, &scalar);
+            (*checked)++;
+
+            if (!index_equal(&simd, &scalar)) {
+                if (mismatches < 10) {
+                    print_mismatch(adv->data, len, &simd, &scalar);
+                }
+                mismatches++;
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+/**
+ * Time one implementation over the whole trace
+ *
+ * @return Nanoseconds per advertisement
+ */
+static double bench(void (*scan)(const uint8_t *, size_t, ble_ad_index_t *),
+                    const replay_trace_t *trace, int rounds) {
+    ble_ad_index_t index;
+    uint32_t sink = 0;
+
+    uint64_t start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t n = 0; n < trace->count; n++) {
+            scan(trace->advs[n].data, trace->advs[n].len, &index);
+            sink ^= index.hash + index.count;
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    /* Keeps the calls from being optimized out */
+    __asm__ volatile("" : : "r"(sink));
+
+    return (double)elapsed / ((double)rounds * (double)trace->count);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-r rounds] trace...\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int rounds = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:h")) != -1) {
+        switch (opt) {
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (rounds < 1 || optind >= argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    replay_trace_t trace = { 0 };
+    int skipped = 0;
+
+    for (int i = optind; i < argc; i++) {
+        int ret = load_trace(argv[i], &trace);
+        if (ret < 0) {
+            free(trace.advs);
+            return 1;
+        }
+        skipped += ret;
+    }
+    if (trace.count == 0) {
+        fprintf(stderr, "No advertisements in the trace (%d line(s) skipped)\n", skipped);
+        free(trace.advs);
+        return 1;
+    }
+
+    uint64_t checked = 0;
+    uint64_t mismatches = verify(&trace, &checked);
+
+    printf("%zu advertisement(s), %d line(s) skipped, %llu input(s) checked, %llu mismatch(es)\n",
+           trace.count, skipped, (unsigned long long)checked, (unsigned long long)mismatches);
+
+    double scan_ns = bench(ble_ad_scan, &trace, rounds);
+    double scalar_ns = bench(ble_ad_scan_scalar, &trace, rounds);
+    printf("ble_ad_scan:        %8.1f ns/adv\n", scan_ns);
+    printf("ble_ad_scan_scalar: %8.1f ns/adv\n", scalar_ns);
+
+    free(trace.advs);
+    return mismatches ? 1 : 0;
+}